@@ -85,6 +85,29 @@ macro(farm_ng_add_executable target)
     )
 endmacro()
 
+macro(farm_ng_add_benchmark target)
+  set(multi_value_args SOURCES LINK_LIBRARIES)
+  cmake_parse_arguments(FARM_NG_ADD_BENCHMARK "" "" "${multi_value_args}" ${ARGN})
+
+  if(benchmark_FOUND)
+    add_executable(${target} ${FARM_NG_ADD_BENCHMARK_SOURCES})
+    target_link_libraries(${target}
+      ${FARM_NG_ADD_BENCHMARK_LINK_LIBRARIES}
+      benchmark::benchmark
+      )
+
+    set(_benchmark_out ${CMAKE_BINARY_DIR}/benchmarks/${target}.json)
+    add_custom_target(run_${target}
+      COMMAND ${CMAKE_COMMAND} -E make_directory ${CMAKE_BINARY_DIR}/benchmarks
+      COMMAND ${target} --benchmark_out=${_benchmark_out} --benchmark_out_format=json
+      DEPENDS ${target}
+      COMMENT "Running ${target}, writing ${_benchmark_out}"
+      USES_TERMINAL
+      VERBATIM)
+    add_dependencies(benchmarks run_${target})
+  endif()
+endmacro()
+
 macro(farm_ng_add_protobufs target)
   set(multi_value_args PROTO_FILES DEPENDENCIES)
   cmake_parse_arguments(FARM_NG_ADD_PROTOBUFS "" "" "${multi_value_args}" ${ARGN})
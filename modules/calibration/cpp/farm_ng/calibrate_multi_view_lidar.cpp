@@ -17,6 +17,7 @@
 
 #include "farm_ng/perception/apriltag.h"
 #include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_batch.h"
 #include "farm_ng/perception/image_loader.h"
 #include "farm_ng/perception/point_cloud.h"
 
@@ -147,14 +148,15 @@ void SavePlyFilesInTagRig(MultiViewLidarModel model, std::string prefix) {
         auto points_camera = perception::TransformPoints<double>(
             camera_pose_cloud, points_cloud);
         const auto& camera_model = cameras[camera_image.first];
+        // Pixels of points behind the camera are computed but not used.
+        Eigen::Matrix2Xd points_image =
+            perception::ProjectPointsToPixels(camera_model, points_camera);
         cv::Rect roi(cv::Point(0, 0), camera_image.second.size());
         for (int i = 0; i < points_camera.cols(); ++i) {
-          const Eigen::Vector3d& point_camera = points_camera.col(i);
-          if (point_camera.z() < 0.01) {
+          if (points_camera(2, i) < 0.01) {
             continue;
           }
-          auto xyf =
-              perception::ProjectPointToPixel(camera_model, point_camera);
+          Eigen::Vector2d xyf = points_image.col(i);
           cv::Point xy(xyf.x() + 0.5, xyf.y() + 0.5);
           if (roi.contains(xy)) {
             cv::Vec3b c = camera_image.second.at<cv::Vec3b>(xy);
@@ -1,8 +1,9 @@
+#include <type_traits>
+
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include <ceres/ceres.h>
-#include <opencv2/imgproc.hpp>
 
 #include "farm_ng/core/blobstore.h"
 #include "farm_ng/core/event_log.h"
@@ -18,7 +19,7 @@
 #include "farm_ng/perception/apriltag.h"
 #include "farm_ng/perception/camera_model.h"
 #include "farm_ng/perception/image.pb.h"
-#include "farm_ng/perception/image_loader.h"
+#include "farm_ng/perception/multi_view_apriltag_detector.h"
 #include "farm_ng/perception/pose_graph.h"
 #include "farm_ng/perception/pose_utils.h"
 #include "farm_ng/perception/robot_arm_fk.h"
@@ -46,6 +47,7 @@ using farm_ng::perception::NamedSE3Pose;
 using farm_ng::perception::RobotArmFK6dof;
 using farm_ng::perception::RobotLinkFK;
 using farm_ng::perception::SE3Map;
+using farm_ng::perception::VisitPinholeCamera;
 
 typedef farm_ng::core::Event EventPb;
 
@@ -84,12 +86,9 @@ RobotArmExtrinsicsModel RobotArmExtrinsicsModelFromDatasetResult(
     LOG(WARNING) << "link_camera_rig not supported yet.";
   }
 
-  std::map<std::string, perception::CameraModel> per_camera_model;
-  std::map<std::string, std::unique_ptr<perception::ApriltagDetector>>
-      per_camera_detector;
+  perception::MultiViewApriltagDetector detector(apriltag_config);
 
   core::EventLogReader log_reader(dataset_result.dataset());
-  perception::ImageLoader image_loader;
   CapturePoseRequest pose_req;
 
   while (true) {
@@ -112,36 +111,8 @@ RobotArmExtrinsicsModel RobotArmExtrinsicsModelFromDatasetResult(
       measurement->mutable_joint_states()->CopyFrom(
           pose_response.joint_states());
 
-      for (Image image : pose_response.images()) {
-        std::string camera_frame_name = image.camera_model().frame_name();
-        CHECK_GT(image.camera_model().image_width(), 1);
-
-        if (!per_camera_model.count(camera_frame_name)) {
-          per_camera_model[camera_frame_name] = image.camera_model();
-          LOG(INFO) << image.camera_model().ShortDebugString();
-
-          per_camera_detector[camera_frame_name].reset(
-              new perception::ApriltagDetector(image.camera_model(), nullptr,
-                                               &apriltag_config));
-        }
-        cv::Mat image_mat = image_loader.LoadImage(image);
-        cv::Mat depth_mat = image_loader.LoadDepthmap(image);
-        cv::Mat gray;
-        if (image_mat.channels() == 3) {
-          cv::cvtColor(image_mat, gray, cv::COLOR_BGR2GRAY);
-
-        } else {
-          CHECK(image_mat.channels() == 1);
-          gray = image_mat;
-        }
-        auto tags = per_camera_detector[camera_frame_name]->Detect(
-            gray, depth_mat, event.stamp());
-        tags.mutable_image()->CopyFrom(image);
-        measurement->mutable_multi_view_detections()
-            ->add_detections_per_view()
-            ->CopyFrom(tags);
-        LOG(INFO) << camera_frame_name << " n tags: " << tags.detections_size();
-      }
+      measurement->mutable_multi_view_detections()->CopyFrom(
+          detector.Detect(pose_response.images(), event.stamp()));
     }
   }
   return model;
@@ -340,9 +311,10 @@ RobotArmExtrinsicsModel InitializeArmExtrinsicsModel(
   return model;
 }
 
+template <class Camera>
 struct CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor {
   CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor(
-      const CameraModel& camera, const perception::ApriltagDetection& detection,
+      const Camera& camera, const perception::ApriltagDetection& detection,
       perception::RobotArmFK6dof fk, Eigen::Matrix<double, 6, 1> joint_values,
       SE3Map camera_pose_camera_rig, SE3Map tag_rig_pose_tag,
       SE3Map base_pose_camera_rig, SE3Map link_pose_tag_rig,
@@ -418,7 +390,7 @@ struct CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor {
 
     return true;
   }
-  CameraModel camera_;
+  Camera camera_;
   std::array<Eigen::Vector3d, 4> points_tag_;
   std::array<Eigen::Vector2d, 4> points_image_;
   std::array<double, 4> depths_camera_;
@@ -551,21 +523,26 @@ RobotArmExtrinsicsModel SolveRobotArmExtrinsicsModel(
         perception::PoseEdge* tag_to_tag_rig =
             pose_graph.MutablePoseEdge(tag_frame, tag_rig_frame);
 
-        ceres::CostFunction* cost_function1 = new ceres::AutoDiffCostFunction<
-            CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor, 12,
-            Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters,
-            Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters, 6>(
-            new CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor(
-                detections_per_view.image().camera_model(), detection, fk,
-                joint_values,
-                camera_to_camera_rig->GetAPoseBMap(camera_frame,
+        ceres::CostFunction* cost_function1 = VisitPinholeCamera(
+            detections_per_view.image().camera_model(),
+            [&](const auto& camera) -> ceres::CostFunction* {
+              using Functor =
+                  CameraRigApriltagRig6dofRobotExtrinsicsCostFunctor<
+                      std::decay_t<decltype(camera)>>;
+              return new ceres::AutoDiffCostFunction<
+                  Functor, 12, Sophus::SE3d::num_parameters,
+                  Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters,
+                  Sophus::SE3d::num_parameters, 6>(new Functor(
+                  camera, detection, fk, joint_values,
+                  camera_to_camera_rig->GetAPoseBMap(camera_frame,
+                                                     camera_rig_frame),
+                  tag_to_tag_rig->GetAPoseBMap(tag_rig_frame, tag_frame),
+                  base_to_camera_rig->GetAPoseBMap(model.base_frame_name(),
                                                    camera_rig_frame),
-                tag_to_tag_rig->GetAPoseBMap(tag_rig_frame, tag_frame),
-                base_to_camera_rig->GetAPoseBMap(model.base_frame_name(),
-                                                 camera_rig_frame),
-                link_to_tag_rig->GetAPoseBMap(model.link_frame_name(),
-                                              tag_rig_frame),
-                100.0));
+                  link_to_tag_rig->GetAPoseBMap(model.link_frame_name(),
+                                                tag_rig_frame),
+                  100.0));
+            });
 
         problem.AddResidualBlock(
             cost_function1, nullptr,  // new ceres::CauchyLoss(1.0),
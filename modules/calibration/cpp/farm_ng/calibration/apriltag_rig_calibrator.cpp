@@ -1,5 +1,7 @@
 #include "farm_ng/calibration/apriltag_rig_calibrator.h"
 
+#include <type_traits>
+
 #include <ceres/ceres.h>
 #include <opencv2/highgui.hpp>  // TODO remove.
 #include <opencv2/imgcodecs.hpp>
@@ -25,6 +27,7 @@ using farm_ng::perception::ImageLoader;
 using farm_ng::perception::NamedSE3Pose;
 using farm_ng::perception::ProtoToSophus;
 using farm_ng::perception::StartsWith;
+using farm_ng::perception::VisitPinholeCamera;
 using Sophus::SE3d;
 
 namespace farm_ng {
@@ -49,8 +52,9 @@ Sophus::optional<SE3d> CameraPoseRigRootInit(
   return Sophus::average(camera_poses_root);
 }
 
+template <class Camera>
 struct CameraApriltagRigCostFunctor {
-  CameraApriltagRigCostFunctor(const CameraModel& camera,
+  CameraApriltagRigCostFunctor(const Camera& camera,
                                std::array<Eigen::Vector3d, 4> points_tag,
                                std::array<Eigen::Vector2d, 4> points_image)
       : camera_(camera), points_tag_(points_tag), points_image_(points_image) {}
@@ -73,11 +77,25 @@ struct CameraApriltagRigCostFunctor {
     }
     return true;
   }
-  CameraModel camera_;
+  Camera camera_;
   std::array<Eigen::Vector3d, 4> points_tag_;
   std::array<Eigen::Vector2d, 4> points_image_;
 };
 
+ceres::CostFunction* CameraApriltagRigCostFunction(
+    const CameraModel& camera_model, std::array<Eigen::Vector3d, 4> points_tag,
+    std::array<Eigen::Vector2d, 4> points_image) {
+  return VisitPinholeCamera(
+      camera_model, [&](const auto& camera) -> ceres::CostFunction* {
+        using Functor =
+            CameraApriltagRigCostFunctor<std::decay_t<decltype(camera)>>;
+        return new ceres::AutoDiffCostFunction<Functor, 8,
+                                               Sophus::SE3d::num_parameters,
+                                               Sophus::SE3d::num_parameters>(
+            new Functor(camera, points_tag, points_image));
+      });
+}
+
 void ApriltagRigModel::ToMonocularApriltagRigModel(
     MonocularApriltagRigModel* rig) const {
   rig->Clear();
@@ -425,13 +443,9 @@ bool Solve(ApriltagRigModel* model) {
 
     const auto& detections = model->all_detections[frame_n];
     for (const auto& detection : detections.detections()) {
-      ceres::CostFunction* cost_function1 =
-          new ceres::AutoDiffCostFunction<CameraApriltagRigCostFunctor, 8,
-                                          Sophus::SE3d::num_parameters,
-                                          Sophus::SE3d::num_parameters>(
-              new CameraApriltagRigCostFunctor(
-                  detections.image().camera_model(), PointsTag(detection),
-                  PointsImage(detection)));
+      ceres::CostFunction* cost_function1 = CameraApriltagRigCostFunction(
+          detections.image().camera_model(), PointsTag(detection),
+          PointsImage(detection));
       problem.AddResidualBlock(cost_function1, new ceres::HuberLoss(1.0),
                                o_camera_pose_root->data(),
                                model->tag_pose_root.at(detection.id()).data());
@@ -515,12 +529,8 @@ Sophus::optional<NamedSE3Pose> EstimateCameraPoseRig(
       LOG(WARNING) << "Tag id not in rig: " << detection.id();
       continue;
     }
-    ceres::CostFunction* cost_function1 =
-        new ceres::AutoDiffCostFunction<CameraApriltagRigCostFunctor, 8,
-                                        Sophus::SE3d::num_parameters,
-                                        Sophus::SE3d::num_parameters>(
-            new CameraApriltagRigCostFunctor(camera_model, PointsTag(detection),
-                                             PointsImage(detection)));
+    ceres::CostFunction* cost_function1 = CameraApriltagRigCostFunction(
+        camera_model, PointsTag(detection), PointsImage(detection));
     problem.AddResidualBlock(cost_function1, new ceres::HuberLoss(1.0),
                              o_camera_pose_root->data(),
                              id_tag_pose_root->second.data());
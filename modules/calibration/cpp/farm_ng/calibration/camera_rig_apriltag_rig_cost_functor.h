@@ -1,5 +1,9 @@
 #ifndef FARM_NG_CALIBRATION_CAMERA_RIG_APRILTAG_RIG_COST_FUNCTOR_H_
 #define FARM_NG_CALIBRATION_CAMERA_RIG_APRILTAG_RIG_COST_FUNCTOR_H_
+#include <type_traits>
+
+#include <ceres/ceres.h>
+
 #include "farm_ng/perception/apriltag.h"
 #include "farm_ng/perception/camera_model.h"
 #include "farm_ng/perception/pose_graph.h"
@@ -9,9 +13,13 @@ namespace calibration {
 
 using perception::CameraModel;
 using perception::SE3Map;
+
+// Camera is a perception::PinholeCamera, see
+// CameraRigApriltagRigCostFunction.
+template <class Camera>
 struct CameraRigApriltagRigCostFunctor {
   CameraRigApriltagRigCostFunctor(
-      const perception::CameraModel& camera,
+      const Camera& camera,
       const perception::ApriltagDetection& detection,
       SE3Map camera_pose_camera_rig, SE3Map tag_rig_pose_tag,
       SE3Map camera_rig_pose_tag_rig, double depth_scale = 100.0)
@@ -101,7 +109,7 @@ struct CameraRigApriltagRigCostFunctor {
 
     return true;
   }
-  CameraModel camera_;
+  Camera camera_;
   std::array<Eigen::Vector3d, 4> points_tag_;
   std::array<Eigen::Vector2d, 4> points_image_;
   std::array<double, 4> depths_camera_;
@@ -111,6 +119,41 @@ struct CameraRigApriltagRigCostFunctor {
   SE3Map camera_rig_pose_tag_rig_;
   double depth_scale_;
 };
+
+// Calls f with the CameraRigApriltagRigCostFunctor of the detection, its
+// camera specialized on the camera model's distortion model.
+template <typename F>
+auto VisitCameraRigApriltagRigCostFunctor(
+    const perception::CameraModel& camera,
+    const perception::ApriltagDetection& detection,
+    SE3Map camera_pose_camera_rig, SE3Map tag_rig_pose_tag,
+    SE3Map camera_rig_pose_tag_rig, double depth_scale, F&& f) {
+  return perception::VisitPinholeCamera(camera, [&](const auto& pinhole) {
+    using Functor =
+        CameraRigApriltagRigCostFunctor<std::decay_t<decltype(pinhole)>>;
+    return f(Functor(pinhole, detection, camera_pose_camera_rig,
+                     tag_rig_pose_tag, camera_rig_pose_tag_rig, depth_scale));
+  });
+}
+
+// The autodiff cost function of CameraRigApriltagRigCostFunctor, whose
+// parameters are the three poses.
+inline ceres::CostFunction* CameraRigApriltagRigCostFunction(
+    const perception::CameraModel& camera,
+    const perception::ApriltagDetection& detection,
+    SE3Map camera_pose_camera_rig, SE3Map tag_rig_pose_tag,
+    SE3Map camera_rig_pose_tag_rig, double depth_scale = 100.0) {
+  return VisitCameraRigApriltagRigCostFunctor(
+      camera, detection, camera_pose_camera_rig, tag_rig_pose_tag,
+      camera_rig_pose_tag_rig, depth_scale,
+      [](const auto& functor) -> ceres::CostFunction* {
+        using Functor = std::decay_t<decltype(functor)>;
+        return new ceres::AutoDiffCostFunction<
+            Functor, 12, Sophus::SE3d::num_parameters,
+            Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters>(
+            new Functor(functor));
+      });
+}
 }  // namespace calibration
 }  // namespace farm_ng
 #endif
@@ -7,12 +7,13 @@
 #include <opencv2/video.hpp>
 
 #include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_remap.h"
 #include "farm_ng/perception/eigen_cv.h"
 
 using farm_ng::perception::CameraModel;
 using farm_ng::perception::EigenToCvPoint;
 using farm_ng::perception::EigenToCvPoint2f;
-using farm_ng::perception::ReprojectPixelToPoint;
+using farm_ng::perception::GetPixelBearings;
 
 namespace farm_ng {
 namespace calibration {
@@ -20,6 +21,7 @@ namespace calibration {
 FlowBookKeeper::FlowBookKeeper(CameraModel camera_model, size_t max_history, cv::Mat image_mask)
     : max_history_(max_history),
       camera_model_(camera_model),
+      bearings_(GetPixelBearings(camera_model)),
       flow_window_(41, 41),
       flow_max_levels_(4) {
   cv::RNG rng;
@@ -253,8 +255,7 @@ FlowPointImage FlowBookKeeper::GenFlowPoint(FlowImage* flow_image,
   flow_point_world.id = flow_point_image.id;
   flow_point_world.point_world =
       flow_image->camera_pose_world.inverse() *
-      ReprojectPixelToPoint<double>(
-          camera_model_, flow_point_image.point_image.cast<double>(), 1.0);
+      bearings_->Bearing(flow_point_image.point_image.cast<double>());
   flow_points_world_.insert(
       std::make_pair(flow_point_image.id, flow_point_world));
   flow_image->flow_points[flow_point_image.id] = flow_point_image;
@@ -2,6 +2,8 @@
 #define FARM_NG_CALIBRATION_FLOW_BOOK_KEEPER_H_
 
 #include <Eigen/Core>
+#include <memory>
+#include <optional>
 #include <unordered_map>
 
 #include <google/protobuf/timestamp.pb.h>
@@ -9,6 +11,7 @@
 #include <sophus/se3.hpp>
 
 #include "farm_ng/perception/camera_model.pb.h"
+#include "farm_ng/perception/camera_remap.h"
 #include "farm_ng/perception/time_series.h"
 
 namespace farm_ng {
@@ -110,6 +113,8 @@ class FlowBookKeeper {
   size_t max_history_;
 
   farm_ng::perception::CameraModel camera_model_;
+  // Shared with other keepers of the same camera.
+  std::shared_ptr<const farm_ng::perception::PixelBearings> bearings_;
   cv::Mat lens_exclusion_mask_;
   std::vector<cv::Scalar> colors_;
   uint64_t image_id_gen_ = 0;
@@ -1,6 +1,7 @@
 #include "farm_ng/calibration/multi_view_apriltag_rig_calibrator.h"
 
 #include <map>
+#include <optional>
 
 #include <ceres/ceres.h>
 #include <google/protobuf/util/time_util.h>
@@ -188,18 +189,19 @@ void ModelError(MultiViewApriltagRigModel* model,
         PoseEdge* tag_to_tag_rig =
             pose_graph.MutablePoseEdge(tag_frame, tag_rig_frame);
         auto points_image = PointsImage(detection);
-        CameraRigApriltagRigCostFunctor cost(
+        Eigen::Matrix<double, 4, 3> residuals;
+        VisitCameraRigApriltagRigCostFunctor(
             detections_per_view.image().camera_model(), detection,
             camera_to_camera_rig->GetAPoseBMap(camera_frame, camera_rig_frame),
             tag_to_tag_rig->GetAPoseBMap(tag_rig_frame, tag_frame),
             camera_rig_to_tag_rig_view->GetAPoseBMap(camera_rig_frame,
                                                      tag_rig_view_frame),
-            1.0);
-        Eigen::Matrix<double, 4, 3> residuals;
-        CHECK(cost(camera_to_camera_rig->GetAPoseB().data(),
-                   tag_to_tag_rig->GetAPoseB().data(),
-                   camera_rig_to_tag_rig_view->GetAPoseB().data(),
-                   residuals.data()));
+            1.0, [&](const auto& cost) {
+              CHECK(cost(camera_to_camera_rig->GetAPoseB().data(),
+                         tag_to_tag_rig->GetAPoseB().data(),
+                         camera_rig_to_tag_rig_view->GetAPoseB().data(),
+                         residuals.data()));
+            });
         double depth_error = 0;
         int depth_count = 0;
         for (int i = 0; i < 4; ++i) {
@@ -376,7 +378,7 @@ std::vector<MultiViewApriltagDetections> LoadMultiViewApriltagDetections(
     if (!config.filter_stable_tags() ||
         tag_filter.AddApriltags(detections, steady_count, 7)) {
       MultiViewApriltagDetections mv_detections;
-      for (auto name_series : apriltag_series) {
+      for (const auto& name_series : apriltag_series) {
         auto nearest_event =
             name_series.second.FindNearest(event.stamp(), time_window);
         if (nearest_event) {
@@ -630,17 +632,13 @@ MultiViewApriltagRigModel SolveMultiViewApriltagModel(
         PoseEdge* tag_to_tag_rig =
             pose_graph.MutablePoseEdge(tag_frame, tag_rig_frame);
 
-        ceres::CostFunction* cost_function1 = new ceres::AutoDiffCostFunction<
-            CameraRigApriltagRigCostFunctor, 12, Sophus::SE3d::num_parameters,
-            Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters>(
-            new CameraRigApriltagRigCostFunctor(
-                detections_per_view.image().camera_model(), detection,
-                camera_to_camera_rig->GetAPoseBMap(camera_frame,
-                                                   camera_rig_frame),
-                tag_to_tag_rig->GetAPoseBMap(tag_rig_frame, tag_frame),
-                camera_rig_to_tag_rig_view->GetAPoseBMap(camera_rig_frame,
-                                                         tag_rig_view_frame),
-                depth_weight));
+        ceres::CostFunction* cost_function1 = CameraRigApriltagRigCostFunction(
+            detections_per_view.image().camera_model(), detection,
+            camera_to_camera_rig->GetAPoseBMap(camera_frame, camera_rig_frame),
+            tag_to_tag_rig->GetAPoseBMap(tag_rig_frame, tag_frame),
+            camera_rig_to_tag_rig_view->GetAPoseBMap(camera_rig_frame,
+                                                     tag_rig_view_frame),
+            depth_weight);
         problem.AddResidualBlock(
             cost_function1, new ceres::CauchyLoss(1.0),
             camera_to_camera_rig->GetAPoseB().data(),
@@ -777,17 +775,13 @@ EstimateMultiViewCameraRigPoseApriltagRig(
       PoseEdge* tag_to_tag_rig =
           pose_graph.MutablePoseEdge(tag_frame, apriltag_rig.name());
 
-      ceres::CostFunction* cost_function1 = new ceres::AutoDiffCostFunction<
-          CameraRigApriltagRigCostFunctor, 12, Sophus::SE3d::num_parameters,
-          Sophus::SE3d::num_parameters, Sophus::SE3d::num_parameters>(
-          new CameraRigApriltagRigCostFunctor(
-              detections_per_view.image().camera_model(), detection,
-              camera_to_camera_rig->GetAPoseBMap(camera_frame,
-                                                 camera_rig.name()),
-              tag_to_tag_rig->GetAPoseBMap(apriltag_rig.name(), tag_frame),
-              camera_rig_to_tag_rig->GetAPoseBMap(camera_rig.name(),
-                                                  apriltag_rig.name()),
-              depth_weight));
+      ceres::CostFunction* cost_function1 = CameraRigApriltagRigCostFunction(
+          detections_per_view.image().camera_model(), detection,
+          camera_to_camera_rig->GetAPoseBMap(camera_frame, camera_rig.name()),
+          tag_to_tag_rig->GetAPoseBMap(apriltag_rig.name(), tag_frame),
+          camera_rig_to_tag_rig->GetAPoseBMap(camera_rig.name(),
+                                              apriltag_rig.name()),
+          depth_weight);
       auto block_id =
           problem.AddResidualBlock(cost_function1, new ceres::CauchyLoss(1.0),
                                    camera_to_camera_rig->GetAPoseB().data(),
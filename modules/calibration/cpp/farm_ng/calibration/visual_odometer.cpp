@@ -1,5 +1,7 @@
 #include "farm_ng/calibration/visual_odometer.h"
 
+#include <type_traits>
+
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
@@ -13,15 +15,19 @@
 #include "farm_ng/calibration/local_parameterization.h"
 #include "farm_ng/core/blobstore.h"
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
 #include "farm_ng/perception/camera_model.h"
 #include "farm_ng/perception/eigen_cv.h"
 #include "farm_ng/perception/sophus_protobuf.h"
 
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::Histogram;
 using farm_ng::core::MakeTimestampNow;
 using farm_ng::perception::CameraModel;
 using farm_ng::perception::EigenToCvPoint;
 using farm_ng::perception::EigenToCvPoint2f;
 using farm_ng::perception::ProjectPointToPixel;
+using farm_ng::perception::VisitPinholeCamera;
 
 namespace farm_ng {
 namespace calibration {
@@ -43,10 +49,11 @@ void SavePly(std::string ply_path, const std::vector<Eigen::Vector3d>& points) {
   }
   out.close();
 }
+template <class Camera>
 struct ProjectionCostFunctor {
-  ProjectionCostFunctor(const CameraModel& camera_model,
+  ProjectionCostFunctor(const Camera& camera,
                         const Eigen::Vector2d& point_image)
-      : camera_model_(camera_model), point_image_(point_image) {}
+      : camera_(camera), point_image_(point_image) {}
 
   template <class T>
   bool operator()(T const* const raw_camera_pose_world,
@@ -57,11 +64,11 @@ struct ProjectionCostFunctor {
     Eigen::Map<Eigen::Matrix<T, 3, 1> const> const point_world(raw_point_world);
     Eigen::Map<Eigen::Matrix<T, 2, 1>> residuals(raw_residuals);
     residuals =
-        ProjectPointToPixel<T>(camera_model_, camera_pose_world * point_world) -
+        ProjectPointToPixel<T>(camera_, camera_pose_world * point_world) -
         point_image_.cast<T>();
     return true;
   }
-  const CameraModel& camera_model_;
+  Camera camera_;
   Eigen::Vector2d point_image_;
 };
 
@@ -143,6 +150,21 @@ VisualOdometerResult VisualOdometer::AddImage(
 
       wheel_measurements_.RemoveBefore(flow_.EarliestFlowImage()->stamp);
       auto after_solve = MakeTimestampNow();
+      static Histogram& total_latency =
+          GetMetricsRegistry().GetHistogram("visual_odometer/total");
+      static Histogram& flow_latency =
+          GetMetricsRegistry().GetHistogram("visual_odometer/flow");
+      static Histogram& solve_latency =
+          GetMetricsRegistry().GetHistogram("visual_odometer/solve");
+      total_latency.Record(
+          google::protobuf::util::TimeUtil::DurationToNanoseconds(after_solve -
+                                                                  start));
+      flow_latency.Record(
+          google::protobuf::util::TimeUtil::DurationToNanoseconds(after_flow -
+                                                                  start));
+      solve_latency.Record(
+          google::protobuf::util::TimeUtil::DurationToNanoseconds(after_solve -
+                                                                  after_flow));
       LOG_EVERY_N(INFO, 100)
           << "VO took: "
           << google::protobuf::util::TimeUtil::DurationToMilliseconds(
@@ -232,12 +254,14 @@ VisualOdometerResult VisualOdometer::AddImage(
 
 void VisualOdometer::AddFlowBlockToProblem(ceres::Problem* problem,
                                            const FlowBlock& flow_block) {
-  ceres::CostFunction* cost_function1 =
-      new ceres::AutoDiffCostFunction<ProjectionCostFunctor, 2,
-                                      Sophus::SE3d::num_parameters, 3>(
-          new ProjectionCostFunctor(
-              camera_model_,
-              flow_block.flow_point_image.point_image.cast<double>()));
+  ceres::CostFunction* cost_function1 = VisitPinholeCamera(
+      camera_model_, [&](const auto& camera) -> ceres::CostFunction* {
+        using Functor = ProjectionCostFunctor<std::decay_t<decltype(camera)>>;
+        return new ceres::AutoDiffCostFunction<Functor, 2,
+                                               Sophus::SE3d::num_parameters,
+                                               3>(new Functor(
+            camera, flow_block.flow_point_image.point_image.cast<double>()));
+      });
 
   problem->AddParameterBlock(flow_block.flow_point_world->point_world.data(),
                              3);
@@ -2,6 +2,7 @@
 #define FARM_NG_CALIBRATION_VISUAL_ODOMETER_H_
 
 #include <Eigen/Core>
+#include <optional>
 #include <unordered_map>
 
 #include <ceres/problem.h>
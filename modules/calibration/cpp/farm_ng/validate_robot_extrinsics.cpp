@@ -1,8 +1,6 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
-#include <opencv2/imgproc.hpp>
-
 #include "farm_ng/core/blobstore.h"
 #include "farm_ng/core/event_log.h"
 #include "farm_ng/core/event_log_reader.h"
@@ -11,6 +9,7 @@
 
 #include "farm_ng/perception/apriltag.h"
 #include "farm_ng/perception/image_loader.h"
+#include "farm_ng/perception/multi_view_apriltag_detector.h"
 
 #include "farm_ng/calibration/calibrator.pb.h"
 #include "farm_ng/calibration/validate_robot_extrinsics.pb.h"
@@ -26,57 +25,6 @@ DEFINE_string(hal_service_address, "", "Hal service address");
 
 namespace farm_ng::calibration {
 
-class MultiViewApriltagDetector {
- public:
-  MultiViewApriltagDetector(perception::ApriltagConfig apriltag_config)
-      : apriltag_config_(apriltag_config) {}
-
-  perception::MultiViewApriltagDetections Detect(
-      const google::protobuf::RepeatedPtrField<perception::Image>& images,
-      google::protobuf::Timestamp stamp) {
-    perception::MultiViewApriltagDetections multi_view_detections;
-    for (const perception::Image& image : images) {
-      std::string camera_frame_name = image.camera_model().frame_name();
-      CHECK_GT(image.camera_model().image_width(), 1);
-
-      if (!per_camera_model_.count(camera_frame_name)) {
-        per_camera_model_[camera_frame_name] = image.camera_model();
-        LOG(INFO) << image.camera_model().ShortDebugString();
-
-        per_camera_detector_[camera_frame_name].reset(
-            new perception::ApriltagDetector(image.camera_model(), nullptr,
-                                             &apriltag_config_));
-      }
-      cv::Mat image_mat = image_loader_.LoadImage(image);
-      cv::Mat depth_mat = image_loader_.LoadDepthmap(image);
-      cv::Mat gray;
-      if (image_mat.channels() == 3) {
-        cv::cvtColor(image_mat, gray, cv::COLOR_BGR2GRAY);
-
-      } else {
-        CHECK(image_mat.channels() == 1);
-        gray = image_mat;
-      }
-      auto tags = per_camera_detector_[camera_frame_name]->Detect(
-          gray, depth_mat, stamp);
-
-      tags.mutable_image()->CopyFrom(image);
-
-      multi_view_detections.add_detections_per_view()->CopyFrom(tags);
-      LOG(INFO) << camera_frame_name << " n tags: " << tags.detections_size();
-    }
-    return multi_view_detections;
-  }
-
- private:
-  std::map<std::string, perception::CameraModel> per_camera_model_;
-  std::map<std::string, std::unique_ptr<perception::ApriltagDetector>>
-      per_camera_detector_;
-
-  perception::ImageLoader image_loader_;
-  perception::ApriltagConfig apriltag_config_;
-};
-
 class ValidateRobotExtrinsicsProgram {
  public:
   ValidateRobotExtrinsicsProgram(
@@ -154,7 +102,7 @@ class ValidateRobotExtrinsicsProgram {
     perception::ApriltagConfig apriltag_config;
     AddApriltagRigToApriltagConfig(apriltag_rig, &apriltag_config);
 
-    MultiViewApriltagDetector detector(apriltag_config);
+    perception::MultiViewApriltagDetector detector(apriltag_config);
 
     std::string log_path = (core::GetBucketRelativePath(core::BUCKET_LOGS) /
                             boost::filesystem::path(configuration_.name()))
@@ -190,6 +138,9 @@ class ValidateRobotExtrinsicsProgram {
 
     auto multiview_detections =
         detector.Detect(capture_response.images(), capture_response.stamp());
+    LOG(INFO) << "Detected " << capture_response.images_size()
+              << " views in " << detector.last_timing().total.count()
+              << " us";
 
     log_writer.Write(
         core::MakeEvent("multivew_detections", multiview_detections));
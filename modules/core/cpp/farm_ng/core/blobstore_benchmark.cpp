@@ -0,0 +1,39 @@
+#include <fstream>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+
+#include "farm_ng/core/blobstore.h"
+
+namespace fs = boost::filesystem;
+
+namespace farm_ng {
+namespace core {
+namespace {
+
+// MakePathUnique probes name.1.ext, name.2.ext, ... so its cost grows with the
+// number of files already sharing the name, e.g. repeated archive resources.
+void BM_MakePathUnique(benchmark::State& state) {
+  const fs::path root = fs::temp_directory_path() /
+                        fs::unique_path("farm_ng_benchmark_%%%%-%%%%");
+  fs::create_directories(root);
+  for (int i = 0; i < state.range(0); ++i) {
+    std::ofstream(
+        (root / MakePathUnique(root, "events/events.log")).string());
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakePathUnique(root, "events/events.log"));
+  }
+  state.SetComplexityN(state.range(0));
+  fs::remove_all(root);
+}
+BENCHMARK(BM_MakePathUnique)
+    ->RangeMultiplier(4)
+    ->Range(1, 1 << 10)
+    ->Complexity(benchmark::oN);
+
+}  // namespace
+}  // namespace core
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
@@ -0,0 +1,73 @@
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <google/protobuf/wrappers.pb.h>
+#include <boost/filesystem.hpp>
+
+#include "farm_ng/core/event_log.h"
+#include "farm_ng/core/event_log_reader.h"
+#include "farm_ng/core/ipc.h"
+
+namespace fs = boost::filesystem;
+
+namespace farm_ng {
+namespace core {
+namespace {
+
+Event MakeBenchmarkEvent(size_t n_bytes) {
+  google::protobuf::BytesValue payload;
+  payload.set_value(std::string(n_bytes, 'x'));
+  return MakeEvent("benchmark/event", payload);
+}
+
+fs::path MakeTempLogPath() {
+  return fs::temp_directory_path() /
+         fs::unique_path("farm_ng_benchmark_%%%%-%%%%.log");
+}
+
+void BM_EventLogWrite(benchmark::State& state) {
+  const fs::path log_path = MakeTempLogPath();
+  const Event event = MakeBenchmarkEvent(state.range(0));
+  {
+    EventLogWriter writer(log_path);
+    for (auto _ : state) {
+      writer.Write(event);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * event.ByteSizeLong());
+  fs::remove(log_path);
+}
+BENCHMARK(BM_EventLogWrite)->RangeMultiplier(8)->Range(16, 32 << 10);
+
+void BM_EventLogReadNext(benchmark::State& state) {
+  const fs::path log_path = MakeTempLogPath();
+  const Event event = MakeBenchmarkEvent(state.range(0));
+  const int kLogLength = 1000;
+  {
+    EventLogWriter writer(log_path);
+    for (int i = 0; i < kLogLength; ++i) {
+      writer.Write(event);
+    }
+  }
+  EventLogReader reader(log_path.string());
+  int n_read = 0;
+  for (auto _ : state) {
+    if (n_read == kLogLength) {
+      state.PauseTiming();
+      reader.Reset(log_path.string());
+      n_read = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(reader.ReadNext());
+    n_read++;
+  }
+  state.SetBytesProcessed(state.iterations() * event.ByteSizeLong());
+  fs::remove(log_path);
+}
+BENCHMARK(BM_EventLogReadNext)->RangeMultiplier(8)->Range(16, 32 << 10);
+
+}  // namespace
+}  // namespace core
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
@@ -5,6 +5,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/stacktrace.hpp>
@@ -12,6 +13,20 @@
 #include <memory>
 
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
+
+DEFINE_string(thread_policy, "",
+              "Path to a ThreadPolicyConfig json file. Defaults to "
+              "configurations/thread_policy/<program name>.json if it exists.");
+
+DEFINE_string(trace_file, "",
+              "If set, record trace spans and write them to this path as "
+              "Chrome Trace Event JSON at exit.");
+
+DEFINE_double(metrics_period, 5.0,
+              "Seconds between <service>/metrics events, 0 disables.");
 
 typedef boost::error_info<struct tag_stacktrace, boost::stacktrace::stacktrace>
     traced;
@@ -30,8 +45,34 @@ boost::asio::signal_set& _get_signal_set() {
   return signals;
 }
 
+boost::asio::steady_timer& _get_metrics_timer() {
+  static boost::asio::steady_timer timer(_get_io_service());
+  return timer;
+}
+
 void (*_g_cleanup_func)(EventBus&) = nullptr;
 
+void _publish_metrics(const boost::system::error_code& error) {
+  if (error) {
+    LOG(WARNING) << "metrics timer error: " << error;
+    return;
+  }
+  EventBus& bus = GetEventBus(_get_io_service());
+  if (!GetMetricsRegistry().empty()) {
+    Metrics metrics = GetMetricsRegistry().Snapshot();
+    // Events must fit in a single datagram.
+    if (metrics.ByteSizeLong() < 60000) {
+      bus.Send(MakeEvent(bus.GetName() + "/metrics", metrics));
+    } else {
+      LOG_EVERY_N(WARNING, 100) << "Metrics too large to publish: "
+                                << metrics.ByteSizeLong() << " bytes";
+    }
+  }
+  _get_metrics_timer().expires_from_now(
+      std::chrono::milliseconds(int64_t(FLAGS_metrics_period * 1000)));
+  _get_metrics_timer().async_wait(&_publish_metrics);
+}
+
 void _signal_handler(const boost::system::error_code& error,
                      int signal_number) {
   std::cout << "Received (error, signal) " << error << " , " << signal_number
@@ -60,12 +101,44 @@ int MainNoGFlags(int argc, char** argv, std::function<int(EventBus&)> main_func,
   google::InstallFailureFunction(&GlogFailureFunction);
   google::InstallFailureSignalHandler();
 
+  if (!FLAGS_thread_policy.empty()) {
+    SetThreadPolicyConfig(
+        ReadProtobufFromJsonFile<ThreadPolicyConfig>(FLAGS_thread_policy));
+  } else {
+    LoadThreadPolicyConfig(filename);
+  }
+  // The main thread runs the EventBus io_service. Threads started afterwards
+  // inherit this placement unless their stage overrides it.
+  ApplyThreadPolicy(GetThreadPolicyConfig().default_policy());
+
   _get_signal_set().async_wait(&_signal_handler);
 
   EventBus& bus = GetEventBus(_get_io_service());
   bus.SetName(filename);
   _g_cleanup_func = cleanup_func;
 
+  if (FLAGS_metrics_period > 0) {
+    _get_metrics_timer().expires_from_now(
+        std::chrono::milliseconds(int64_t(FLAGS_metrics_period * 1000)));
+    _get_metrics_timer().async_wait(&_publish_metrics);
+  }
+
+  if (!FLAGS_trace_file.empty()) {
+    SetTracingEnabled(true);
+  }
+  std::shared_ptr<const std::string> write_trace(
+      &FLAGS_trace_file, [](const std::string* trace_file) {
+        if (!trace_file->empty()) {
+          SetTracingEnabled(false);
+          WriteChromeTrace(*trace_file);
+        }
+      });
+
+  std::shared_ptr<MetricsRegistry> log_metrics(
+      &GetMetricsRegistry(), [](MetricsRegistry* registry) {
+        LogMetricsSummary(registry->Snapshot());
+      });
+
   std::shared_ptr<void (*)(EventBus&)> callme(&_g_cleanup_func, [](auto p) {
     (*p)(GetEventBus(_get_io_service()));
     // run any jobs scheduled by cleanup function on the io_service.
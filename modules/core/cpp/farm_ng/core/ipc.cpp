@@ -1,5 +1,6 @@
 #include "farm_ng/core/ipc.h"
 
+#include <time.h>
 #include <unistd.h>
 #include <chrono>
 #include <cstdio>
@@ -19,6 +20,7 @@
 
 #include "farm_ng/core/blobstore.h"
 #include "farm_ng/core/io.pb.h"
+#include "farm_ng/core/trace.h"
 
 namespace farm_ng {
 namespace core {
@@ -240,8 +242,12 @@ class EventBusImpl {
   void handle_receive_from(const boost::system::error_code& error,
                            size_t bytes_recvd) {
     if (!error) {
+      auto recv_monotonic_stamp = MakeMonotonicTimestampNow();
+      auto recv_stamp = MakeTimestampNow();
       Event event;
       CHECK(event.ParseFromArray(static_cast<const void*>(data_), bytes_recvd));
+      *event.mutable_recv_stamp() = recv_stamp;
+      *event.mutable_recv_monotonic_stamp() = recv_monotonic_stamp;
 
       if (event.data().type_url() ==
           "type.googleapis.com/" + LoggingCommand::descriptor()->full_name()) {
@@ -269,6 +275,13 @@ class EventBusImpl {
     if (recipient_list.empty()) {
       return;
     }
+    TraceSpan span("event_bus/send", event.stamp());
+    {
+      std::lock_guard<std::mutex> lock(sequence_mtx_);
+      event.set_sequence(++sequences_[event.name()]);
+    }
+    *event.mutable_send_stamp() = MakeTimestampNow();
+    *event.mutable_send_monotonic_stamp() = MakeMonotonicTimestampNow();
     std::string event_message;
     event.SerializeToString(&event_message);
     CHECK_LT(int(event_message.size()), max_datagram_size)
@@ -308,6 +321,9 @@ class EventBusImpl {
   }
   std::mutex send_mtx_;
 
+  std::mutex sequence_mtx_;
+  std::unordered_map<std::string, uint64_t> sequences_;
+
   boost::asio::ip::udp::socket socket_;
   boost::asio::deadline_timer announce_timer_;
 
@@ -392,9 +408,16 @@ boost::filesystem::path GetArchiveRoot() { return get_archive().root(); }
 std::pair<farm_ng::core::Resource, boost::filesystem::path>
 GetUniqueArchiveResource(const std::string& prefix, const std::string& ext,
                          const std::string& content_type) {
+  return GetUniqueArchiveResource(GetArchivePath(), prefix, ext, content_type);
+}
+
+std::pair<farm_ng::core::Resource, boost::filesystem::path>
+GetUniqueArchiveResource(const boost::filesystem::path& archive_path,
+                         const std::string& prefix, const std::string& ext,
+                         const std::string& content_type) {
   farm_ng::core::Resource resource;
   resource.set_content_type(content_type);
-  auto blobstore_dir = GetArchivePath() / fs::path(prefix).parent_path();
+  auto blobstore_dir = archive_path / fs::path(prefix).parent_path();
   auto filename = MakePathUnique(GetArchiveRoot() / blobstore_dir,
                                  fs::basename(prefix) + "." + ext);
   resource.set_path((blobstore_dir / filename).string());
@@ -406,6 +429,15 @@ google::protobuf::Timestamp MakeTimestampNow() {
   return MakeTimestamp(std::chrono::system_clock::now());
 }
 
+google::protobuf::Timestamp MakeMonotonicTimestampNow() {
+  timespec now;
+  CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &now), 0);
+  google::protobuf::Timestamp stamp;
+  stamp.set_seconds(now.tv_sec);
+  stamp.set_nanos(now.tv_nsec);
+  return stamp;
+}
+
 void WaitForServices(EventBus& bus,
                      const std::vector<std::string>& service_names_in) {
   std::vector<std::string> service_names(service_names_in.begin(),
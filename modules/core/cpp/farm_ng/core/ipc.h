@@ -69,6 +69,12 @@ boost::filesystem::path GetArchiveRoot();
 std::pair<farm_ng::core::Resource, boost::filesystem::path>
 GetUniqueArchiveResource(const std::string& prefix, const std::string& ext,
                          const std::string& mime_type);
+// As above, in the given archive rather than the active one, e.g. for files
+// that belong to a recording which has since stopped.
+std::pair<farm_ng::core::Resource, boost::filesystem::path>
+GetUniqueArchiveResource(const boost::filesystem::path& archive_path,
+                         const std::string& prefix, const std::string& ext,
+                         const std::string& mime_type);
 
 // writes a protobuf, as json, to the active logging directory
 template <typename ProtobufT>
@@ -98,6 +104,13 @@ farm_ng::core::Resource ArchiveProtobufAsBinaryResource(
 
 google::protobuf::Timestamp MakeTimestampNow();
 
+// The host's CLOCK_MONOTONIC, which is not wall clock time. It never steps
+// when NTP adjusts the system clock, and every process on the host shares it
+// (Python's time.monotonic), so an Event's send_monotonic_stamp and
+// recv_monotonic_stamp are comparable when the sender and receiver share a
+// host.
+google::protobuf::Timestamp MakeMonotonicTimestampNow();
+
 template <typename T>
 farm_ng::core::Event MakeEvent(std::string name, const T& message,
                                const google::protobuf::Timestamp& stamp) {
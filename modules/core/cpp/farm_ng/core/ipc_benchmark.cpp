@@ -0,0 +1,128 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+#include <google/protobuf/wrappers.pb.h>
+#include <boost/asio.hpp>
+
+#include "farm_ng/core/ipc.h"
+
+namespace farm_ng {
+namespace core {
+namespace {
+
+google::protobuf::BytesValue MakePayload(size_t n_bytes) {
+  google::protobuf::BytesValue payload;
+  payload.set_value(std::string(n_bytes, 'x'));
+  return payload;
+}
+
+void BM_MakeEventSerialize(benchmark::State& state) {
+  auto payload = MakePayload(state.range(0));
+  std::string buffer;
+  for (auto _ : state) {
+    Event event = MakeEvent("benchmark/event", payload);
+    event.SerializeToString(&buffer);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_MakeEventSerialize)->RangeMultiplier(8)->Range(16, 32 << 10);
+
+void BM_EventParse(benchmark::State& state) {
+  std::string buffer;
+  MakeEvent("benchmark/event", MakePayload(state.range(0)))
+      .SerializeToString(&buffer);
+  for (auto _ : state) {
+    Event event;
+    event.ParseFromString(buffer);
+    benchmark::DoNotOptimize(event);
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_EventParse)->RangeMultiplier(8)->Range(16, 32 << 10);
+
+// Two buses on loopback, each with its own io_service. The pong bus runs on a
+// thread and echoes every ping back, the ping bus measures the round trip.
+void BM_EventBusRoundTrip(benchmark::State& state) {
+  boost::asio::io_service ping_io;
+  boost::asio::io_service pong_io;
+  EventBus& ping_bus = GetEventBus(ping_io);
+  ping_bus.SetName("benchmark_ping");
+  ping_bus.AddSubscriptions({"^benchmark/pong$"});
+  EventBus& pong_bus = GetEventBus(pong_io);
+  pong_bus.SetName("benchmark_pong");
+  pong_bus.AddSubscriptions({"^benchmark/ping$"});
+
+  pong_bus.GetEventSignal()->connect([&pong_bus](const Event& event) {
+    if (event.name() == "benchmark/ping") {
+      Event pong = event;
+      pong.set_name("benchmark/pong");
+      pong_bus.Send(pong);
+    }
+  });
+  uint64_t n_pongs = 0;
+  ping_bus.GetEventSignal()->connect([&n_pongs](const Event& event) {
+    if (event.name() == "benchmark/pong") {
+      n_pongs++;
+    }
+  });
+
+  auto work = std::make_unique<boost::asio::io_service::work>(pong_io);
+  std::thread pong_thread([&pong_io] { pong_io.run(); });
+
+  Event ping = MakeEvent("benchmark/ping", MakePayload(state.range(0)));
+  // Returns false if no pong arrives before the timeout. run_one returns at
+  // least once a second, when the announce timer fires.
+  auto round_trip = [&](std::chrono::seconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    uint64_t n_expected = n_pongs + 1;
+    ping_bus.Send(ping);
+    while (n_pongs < n_expected) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      ping_io.run_one();
+    }
+    return true;
+  };
+
+  // Wait for both buses to discover each other's subscriptions.
+  bool connected = false;
+  auto discovery_deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!connected &&
+         std::chrono::steady_clock::now() < discovery_deadline) {
+    connected = round_trip(std::chrono::seconds(1));
+  }
+
+  if (!connected) {
+    state.SkipWithError("Event bus peers not discovered, is multicast up?");
+  } else {
+    for (auto _ : state) {
+      if (!round_trip(std::chrono::seconds(1))) {
+        state.SkipWithError("Lost a ping or pong.");
+        break;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  work.reset();
+  pong_io.stop();
+  pong_thread.join();
+}
+BENCHMARK(BM_EventBusRoundTrip)
+    ->RangeMultiplier(8)
+    ->Range(16, 32 << 10)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace core
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
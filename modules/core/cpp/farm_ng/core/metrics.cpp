@@ -0,0 +1,197 @@
+#include "farm_ng/core/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "farm_ng/core/ipc.h"
+
+namespace farm_ng {
+namespace core {
+
+namespace {
+
+int HighestBit(uint64_t value) { return 63 - __builtin_clzll(value); }
+
+template <typename T>
+void AtomicMin(std::atomic<T>& target, T value) {
+  T current = target.load(std::memory_order_relaxed);
+  while (value < current &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+template <typename T>
+void AtomicMax(std::atomic<T>& target, T value) {
+  T current = target.load(std::memory_order_relaxed);
+  while (value > current &&
+         !target.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+int Histogram::BucketIndex(int64_t value) {
+  if (value < kSubBucketCount) {
+    return std::max<int64_t>(value, 0);
+  }
+  int exponent = HighestBit(value);
+  int shift = exponent - kSubBucketBits;
+  int sub_bucket = (value >> shift) - kSubBucketCount;
+  return (shift + 1) * kSubBucketCount + sub_bucket;
+}
+
+int64_t Histogram::BucketLowerBound(int index) {
+  if (index < kSubBucketCount) {
+    return index;
+  }
+  int shift = index / kSubBucketCount - 1;
+  int sub_bucket = index % kSubBucketCount;
+  return int64_t(kSubBucketCount + sub_bucket) << shift;
+}
+
+int64_t Histogram::BucketUpperBound(int index) {
+  if (index < kSubBucketCount) {
+    return index + 1;
+  }
+  int shift = index / kSubBucketCount - 1;
+  return BucketLowerBound(index) + (int64_t(1) << shift);
+}
+
+void Histogram::Record(int64_t value) {
+  value = std::max<int64_t>(value, 0);
+  buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  AtomicMin(min_, value);
+  AtomicMax(max_, value);
+}
+
+double Histogram::Percentile(double fraction) const {
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return 0.0;
+  }
+  uint64_t target =
+      std::max<uint64_t>(1, std::ceil(std::clamp(fraction, 0.0, 1.0) * count));
+  uint64_t accumulated = 0;
+  for (int i = 0; i < kBucketCount; ++i) {
+    accumulated += buckets_[i].load(std::memory_order_relaxed);
+    if (accumulated >= target) {
+      // Report the bucket midpoint, clamped to the observed range.
+      double mid = 0.5 * (BucketLowerBound(i) + BucketUpperBound(i) - 1);
+      return std::clamp<double>(mid, min_.load(std::memory_order_relaxed),
+                                max_.load(std::memory_order_relaxed));
+    }
+  }
+  return max_.load(std::memory_order_relaxed);
+}
+
+HistogramMetric Histogram::Summary(const std::string& name) const {
+  HistogramMetric summary;
+  summary.set_name(name);
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  summary.set_count(count);
+  if (count == 0) {
+    return summary;
+  }
+  summary.set_min(min_.load(std::memory_order_relaxed));
+  summary.set_max(max_.load(std::memory_order_relaxed));
+  summary.set_mean(double(sum_.load(std::memory_order_relaxed)) / count);
+  summary.set_p50(Percentile(0.5));
+  summary.set_p90(Percentile(0.9));
+  summary.set_p99(Percentile(0.99));
+  summary.set_p999(Percentile(0.999));
+  return summary;
+}
+
+Counter& MetricsRegistry::GetCounter(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto& counter = counters_[name];
+  if (!counter) {
+    counter.reset(new Counter);
+  }
+  return *counter;
+}
+
+Gauge& MetricsRegistry::GetGauge(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto& gauge = gauges_[name];
+  if (!gauge) {
+    gauge.reset(new Gauge);
+  }
+  return *gauge;
+}
+
+Histogram& MetricsRegistry::GetHistogram(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto& histogram = histograms_[name];
+  if (!histogram) {
+    histogram.reset(new Histogram);
+  }
+  return *histogram;
+}
+
+bool MetricsRegistry::empty() const {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return counters_.empty() && gauges_.empty() && histograms_.empty();
+}
+
+Metrics MetricsRegistry::Snapshot() const {
+  Metrics metrics;
+  *metrics.mutable_stamp() = MakeTimestampNow();
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (const auto& it : counters_) {
+    CounterMetric* counter = metrics.add_counters();
+    counter->set_name(it.first);
+    counter->set_value(it.second->value());
+  }
+  for (const auto& it : gauges_) {
+    GaugeMetric* gauge = metrics.add_gauges();
+    gauge->set_name(it.first);
+    gauge->set_value(it.second->value());
+  }
+  for (const auto& it : histograms_) {
+    *metrics.add_histograms() = it.second->Summary(it.first);
+  }
+  return metrics;
+}
+
+MetricsRegistry& GetMetricsRegistry() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+void LogMetricsSummary(const Metrics& metrics) {
+  if (metrics.counters().empty() && metrics.gauges().empty() &&
+      metrics.histograms().empty()) {
+    return;
+  }
+  std::stringstream ss;
+  ss << "Metrics summary:\n";
+  for (const auto& counter : metrics.counters()) {
+    ss << "  " << counter.name() << " count: " << counter.value() << "\n";
+  }
+  for (const auto& gauge : metrics.gauges()) {
+    ss << "  " << gauge.name() << " value: " << gauge.value() << "\n";
+  }
+  ss << std::fixed << std::setprecision(3);
+  for (const auto& histogram : metrics.histograms()) {
+    // Histograms record nanoseconds, report milliseconds.
+    ss << "  " << histogram.name() << " count: " << histogram.count()
+       << " ms p50: " << histogram.p50() * 1e-6
+       << " p90: " << histogram.p90() * 1e-6
+       << " p99: " << histogram.p99() * 1e-6
+       << " max: " << histogram.max() * 1e-6
+       << " mean: " << histogram.mean() * 1e-6 << "\n";
+  }
+  LOG(INFO) << ss.str();
+}
+
+}  // namespace core
+}  // namespace farm_ng
@@ -0,0 +1,128 @@
+#ifndef FARM_NG_METRICS_H_
+#define FARM_NG_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "farm_ng/core/metrics.pb.h"
+
+namespace farm_ng {
+namespace core {
+
+class Counter {
+ public:
+  void Increment(int64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0.0};
+};
+
+// A lock free, fixed memory histogram of non-negative integer values
+// (typically nanoseconds), in the spirit of HdrHistogram.
+//
+// Values are bucketed log-linearly: each power of two range is split into
+// 2^kSubBucketBits linear sub-buckets, so any recorded value is reported with
+// a relative error below 1/2^kSubBucketBits (~6%), over the full int64 range.
+class Histogram {
+ public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr int kBucketCount =
+      (64 - kSubBucketBits + 1) * kSubBucketCount;
+
+  void Record(int64_t value);
+
+  template <typename Rep, typename Period>
+  void Record(std::chrono::duration<Rep, Period> duration) {
+    Record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count());
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  // Returns the value below which the given fraction (0 to 1) of recorded
+  // values fall, or 0 if nothing has been recorded.
+  double Percentile(double fraction) const;
+
+  HistogramMetric Summary(const std::string& name) const;
+
+  // Exposed for testing.
+  static int BucketIndex(int64_t value);
+  static int64_t BucketLowerBound(int index);
+  static int64_t BucketUpperBound(int index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketCount> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> sum_{0};
+  std::atomic<int64_t> min_{std::numeric_limits<int64_t>::max()};
+  std::atomic<int64_t> max_{0};
+};
+
+// Records the time between construction and destruction into a Histogram.
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    histogram_.Record(std::chrono::steady_clock::now() - start_);
+  }
+
+ private:
+  Histogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Process wide registry of named metrics.
+//
+// Looking up a metric takes a lock, so hot paths should look up once and keep
+// the returned reference, which remains valid for the life of the process.
+// Updating a metric is lock free.
+//
+//   static Histogram& latency = GetMetricsRegistry().GetHistogram("foo/ns");
+//   ScopedLatency timer(latency);
+class MetricsRegistry {
+ public:
+  Counter& GetCounter(const std::string& name);
+  Gauge& GetGauge(const std::string& name);
+  Histogram& GetHistogram(const std::string& name);
+
+  bool empty() const;
+
+  Metrics Snapshot() const;
+
+ private:
+  mutable std::mutex mtx_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+};
+
+MetricsRegistry& GetMetricsRegistry();
+
+// Logs a human readable table of the current metrics, used at process exit.
+void LogMetricsSummary(const Metrics& metrics);
+
+}  // namespace core
+}  // namespace farm_ng
+
+#endif
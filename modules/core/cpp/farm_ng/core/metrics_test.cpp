@@ -0,0 +1,133 @@
+#include "farm_ng/core/metrics.h"
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "gtest/gtest.h"
+
+using farm_ng::core::Counter;
+using farm_ng::core::Gauge;
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::Histogram;
+using farm_ng::core::HistogramMetric;
+using farm_ng::core::Metrics;
+
+TEST(metrics, counter) {
+  Counter counter;
+  EXPECT_EQ(counter.value(), 0);
+  counter.Increment();
+  counter.Increment(41);
+  EXPECT_EQ(counter.value(), 42);
+}
+
+TEST(metrics, gauge) {
+  Gauge gauge;
+  EXPECT_EQ(gauge.value(), 0.0);
+  gauge.Set(2.5);
+  gauge.Set(-1.25);
+  EXPECT_EQ(gauge.value(), -1.25);
+}
+
+TEST(metrics, histogram_buckets) {
+  // Small values have a bucket each.
+  for (int64_t value = 0; value < Histogram::kSubBucketCount; ++value) {
+    EXPECT_EQ(Histogram::BucketIndex(value), value);
+  }
+  // Buckets tile the int64 range, each narrower than 1/kSubBucketCount of its
+  // lower bound.
+  const int last = Histogram::BucketIndex(std::numeric_limits<int64_t>::max());
+  EXPECT_LT(last, Histogram::kBucketCount);
+  for (int i = 0; i < last; ++i) {
+    const int64_t lower = Histogram::BucketLowerBound(i);
+    const int64_t upper = Histogram::BucketUpperBound(i);
+    EXPECT_EQ(upper, Histogram::BucketLowerBound(i + 1)) << i;
+    if (i >= Histogram::kSubBucketCount) {
+      EXPECT_LE((upper - lower) * Histogram::kSubBucketCount, lower) << i;
+    }
+  }
+  for (int64_t value : {16LL, 17LL, 31LL, 32LL, 1000LL, 123456789LL,
+                        (1LL << 62) + 5}) {
+    const int i = Histogram::BucketIndex(value);
+    EXPECT_LE(Histogram::BucketLowerBound(i), value);
+    EXPECT_LT(value, Histogram::BucketUpperBound(i));
+  }
+  // Negative values are counted as 0.
+  EXPECT_EQ(Histogram::BucketIndex(-5), 0);
+}
+
+TEST(metrics, histogram_quantiles) {
+  Histogram histogram;
+  EXPECT_EQ(histogram.Percentile(0.5), 0.0);
+  EXPECT_EQ(histogram.Summary("empty").count(), 0);
+
+  for (int64_t value = 1; value <= 1000; ++value) {
+    histogram.Record(value);
+  }
+  EXPECT_EQ(histogram.count(), 1000);
+  // Within the relative error of a bucket.
+  const double error = 1.0 / Histogram::kSubBucketCount;
+  EXPECT_NEAR(histogram.Percentile(0.5), 500, 500 * error);
+  EXPECT_NEAR(histogram.Percentile(0.9), 900, 900 * error);
+  EXPECT_NEAR(histogram.Percentile(0.99), 990, 990 * error);
+  // Clamped to the recorded range.
+  EXPECT_EQ(histogram.Percentile(0.0), 1);
+  EXPECT_LE(histogram.Percentile(1.0), 1000);
+  EXPECT_GE(histogram.Percentile(1.0), 1000 * (1 - error));
+
+  HistogramMetric summary = histogram.Summary("latency");
+  EXPECT_EQ(summary.name(), "latency");
+  EXPECT_EQ(summary.count(), 1000);
+  EXPECT_EQ(summary.min(), 1);
+  EXPECT_EQ(summary.max(), 1000);
+  EXPECT_DOUBLE_EQ(summary.mean(), 500.5);
+  EXPECT_EQ(summary.p50(), histogram.Percentile(0.5));
+  EXPECT_EQ(summary.p999(), histogram.Percentile(0.999));
+
+  Histogram durations;
+  durations.Record(std::chrono::microseconds(3));
+  durations.Record(-7);
+  HistogramMetric durations_summary = durations.Summary("durations");
+  EXPECT_EQ(durations_summary.max(), 3000);
+  EXPECT_EQ(durations_summary.min(), 0);
+}
+
+TEST(metrics, registry_reuses_names) {
+  auto& registry = GetMetricsRegistry();
+  Counter& counter = registry.GetCounter("metrics_test/reused");
+  EXPECT_EQ(&registry.GetCounter("metrics_test/reused"), &counter);
+  EXPECT_NE(&registry.GetCounter("metrics_test/other"), &counter);
+  counter.Increment(3);
+  EXPECT_EQ(registry.GetCounter("metrics_test/reused").value(), 3);
+
+  // Each kind of metric has its own names.
+  Gauge& gauge = registry.GetGauge("metrics_test/reused");
+  EXPECT_EQ(&registry.GetGauge("metrics_test/reused"), &gauge);
+  gauge.Set(1.5);
+  Histogram& histogram = registry.GetHistogram("metrics_test/reused");
+  EXPECT_EQ(&registry.GetHistogram("metrics_test/reused"), &histogram);
+  histogram.Record(10);
+  EXPECT_FALSE(registry.empty());
+
+  Metrics snapshot = registry.Snapshot();
+  int found = 0;
+  for (const auto& c : snapshot.counters()) {
+    if (c.name() == "metrics_test/reused") {
+      EXPECT_EQ(c.value(), 3);
+      ++found;
+    }
+  }
+  for (const auto& g : snapshot.gauges()) {
+    if (g.name() == "metrics_test/reused") {
+      EXPECT_EQ(g.value(), 1.5);
+      ++found;
+    }
+  }
+  for (const auto& h : snapshot.histograms()) {
+    if (h.name() == "metrics_test/reused") {
+      EXPECT_EQ(h.count(), 1);
+      ++found;
+    }
+  }
+  EXPECT_EQ(found, 3);
+}
@@ -0,0 +1,184 @@
+#include "farm_ng/core/thread_policy.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "farm_ng/core/blobstore.h"
+
+namespace farm_ng {
+namespace core {
+
+namespace {
+
+std::mutex& _config_mtx() {
+  static std::mutex mtx;
+  return mtx;
+}
+
+ThreadPolicyConfig& _config() {
+  static ThreadPolicyConfig config;
+  return config;
+}
+
+int ToSchedPolicy(ThreadPolicy::Scheduler scheduler) {
+  switch (scheduler) {
+    case ThreadPolicy::SCHEDULER_OTHER:
+      return SCHED_OTHER;
+    case ThreadPolicy::SCHEDULER_FIFO:
+      return SCHED_FIFO;
+    case ThreadPolicy::SCHEDULER_RR:
+      return SCHED_RR;
+    case ThreadPolicy::SCHEDULER_BATCH:
+      return SCHED_BATCH;
+    case ThreadPolicy::SCHEDULER_IDLE:
+      return SCHED_IDLE;
+    default:
+      return -1;
+  }
+}
+
+bool SetAffinity(const ThreadPolicy& policy) {
+  if (policy.cpus().empty()) {
+    return true;
+  }
+  // CPU_SET doesn't bounds check, and a config may have been written for a
+  // machine with more cores.
+  const int n_cpus = std::thread::hardware_concurrency();
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : policy.cpus()) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE || (n_cpus > 0 && cpu >= n_cpus)) {
+      LOG(WARNING) << "Skipping cpu " << cpu << ", this machine has " << n_cpus
+                   << " cpus, policy: " << policy.ShortDebugString();
+      continue;
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (CPU_COUNT(&cpu_set) == 0) {
+    LOG(WARNING) << "No valid cpus, not setting cpu affinity, policy: "
+                 << policy.ShortDebugString();
+    return false;
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (err != 0) {
+    LOG(WARNING) << "Could not set cpu affinity: " << std::strerror(err)
+                 << " policy: " << policy.ShortDebugString();
+    return false;
+  }
+  return true;
+}
+
+bool SetScheduler(const ThreadPolicy& policy) {
+  int sched_policy = ToSchedPolicy(policy.scheduler());
+  if (sched_policy < 0) {
+    return true;
+  }
+  sched_param param;
+  param.sched_priority = 0;
+  if (sched_policy == SCHED_FIFO || sched_policy == SCHED_RR) {
+    param.sched_priority =
+        std::max(sched_get_priority_min(sched_policy),
+                 std::min(policy.priority(),
+                          sched_get_priority_max(sched_policy)));
+  }
+  int err = pthread_setschedparam(pthread_self(), sched_policy, &param);
+  if (err != 0) {
+    LOG(WARNING) << "Could not set scheduler: " << std::strerror(err)
+                 << " (real-time schedulers require CAP_SYS_NICE) policy: "
+                 << policy.ShortDebugString();
+    return false;
+  }
+  return true;
+}
+
+bool SetNice(const ThreadPolicy& policy) {
+  if (!policy.has_nice()) {
+    return true;
+  }
+  // On linux, nice values are per thread when addressed by thread id.
+  pid_t tid = syscall(SYS_gettid);
+  if (setpriority(PRIO_PROCESS, tid, policy.nice().value()) != 0) {
+    LOG(WARNING) << "Could not set nice level: " << std::strerror(errno)
+                 << " policy: " << policy.ShortDebugString();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+void SetThreadPolicyConfig(const ThreadPolicyConfig& config) {
+  std::lock_guard<std::mutex> lock(_config_mtx());
+  _config().CopyFrom(config);
+}
+
+const ThreadPolicyConfig& GetThreadPolicyConfig() { return _config(); }
+
+bool LoadThreadPolicyConfig(const std::string& program_name) {
+  fs::path config_path = GetBucketAbsolutePath(Bucket::BUCKET_CONFIGURATIONS) /
+                         "thread_policy" / (program_name + ".json");
+  if (!fs::exists(config_path)) {
+    VLOG(1) << "No thread policy configuration: " << config_path.string();
+    return false;
+  }
+  SetThreadPolicyConfig(
+      ReadProtobufFromJsonFile<ThreadPolicyConfig>(config_path));
+  LOG(INFO) << "thread policy config: "
+            << GetThreadPolicyConfig().ShortDebugString();
+  return true;
+}
+
+ThreadPolicy GetThreadPolicy(const std::string& stage) {
+  std::lock_guard<std::mutex> lock(_config_mtx());
+  auto it = _config().stages().find(stage);
+  if (it != _config().stages().end()) {
+    return it->second;
+  }
+  return _config().default_policy();
+}
+
+void SetCurrentThreadName(const std::string& name) {
+  // The kernel limits thread names to 16 bytes, including the terminator.
+  std::string truncated = name.substr(0, 15);
+  int err = pthread_setname_np(pthread_self(), truncated.c_str());
+  if (err != 0) {
+    LOG(WARNING) << "Could not set thread name: " << truncated << " "
+                 << std::strerror(err);
+  }
+}
+
+bool ApplyThreadPolicy(const ThreadPolicy& policy) {
+  bool success = SetAffinity(policy);
+  success &= SetScheduler(policy);
+  success &= SetNice(policy);
+  return success;
+}
+
+bool ApplyThreadPolicy(const std::string& stage, int index) {
+  ThreadPolicy policy = GetThreadPolicy(stage);
+  std::string name =
+      policy.thread_name().empty() ? stage : policy.thread_name();
+  if (index >= 0) {
+    // Keep the index visible when the prefix is truncated.
+    std::string suffix = "/" + std::to_string(index);
+    name = name.substr(0, 15 - std::min<size_t>(suffix.size(), 15)) + suffix;
+  }
+  SetCurrentThreadName(name);
+  VLOG(1) << "Applying thread policy for stage: " << stage << " name: " << name
+          << " policy: " << policy.ShortDebugString();
+  return ApplyThreadPolicy(policy);
+}
+
+}  // namespace core
+}  // namespace farm_ng
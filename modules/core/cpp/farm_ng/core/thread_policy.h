@@ -0,0 +1,44 @@
+#ifndef FARM_NG_THREAD_POLICY_H_
+#define FARM_NG_THREAD_POLICY_H_
+
+#include <string>
+
+#include "farm_ng/core/thread_policy.pb.h"
+
+namespace farm_ng {
+namespace core {
+
+// Sets the process wide thread policy configuration, consulted by
+// ApplyThreadPolicy.  Typically called once from core::Main before any
+// threads are started.
+void SetThreadPolicyConfig(const ThreadPolicyConfig& config);
+
+const ThreadPolicyConfig& GetThreadPolicyConfig();
+
+// Loads the configuration for the given program from
+// configurations/thread_policy/<program_name>.json, if such a file exists.
+// Returns true if a configuration was loaded.
+bool LoadThreadPolicyConfig(const std::string& program_name);
+
+// Returns the policy for the stage, or the default policy if the stage has
+// no override.
+ThreadPolicy GetThreadPolicy(const std::string& stage);
+
+// Names the calling thread, truncating to the kernel's 15 character limit.
+void SetCurrentThreadName(const std::string& name);
+
+// Applies the policy's affinity, scheduler, priority and nice level to the
+// calling thread, leaving its name untouched. Failures, e.g. missing
+// CAP_SYS_NICE for SCHEDULER_FIFO, are logged and the thread keeps running with
+// what could be applied. Returns false if any part of the policy failed.
+bool ApplyThreadPolicy(const ThreadPolicy& policy);
+
+// Names the calling thread after the stage and applies the stage's policy.
+// index is appended to the thread name when non-negative, so pool threads are
+// distinguishable.
+bool ApplyThreadPolicy(const std::string& stage, int index = -1);
+
+}  // namespace core
+}  // namespace farm_ng
+
+#endif
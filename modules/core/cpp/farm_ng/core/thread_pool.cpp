@@ -2,10 +2,12 @@
 
 #include <glog/logging.h>
 
+#include "farm_ng/core/thread_policy.h"
+
 namespace farm_ng {
 namespace core {
 
-ThreadPool::ThreadPool() {}
+ThreadPool::ThreadPool(const std::string& name) : name_(name) {}
 
 void ThreadPool::Stop() { io_service_.stop(); }
 
@@ -14,7 +16,12 @@ void ThreadPool::Start(size_t n_threads) {
   CHECK(threads_.empty()) << "ThreadPool already started. Call Join().";
   io_service_.reset();
   for (size_t i = 0; i < n_threads; ++i) {
-    threads_.emplace_back([this]() { io_service_.run(); });
+    threads_.emplace_back([this, i]() {
+      if (!name_.empty()) {
+        ApplyThreadPolicy(name_, i);
+      }
+      io_service_.run();
+    });
   }
 }
 
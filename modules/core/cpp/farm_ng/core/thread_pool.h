@@ -1,3 +1,4 @@
+#include <string>
 #include <thread>
 
 #include <boost/asio/io_service.hpp>
@@ -7,7 +8,9 @@ namespace core {
 
 class ThreadPool {
  public:
-  ThreadPool();
+  // name selects the ThreadPolicy stage applied to each pool thread, see
+  // thread_policy.h. An empty name leaves the threads untouched.
+  explicit ThreadPool(const std::string& name = "");
 
   void Stop();
 
@@ -18,6 +21,7 @@ class ThreadPool {
   boost::asio::io_service& get_io_service();
 
  private:
+  std::string name_;
   boost::asio::io_service io_service_;
   std::vector<std::thread> threads_;
 };
@@ -0,0 +1,295 @@
+#include "farm_ng/core/trace.h"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace farm_ng {
+namespace core {
+
+namespace {
+
+struct TraceRecord {
+  const char* name;
+  int64_t begin_ns;
+  int64_t end_ns;
+  int64_t id;
+};
+
+// Written by the owning thread, and read when the trace is written. The lock
+// is only contended while a trace is being written.
+class TraceRing {
+ public:
+  static constexpr size_t kCapacity = 1 << 15;
+
+  TraceRing() : tid_(syscall(SYS_gettid)) {}
+
+  void Push(const TraceRecord& record) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (thread_name_.empty()) {
+      // Captured on first use, after any ThreadPolicy has named the thread.
+      char name[16] = {0};
+      pthread_getname_np(pthread_self(), name, sizeof(name));
+      thread_name_ = name;
+    }
+    records_[count_ % kCapacity] = record;
+    ++count_;
+  }
+
+  std::vector<TraceRecord> Records() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t begin = count_ > kCapacity ? count_ - kCapacity : 0;
+    std::vector<TraceRecord> records;
+    records.reserve(count_ - begin);
+    for (uint64_t i = begin; i < count_; ++i) {
+      records.push_back(records_[i % kCapacity]);
+    }
+    return records;
+  }
+
+  // Clears the ring for reuse by the calling thread.
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    tid_ = syscall(SYS_gettid);
+    thread_name_.clear();
+    count_ = 0;
+  }
+
+  pid_t tid() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return tid_;
+  }
+  std::string thread_name() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return thread_name_;
+  }
+
+ private:
+  pid_t tid_;
+  mutable std::mutex mtx_;
+  std::string thread_name_;
+  uint64_t count_ = 0;
+  std::array<TraceRecord, kCapacity> records_;
+};
+
+std::atomic<bool> _g_tracing_enabled(false);
+
+std::chrono::steady_clock::time_point _trace_epoch() {
+  static std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+  return epoch;
+}
+
+std::mutex& _rings_mtx() {
+  static std::mutex mtx;
+  return mtx;
+}
+
+// Rings are owned here rather than by the thread, so spans survive thread
+// exit.
+std::vector<std::unique_ptr<TraceRing>>& _rings() {
+  static std::vector<std::unique_ptr<TraceRing>> rings;
+  return rings;
+}
+
+// Rings of exited threads, oldest first. Threads started later reuse them
+// once there are more than this many, so pools that churn threads don't grow
+// the trace without bound.
+constexpr size_t kMaxRetiredRings = 16;
+
+std::deque<TraceRing*>& _retired_rings() {
+  static std::deque<TraceRing*> rings;
+  return rings;
+}
+
+TraceRing* AcquireRing() {
+  std::lock_guard<std::mutex> lock(_rings_mtx());
+  if (_retired_rings().size() >= kMaxRetiredRings) {
+    TraceRing* ring = _retired_rings().front();
+    _retired_rings().pop_front();
+    ring->Reset();
+    return ring;
+  }
+  _rings().emplace_back(new TraceRing);
+  return _rings().back().get();
+}
+
+// Retires the thread's ring when the thread exits.
+class ThreadRing {
+ public:
+  ~ThreadRing() {
+    if (ring_ != nullptr) {
+      std::lock_guard<std::mutex> lock(_rings_mtx());
+      _retired_rings().push_back(ring_);
+    }
+  }
+
+  TraceRing& get() {
+    if (ring_ == nullptr) {
+      ring_ = AcquireRing();
+    }
+    return *ring_;
+  }
+
+ private:
+  TraceRing* ring_ = nullptr;
+};
+
+TraceRing& _thread_ring() {
+  thread_local ThreadRing ring;
+  return ring.get();
+}
+
+int64_t SinceEpochNs(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t -
+                                                              _trace_epoch())
+      .count();
+}
+
+std::string JsonEscape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    if (static_cast<unsigned char>(c) < 0x20) {
+      continue;
+    }
+    out += c;
+  }
+  return out;
+}
+
+}  // namespace
+
+void SetTracingEnabled(bool enabled) {
+  // Pin the epoch before any span is recorded.
+  _trace_epoch();
+  _g_tracing_enabled = enabled;
+}
+
+bool TracingEnabled() {
+  return _g_tracing_enabled.load(std::memory_order_relaxed);
+}
+
+int64_t TraceId(const google::protobuf::Timestamp& stamp) {
+  return stamp.seconds() * 1000000000LL + stamp.nanos();
+}
+
+void RecordTraceSpan(const char* name,
+                     std::chrono::steady_clock::time_point begin,
+                     std::chrono::steady_clock::time_point end, int64_t id) {
+  if (!TracingEnabled()) {
+    return;
+  }
+  _thread_ring().Push({name, SinceEpochNs(begin), SinceEpochNs(end), id});
+}
+
+void WriteChromeTrace(const std::string& path) {
+  struct Span {
+    pid_t tid;
+    TraceRecord record;
+  };
+  std::vector<Span> spans;
+  {
+    // Under the lock, so a ring isn't reused between its tid and records.
+    std::lock_guard<std::mutex> lock(_rings_mtx());
+    for (const auto& ring : _rings()) {
+      const pid_t tid = ring->tid();
+      for (const TraceRecord& record : ring->Records()) {
+        spans.push_back({tid, record});
+      }
+    }
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+    return a.record.begin_ns < b.record.begin_ns;
+  });
+
+  std::ofstream out(path);
+  if (!out) {
+    LOG(ERROR) << "Could not open trace file: " << path;
+    return;
+  }
+  const pid_t pid = getpid();
+  // Chrome trace timestamps are in microseconds.
+  auto us = [](int64_t ns) { return ns / 1000.0; };
+  out << std::fixed;
+  out.precision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  auto separator = [&out, &first]() {
+    if (!first) {
+      out << ",\n";
+    }
+    first = false;
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(_rings_mtx());
+    for (const auto& ring : _rings()) {
+      separator();
+      out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+          << ",\"tid\":" << ring->tid() << ",\"args\":{\"name\":\""
+          << JsonEscape(ring->thread_name()) << "\"}}";
+    }
+  }
+
+  // Spans sharing an id are chained with flow events, in time order. Ids are
+  // written as strings as they exceed the precision of a json number.
+  std::map<int64_t, size_t> flow_remaining;
+  for (const Span& span : spans) {
+    if (span.record.id >= 0) {
+      flow_remaining[span.record.id]++;
+    }
+  }
+  std::map<int64_t, bool> flow_started;
+
+  for (const Span& span : spans) {
+    const TraceRecord& r = span.record;
+    separator();
+    out << "{\"ph\":\"X\",\"cat\":\"farm_ng\",\"name\":\""
+        << JsonEscape(r.name) << "\",\"pid\":" << pid
+        << ",\"tid\":" << span.tid << ",\"ts\":" << us(r.begin_ns)
+        << ",\"dur\":" << us(r.end_ns - r.begin_ns);
+    if (r.id >= 0) {
+      out << ",\"args\":{\"id\":\"" << r.id << "\"}";
+    }
+    out << "}";
+
+    if (r.id < 0 || (!flow_started[r.id] && flow_remaining[r.id] == 1)) {
+      // Nothing to link a lone span to.
+      continue;
+    }
+    const char* phase = "t";
+    if (!flow_started[r.id]) {
+      phase = "s";
+      flow_started[r.id] = true;
+    } else if (flow_remaining[r.id] == 1) {
+      phase = "f";
+    }
+    flow_remaining[r.id]--;
+    separator();
+    out << "{\"ph\":\"" << phase
+        << "\",\"cat\":\"frame\",\"name\":\"frame\",\"bp\":\"e\",\"id\":\"0x"
+        << std::hex << r.id << std::dec << "\",\"pid\":" << pid
+        << ",\"tid\":" << span.tid << ",\"ts\":" << us(r.begin_ns)
+        << "}";
+  }
+  out << "\n]}\n";
+  LOG(INFO) << "Wrote " << spans.size() << " trace spans to: " << path;
+}
+
+}  // namespace core
+}  // namespace farm_ng
@@ -0,0 +1,78 @@
+#ifndef FARM_NG_TRACE_H_
+#define FARM_NG_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <google/protobuf/timestamp.pb.h>
+
+namespace farm_ng {
+namespace core {
+
+// Low overhead span recorder, for seeing where time goes in a pipeline.
+//
+// Spans are written to a per thread ring buffer, stamped with the monotonic
+// clock, and can be dumped as Chrome Trace Event JSON, viewable in
+// chrome://tracing or https://ui.perfetto.dev.  Programs started with
+// core::Main enable tracing with --trace_file=/tmp/trace.json. The rings of
+// exited threads are kept, and reused by new threads once a few have exited.
+//
+// Spans carrying the same id (typically the frame stamp, see TraceId) are
+// linked with flow arrows, so a single frame can be followed end to end across
+// threads:
+//
+//   TraceSpan span("camera_pipeline/compute", TraceId(frame_data.stamp()));
+//
+// Recording is a no-op unless tracing is enabled.
+
+// Enables or disables recording, process wide.
+void SetTracingEnabled(bool enabled);
+bool TracingEnabled();
+
+// Converts a stamp to a span id, nanoseconds since the epoch.
+int64_t TraceId(const google::protobuf::Timestamp& stamp);
+
+// Records a completed span. name must outlive the process, e.g. a string
+// literal. id < 0 means the span is not correlated with other spans.
+void RecordTraceSpan(const char* name,
+                     std::chrono::steady_clock::time_point begin,
+                     std::chrono::steady_clock::time_point end,
+                     int64_t id = -1);
+
+// Writes all recorded spans as Chrome Trace Event JSON. Spans recorded
+// concurrently with the write may be missing.
+void WriteChromeTrace(const std::string& path);
+
+// Records the lifetime of the object as a span.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name, int64_t id = -1)
+      : name_(name), id_(id), enabled_(TracingEnabled()) {
+    if (enabled_) {
+      begin_ = std::chrono::steady_clock::now();
+    }
+  }
+  TraceSpan(const char* name, const google::protobuf::Timestamp& stamp)
+      : TraceSpan(name, TraceId(stamp)) {}
+
+  ~TraceSpan() {
+    if (enabled_) {
+      RecordTraceSpan(name_, begin_, std::chrono::steady_clock::now(), id_);
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  const char* name_;
+  int64_t id_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point begin_;
+};
+
+}  // namespace core
+}  // namespace farm_ng
+
+#endif
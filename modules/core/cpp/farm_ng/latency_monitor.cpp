@@ -0,0 +1,186 @@
+// Measures event bus latency and loss, per event name.
+//
+// # monitor all traffic, publishing latency_monitor/status every 5 seconds
+// latency_monitor
+// # monitor only camera traffic
+// latency_monitor --topics="tracking_camera/.*,camera_pipeline/.*"
+//
+// Latency is measured from Event.send_monotonic_stamp to
+// Event.recv_monotonic_stamp, loss from
+// gaps in Event.sequence. Senders are assumed to be on the same host, and
+// each event name to have a single sender.
+
+#include <gflags/gflags.h>
+#include <google/protobuf/util/time_util.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "farm_ng/core/init.h"
+#include "farm_ng/core/ipc.h"
+#include "farm_ng/core/latency_monitor.pb.h"
+#include "farm_ng/core/metrics.h"
+
+DEFINE_string(topics, ".*",
+              "Comma separated regular expressions of event names to monitor.");
+
+DEFINE_double(period, 5.0, "Seconds between latency_monitor/status events.");
+
+namespace farm_ng {
+namespace core {
+
+namespace {
+
+int64_t ToNanoseconds(const google::protobuf::Timestamp& stamp) {
+  return google::protobuf::util::TimeUtil::TimestampToNanoseconds(stamp);
+}
+
+}  // namespace
+
+class LatencyMonitor {
+ public:
+  LatencyMonitor(EventBus& bus, const std::vector<std::string>& topics,
+                 double period)
+      : bus_(bus),
+        period_(period),
+        status_timer_(bus_.get_io_service()),
+        status_name_(bus_.GetName() + "/status") {
+    CHECK_GT(period_, 0.0);
+    bus_.AddSubscriptions(topics);
+    bus_.GetEventSignal()->connect(
+        std::bind(&LatencyMonitor::on_event, this, std::placeholders::_1));
+    status_timer_.expires_from_now(
+        std::chrono::microseconds(int64_t(period_ * 1e6)));
+    status_timer_.async_wait(
+        std::bind(&LatencyMonitor::send_status, this, std::placeholders::_1));
+  }
+
+  void on_event(const Event& event) {
+    if (event.name() == status_name_) {
+      return;
+    }
+    TopicStats& stats = topics_[event.name()];
+    if (!stats.latency) {
+      stats.latency.reset(new Histogram);
+      stats.age.reset(new Histogram);
+    }
+    stats.received++;
+
+    if (event.has_send_monotonic_stamp()) {
+      stats.latency->Record(ToNanoseconds(event.recv_monotonic_stamp()) -
+                            ToNanoseconds(event.send_monotonic_stamp()));
+    }
+    if (event.has_stamp()) {
+      stats.age->Record(ToNanoseconds(event.recv_stamp()) -
+                        ToNanoseconds(event.stamp()));
+    }
+
+    // Senders that don't number their events are only measured for latency.
+    uint64_t sequence = event.sequence();
+    if (sequence == 0) {
+      return;
+    }
+    if (stats.last_sequence == 0 || sequence == 1) {
+      // First event seen, or the sender restarted.
+    } else if (sequence > stats.last_sequence) {
+      stats.lost += sequence - stats.last_sequence - 1;
+    } else {
+      // Arrived after a later event, so it was counted as lost.
+      stats.reordered++;
+      if (stats.lost > 0) {
+        stats.lost--;
+      }
+      return;
+    }
+    stats.last_sequence = sequence;
+  }
+
+  void send_status(const boost::system::error_code& error) {
+    if (error) {
+      LOG(WARNING) << "status timer error: " << error;
+      return;
+    }
+    status_timer_.expires_from_now(
+        std::chrono::microseconds(int64_t(period_ * 1e6)));
+    status_timer_.async_wait(
+        std::bind(&LatencyMonitor::send_status, this, std::placeholders::_1));
+
+    LatencyMonitorStatus status;
+    *status.mutable_stamp() = MakeTimestampNow();
+    status.set_period(period_);
+    for (auto& it : topics_) {
+      TopicStats& stats = it.second;
+      TopicLatency* topic = status.add_topics();
+      topic->set_name(it.first);
+      *topic->mutable_latency() = stats.latency->Summary("latency");
+      *topic->mutable_age() = stats.age->Summary("age");
+      topic->set_received(stats.received);
+      topic->set_lost(stats.lost);
+      topic->set_reordered(stats.reordered);
+      topic->set_loss_rate(double(stats.lost) /
+                           std::max<uint64_t>(1, stats.received + stats.lost));
+      // Histograms cover one period, counts are cumulative.
+      stats.latency.reset(new Histogram);
+      stats.age.reset(new Histogram);
+    }
+    LogStatus(status);
+    if (status.ByteSizeLong() > 60000) {
+      LOG(WARNING) << "Too many topics to publish status ("
+                   << status.topics_size()
+                   << "), narrow them with --topics.";
+      return;
+    }
+    bus_.Send(MakeEvent(status_name_, status));
+  }
+
+ private:
+  struct TopicStats {
+    std::unique_ptr<Histogram> latency;
+    std::unique_ptr<Histogram> age;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t reordered = 0;
+    uint64_t last_sequence = 0;
+  };
+
+  static void LogStatus(const LatencyMonitorStatus& status) {
+    std::stringstream ss;
+    ss << std::fixed;
+    ss.precision(3);
+    for (const TopicLatency& topic : status.topics()) {
+      ss << "\n  " << topic.name() << " received: " << topic.received()
+         << " lost: " << topic.lost() << " ms p50: "
+         << topic.latency().p50() * 1e-6
+         << " p99: " << topic.latency().p99() * 1e-6
+         << " max: " << topic.latency().max() * 1e-6;
+    }
+    LOG(INFO) << "Bus latency:" << ss.str();
+  }
+
+  EventBus& bus_;
+  double period_;
+  boost::asio::steady_timer status_timer_;
+  std::string status_name_;
+  std::map<std::string, TopicStats> topics_;
+};
+
+}  // namespace core
+}  // namespace farm_ng
+
+void Cleanup(farm_ng::core::EventBus& bus) {}
+
+int Main(farm_ng::core::EventBus& bus) {
+  std::vector<std::string> topics;
+  boost::split(topics, FLAGS_topics, boost::is_any_of(","));
+  farm_ng::core::LatencyMonitor monitor(bus, topics, FLAGS_period);
+  bus.get_io_service().run();
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  return farm_ng::core::Main(argc, argv, &Main, &Cleanup);
+}
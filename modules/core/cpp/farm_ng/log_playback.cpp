@@ -21,6 +21,7 @@
 #include "farm_ng/core/init.h"
 #include "farm_ng/core/ipc.h"
 #include "farm_ng/core/log_playback.pb.h"
+#include "farm_ng/core/metrics.h"
 
 DEFINE_bool(interactive, false, "receive program args via eventbus");
 
@@ -50,7 +51,11 @@ class IpcLogPlayback {
       : io_service_(bus.get_io_service()),
         bus_(bus),
         status_timer_(bus.get_io_service()),
-        log_timer_(bus.get_io_service()) {
+        log_timer_(bus.get_io_service()),
+        message_count_(
+            GetMetricsRegistry().GetCounter("log_playback/messages")),
+        read_latency_(GetMetricsRegistry().GetHistogram("log_playback/read")),
+        send_latency_(GetMetricsRegistry().GetHistogram("log_playback/send")) {
     if (interactive) {
       status_.mutable_input_required_configuration()->CopyFrom(configuration);
     } else {
@@ -132,15 +137,19 @@ class IpcLogPlayback {
       }
       stats.mutable_last_stamp()->CopyFrom(next_message_->stamp());
 
+      message_count_.Increment();
+
       if (configuration_.send()) {
         if (!next_message_->data().Is<LoggingCommand>()) {
           next_message_->set_name(std::string("playback/") +
                                   next_message_->name());
+          ScopedLatency timer(send_latency_);
           bus_.Send(*next_message_);
         }
       }
     }
     try {
+      ScopedLatency timer(read_latency_);
       next_message_ = log_reader_->ReadNext();
       LOG(INFO) << next_message_->name();
     } catch (std::runtime_error& e) {
@@ -190,6 +199,9 @@ class IpcLogPlayback {
   boost::optional<google::protobuf::Timestamp> last_message_stamp_;
   boost::optional<farm_ng::core::Event> next_message_;
   std::map<std::string, MessageStats> message_stats_;
+  Counter& message_count_;
+  Histogram& read_latency_;
+  Histogram& send_latency_;
 };
 
 }  // namespace core
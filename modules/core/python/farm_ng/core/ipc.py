@@ -103,6 +103,8 @@ class EventBus:
         self._multicast_group = _g_multicast_group
         self._name = name
         self._quiet_count = 0
+        # Next Event.sequence, keyed by event name
+        self._sequences: Dict[str, int] = dict()
         self._mc_recv_sock: Optional[socket.SocketType] = None
         self._mc_send_sock: Optional[socket.SocketType] = None
         self._connect_recv_sock()
@@ -218,6 +220,11 @@ class EventBus:
         if not self._mc_send_sock:
             logger.error('No socket ready to send on')
             return
+        self._sequences[event.name] = self._sequences.get(event.name, 0) + 1
+        event.sequence = self._sequences[event.name]
+        event.send_stamp.GetCurrentTime()
+        # CLOCK_MONOTONIC, as C++ senders and receivers use.
+        event.send_monotonic_stamp.FromNanoseconds(int(time.monotonic() * 1e9))
         buff = event.SerializeToString()
         for service in recipients:
             self._mc_send_sock.sendto(buff, (service.host, service.port))
@@ -232,6 +239,7 @@ class EventBus:
         event = Event()
         event.ParseFromString(data)
         event.recv_stamp.GetCurrentTime()
+        event.recv_monotonic_stamp.FromNanoseconds(int(time.monotonic() * 1e9))
 
         self._state[event.name] = event
 
@@ -2,7 +2,10 @@ import { useState, useEffect } from "react";
 import * as React from "react";
 import { Vector3 } from "three";
 import { Event as BusEvent } from "@farm-ng/genproto-core/farm_ng/core/io";
-import { NamedSE3Pose } from "@farm-ng/genproto-perception/farm_ng/perception/geometry";
+import {
+  NamedSE3Pose,
+  NamedSE3Poses,
+} from "@farm-ng/genproto-perception/farm_ng/perception/geometry";
 import { Html } from "drei";
 import { useFrame } from "react-three-fiber";
 import { decodeAnyEvent } from "../models/decodeAnyEvent";
@@ -74,24 +77,38 @@ export const PoseViz: React.FC = () => {
   const busEventEmitter = busEventStore.transport;
 
   useEffect(() => {
+    const updatePose = (pose: NamedSE3Pose) => {
+      const poseNode = findFrameB(root, pose.frameB);
+      if (poseNode && poseNode.pose.frameA == pose.frameA) {
+        poseNode.pose = pose;
+      } else {
+        const parent = findFrameB(root, pose.frameA);
+        if (!parent) return;
+        parent.children.push({ pose: pose, parent: parent, children: [] });
+      }
+    };
     const handle = busEventEmitter.on(
       "type.googleapis.com/farm_ng.perception.NamedSE3Pose",
       (event: BusEvent) => {
         const pose = decodeAnyEvent(event) as NamedSE3Pose;
 
         if (!pose) return;
-        const poseNode = findFrameB(root, pose.frameB);
-        if (poseNode && poseNode.pose.frameA == pose.frameA) {
-          poseNode.pose = pose;
-        } else {
-          const parent = findFrameB(root, pose.frameA);
-          if (!parent) return;
-          parent.children.push({ pose: pose, parent: parent, children: [] });
-        }
+        updatePose(pose);
+      }
+    );
+    // e.g. the apriltag detector's pose/<camera>/tags, every tag in a frame.
+    const posesHandle = busEventEmitter.on(
+      "type.googleapis.com/farm_ng.perception.NamedSE3Poses",
+      (event: BusEvent) => {
+        const poses = decodeAnyEvent(event) as NamedSE3Poses;
+
+        if (!poses) return;
+        poses.poses.forEach(updatePose);
       }
     );
     return () => {
       handle.unsubscribe();
+      posesHandle.unsubscribe();
     };
   }, [busEventEmitter]);
 
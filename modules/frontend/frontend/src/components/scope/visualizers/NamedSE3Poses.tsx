@@ -0,0 +1,36 @@
+/* eslint-disable no-console */
+import * as React from "react";
+import { SingleElementVisualizerProps } from "../../../registry/visualization";
+import { NamedSE3Poses } from "@farm-ng/genproto-perception/farm_ng/perception/geometry";
+import {
+  StandardMultiElement3D,
+  StandardMultiElement3DOptions,
+  StandardElement3D,
+} from "./StandardMultiElement";
+import { NamedSE3PoseVisualizer } from "./NamedSE3Pose";
+
+const NamedSE3Poses3DElement: React.FC<SingleElementVisualizerProps<
+  NamedSE3Poses
+>> = (props) => {
+  const {
+    value: [timestamp, value],
+  } = props;
+
+  const poses = value.poses.map((pose) => (
+    <NamedSE3PoseVisualizer.Element3D
+      key={`${pose.frameA}:${pose.frameB}`}
+      value={[timestamp, pose]}
+    />
+  ));
+
+  return <group>{poses}</group>;
+};
+
+export const NamedSE3PosesVisualizer = {
+  id: "NamedSE3Poses",
+  types: ["type.googleapis.com/farm_ng.perception.NamedSE3Poses"],
+  options: StandardMultiElement3DOptions,
+  MultiElement: StandardMultiElement3D(NamedSE3Poses3DElement),
+  Element: StandardElement3D(NamedSE3Poses3DElement),
+  Element3D: NamedSE3Poses3DElement,
+};
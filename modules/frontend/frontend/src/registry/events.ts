@@ -6,6 +6,7 @@ import {
 } from "@farm-ng/genproto-perception/farm_ng/perception/apriltag";
 import {
   NamedSE3Pose,
+  NamedSE3Poses,
   SE3Pose,
   Vec2,
 } from "@farm-ng/genproto-perception/farm_ng/perception/geometry";
@@ -171,6 +172,7 @@ export type EventType =
   | MultiViewApriltagRigModel
   | MultiViewCameraRig
   | NamedSE3Pose
+  | NamedSE3Poses
   | ProgramOutput
   | ProgramSupervisorStatus
   | Resource
@@ -257,6 +259,7 @@ export const eventRegistry = inferKeys({
   "type.googleapis.com/farm_ng.perception.JointState": JointState,
   "type.googleapis.com/farm_ng.perception.MultiViewCameraRig": MultiViewCameraRig,
   "type.googleapis.com/farm_ng.perception.NamedSE3Pose": NamedSE3Pose,
+  "type.googleapis.com/farm_ng.perception.NamedSE3Poses": NamedSE3Poses,
   "type.googleapis.com/farm_ng.perception.SE3Pose": SE3Pose,
   "type.googleapis.com/farm_ng.perception.TagConfig": TagConfig,
   "type.googleapis.com/farm_ng.perception.Vec2": Vec2,
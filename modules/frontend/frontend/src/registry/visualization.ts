@@ -7,6 +7,7 @@ import { ResourceArchive } from "../models/ResourceArchive";
 import { ImageVisualizer } from "../components/scope/visualizers/Image";
 import { ApriltagDetectionsVisualizer } from "../components/scope/visualizers/ApriltagDetections";
 import { NamedSE3PoseVisualizer } from "../components/scope/visualizers/NamedSE3Pose";
+import { NamedSE3PosesVisualizer } from "../components/scope/visualizers/NamedSE3Poses";
 import { CalibrateApriltagRigStatusVisualizer } from "../components/scope/visualizers/CalibrateApriltagRigStatus";
 import { CalibrateBaseToCameraStatusVisualizer } from "../components/scope/visualizers/CalibrateBaseToCameraStatus";
 import { BaseToCameraModelVisualizer } from "../components/scope/visualizers/BaseToCameraModel";
@@ -137,6 +138,7 @@ export const visualizerRegistry: { [k: string]: Visualizer } = [
   MultiViewApriltagRigModelVisualizer,
   MultiViewCameraRigVisualizer,
   NamedSE3PoseVisualizer,
+  NamedSE3PosesVisualizer,
   SteeringCommandVisualizer,
   CameraPipelineConfigVisualizer,
   TractorConfigVisualizer,
@@ -0,0 +1,145 @@
+// Load tests the camera pipeline with simulated cameras.
+//
+// # 4 synthetic apriltag cameras at 30fps for 20 seconds
+// camera_pipeline_benchmark --cameras=4 --fps=30 --duration=20
+// # replay a recorded video on 2 cameras, without recording
+// camera_pipeline_benchmark --cameras=2 --source=video_file \
+//     --path=logs/foo/camera.mp4 --mode=none
+//
+// Runs a CameraPipelineClient in process, then reports per camera throughput,
+// drops and post to processed latency.
+
+#include <gflags/gflags.h>
+#include <boost/asio/steady_timer.hpp>
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "farm_ng/core/init.h"
+#include "farm_ng/core/ipc.h"
+
+#include "farm_ng/perception/camera_pipeline.h"
+
+DEFINE_int32(cameras, 2, "Number of simulated cameras.");
+DEFINE_string(source, "synthetic_apriltags",
+              "Frame source: synthetic_apriltags, video_file or event_log.");
+DEFINE_string(path, "",
+              "Video file or event log to replay, relative to the blobstore.");
+DEFINE_double(fps, 30.0, "Frame rate of each camera.");
+DEFINE_int32(width, 1280, "Image width.");
+DEFINE_int32(height, 720, "Image height.");
+DEFINE_double(jitter_ms, 2.0,
+              "Standard deviation of frame stamp jitter, in milliseconds.");
+DEFINE_string(mode, "every_apriltag_frame",
+              "Recording mode: none, every_frame, every_apriltag_frame or "
+              "raw_burst.");
+DEFINE_string(queue_policy, "latest_only",
+              "Per camera queue policy: latest_only, keep_n or block.");
+DEFINE_int32(queue_capacity, 4, "Queue capacity for keep_n and block.");
+DEFINE_double(duration, 10.0, "Seconds to run for.");
+
+using farm_ng::core::EventBus;
+using farm_ng::perception::CameraConfig;
+using farm_ng::perception::CameraPipelineClient;
+using farm_ng::perception::CameraPipelineCommand;
+using farm_ng::perception::CameraPipelineConfig;
+using farm_ng::perception::CameraQueueConfig;
+using farm_ng::perception::CameraQueueStatus;
+using farm_ng::perception::CameraSyncStatus;
+using farm_ng::perception::MultiCameraPipelineStatus;
+using farm_ng::perception::MultiCameraSyncStatus;
+using farm_ng::perception::SimulatedCameraConfig;
+
+namespace {
+
+// e.g. ParseEnumFlag<Policy>("keep_n", "POLICY_", &Policy_Parse)
+template <typename EnumT, typename ParseT>
+EnumT ParseEnumFlag(const std::string& flag, const std::string& prefix,
+                    ParseT parse) {
+  EnumT value;
+  std::string name = prefix + flag;
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  CHECK(parse(name, &value)) << "Unknown value: " << flag;
+  return value;
+}
+
+CameraPipelineConfig MakeConfig() {
+  CameraPipelineConfig config;
+  for (int i = 0; i < FLAGS_cameras; ++i) {
+    CameraConfig* camera = config.add_camera_configs();
+    camera->set_name("simulated/camera_" + std::to_string(i));
+    camera->set_frame_grabber_name("simulated");
+    SimulatedCameraConfig* sim = camera->mutable_simulated();
+    sim->set_source(ParseEnumFlag<SimulatedCameraConfig::Source>(
+        FLAGS_source, "SOURCE_", &SimulatedCameraConfig::Source_Parse));
+    sim->set_path(FLAGS_path);
+    sim->set_frame_rate(FLAGS_fps);
+    sim->set_image_width(FLAGS_width);
+    sim->set_image_height(FLAGS_height);
+    sim->set_stamp_jitter_ms(FLAGS_jitter_ms);
+    sim->set_loop(true);
+    CameraQueueConfig* queue = camera->mutable_queue();
+    queue->set_policy(ParseEnumFlag<CameraQueueConfig::Policy>(
+        FLAGS_queue_policy, "POLICY_", &CameraQueueConfig::Policy_Parse));
+    queue->set_capacity(FLAGS_queue_capacity);
+  }
+  return config;
+}
+
+void Report(const MultiCameraPipelineStatus& pipeline,
+            const MultiCameraSyncStatus& sync, double duration) {
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "sets: " << sync.sets() << " complete: " << sync.complete_sets()
+            << " (" << sync.sets() / duration << " /s)\n";
+  for (const CameraSyncStatus& camera : sync.cameras()) {
+    std::cout << "  " << camera.frame_name() << " rate: " << camera.frame_rate()
+              << " Hz skew: " << camera.skew_ms()
+              << " ms completeness: " << camera.completeness() << "\n";
+  }
+  std::cout << "pipeline:\n";
+  for (const CameraQueueStatus& camera : pipeline.cameras()) {
+    std::cout << "  " << camera.frame_name()
+              << " posted: " << camera.frames_posted()
+              << " processed: " << camera.frames_processed() << " ("
+              << camera.frames_processed() / duration << " fps)"
+              << " dropped: " << camera.frames_dropped()
+              << " latency ms p50: " << camera.latency().p50() * 1e-6
+              << " p99: " << camera.latency().p99() * 1e-6
+              << " max: " << camera.latency().max() * 1e-6 << "\n";
+  }
+}
+
+}  // namespace
+
+void Cleanup(EventBus& bus) {}
+
+int Main(EventBus& bus) {
+  CHECK_GT(FLAGS_cameras, 0);
+  CHECK_GT(FLAGS_duration, 0.0);
+  CameraPipelineClient client(bus, MakeConfig());
+  if (FLAGS_mode != "none") {
+    CameraPipelineCommand command;
+    command.mutable_record_start()->set_mode(
+        ParseEnumFlag<CameraPipelineCommand::RecordStart::Mode>(
+            FLAGS_mode, "MODE_",
+            &CameraPipelineCommand::RecordStart::Mode_Parse));
+    client.on_command(command);
+  }
+
+  boost::asio::steady_timer timer(bus.get_io_service());
+  timer.expires_from_now(
+      std::chrono::microseconds(int64_t(FLAGS_duration * 1e6)));
+  timer.async_wait([&](const boost::system::error_code& error) {
+    Report(client.GetPipelineStatus(), client.GetSyncStatus(),
+           FLAGS_duration);
+    bus.get_io_service().stop();
+  });
+  bus.get_io_service().run();
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  return farm_ng::core::Main(argc, argv, &Main, &Cleanup);
+}
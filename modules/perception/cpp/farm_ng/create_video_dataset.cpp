@@ -32,6 +32,10 @@ DEFINE_bool(detect_apriltags, true, "Detect apriltags.");
 
 DEFINE_int32(skip_frames, 0, "Number of frames to skip between detections.");
 DEFINE_double(detection_scale, 0, "Scale the image before detection.");
+DEFINE_bool(refine_corners, true,
+            "Refine corners at full resolution when detection_scale is set.");
+DEFINE_int32(n_workers, 0,
+             "Frames detected in parallel, defaults to the number of cores.");
 
 
 int Main(farm_ng::core::EventBus& bus) {
@@ -62,6 +66,8 @@ int Main(farm_ng::core::EventBus& bus) {
     if (FLAGS_detection_scale > 0) {
       config.mutable_detection_scale()->set_value(FLAGS_detection_scale);
     }
+    config.set_refine_corners(FLAGS_refine_corners);
+    config.set_n_workers(FLAGS_n_workers);
     if (FLAGS_skip_frames > 0) {
       config.mutable_skip_frames()->set_value(FLAGS_skip_frames);
     }
@@ -4,7 +4,6 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <opencv2/imgproc.hpp>
 
 #include <boost/algorithm/string.hpp>
 
@@ -19,7 +18,7 @@
 #include "farm_ng/perception/capture_video_dataset.pb.h"
 #include "farm_ng/perception/detect_apriltags.pb.h"
 #include "farm_ng/perception/image.pb.h"
-#include "farm_ng/perception/image_loader.h"
+#include "farm_ng/perception/offline_apriltag_detector.h"
 
 DEFINE_bool(interactive, false, "receive program args via eventbus");
 DEFINE_string(name, "default",
@@ -29,6 +28,8 @@ DEFINE_string(video_dataset, "",
 DEFINE_string(tag_config, "",
               "ApriltagConfig json path, relative to blobstore.  If not set, "
               "uses configurations/apriltag.json");
+DEFINE_int32(n_workers, 0,
+             "Frames detected in parallel, defaults to the number of cores.");
 
 typedef farm_ng::core::Event EventPb;
 using farm_ng::core::ArchiveProtobufAsJsonResource;
@@ -84,14 +85,18 @@ class DetectApriltagsProgram {
 
     EventLogReader log_reader(video_dataset.dataset());
 
-    std::map<std::string, std::shared_ptr<perception::ApriltagDetector>>
-        per_camera_detectors;
     std::optional<perception::ApriltagConfig> tag_config;
     if (configuration_.has_tag_config()) {
       tag_config = core::ReadProtobufFromResource<ApriltagConfig>(
           configuration_.tag_config());
     }
-    ImageLoader image_loader;
+    OfflineApriltagDetector detector(
+        tag_config ? &tag_config.value() : nullptr,
+        configuration_.n_workers(),
+        [this](const ApriltagDetections& detections,
+               const google::protobuf::Timestamp& stamp) {
+          on_detections(detections, stamp);
+        });
     while (true) {
       EventPb event;
       try {
@@ -108,8 +113,6 @@ class DetectApriltagsProgram {
       bus_.Send(event);
 
       Image image;
-      ApriltagDetections unfiltered_detections;
-      bool has_detections = false;
       if (event.data().UnpackTo(&image)) {
         if (image.camera_model().distortion_coefficients_size() == 0) {
           for (int i = 0; i < 8; ++i) {
@@ -119,66 +122,11 @@ class DetectApriltagsProgram {
         LOG(INFO) << image.camera_model().frame_name() << " "
                   << image.frame_number().ShortDebugString() << " "
                   << image.resource().ShortDebugString();
-        if (per_camera_detectors.count(image.camera_model().frame_name()) ==
-            0) {
-          const perception::ApriltagConfig* tag_config_ptr = nullptr;
-          if (tag_config.has_value()) {
-            tag_config_ptr = &tag_config.value();
-          }
-          per_camera_detectors.emplace(
-              image.camera_model().frame_name(),
-              std::shared_ptr<perception::ApriltagDetector>(
-                  new perception::ApriltagDetector(image.camera_model(),
-                                                   nullptr, tag_config_ptr)));
-        }
-        cv::Mat image_mat = image_loader.LoadImage(image);
-        cv::Mat gray;
-        if (image_mat.channels() == 3) {
-          cv::cvtColor(image_mat, gray, cv::COLOR_BGR2GRAY);
-        } else {
-          CHECK_EQ(image_mat.channels(), 1);
-          gray = image_mat;
-        }
-        unfiltered_detections =
-            per_camera_detectors[image.camera_model().frame_name()]->Detect(
-                gray, event.stamp());
-        unfiltered_detections.mutable_image()->CopyFrom(image);
-
-        auto tag_event =
-            core::MakeEvent(image.camera_model().frame_name() + "/apriltags",
-                            unfiltered_detections, event.stamp());
-        bus_.Send(tag_event);
-        bool first_frame_for_camera = true;
-        for (auto& entry : *status_.mutable_per_camera_num_frames()) {
-          if (entry.camera_name() == image.camera_model().frame_name()) {
-            entry.set_num_frames(entry.num_frames() + 1);
-            first_frame_for_camera = false;
-          }
-        }
-        if (first_frame_for_camera) {
-          auto per_camera_num_frames = status_.add_per_camera_num_frames();
-          per_camera_num_frames->set_camera_name(
-              image.camera_model().frame_name());
-          per_camera_num_frames->set_num_frames(1);
-        }
-
-        for (auto const& detection : unfiltered_detections.detections()) {
-          bool first_time_seen = true;
-          for (auto& entry : *status_.mutable_per_tag_id_num_frames()) {
-            if (entry.tag_id() == detection.id()) {
-              entry.set_num_frames(entry.num_frames() + 1);
-              first_time_seen = false;
-            }
-          }
-          if (first_time_seen) {
-            auto per_tag_id_num_frames = status_.add_per_tag_id_num_frames();
-            per_tag_id_num_frames->set_tag_id(detection.id());
-            per_tag_id_num_frames->set_num_frames(1);
-          }
-        }
+        detector.Submit(image, event.stamp());
       }
       bus_.get_io_service().poll();
     }
+    detector.Flush();
 
     bus_.get_io_service().poll();
 
@@ -199,6 +147,41 @@ class DetectApriltagsProgram {
     return 0;
   }
 
+  // Called in frame order, as each frame's detections complete.
+  void on_detections(const ApriltagDetections& detections,
+                     const google::protobuf::Timestamp& stamp) {
+    const std::string& camera_name =
+        detections.image().camera_model().frame_name();
+    bus_.Send(core::MakeEvent(camera_name + "/apriltags", detections, stamp));
+    bool first_frame_for_camera = true;
+    for (auto& entry : *status_.mutable_per_camera_num_frames()) {
+      if (entry.camera_name() == camera_name) {
+        entry.set_num_frames(entry.num_frames() + 1);
+        first_frame_for_camera = false;
+      }
+    }
+    if (first_frame_for_camera) {
+      auto per_camera_num_frames = status_.add_per_camera_num_frames();
+      per_camera_num_frames->set_camera_name(camera_name);
+      per_camera_num_frames->set_num_frames(1);
+    }
+
+    for (auto const& detection : detections.detections()) {
+      bool first_time_seen = true;
+      for (auto& entry : *status_.mutable_per_tag_id_num_frames()) {
+        if (entry.tag_id() == detection.id()) {
+          entry.set_num_frames(entry.num_frames() + 1);
+          first_time_seen = false;
+        }
+      }
+      if (first_time_seen) {
+        auto per_tag_id_num_frames = status_.add_per_tag_id_num_frames();
+        per_tag_id_num_frames->set_tag_id(detection.id());
+        per_tag_id_num_frames->set_num_frames(1);
+      }
+    }
+  }
+
   void send_status() {
     LOG(INFO) << status_.ShortDebugString();
     bus_.Send(MakeEvent(bus_.GetName() + "/status", status_));
@@ -263,6 +246,8 @@ int Main(farm_ng::core::EventBus& bus) {
         ContentTypeProtobufJson<farm_ng::perception::ApriltagConfig>());
   }
 
+  config.set_n_workers(FLAGS_n_workers);
+
   farm_ng::perception::DetectApriltagsProgram program(bus, config,
                                                       FLAGS_interactive);
   return program.run();
@@ -1,22 +1,38 @@
 #include "farm_ng/perception/apriltag.h"
 
 #include <apriltag.h>
-#include <apriltag_pose.h>
+#include <common/timeprofile.h>
 #include <glog/logging.h>
 #include <tag36h11.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <sophus/se3.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "farm_ng/core/blobstore.h"
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
+#include "farm_ng/core/thread_pool.h"
+#include "farm_ng/core/trace.h"
 #include "farm_ng/perception/camera_model.h"
 #include "farm_ng/perception/sophus_protobuf.h"
 
 using farm_ng::core::Bucket;
 using farm_ng::core::EventBus;
 using farm_ng::core::GetBucketAbsolutePath;
+using farm_ng::core::GetMetricsRegistry;
 using farm_ng::core::MakeEvent;
 using farm_ng::core::ReadProtobufFromJsonFile;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::ThreadPool;
+using farm_ng::core::TraceSpan;
 
 namespace farm_ng {
 namespace perception {
@@ -88,7 +104,7 @@ void AddApriltagRigToApriltagConfig(const ApriltagRig& rig,
 // @see        static void apriltag_manager::undistort(...)
 //
 namespace {
-bool ComputeHomography(const double c[4][4], matd_t* H) {
+bool ComputeHomography(const double c[4][4], double H[9]) {
   double A[] = {
       c[0][0],
       c[0][1],
@@ -210,92 +226,98 @@ bool ComputeHomography(const double c[4][4], matd_t* H) {
     }
     A[col * 9 + 8] = (A[col * 9 + 8] - sum) / A[col * 9 + col];
   }
-  H->data[0] = A[8];
-  H->data[1] = A[17];
-  H->data[2] = A[26];
-  H->data[3] = A[35];
-  H->data[4] = A[44];
-  H->data[5] = A[53];
-  H->data[6] = A[62];
-  H->data[7] = A[71];
-  H->data[8] = 1;
+  H[0] = A[8];
+  H[1] = A[17];
+  H[2] = A[26];
+  H[3] = A[35];
+  H[4] = A[44];
+  H[5] = A[53];
+  H[6] = A[62];
+  H[7] = A[71];
+  H[8] = 1;
   return true;
 }
 
-void deproject(double* pt_out, const CameraModel& camera_model,
-               const double px[2]) {
-  // taken from:
-  // github.com/IntelRealSense/librealsense/blob/d8f5d4212df85522a14b4a7b83bf4d54219b06fa/examples/pose-apriltag/rs-pose-apriltag.cpp#L166
-  Eigen::Map<Eigen::Vector2d> pt(pt_out);
-  pt = ReprojectPixelToPoint(camera_model, Eigen::Vector2d(px[0], px[1]), 1.0)
-           .head<2>();
+}  // namespace
+
+// This is the library's estimate_pose_for_tag_homography, for fx = fy = 1 and
+// cx = cy = 0, without its matd_t allocations.
+Sophus::SE3d TagPoseFromHomography(const double H[9], double tag_size) {
+  // homography_to_pose is passed -fx.
+  Eigen::Vector3d r0(-H[0], H[3], H[6]);
+  Eigen::Vector3d r1(-H[1], H[4], H[7]);
+  Eigen::Vector3d t(-H[2], H[5], H[8]);
+  // Scale the rotation columns to unit length, and put the tag in front of
+  // the library's camera, which looks down -Z.
+  double s = 1.0 / std::sqrt(r0.norm() * r1.norm());
+  if (t.z() > 0) {
+    s = -s;
+  }
+  Eigen::Matrix3d R;
+  R.col(0) = s * r0;
+  R.col(1) = s * r1;
+  R.col(2) = R.col(0).cross(R.col(1));
+  // Polar decomposition, for the nearest rotation.
+  Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+      R, Eigen::ComputeFullU | Eigen::ComputeFullV);
+  R = svd.matrixU() * svd.matrixV().transpose();
+  t *= s * tag_size / 2.0;
+  // From the library's camera frame to ours, looking down +Z.
+  const Eigen::Matrix3d fix = Eigen::Vector3d(1, -1, -1).asDiagonal();
+  return Sophus::SE3d(fix * R, fix * t);
 }
 
-bool undistort(apriltag_detection_t& src, const CameraModel& camera_model) {
-  // Taken from:
-  // github.com/IntelRealSense/librealsense/blob/d8f5d4212df85522a14b4a7b83bf4d54219b06fa/examples/pose-apriltag/rs-pose-apriltag.cpp#L149
-  deproject(src.c, camera_model, src.c);
+namespace {
 
-  double corr_arr[4][4];
-  for (int c = 0; c < 4; ++c) {
-    deproject(src.p[c], camera_model, src.p[c]);
+// Scratch memory for EstimateCameraPoseTags, reused across frames.
+struct TagPoseBatch {
+  std::vector<apriltag_detection_t*> detections;
+  std::vector<double> tag_sizes;
+  std::vector<std::optional<Sophus::SE3d>> poses;
 
-    corr_arr[c][0] =
-        (c == 0 || c == 3) ? -1 : 1;  // tag corners in an ideal image
-    corr_arr[c][1] =
-        (c == 0 || c == 1) ? -1 : 1;  // tag corners in an ideal image
-    corr_arr[c][2] =
-        src.p[c][0];  // tag corners in undistorted image focal length = 1
-    corr_arr[c][3] =
-        src.p[c][1];  // tag corners in undistorted image focal length = 1
-  }
-  if (src.H == nullptr) {
-    src.H = matd_create(3, 3);
+  void clear() {
+    detections.clear();
+    tag_sizes.clear();
+    poses.clear();
   }
-  return ComputeHomography(corr_arr, src.H);
-}
-
-void apriltag_pose_destroy(apriltag_pose_t* p) {
-  matd_destroy(p->R);
-  matd_destroy(p->t);
-  delete p;
-}
+};
 
-Sophus::SE3d ApriltagPoseToSE3d(const apriltag_pose_t& pose) {
-  typedef Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>
-      Map33RowMajor;
-  return Sophus::SE3d(
-      Map33RowMajor(pose.R->data),
-      Eigen::Vector3d(pose.t->data[0], pose.t->data[1], pose.t->data[2]));
+// Estimates the camera pose of each tag in the batch, by undistorting its
+// corners to unit focal length and decomposing the homography of the ideal
+// tag onto them.
+// https://github.com/IntelRealSense/librealsense/blob/master/examples/pose-apriltag/rs-pose-apriltag.cpp
+template <class Camera>
+void EstimateCameraPoseTags(const Camera& camera, TagPoseBatch* batch) {
+  batch->poses.resize(batch->detections.size());
+  for (size_t i = 0; i < batch->detections.size(); ++i) {
+    const apriltag_detection_t* det = batch->detections[i];
+    // Corners on the ideal tag, then on the undistorted image.
+    double corr_arr[4][4];
+    for (int c = 0; c < 4; ++c) {
+      Eigen::Vector2d pt =
+          ReprojectPixelToPoint(
+              camera, Eigen::Vector2d(det->p[c][0], det->p[c][1]), 1.0)
+              .head<2>();
+      corr_arr[c][0] = (c == 0 || c == 3) ? -1 : 1;
+      corr_arr[c][1] = (c == 0 || c == 1) ? -1 : 1;
+      corr_arr[c][2] = pt.x();
+      corr_arr[c][3] = pt.y();
+    }
+    double H[9];
+    if (!ComputeHomography(corr_arr, H)) {
+      LOG(WARNING) << "Tag with id: " << det->id << " can not compute pose.";
+      batch->poses[i] = std::nullopt;
+      continue;
+    }
+    batch->poses[i] = TagPoseFromHomography(H, batch->tag_sizes[i]);
+  }
 }
 
-// https://github.com/IntelRealSense/librealsense/blob/master/examples/pose-apriltag/rs-pose-apriltag.cpp
-// Note this function mutates detection, by undistorting the points and
-// populating the homography
-std::optional<Sophus::SE3d> EstimateCameraPoseTag(
-    const CameraModel& camera_model, const TagLibrary& tag_library,
-    apriltag_detection_t* detection) {
-  auto tag_size = TagSize(tag_library, detection->id);
-  if (!tag_size) {
-    return std::nullopt;
-  }
-  apriltag_detection_info_t info;
-  info.fx = info.fy = 1;  // undistorted image with focal length = 1
-  info.cx = info.cy = 0;  // undistorted image with principal point at (0,0)
-  info.det = detection;
-  info.tagsize = *tag_size;
-
-  // recompute tag corners on an undistorted image focal
-  // length = 1 this also populates the homography
-  if (!undistort(*info.det, camera_model)) {
-    LOG(WARNING) << "Tag with id: " << info.det->id << " can not compute pose.";
-    return std::nullopt;
-  }
-  auto pose = std::shared_ptr<apriltag_pose_t>(new apriltag_pose_t(),
-                                               apriltag_pose_destroy);
-  // estimate tag pose in camera coordinate
-  estimate_pose_for_tag_homography(&info, pose.get());
-  return ApriltagPoseToSE3d(*pose);
+void EstimateCameraPoseTags(const CameraModel& camera_model,
+                            TagPoseBatch* batch) {
+  VisitPinholeCamera(camera_model, [batch](const auto& camera) {
+    EstimateCameraPoseTags(camera, batch);
+  });
 }
 
 }  // namespace
@@ -303,38 +325,42 @@ class ApriltagDetector::Impl {
  public:
   Impl(const CameraModel& camera_model, EventBus* event_bus,
        const ApriltagConfig* config)
-      : event_bus_(event_bus), camera_model_(camera_model) {
+      : event_bus_(event_bus),
+        camera_model_(camera_model),
+        detect_latency_(GetMetricsRegistry().GetHistogram(
+            "apriltag/detect/" + camera_model.frame_name())),
+        detection_count_(GetMetricsRegistry().GetCounter(
+            "apriltag/detections/" + camera_model.frame_name())),
+        full_frames_(GetMetricsRegistry().GetCounter(
+            "apriltag/full_frames/" + camera_model.frame_name())),
+        tracked_frames_(GetMetricsRegistry().GetCounter(
+            "apriltag/tracked_frames/" + camera_model.frame_name())) {
     if (config != nullptr) {
       apriltag_config_ = *config;
     }
     tag_family_ = std::shared_ptr<apriltag_family_t>(tag36h11_create(),
                                                      &tag36h11_destroy);
-
-    tag_detector_ = std::shared_ptr<apriltag_detector_t>(
-        apriltag_detector_create(), &apriltag_detector_destroy);
-
-    apriltag_detector_add_family(tag_detector_.get(), tag_family_.get());
-    tag_detector_->quad_decimate = 1.0;
-    tag_detector_->quad_sigma = 0.8;
-    tag_detector_->nthreads = 1;
-    tag_detector_->debug = false;
-    tag_detector_->refine_edges = true;
   }
 
+  ~Impl() { StopPool(); }
+
   ApriltagDetections Detect(const cv::Mat& gray,
                             const google::protobuf::Timestamp& stamp, double scale) {
+    TraceSpan span("apriltag/detect", stamp);
     if (!apriltag_config_) {
       LoadApriltagConfig();
     }
     CHECK(apriltag_config_.has_value());
+    Configure(apriltag_config_->detector());
 
     CHECK_EQ(gray.channels(), 1);
     CHECK_EQ(gray.type(), CV_8UC1);
 
     auto start = std::chrono::high_resolution_clock::now();
     const int border = 10;
-  cv::Mat image;
+    cv::Mat image;
     if(scale > 0.0 && scale != 1.0) {
+      ScopedLatency latency(StageLatency("resize"));
       int interp = cv::INTER_AREA;
       if(scale > 1.0) {
         interp = cv::INTER_LINEAR;
@@ -344,31 +370,30 @@ class ApriltagDetector::Impl {
       image = gray;
     }
 
-    // Make an image_u8_t header for the Mat data
-    image_u8_t im = {.width = image.cols,
-                     .height = image.rows,
-                     .stride = image.cols,
-                     .buf = image.data};
-
-    std::shared_ptr<zarray_t> detections(
-        apriltag_detector_detect(tag_detector_.get(), &im),
-        apriltag_detections_destroy);
+    std::vector<apriltag_detection_t*> merged = Search(image);
 
     // copy detections into protobuf
     ApriltagDetections pb_out;
     pb_out.mutable_image()->mutable_camera_model()->CopyFrom(camera_model_);
 
-    for (int i = 0; i < zarray_size(detections.get()); i++) {
-      apriltag_detection_t* det;
-      zarray_get(detections.get(), i, &det);
-      if(scale > 0.0 && scale != 1.0) {
+    if(scale > 0.0 && scale != 1.0) {
+      for (apriltag_detection_t* det : merged) {
         det->c[0] /= scale;
         det->c[1] /= scale;
-      for (int j = 0; j < 4; j++) {
+        for (int j = 0; j < 4; j++) {
           det->p[j][0] /= scale;
           det->p[j][1] /= scale;
         }
       }
+      if (detector_config_.refine_corners()) {
+        ScopedLatency latency(StageLatency("refine"));
+        for (apriltag_detection_t* det : merged) {
+          RefineCorners(gray, scale, det);
+        }
+      }
+    }
+
+    for (apriltag_detection_t* det : merged) {
       auto tag_size = TagSize(apriltag_config_.value().tag_library(), det->id);
       if (!tag_size) {
         continue;
@@ -378,7 +403,7 @@ class ApriltagDetector::Impl {
       for (int j = 0; j < 4; j++) {
         auto x = det->p[j][0];
         auto y = det->p[j][1];
-        if(x < border  || y < border || x > image.cols - border || y > image.rows - border) {
+        if(x < border  || y < border || x > gray.cols - border || y > gray.rows - border) {
           close_to_image_edge = true;
           break;
         }
@@ -401,23 +426,38 @@ class ApriltagDetector::Impl {
       detection->set_id(det->id);
       detection->set_hamming(static_cast<uint8_t>(det->hamming));
       detection->set_decision_margin(det->decision_margin);
-      // estimation comes last because this mutates det
-      auto pose = EstimateCameraPoseTag(
-          camera_model_, apriltag_config_.value().tag_library(), det);
-      if (pose) {
-        auto* named_pose = detection->mutable_pose();
-        SophusToProto(*pose, named_pose->mutable_a_pose_b());
-        named_pose->mutable_a_pose_b()->mutable_stamp()->CopyFrom(stamp);
-        named_pose->set_frame_a(camera_model_.frame_name());
-        named_pose->set_frame_b("tag/" + std::to_string(det->id));
-        if (event_bus_) {
-          event_bus_->Send(MakeEvent("pose/" + camera_model_.frame_name() +
-                                         "/tag/" + std::to_string(det->id),
-                                     *named_pose, stamp));
-        }
+      pose_batch_.detections.push_back(det);
+      pose_batch_.tag_sizes.push_back(*tag_size);
+    }
+
+    {
+      ScopedLatency pose_latency(StageLatency("pose"));
+      EstimateCameraPoseTags(camera_model_, &pose_batch_);
+    }
+    NamedSE3Poses poses;
+    for (size_t i = 0; i < pose_batch_.poses.size(); ++i) {
+      if (!pose_batch_.poses[i]) {
+        continue;
       }
+      auto* named_pose = pb_out.mutable_detections(i)->mutable_pose();
+      SophusToProto(*pose_batch_.poses[i], named_pose->mutable_a_pose_b());
+      named_pose->mutable_a_pose_b()->mutable_stamp()->CopyFrom(stamp);
+      named_pose->set_frame_a(camera_model_.frame_name());
+      named_pose->set_frame_b("tag/" +
+                              std::to_string(pose_batch_.detections[i]->id));
+      if (event_bus_) {
+        poses.add_poses()->CopyFrom(*named_pose);
+      }
+    }
+    pose_batch_.clear();
+    if (event_bus_ && poses.poses_size() > 0) {
+      event_bus_->AsyncSend(MakeEvent(
+          "pose/" + camera_model_.frame_name() + "/tags", poses, stamp));
     }
+    regions_.clear();
     auto stop = std::chrono::high_resolution_clock::now();
+    detect_latency_.Record(stop - start);
+    detection_count_.Increment(pb_out.detections_size());
     auto duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     LOG_EVERY_N(INFO, 100) << "april tag detection took: " << duration.count()
@@ -431,13 +471,430 @@ class ApriltagDetector::Impl {
               << apriltag_config_.value().ShortDebugString();
   }
 
+  // A region of the frame to search, and what was found in it.
+  struct Region {
+    cv::Rect roi;
+    // Detections centered here are preferred over those from other regions.
+    cv::Rect core;
+    // Detections from the last frame, in frame coordinates.
+    std::shared_ptr<zarray_t> detections;
+  };
+
+  // Predicted from the last two detections of a tag, in the coordinates of
+  // the image passed to the library.
+  struct Track {
+    cv::Rect2d box;
+    cv::Point2d velocity;
+  };
+
+  // Sets up the library detectors and thread pool, if the config changed.
+  void Configure(const ApriltagDetectorConfig& config) {
+    if (!detectors_.empty() &&
+        google::protobuf::util::MessageDifferencer::Equals(config,
+                                                           detector_config_)) {
+      return;
+    }
+    detector_config_ = config;
+    LOG(INFO) << camera_model_.frame_name()
+              << " apriltag detector: " << config.ShortDebugString();
+    const int n_threads =
+        config.n_threads() > 0
+            ? config.n_threads()
+            : std::max(1u, std::thread::hardware_concurrency());
+    // Regions are searched in parallel, one library detector per thread.
+    int n_detectors = 1;
+    if (config.engine() == ApriltagDetectorConfig::ENGINE_TILES) {
+      n_detectors = std::min(n_threads, TileRows() * TileCols());
+    }
+    detectors_.clear();
+    for (int i = 0; i < n_detectors; ++i) {
+      auto detector = std::shared_ptr<apriltag_detector_t>(
+          apriltag_detector_create(), &apriltag_detector_destroy);
+      apriltag_detector_t* td = detector.get();
+      apriltag_detector_add_family(td, tag_family_.get());
+      td->quad_decimate =
+          config.quad_decimate() > 0 ? config.quad_decimate() : 1.0;
+      td->quad_sigma =
+          config.has_quad_sigma() ? config.quad_sigma().value() : 0.8;
+      td->nthreads =
+          config.engine() == ApriltagDetectorConfig::ENGINE_LIBRARY_THREADS
+              ? n_threads
+              : 1;
+      td->debug = false;
+      td->refine_edges = true;
+      detectors_.push_back(detector);
+    }
+    StopPool();
+    if (n_detectors > 1) {
+      // The calling thread uses the first detector.
+      pool_ = std::make_unique<ThreadPool>("apriltag");
+      pool_work_ = std::make_unique<boost::asio::io_service::work>(
+          pool_->get_io_service());
+      pool_->Start(n_detectors - 1);
+    }
+    tracks_.clear();
+  }
+
+  void StopPool() {
+    if (pool_) {
+      pool_work_.reset();
+      pool_->Stop();
+      pool_->Join();
+      pool_.reset();
+    }
+  }
+
+  int TileRows() const {
+    return detector_config_.tile_rows() > 0 ? detector_config_.tile_rows() : 2;
+  }
+  int TileCols() const {
+    return detector_config_.tile_cols() > 0 ? detector_config_.tile_cols() : 2;
+  }
+
+  // The whole frame, or with ENGINE_TILES a grid of tiles. Each tile's core
+  // is its share of the frame, and it is searched with tile_overlap pixels
+  // of margin.
+  std::vector<Region> FullFrameRegions(cv::Size size) const {
+    const cv::Rect frame(cv::Point(0, 0), size);
+    if (detector_config_.engine() != ApriltagDetectorConfig::ENGINE_TILES) {
+      return {{frame, frame}};
+    }
+    const int overlap = detector_config_.tile_overlap() > 0
+                            ? detector_config_.tile_overlap()
+                            : 128;
+    std::vector<Region> regions;
+    for (int row = 0; row < TileRows(); ++row) {
+      for (int col = 0; col < TileCols(); ++col) {
+        int x0 = col * size.width / TileCols();
+        int x1 = (col + 1) * size.width / TileCols();
+        int y0 = row * size.height / TileRows();
+        int y1 = (row + 1) * size.height / TileRows();
+        cv::Rect core(x0, y0, x1 - x0, y1 - y0);
+        cv::Rect roi(core.x - overlap, core.y - overlap,
+                     core.width + 2 * overlap, core.height + 2 * overlap);
+        regions.push_back({roi & frame, core});
+      }
+    }
+    return regions;
+  }
+
+  // Padded regions around where each tracked tag is predicted to be, with
+  // overlapping regions combined.
+  std::vector<Region> TrackedRegions(cv::Size size) const {
+    const cv::Rect frame(cv::Point(0, 0), size);
+    const double padding = detector_config_.roi_padding() > 0
+                               ? detector_config_.roi_padding()
+                               : 64;
+    std::vector<cv::Rect> rois;
+    for (const auto& id_track : tracks_) {
+      const Track& track = id_track.second;
+      cv::Rect2d box = track.box + track.velocity;
+      double pad = padding + std::hypot(track.velocity.x, track.velocity.y);
+      rois.push_back(cv::Rect(cv::Rect2d(box.x - pad, box.y - pad,
+                                         box.width + 2 * pad,
+                                         box.height + 2 * pad)) &
+                     frame);
+    }
+    bool combined = true;
+    while (combined) {
+      combined = false;
+      for (size_t i = 0; i < rois.size() && !combined; ++i) {
+        for (size_t j = i + 1; j < rois.size(); ++j) {
+          if ((rois[i] & rois[j]).area() > 0) {
+            rois[i] |= rois[j];
+            rois.erase(rois.begin() + j);
+            combined = true;
+            break;
+          }
+        }
+      }
+    }
+    std::vector<Region> regions;
+    for (const cv::Rect& roi : rois) {
+      if (!roi.empty()) {
+        regions.push_back({roi, roi});
+      }
+    }
+    return regions;
+  }
+
+  void DetectRegion(apriltag_detector_t* detector, const cv::Mat& image,
+                    Region* region) {
+    const cv::Rect& roi = region->roi;
+    // Make an image_u8_t header for the Mat data
+    image_u8_t im = {.width = roi.width,
+                     .height = roi.height,
+                     .stride = int(image.step[0]),
+                     .buf = const_cast<uint8_t*>(image.ptr(roi.y) + roi.x)};
+    region->detections = std::shared_ptr<zarray_t>(
+        apriltag_detector_detect(detector, &im), apriltag_detections_destroy);
+    for (int k = 0; k < zarray_size(region->detections.get()); k++) {
+      apriltag_detection_t* det;
+      zarray_get(region->detections.get(), k, &det);
+      det->c[0] += roi.x;
+      det->c[1] += roi.y;
+      for (int j = 0; j < 4; j++) {
+        det->p[j][0] += roi.x;
+        det->p[j][1] += roi.y;
+      }
+    }
+    RecordStages(detector->tp);
+  }
+
+  void DetectRegions(const cv::Mat& image, std::vector<Region>* regions) {
+    // Each worker takes regions until none are left, with its own detector.
+    std::atomic<size_t> next_region(0);
+    auto work = [&](apriltag_detector_t* detector) {
+      size_t i;
+      while ((i = next_region++) < regions->size()) {
+        DetectRegion(detector, image, &(*regions)[i]);
+      }
+    };
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t n_workers = 0;
+    for (size_t k = 1; k < detectors_.size() && k < regions->size(); ++k) {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        n_workers++;
+      }
+      apriltag_detector_t* detector = detectors_[k].get();
+      pool_->get_io_service().post([&, detector]() {
+        work(detector);
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--n_workers == 0) {
+          cv.notify_one();
+        }
+      });
+    }
+    work(detectors_[0].get());
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return n_workers == 0; });
+  }
+
+  // Tags seen in more than one region are kept once, preferring the region
+  // whose core holds the tag's center, then the better decode.
+  std::vector<apriltag_detection_t*> MergeRegions(
+      const std::vector<Region>& regions) {
+    struct Candidate {
+      apriltag_detection_t* det;
+      bool owned;
+    };
+    std::vector<Candidate> candidates;
+    for (const Region& region : regions) {
+      zarray_t* detections = region.detections.get();
+      for (int k = 0; k < zarray_size(detections); k++) {
+        apriltag_detection_t* det;
+        zarray_get(detections, k, &det);
+        candidates.push_back(
+            {det, region.core.contains(cv::Point(det->c[0], det->c[1]))});
+      }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const Candidate& a, const Candidate& b) {
+                       if (a.owned != b.owned) {
+                         return a.owned;
+                       }
+                       return a.det->decision_margin > b.det->decision_margin;
+                     });
+    std::vector<apriltag_detection_t*> merged;
+    for (const Candidate& candidate : candidates) {
+      apriltag_detection_t* det = candidate.det;
+      // Within a region the library reports each tag once.
+      bool duplicate = std::any_of(
+          merged.begin(), merged.end(), [&](const apriltag_detection_t* m) {
+            return m->id == det->id &&
+                   std::hypot(m->c[0] - det->c[0], m->c[1] - det->c[1]) <
+                       std::max(TagExtent(m), TagExtent(det));
+          });
+      if (!duplicate) {
+        merged.push_back(det);
+      }
+    }
+    return merged;
+  }
+
+  static cv::Rect2d TagBox(const apriltag_detection_t* det) {
+    double x0 = det->p[0][0], x1 = x0, y0 = det->p[0][1], y1 = y0;
+    for (int j = 1; j < 4; j++) {
+      x0 = std::min(x0, det->p[j][0]);
+      x1 = std::max(x1, det->p[j][0]);
+      y0 = std::min(y0, det->p[j][1]);
+      y1 = std::max(y1, det->p[j][1]);
+    }
+    return cv::Rect2d(x0, y0, x1 - x0, y1 - y0);
+  }
+
+  static double TagExtent(const apriltag_detection_t* det) {
+    cv::Rect2d box = TagBox(det);
+    return std::max(box.width, box.height);
+  }
+
+  // Searches the tracked regions when tracking, else or if any tracked tag
+  // was lost, the full frame. Returns the merged detections, which the
+  // regions own.
+  std::vector<apriltag_detection_t*> Search(const cv::Mat& image) {
+    const bool tracking = detector_config_.tracking();
+    const int full_frame_interval =
+        detector_config_.full_frame_interval() > 0
+            ? detector_config_.full_frame_interval()
+            : 15;
+    std::vector<apriltag_detection_t*> merged;
+    if (tracking && !tracks_.empty() &&
+        frames_since_full_frame_ < full_frame_interval &&
+        image.size() == tracked_size_) {
+      regions_ = TrackedRegions(image.size());
+      DetectRegions(image, &regions_);
+      {
+        ScopedLatency latency(StageLatency("merge"));
+        merged = MergeRegions(regions_);
+      }
+      bool lost = std::any_of(
+          tracks_.begin(), tracks_.end(), [&](const auto& id_track) {
+            return std::none_of(
+                merged.begin(), merged.end(),
+                [&](const apriltag_detection_t* det) {
+                  return det->id == id_track.first;
+                });
+          });
+      if (lost) {
+        merged.clear();
+      } else {
+        frames_since_full_frame_++;
+        tracked_frames_.Increment();
+      }
+    }
+    if (merged.empty()) {
+      regions_ = FullFrameRegions(image.size());
+      DetectRegions(image, &regions_);
+      {
+        ScopedLatency latency(StageLatency("merge"));
+        merged = MergeRegions(regions_);
+      }
+      frames_since_full_frame_ = 0;
+      full_frames_.Increment();
+    }
+    if (tracking) {
+      UpdateTracks(merged, image.size());
+    }
+    return merged;
+  }
+
+  void UpdateTracks(const std::vector<apriltag_detection_t*>& detections,
+                    cv::Size size) {
+    std::map<int, Track> tracks;
+    for (const apriltag_detection_t* det : detections) {
+      Track track{TagBox(det), cv::Point2d(0, 0)};
+      auto it = tracks_.find(det->id);
+      if (it != tracks_.end()) {
+        track.velocity = (track.box.tl() + track.box.br()) * 0.5 -
+                         (it->second.box.tl() + it->second.box.br()) * 0.5;
+      }
+      tracks[det->id] = track;
+    }
+    tracks_ = std::move(tracks);
+    tracked_size_ = size;
+  }
+
+  // Refines the corners of a tag found on an image scaled by scale, against
+  // the full resolution gray image, and recenters it on its diagonals.
+  void RefineCorners(const cv::Mat& gray, double scale,
+                     apriltag_detection_t* det) {
+    // The scaled corners are off by up to about a scaled pixel. Keep the
+    // window inside the tag's black border, which is an eighth of its side.
+    int half = detector_config_.refine_window();
+    if (half <= 0) {
+      half = std::ceil(2.0 / scale);
+    }
+    half = std::min(half, int(TagExtent(det) / 16));
+    if (half < 2) {
+      return;
+    }
+    std::vector<cv::Point2f> corners;
+    for (int j = 0; j < 4; j++) {
+      corners.emplace_back(det->p[j][0], det->p[j][1]);
+    }
+    cv::cornerSubPix(
+        gray, corners, cv::Size(half, half), cv::Size(-1, -1),
+        cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20,
+                         0.01));
+    for (int j = 0; j < 4; j++) {
+      // Corners that wandered out of the window didn't converge on the tag.
+      if (std::abs(corners[j].x - det->p[j][0]) > half ||
+          std::abs(corners[j].y - det->p[j][1]) > half) {
+        continue;
+      }
+      det->p[j][0] = corners[j].x;
+      det->p[j][1] = corners[j].y;
+    }
+    cv::Point2d a(det->p[0][0], det->p[0][1]);
+    cv::Point2d b(det->p[1][0], det->p[1][1]);
+    cv::Point2d c(det->p[2][0], det->p[2][1]);
+    cv::Point2d d(det->p[3][0], det->p[3][1]);
+    cv::Point2d ac = c - a;
+    cv::Point2d bd = d - b;
+    double denom = ac.cross(bd);
+    if (std::abs(denom) > 1e-9) {
+      cv::Point2d center = a + ac * ((b - a).cross(bd) / denom);
+      det->c[0] = center.x;
+      det->c[1] = center.y;
+    }
+  }
+
+  farm_ng::core::Histogram& StageLatency(const std::string& stage) {
+    std::lock_guard<std::mutex> lock(stage_mtx_);
+    auto it = stage_latency_.find(stage);
+    if (it == stage_latency_.end()) {
+      std::string name = stage;
+      std::replace_if(
+          name.begin(), name.end(),
+          [](char c) { return !std::isalnum(static_cast<unsigned char>(c)); },
+          '_');
+      it = stage_latency_
+               .emplace(stage, &GetMetricsRegistry().GetHistogram(
+                                   "apriltag/stage/" + name + "/" +
+                                   camera_model_.frame_name()))
+               .first;
+    }
+    return *it->second;
+  }
+
+  // The library time stamps each of its stages, e.g. "threshold", "quads".
+  void RecordStages(const timeprofile_t* tp) {
+    int64_t last_utime = tp->utime;
+    for (int i = 0; i < zarray_size(tp->stamps); i++) {
+      struct timeprofile_entry* stamp;
+      zarray_get_volatile(tp->stamps, i, &stamp);
+      StageLatency(stamp->name)
+          .Record(std::chrono::microseconds(stamp->utime - last_utime));
+      last_utime = stamp->utime;
+    }
+  }
+
   EventBus* event_bus_;
   CameraModel camera_model_;
+  farm_ng::core::Histogram& detect_latency_;
+  farm_ng::core::Counter& detection_count_;
 
   std::optional<ApriltagConfig> apriltag_config_;
+  ApriltagDetectorConfig detector_config_;
 
   std::shared_ptr<apriltag_family_t> tag_family_;
-  std::shared_ptr<apriltag_detector_t> tag_detector_;
+  std::vector<std::shared_ptr<apriltag_detector_t>> detectors_;
+  std::vector<Region> regions_;
+  TagPoseBatch pose_batch_;
+  std::unique_ptr<ThreadPool> pool_;
+  std::unique_ptr<boost::asio::io_service::work> pool_work_;
+
+  std::mutex stage_mtx_;
+  std::map<std::string, farm_ng::core::Histogram*> stage_latency_;
+
+  // Tracking, by tag id.
+  std::map<int, Track> tracks_;
+  cv::Size tracked_size_;
+  int frames_since_full_frame_ = 0;
+  farm_ng::core::Counter& full_frames_;
+  farm_ng::core::Counter& tracked_frames_;
 };
 
 ApriltagDetector::ApriltagDetector(const CameraModel& camera_model,
@@ -542,7 +999,7 @@ bool ApriltagsFilter::AddApriltags(const ApriltagDetections& detections,
   }
   history_ = new_history;
 
-  LOG(INFO) << mean_count / n_counts << " n_counts " << n_counts;
+  VLOG(1) << mean_count / n_counts << " n_counts " << n_counts;
 
   mean_count /= n_counts;
   if (mean_count > steady_count && !once_) {
@@ -578,7 +1035,7 @@ bool ApriltagsFilterNovel::AddApriltags(const ApriltagDetections& detections,
 
   history_ = new_history;
   mean_distance = mean_distance / n_tags;
-  LOG(INFO) << "mean_distance: " << mean_distance << " n_tags: " << n_tags;
+  VLOG(1) << "mean_distance: " << mean_distance << " n_tags: " << n_tags;
   bool add_tag = mean_distance > window_size;
   if(add_tag) { Reset();}
   return add_tag;
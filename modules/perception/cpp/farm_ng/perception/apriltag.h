@@ -2,11 +2,12 @@
 #define FARM_NG_CALIBRATION_APRILTAG_H_
 #include <array>
 #include <map>
+#include <optional>
 
 #include <glog/logging.h>
 #include <Eigen/Dense>
 #include <opencv2/core.hpp>
-
+#include <sophus/se3.hpp>
 
 #include "farm_ng/perception/apriltag.pb.h"
 #include "farm_ng/perception/camera_model.pb.h"
@@ -24,6 +25,11 @@ std::array<Eigen::Vector3d, 4> PointsTag(const ApriltagRig::Node& node);
 
 std::array<Eigen::Vector2d, 4> PointsImage(const ApriltagDetection& detection);
 
+// The camera pose of a tag of the given size, from the homography H (row
+// major, H[8] = 1) of the ideal tag's corners, at +/-1, onto its corners
+// undistorted to unit focal length.
+Sophus::SE3d TagPoseFromHomography(const double H[9], double tag_size);
+
 std::optional<double> TagSize(const TagLibrary& tag_library, int tag_id);
 
 // Adds the tag id and sizes contained in ApriltagRig to the ApriltagConfig.
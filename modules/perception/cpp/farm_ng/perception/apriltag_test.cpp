@@ -1,4 +1,82 @@
 #include "farm_ng/perception/apriltag.h"
+
+#include <apriltag.h>
+#include <apriltag_pose.h>
+
+#include <vector>
+
 #include "gtest/gtest.h"
 
-TEST(apriltag, smoke) {}
+using farm_ng::perception::TagPoseFromHomography;
+
+namespace {
+
+typedef Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> Map33RowMajor;
+
+// The homography of the ideal tag's corners onto the undistorted image at unit
+// focal length, for a tag of the given size at camera_pose_tag.
+Eigen::Matrix<double, 3, 3, Eigen::RowMajor> TagHomography(
+    const Sophus::SE3d& camera_pose_tag, double tag_size) {
+  const Eigen::Matrix3d R = camera_pose_tag.rotationMatrix();
+  Eigen::Matrix<double, 3, 3, Eigen::RowMajor> H;
+  H.col(0) = R.col(0) * tag_size / 2.0;
+  H.col(1) = R.col(1) * tag_size / 2.0;
+  H.col(2) = camera_pose_tag.translation();
+  return H / H(2, 2);
+}
+
+Sophus::SE3d LibraryTagPose(Eigen::Matrix<double, 3, 3, Eigen::RowMajor> H,
+                            double tag_size) {
+  apriltag_detection_t detection = {};
+  detection.H = matd_create_data(3, 3, H.data());
+  apriltag_detection_info_t info;
+  info.det = &detection;
+  info.tagsize = tag_size;
+  info.fx = info.fy = 1;
+  info.cx = info.cy = 0;
+  apriltag_pose_t pose;
+  estimate_pose_for_tag_homography(&info, &pose);
+  Sophus::SE3d camera_pose_tag(
+      Map33RowMajor(pose.R->data),
+      Eigen::Vector3d(pose.t->data[0], pose.t->data[1], pose.t->data[2]));
+  matd_destroy(pose.R);
+  matd_destroy(pose.t);
+  matd_destroy(detection.H);
+  return camera_pose_tag;
+}
+
+}  // namespace
+
+TEST(apriltag, tag_pose_from_homography_matches_library) {
+  const std::vector<Sophus::SE3d> poses = {
+      Sophus::SE3d(Sophus::SO3d(), Eigen::Vector3d(0, 0, 1)),
+      Sophus::SE3d(Sophus::SO3d::exp(Eigen::Vector3d(0.3, -0.2, 0.1)),
+                   Eigen::Vector3d(0.1, -0.2, 1.5)),
+      Sophus::SE3d(Sophus::SO3d::exp(Eigen::Vector3d(-0.9, 0.4, 2.5)),
+                   Eigen::Vector3d(-0.5, 0.3, 0.4)),
+      Sophus::SE3d(Sophus::SO3d::exp(Eigen::Vector3d(1.1, 0.6, -3.0)),
+                   Eigen::Vector3d(2.0, 1.0, 8.0)),
+  };
+  for (double tag_size : {0.02, 0.16, 1.0}) {
+    for (const Sophus::SE3d& pose : poses) {
+      // Distance scales with the tag, so the tag covers the same pixels.
+      Sophus::SE3d camera_pose_tag(pose.so3(), pose.translation() * tag_size);
+      auto H = TagHomography(camera_pose_tag, tag_size);
+      Sophus::SE3d ours = TagPoseFromHomography(H.data(), tag_size);
+      Sophus::SE3d library = LibraryTagPose(H, tag_size);
+
+      EXPECT_LT((ours.rotationMatrix() - library.rotationMatrix()).norm(),
+                1e-9)
+          << tag_size << " " << pose.log().transpose();
+      EXPECT_LT((ours.translation() - library.translation()).norm(),
+                1e-9 * tag_size)
+          << tag_size << " " << pose.log().transpose();
+      EXPECT_LT((ours.rotationMatrix() - camera_pose_tag.rotationMatrix())
+                    .norm(),
+                1e-9);
+      EXPECT_LT(
+          (ours.translation() - camera_pose_tag.translation()).norm(),
+          1e-9 * tag_size);
+    }
+  }
+}
@@ -58,5 +58,20 @@ CameraModel DefaultCameraModel(const std::string& frame_name, int width,
   model.set_frame_name(frame_name);
   return model;
 }
+
+CameraModel ResizeCameraModel(const CameraModel& model, int width,
+                              int height) {
+  CameraModel resized = model;
+  double sx = double(width) / model.image_width();
+  double sy = double(height) / model.image_height();
+  resized.set_image_width(width);
+  resized.set_image_height(height);
+  resized.set_fx(model.fx() * sx);
+  resized.set_cx(model.cx() * sx);
+  resized.set_fy(model.fy() * sy);
+  resized.set_cy(model.cy() * sy);
+  return resized;
+}
+
 }  // namespace perception
 }  // namespace farm_ng
@@ -1,6 +1,9 @@
 #ifndef FARM_NG_CALIBRATION_CAMERA_MODEL_H_
 #define FARM_NG_CALIBRATION_CAMERA_MODEL_H_
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <numeric>
 
 #include <glog/logging.h>
@@ -80,69 +83,108 @@ inline cv::Size GetCvSize(const CameraModel& model) {
   return cv::Size(model.image_width(), model.image_height());
 }
 
-// Given a point in 3D space, compute the corresponding pixel coordinates in
-// an
-//  image with no distortion or forward distortion coefficients produced by
-//  the same camera
+// Distortion kernels, one per DistortionModel, shared by the runtime
+// dispatched ProjectPointToPixel and ReprojectPixelToPoint below and the
+// compile time specialized PinholeCamera.
 //
-//  This is compatable with autodiff using ceres jet types, except that it
-//  will not support solving for the camera model itself.
-template <class T, class CameraModelT>
-Eigen::Matrix<T, 2, 1> ProjectPointToPixel(
-    const CameraModelT& camera, const Eigen::Matrix<T, 3, 1>& point) {
-  using std::atan;
-  using std::sqrt;
-  const T eps(std::numeric_limits<float>::epsilon());
-  T x = point.x() / point.z();
-  T y = point.y() / point.z();
+// Distort maps undistorted normalized image coordinates to distorted ones,
+// and Undistort the reverse. k holds num_coefficients coefficients, of a
+// scalar type K that may differ from T, so constant coefficients aren't
+// promoted to jets in autodiff.
+template <CameraModel::DistortionModel Model>
+struct Distortion;
+
+template <>
+struct Distortion<CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY> {
+  static constexpr int num_coefficients = 5;
 
-  if (camera.distortion_model() ==
-      CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY) {
+  template <typename T, typename K>
+  static void Distort(const K* k, T* x_io, T* y_io) {
     // Model copied from librealsense:
     // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L23
+    T x = *x_io;
+    T y = *y_io;
     T r2 = x * x + y * y;
-    T f = T(1) + T(camera.distortion_coefficients(0)) * r2 +
-          T(camera.distortion_coefficients(1)) * r2 * r2 +
-          T(camera.distortion_coefficients(4)) * r2 * r2 * r2;
+    T f = T(1) + k[0] * r2 + k[1] * r2 * r2 + k[4] * r2 * r2 * r2;
     x *= f;
     y *= f;
-    T dx = x + T(2) * T(camera.distortion_coefficients(2)) * x * y +
-           T(camera.distortion_coefficients(3)) * (r2 + T(2) * x * x);
-    T dy = y + T(2) * T(camera.distortion_coefficients(3)) * x * y +
-           T(camera.distortion_coefficients(2)) * (r2 + T(2) * y * y);
-    x = dx;
-    y = dy;
-  } else if (camera.distortion_model() ==
-             CameraModel::DISTORTION_MODEL_BROWN_CONRADY) {
+    *x_io = x + T(2) * k[2] * x * y + k[3] * (r2 + T(2) * x * x);
+    *y_io = y + T(2) * k[3] * x * y + k[2] * (r2 + T(2) * y * y);
+  }
+
+  template <typename T, typename K>
+  static void Undistort(const K* k, T* x_io, T* y_io) {
+    // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L90
+    T x = *x_io;
+    T y = *y_io;
+    T r2 = x * x + y * y;
+    T f = T(1) + k[0] * r2 + k[1] * r2 * r2 + k[4] * r2 * r2 * r2;
+    *x_io = x * f + T(2) * k[2] * x * y + k[3] * (r2 + T(2) * x * x);
+    *y_io = y * f + T(2) * k[3] * x * y + k[2] * (r2 + T(2) * y * y);
+  }
+};
+
+template <>
+struct Distortion<CameraModel::DISTORTION_MODEL_BROWN_CONRADY> {
+  // k1, k2, p1, p2, k3, and optionally k4, k5, k6, which are zero if unused.
+  static constexpr int num_coefficients = 8;
+
+  template <typename T, typename K>
+  static void Distort(const K* k, T* x_io, T* y_io) {
     // From:
     // https://github.com/opencv/opencv/blob/63bb2abadab875fc648a572faccafee134f06fc8/modules/calib3d/src/calibration.cpp#L791
+    T x = *x_io;
+    T y = *y_io;
     T r2 = x * x + y * y;
     T r4 = r2 * r2;
     T r6 = r4 * r2;
     T a1 = T(2) * x * y;
-    T a2 = r2 + T(2) * x * x;
     T a3 = r2 + T(2) * y * y;
+    T cdist = T(1) + k[0] * r2 + k[1] * r4 + k[4] * r6;
+    T icdist2 = T(1) / (T(1) + k[5] * r2 + k[6] * r4 + k[7] * r6);
+    *x_io = x * cdist * icdist2 + k[2] * a1 + k[3] * r2;
+    *y_io = y * cdist * icdist2 + k[2] * a3 + k[3] * a1;
+  }
 
-    T cdist = T(1) + T(camera.distortion_coefficients(0)) * r2 +
-              T(camera.distortion_coefficients(1)) * r4 +
-              T(camera.distortion_coefficients(4)) * r6;
-
-    T icdist2 = T(1);
-    if (camera.distortion_coefficients_size() >= 8) {
-      icdist2 = T(1) / (T(1) + T(camera.distortion_coefficients(5)) * r2 +
-                        T(camera.distortion_coefficients(6)) * r4 +
-                        T(camera.distortion_coefficients(7)) * r6);
+  template <typename T, typename K>
+  static void Undistort(const K* k, T* x_io, T* y_io) {
+    // From
+    // https://github.com/opencv/opencv/blob/63bb2abadab875fc648a572faccafee134f06fc8/modules/calib3d/src/undistort.dispatch.cpp#L365
+    T x0 = *x_io;
+    T y0 = *y_io;
+    T x = x0;
+    T y = y0;
+    for (int j = 0; j < 5; j++) {
+      T r2 = x * x + y * y;
+      T icdist = (T(1) + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2) /
+                 (T(1) + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2);
+      if (icdist < T(0)) {
+        x = x0;
+        y = y0;
+        break;
+      }
+      T deltaX = T(2) * k[2] * x * y + k[3] * (r2 + T(2) * x * x);
+      T deltaY = k[2] * (r2 + T(2) * y * y) + T(2) * k[3] * x * y;
+      x = (x0 - deltaX) * icdist;
+      y = (y0 - deltaY) * icdist;
     }
+    *x_io = x;
+    *y_io = y;
+  }
+};
 
-    x = x * cdist * icdist2 + T(camera.distortion_coefficients(2)) * a1 +
-        T(camera.distortion_coefficients(3)) * r2;
-    y = y * cdist * icdist2 + T(camera.distortion_coefficients(2)) * a3 +
-        T(camera.distortion_coefficients(3)) * a1;
-  } else if (camera.distortion_model() ==
-             CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4) {
+template <>
+struct Distortion<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4> {
+  static constexpr int num_coefficients = 4;
+
+  template <typename T, typename K>
+  static void Distort(const K* k, T* x, T* y) {
     // Model copied from librealsense:
     // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L63
-    T r = sqrt(x * x + y * y);
+    using std::atan;
+    using std::sqrt;
+    const T eps(std::numeric_limits<float>::epsilon());
+    T r = sqrt(*x * *x + *y * *y);
     if (r < eps) {
       r = eps;
     }
@@ -150,29 +192,186 @@ Eigen::Matrix<T, 2, 1> ProjectPointToPixel(
     T theta2 = theta * theta;
     T series =
         T(1) +
-        theta2 *
-            (T(camera.distortion_coefficients(0)) +
-             theta2 *
-                 (T(camera.distortion_coefficients(1)) +
-                  theta2 * (T(camera.distortion_coefficients(2)) +
-                            theta2 * T(camera.distortion_coefficients(3)))));
+        theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3])));
     T rd = theta * series;
-    x *= rd / r;
-    y *= rd / r;
-  } else if(camera.distortion_model() == CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH) {
-    T r_corr = sqrt(x * x + y * y);
+    *x *= rd / r;
+    *y *= rd / r;
+  }
+
+  template <typename T, typename K>
+  static void Undistort(const K* k, T* x, T* y) {
+    // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L83
+    using std::abs;
+    using std::sqrt;
+    using std::tan;
+    const T kEps(std::numeric_limits<float>::epsilon());
+    T rd = sqrt(*x * *x + *y * *y);
+    if (rd < kEps) {
+      rd = kEps;
+    }
+    T theta = rd;
+    T theta2 = rd * rd;
+    for (int i = 0; i < 4; i++) {
+      T series =
+          T(1) +
+          theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3])));
+      T f = theta * series - rd;
+      if (abs(f) < kEps) {
+        break;
+      }
+      T df = T(1) + theta2 * (T(3) * k[0] +
+                              theta2 * (T(5) * k[1] +
+                                        theta2 * (T(7) * k[2] +
+                                                  T(9) * theta2 * k[3])));
+      theta -= f / df;
+      theta2 = theta * theta;
+    }
+    T r = tan(theta);
+    *x *= r / rd;
+    *y *= r / rd;
+  }
+};
+
+template <>
+struct Distortion<CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH> {
+  static constexpr int num_coefficients = 3;
+
+  template <typename T, typename K>
+  static void Distort(const K* k, T* x, T* y) {
+    using std::sqrt;
+    const T eps(std::numeric_limits<float>::epsilon());
+    T r_corr = sqrt(*x * *x + *y * *y);
     if (r_corr < eps) {
       r_corr = eps;
     }
-    T a(camera.distortion_coefficients(0));
-    T b(camera.distortion_coefficients(1));
-    T c(camera.distortion_coefficients(2));
-    const T d(1.0); // here d is 1, TODO support d = 1 - (a+b+c), possibly through another camera model type.?
-    T r_dist = a*r_corr*r_corr*r_corr*r_corr + b*r_corr*r_corr*r_corr + c*r_corr*r_corr + r_corr;
-    x *= r_dist/r_corr;
-    y *= r_dist/r_corr;
-  } else {
-    LOG(FATAL) << "Unsupported distortion model: " << camera.ShortDebugString();
+    // Here d is 1, TODO support d = 1 - (a+b+c), possibly through another
+    // camera model type.?
+    T r_dist = k[0] * r_corr * r_corr * r_corr * r_corr +
+               k[1] * r_corr * r_corr * r_corr + k[2] * r_corr * r_corr +
+               r_corr;
+    *x *= r_dist / r_corr;
+    *y *= r_dist / r_corr;
+  }
+
+  template <typename T, typename K>
+  static void Undistort(const K*, T*, T*) {
+    LOG(FATAL) << "Unsupported distortion model: "
+               << CameraModel::DistortionModel_Name(
+                      CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH);
+  }
+};
+
+// Camera intrinsics specialized at compile time on the distortion model, so
+// projection in tight loops, e.g. ceres cost functors, doesn't branch on the
+// model or read the CameraModel protobuf. Construct with FromCameraModel, or
+// VisitPinholeCamera where the model is only known at runtime.
+template <CameraModel::DistortionModel Model>
+struct PinholeCamera {
+  static constexpr CameraModel::DistortionModel distortion_model = Model;
+  static constexpr int num_coefficients = Distortion<Model>::num_coefficients;
+
+  double fx;
+  double fy;
+  double cx;
+  double cy;
+  // Coefficients the model doesn't use are zero.
+  double k[num_coefficients];
+
+  // Precondition: camera_model has this distortion model.
+  static PinholeCamera FromCameraModel(const CameraModel& camera_model) {
+    CHECK_EQ(camera_model.distortion_model(), Model)
+        << camera_model.ShortDebugString();
+    CHECK_LE(camera_model.distortion_coefficients_size(), 8);
+    PinholeCamera camera;
+    camera.fx = camera_model.fx();
+    camera.fy = camera_model.fy();
+    camera.cx = camera_model.cx();
+    camera.cy = camera_model.cy();
+    int n = std::min(num_coefficients,
+                     camera_model.distortion_coefficients_size());
+    for (int i = 0; i < num_coefficients; ++i) {
+      camera.k[i] = i < n ? camera_model.distortion_coefficients(i) : 0.0;
+    }
+    return camera;
+  }
+};
+
+// Calls f with camera_model as the PinholeCamera of its distortion model, and
+// returns its result. This is the one runtime dispatch for code templated on
+// the camera, e.g. cost functors, which f should instantiate.
+template <typename F>
+auto VisitPinholeCamera(const CameraModel& camera_model, F&& f) {
+  switch (camera_model.distortion_model()) {
+    case CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4:
+      return f(PinholeCamera<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4>::
+                   FromCameraModel(camera_model));
+    case CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY:
+      return f(
+          PinholeCamera<CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY>::
+              FromCameraModel(camera_model));
+    case CameraModel::DISTORTION_MODEL_BROWN_CONRADY:
+      return f(PinholeCamera<CameraModel::DISTORTION_MODEL_BROWN_CONRADY>::
+                   FromCameraModel(camera_model));
+    case CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH:
+      break;
+    default:
+      LOG(FATAL) << "Unsupported distortion model: "
+                 << camera_model.ShortDebugString();
+  }
+  return f(PinholeCamera<CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH>::
+               FromCameraModel(camera_model));
+}
+
+// Given a point in 3D space, compute the corresponding pixel coordinates in
+// an
+//  image with no distortion or forward distortion coefficients produced by
+//  the same camera
+//
+//  This is compatable with autodiff using ceres jet types, except that it
+//  will not support solving for the camera model itself.
+template <class T, CameraModel::DistortionModel Model>
+Eigen::Matrix<T, 2, 1> ProjectPointToPixel(
+    const PinholeCamera<Model>& camera, const Eigen::Matrix<T, 3, 1>& point) {
+  T x = point.x() / point.z();
+  T y = point.y() / point.z();
+  Distortion<Model>::Distort(camera.k, &x, &y);
+  return Eigen::Matrix<T, 2, 1>(x * camera.fx + camera.cx,
+                                y * camera.fy + camera.cy);
+}
+
+// As above, for a CameraModel or CameraModelJetMap, branching on the
+// distortion model at each call. CameraModelJetMap supports solving for the
+// camera model itself.
+template <class T, class CameraModelT>
+Eigen::Matrix<T, 2, 1> ProjectPointToPixel(
+    const CameraModelT& camera, const Eigen::Matrix<T, 3, 1>& point) {
+  T k[8] = {T(0), T(0), T(0), T(0), T(0), T(0), T(0), T(0)};
+  CHECK_LE(camera.distortion_coefficients_size(), 8);
+  for (int i = 0; i < int(camera.distortion_coefficients_size()); ++i) {
+    k[i] = T(camera.distortion_coefficients(i));
+  }
+  T x = point.x() / point.z();
+  T y = point.y() / point.z();
+  switch (camera.distortion_model()) {
+    case CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY:
+      Distortion<CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY>::Distort(
+          k, &x, &y);
+      break;
+    case CameraModel::DISTORTION_MODEL_BROWN_CONRADY:
+      Distortion<CameraModel::DISTORTION_MODEL_BROWN_CONRADY>::Distort(k, &x,
+                                                                       &y);
+      break;
+    case CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4:
+      Distortion<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4>::Distort(k, &x,
+                                                                         &y);
+      break;
+    case CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH:
+      Distortion<CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH>::Distort(
+          k, &x, &y);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported distortion model: "
+                 << camera.ShortDebugString();
   }
   return Eigen::Matrix<T, 2, 1>(x * T(camera.fx()) + T(camera.cx()),
                                 y * T(camera.fy()) + T(camera.cy()));
@@ -183,105 +382,59 @@ Eigen::Matrix<T, 2, 1> ProjectPointToPixel(
 //
 //  This is compatable with autodiff using ceres jet types, except that it
 //  will not support solving for the camera model itself.
+template <typename T, CameraModel::DistortionModel Model>
+Eigen::Matrix<T, 3, 1> ReprojectPixelToPoint(
+    const PinholeCamera<Model>& camera, const Eigen::Matrix<T, 2, 1>& pixel,
+    const T& depth) {
+  T x = (pixel.x() - camera.cx) / camera.fx;
+  T y = (pixel.y() - camera.cy) / camera.fy;
+  Distortion<Model>::Undistort(camera.k, &x, &y);
+  return Eigen::Matrix<T, 3, 1>(depth * x, depth * y, depth);
+}
+
+// As above, for a CameraModel or CameraModelJetMap, branching on the
+// distortion model at each call.
 template <typename T, typename CameraModelT>
 Eigen::Matrix<T, 3, 1> ReprojectPixelToPoint(
     const CameraModelT& camera, const Eigen::Matrix<T, 2, 1>& pixel,
     const T& depth) {
-  using std::abs;
-  using std::sqrt;
-  using std::tan;
-  const T kEps(std::numeric_limits<float>::epsilon());
+  T k[8] = {T(0), T(0), T(0), T(0), T(0), T(0), T(0), T(0)};
+  CHECK_LE(camera.distortion_coefficients_size(), 8);
+  for (int i = 0; i < int(camera.distortion_coefficients_size()); ++i) {
+    k[i] = T(camera.distortion_coefficients(i));
+  }
   T x = (pixel.x() - T(camera.cx())) / T(camera.fx());
   T y = (pixel.y() - T(camera.cy())) / T(camera.fy());
-  if (camera.distortion_model() ==
-      CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY) {
-    const T dist[5] = {T(camera.distortion_coefficients(0)),
-                       T(camera.distortion_coefficients(1)),
-                       T(camera.distortion_coefficients(2)),
-                       T(camera.distortion_coefficients(3)),
-                       T(camera.distortion_coefficients(4))};
-    // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L90
-    T r2 = x * x + y * y;
-    T f = T(1) + dist[0] * r2 + dist[1] * r2 * r2 + dist[4] * r2 * r2 * r2;
-    T ux = x * f + T(2) * dist[2] * x * y + dist[3] * (r2 + T(2) * x * x);
-    T uy = y * f + T(2) * dist[3] * x * y + dist[2] * (r2 + T(2) * y * y);
-    x = ux;
-    y = uy;
-  } else if (camera.distortion_model() ==
-             CameraModel::DISTORTION_MODEL_BROWN_CONRADY) {
-    // From
-    // https://github.com/opencv/opencv/blob/63bb2abadab875fc648a572faccafee134f06fc8/modules/calib3d/src/undistort.dispatch.cpp#L365
-    T k[8] = {T(0)};
-    CHECK_LE(camera.distortion_coefficients_size(), 8);
-    for (int i = 0; i < camera.distortion_coefficients_size(); ++i) {
-      k[i] = camera.distortion_coefficients(i);
-    }
-    T x0 = x;
-    T y0 = y;
-    for (int j = 0; j < 5; j++) {
-      T r2 = x * x + y * y;
-      T icdist = (T(1) + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2) /
-                 (T(1) + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2);
-      if (icdist < 0) {
-        x = x0;
-        y = y0;
-        break;
-      }
-      T deltaX = T(2) * k[2] * x * y + k[3] * (r2 + T(2) * x * x);
-      T deltaY = k[2] * (r2 + T(2) * y * y) + T(2) * k[3] * x * y;
-      x = (x0 - deltaX) * icdist;
-      y = (y0 - deltaY) * icdist;
-    }
-  } else if (camera.distortion_model() ==
-             CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4) {
-    // https://github.com/IntelRealSense/librealsense/blob/0adceb9dc6fce63c348346e1aef1b63c052a1db9/include/librealsense2/rsutil.h#L83
-
-    T rd = sqrt(x * x + y * y);
-    if (rd < kEps) {
-      rd = kEps;
-    }
-
-    T theta = rd;
-    T theta2 = rd * rd;
-
-    const T dist[4] = {T(camera.distortion_coefficients(0)),
-                       T(camera.distortion_coefficients(1)),
-                       T(camera.distortion_coefficients(2)),
-                       T(camera.distortion_coefficients(3))};
-
-    for (int i = 0; i < 4; i++) {
-      T f = theta *
-                (T(1) +
-                 theta2 * (dist[0] +
-                           theta2 * (dist[1] +
-                                     theta2 * (dist[2] + theta2 * dist[3])))) -
-            rd;
-      if (abs(f) < kEps) {
-        break;
-      }
-      float df =
-          T(1) +
-          theta2 *
-              (T(3) * dist[0] +
-               theta2 * (T(5) * dist[1] +
-                         theta2 * (T(7) * dist[2] + T(9) * theta2 * dist[3])));
-      theta -= f / df;
-      theta2 = theta * theta;
-    }
-    T r = tan(theta);
-    x *= r / rd;
-    y *= r / rd;
-  } else {
-    LOG(FATAL) << "Unsupported distortion model: " << camera.ShortDebugString();
+  switch (camera.distortion_model()) {
+    case CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY:
+      Distortion<CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY>::
+          Undistort(k, &x, &y);
+      break;
+    case CameraModel::DISTORTION_MODEL_BROWN_CONRADY:
+      Distortion<CameraModel::DISTORTION_MODEL_BROWN_CONRADY>::Undistort(k, &x,
+                                                                         &y);
+      break;
+    case CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4:
+      Distortion<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4>::Undistort(
+          k, &x, &y);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported distortion model: "
+                 << camera.ShortDebugString();
   }
   return Eigen::Matrix<T, 3, 1>(depth * x, depth * y, depth);
-}  // namespace perception
+}
 
 CameraModel DefaultFishEyeT265CameraModel();
 CameraModel Default1080HDCameraModel();
 CameraModel DefaultCameraModel(const std::string& frame_name, int width,
                                int height);
 
+// Scales the intrinsics of a model to a new resolution, e.g. for a resized
+// image. Distortion coefficients are unchanged.
+CameraModel ResizeCameraModel(const CameraModel& model, int width,
+                              int height);
+
 inline CameraModel CreateCameraModel(double horizontal_fov, int image_width,
                               int image_height) {
   CameraModel model;
@@ -0,0 +1,195 @@
+#include "farm_ng/perception/camera_model_batch.h"
+
+#include <atomic>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <glog/logging.h>
+
+#include "farm_ng/perception/camera_model_batch_kernels.h"
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+// NEON is baseline on aarch64, so it is chosen at compile time. On x86-64 the
+// kernels are also built for AVX2, see camera_model_batch_avx2.cpp, and that
+// build is chosen at runtime where the CPU supports it.
+#if defined(__aarch64__) && defined(__ARM_NEON)
+constexpr char kIsa[] = "neon";
+
+template <>
+struct Pack<double> {
+  using Scalar = double;
+  static constexpr int kLanes = 2;
+  struct Mask {
+    uint64x2_t m;
+    friend Mask operator|(Mask a, Mask b) { return {vorrq_u64(a.m, b.m)}; }
+    friend bool All(Mask a) {
+      return (vgetq_lane_u64(a.m, 0) & vgetq_lane_u64(a.m, 1)) != 0;
+    }
+  };
+
+  Pack() = default;
+  explicit Pack(double s) : v(vdupq_n_f64(s)) {}
+  explicit Pack(float64x2_t raw) : v(raw) {}
+  static Pack Load(const double* p) { return Pack(vld1q_f64(p)); }
+  void Store(double* p) const { vst1q_f64(p, v); }
+  static Pack LoadStrided(const double* p, int stride) {
+    return Pack(vcombine_f64(vld1_f64(p), vld1_f64(p + stride)));
+  }
+  void StoreStrided(double* p, int stride) const {
+    vst1q_lane_f64(p, v, 0);
+    vst1q_lane_f64(p + stride, v, 1);
+  }
+  Pack& operator*=(Pack b) { return *this = *this * b; }
+
+  friend Pack operator+(Pack a, Pack b) { return Pack(vaddq_f64(a.v, b.v)); }
+  friend Pack operator-(Pack a, Pack b) { return Pack(vsubq_f64(a.v, b.v)); }
+  friend Pack operator*(Pack a, Pack b) { return Pack(vmulq_f64(a.v, b.v)); }
+  friend Pack operator/(Pack a, Pack b) { return Pack(vdivq_f64(a.v, b.v)); }
+  friend Mask operator<(Pack a, Pack b) { return {vcltq_f64(a.v, b.v)}; }
+  friend Pack Select(Mask m, Pack a, Pack b) {
+    return Pack(vbslq_f64(m.m, a.v, b.v));
+  }
+  friend Pack Sqrt(Pack a) { return Pack(vsqrtq_f64(a.v)); }
+  friend Pack Abs(Pack a) { return Pack(vabsq_f64(a.v)); }
+
+  float64x2_t v;
+};
+
+template <>
+struct Pack<float> {
+  using Scalar = float;
+  static constexpr int kLanes = 4;
+  struct Mask {
+    uint32x4_t m;
+    friend Mask operator|(Mask a, Mask b) { return {vorrq_u32(a.m, b.m)}; }
+    friend bool All(Mask a) { return vminvq_u32(a.m) != 0; }
+  };
+
+  Pack() = default;
+  explicit Pack(float s) : v(vdupq_n_f32(s)) {}
+  explicit Pack(float32x4_t raw) : v(raw) {}
+  static Pack Load(const float* p) { return Pack(vld1q_f32(p)); }
+  void Store(float* p) const { vst1q_f32(p, v); }
+  static Pack LoadStrided(const float* p, int stride) {
+    float32x4_t v = vld1q_dup_f32(p);
+    v = vld1q_lane_f32(p + stride, v, 1);
+    v = vld1q_lane_f32(p + 2 * stride, v, 2);
+    v = vld1q_lane_f32(p + 3 * stride, v, 3);
+    return Pack(v);
+  }
+  void StoreStrided(float* p, int stride) const {
+    vst1q_lane_f32(p, v, 0);
+    vst1q_lane_f32(p + stride, v, 1);
+    vst1q_lane_f32(p + 2 * stride, v, 2);
+    vst1q_lane_f32(p + 3 * stride, v, 3);
+  }
+  Pack& operator*=(Pack b) { return *this = *this * b; }
+
+  friend Pack operator+(Pack a, Pack b) { return Pack(vaddq_f32(a.v, b.v)); }
+  friend Pack operator-(Pack a, Pack b) { return Pack(vsubq_f32(a.v, b.v)); }
+  friend Pack operator*(Pack a, Pack b) { return Pack(vmulq_f32(a.v, b.v)); }
+  friend Pack operator/(Pack a, Pack b) { return Pack(vdivq_f32(a.v, b.v)); }
+  friend Mask operator<(Pack a, Pack b) { return {vcltq_f32(a.v, b.v)}; }
+  friend Pack Select(Mask m, Pack a, Pack b) {
+    return Pack(vbslq_f32(m.m, a.v, b.v));
+  }
+  friend Pack Sqrt(Pack a) { return Pack(vsqrtq_f32(a.v)); }
+  friend Pack Abs(Pack a) { return Pack(vabsq_f32(a.v)); }
+
+  float32x4_t v;
+};
+
+#else
+constexpr char kIsa[] = "scalar";
+#endif
+
+bool CpuSupportsAvx2() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
+std::atomic<bool> _g_avx2_enabled(CpuSupportsAvx2());
+
+bool UseAvx2() { return _g_avx2_enabled.load(std::memory_order_relaxed); }
+
+template <typename S>
+Eigen::Matrix<S, 2, Eigen::Dynamic> ProjectPoints(
+    const CameraModel& camera_model,
+    const Eigen::Matrix<S, 3, Eigen::Dynamic>& points) {
+  Eigen::Matrix<S, 2, Eigen::Dynamic> pixels(2, points.cols());
+  VisitPinholeCamera(camera_model, [&](const auto& camera) {
+#if defined(__x86_64__)
+    if (UseAvx2()) {
+      ProjectBatchAvx2(camera, points.data(), points.cols(), pixels.data());
+      return;
+    }
+#endif
+    ProjectBatch<Pack<S>>(camera, points.data(), points.cols(),
+                          pixels.data());
+  });
+  return pixels;
+}
+
+template <typename S>
+Eigen::Matrix<S, 3, Eigen::Dynamic> ReprojectPixels(
+    const CameraModel& camera_model,
+    const Eigen::Matrix<S, 2, Eigen::Dynamic>& pixels,
+    const Eigen::Matrix<S, Eigen::Dynamic, 1>& depths) {
+  CHECK_EQ(pixels.cols(), depths.size());
+  Eigen::Matrix<S, 3, Eigen::Dynamic> points(3, pixels.cols());
+  VisitPinholeCamera(camera_model, [&](const auto& camera) {
+#if defined(__x86_64__)
+    if (UseAvx2()) {
+      ReprojectBatchAvx2(camera, pixels.data(), depths.data(), pixels.cols(),
+                         points.data());
+      return;
+    }
+#endif
+    ReprojectBatch<Pack<S>>(camera, pixels.data(), depths.data(),
+                            pixels.cols(), points.data());
+  });
+  return points;
+}
+
+}  // namespace
+
+Eigen::Matrix2Xd ProjectPointsToPixels(const CameraModel& camera,
+                                       const Eigen::Matrix3Xd& points) {
+  return ProjectPoints(camera, points);
+}
+
+Eigen::Matrix2Xf ProjectPointsToPixels(const CameraModel& camera,
+                                       const Eigen::Matrix3Xf& points) {
+  return ProjectPoints(camera, points);
+}
+
+Eigen::Matrix3Xd ReprojectPixelsToPoints(const CameraModel& camera,
+                                         const Eigen::Matrix2Xd& pixels,
+                                         const Eigen::VectorXd& depths) {
+  return ReprojectPixels(camera, pixels, depths);
+}
+
+Eigen::Matrix3Xf ReprojectPixelsToPoints(const CameraModel& camera,
+                                         const Eigen::Matrix2Xf& pixels,
+                                         const Eigen::VectorXf& depths) {
+  return ReprojectPixels(camera, pixels, depths);
+}
+
+const char* CameraModelBatchIsa() { return UseAvx2() ? "avx2" : kIsa; }
+
+void SetCameraModelBatchAvx2Enabled(bool enabled) {
+  _g_avx2_enabled = enabled && CpuSupportsAvx2();
+}
+
+}  // namespace perception
+}  // namespace farm_ng
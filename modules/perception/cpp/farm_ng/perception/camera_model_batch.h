@@ -0,0 +1,45 @@
+#ifndef FARM_NG_PERCEPTION_CAMERA_MODEL_BATCH_H_
+#define FARM_NG_PERCEPTION_CAMERA_MODEL_BATCH_H_
+
+#include <Eigen/Core>
+
+#include "farm_ng/perception/camera_model.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// Batch versions of ProjectPointToPixel and ReprojectPixelToPoint, for point
+// clouds and other large point sets. The distortion model is dispatched once
+// per call, and points are processed several at a time with AVX2, where the
+// CPU supports it, or NEON on aarch64, or one at a time otherwise. Results
+// match the single point functions up to rounding.
+
+// Projects each column of points, in the camera frame, to a column of pixel
+// coordinates. As with ProjectPointToPixel, points must be in front of the
+// camera.
+Eigen::Matrix2Xd ProjectPointsToPixels(const CameraModel& camera,
+                                       const Eigen::Matrix3Xd& points);
+Eigen::Matrix2Xf ProjectPointsToPixels(const CameraModel& camera,
+                                       const Eigen::Matrix3Xf& points);
+
+// Reprojects each column of pixels to the point in the camera frame at the
+// corresponding depth.
+Eigen::Matrix3Xd ReprojectPixelsToPoints(const CameraModel& camera,
+                                         const Eigen::Matrix2Xd& pixels,
+                                         const Eigen::VectorXd& depths);
+Eigen::Matrix3Xf ReprojectPixelsToPoints(const CameraModel& camera,
+                                         const Eigen::Matrix2Xf& pixels,
+                                         const Eigen::VectorXf& depths);
+
+// The instruction set of the batch kernels, "avx2", "neon" or "scalar".
+const char* CameraModelBatchIsa();
+
+// Enables the AVX2 kernels where the CPU supports them, the default. Disabling
+// them, e.g. to compare with the baseline kernels in a test or benchmark,
+// affects all threads.
+void SetCameraModelBatchAvx2Enabled(bool enabled);
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,161 @@
+// The kernels of camera_model_batch_kernels.h built for AVX2 and FMA. This
+// file alone is compiled with -mavx2 -mfma, and camera_model_batch.cpp only
+// calls into it on CPUs that support them.
+#if defined(__x86_64__)
+
+#if !defined(__AVX2__) || !defined(__FMA__)
+#error "camera_model_batch_avx2.cpp must be compiled with -mavx2 -mfma"
+#endif
+
+#include <immintrin.h>
+
+#include "farm_ng/perception/camera_model_batch_kernels.h"
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+template <>
+struct Pack<double> {
+  using Scalar = double;
+  static constexpr int kLanes = 4;
+  struct Mask {
+    __m256d m;
+    friend Mask operator|(Mask a, Mask b) { return {_mm256_or_pd(a.m, b.m)}; }
+    friend bool All(Mask a) { return _mm256_movemask_pd(a.m) == 0xf; }
+  };
+
+  Pack() = default;
+  explicit Pack(double s) : v(_mm256_set1_pd(s)) {}
+  explicit Pack(__m256d raw) : v(raw) {}
+  static Pack Load(const double* p) { return Pack(_mm256_loadu_pd(p)); }
+  void Store(double* p) const { _mm256_storeu_pd(p, v); }
+  static Pack LoadStrided(const double* p, int stride) {
+    return Pack(_mm256_set_pd(p[3 * stride], p[2 * stride], p[stride], p[0]));
+  }
+  void StoreStrided(double* p, int stride) const {
+    alignas(32) double lanes[kLanes];
+    _mm256_store_pd(lanes, v);
+    for (int l = 0; l < kLanes; ++l) {
+      p[l * stride] = lanes[l];
+    }
+  }
+  Pack& operator*=(Pack b) { return *this = *this * b; }
+
+  friend Pack operator+(Pack a, Pack b) {
+    return Pack(_mm256_add_pd(a.v, b.v));
+  }
+  friend Pack operator-(Pack a, Pack b) {
+    return Pack(_mm256_sub_pd(a.v, b.v));
+  }
+  friend Pack operator*(Pack a, Pack b) {
+    return Pack(_mm256_mul_pd(a.v, b.v));
+  }
+  friend Pack operator/(Pack a, Pack b) {
+    return Pack(_mm256_div_pd(a.v, b.v));
+  }
+  friend Mask operator<(Pack a, Pack b) {
+    return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)};
+  }
+  friend Pack Select(Mask m, Pack a, Pack b) {
+    return Pack(_mm256_blendv_pd(b.v, a.v, m.m));
+  }
+  friend Pack Sqrt(Pack a) { return Pack(_mm256_sqrt_pd(a.v)); }
+  friend Pack Abs(Pack a) {
+    return Pack(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v));
+  }
+
+  __m256d v;
+};
+
+template <>
+struct Pack<float> {
+  using Scalar = float;
+  static constexpr int kLanes = 8;
+  struct Mask {
+    __m256 m;
+    friend Mask operator|(Mask a, Mask b) { return {_mm256_or_ps(a.m, b.m)}; }
+    friend bool All(Mask a) { return _mm256_movemask_ps(a.m) == 0xff; }
+  };
+
+  Pack() = default;
+  explicit Pack(float s) : v(_mm256_set1_ps(s)) {}
+  explicit Pack(__m256 raw) : v(raw) {}
+  static Pack Load(const float* p) { return Pack(_mm256_loadu_ps(p)); }
+  void Store(float* p) const { _mm256_storeu_ps(p, v); }
+  static Pack LoadStrided(const float* p, int stride) {
+    return Pack(_mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride],
+                              p[4 * stride], p[3 * stride], p[2 * stride],
+                              p[stride], p[0]));
+  }
+  void StoreStrided(float* p, int stride) const {
+    alignas(32) float lanes[kLanes];
+    _mm256_store_ps(lanes, v);
+    for (int l = 0; l < kLanes; ++l) {
+      p[l * stride] = lanes[l];
+    }
+  }
+  Pack& operator*=(Pack b) { return *this = *this * b; }
+
+  friend Pack operator+(Pack a, Pack b) {
+    return Pack(_mm256_add_ps(a.v, b.v));
+  }
+  friend Pack operator-(Pack a, Pack b) {
+    return Pack(_mm256_sub_ps(a.v, b.v));
+  }
+  friend Pack operator*(Pack a, Pack b) {
+    return Pack(_mm256_mul_ps(a.v, b.v));
+  }
+  friend Pack operator/(Pack a, Pack b) {
+    return Pack(_mm256_div_ps(a.v, b.v));
+  }
+  friend Mask operator<(Pack a, Pack b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+  }
+  friend Pack Select(Mask m, Pack a, Pack b) {
+    return Pack(_mm256_blendv_ps(b.v, a.v, m.m));
+  }
+  friend Pack Sqrt(Pack a) { return Pack(_mm256_sqrt_ps(a.v)); }
+  friend Pack Abs(Pack a) {
+    return Pack(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v));
+  }
+
+  __m256 v;
+};
+
+}  // namespace
+
+template <typename S, class Camera>
+void ProjectBatchAvx2(const Camera& camera, const S* points, int n,
+                      S* pixels) {
+  ProjectBatch<Pack<S>>(camera, points, n, pixels);
+}
+
+template <typename S, class Camera>
+void ReprojectBatchAvx2(const Camera& camera, const S* pixels,
+                        const S* depths, int n, S* points) {
+  ReprojectBatch<Pack<S>>(camera, pixels, depths, n, points);
+}
+
+#define FARM_NG_INSTANTIATE_BATCH_AVX2(S, MODEL)                           \
+  template void ProjectBatchAvx2(const PinholeCamera<CameraModel::MODEL>&,  \
+                                 const S*, int, S*);                        \
+  template void ReprojectBatchAvx2(const PinholeCamera<CameraModel::MODEL>&, \
+                                   const S*, const S*, int, S*);
+
+FARM_NG_INSTANTIATE_BATCH_AVX2(float, DISTORTION_MODEL_INVERSE_BROWN_CONRADY)
+FARM_NG_INSTANTIATE_BATCH_AVX2(float, DISTORTION_MODEL_BROWN_CONRADY)
+FARM_NG_INSTANTIATE_BATCH_AVX2(float, DISTORTION_MODEL_KANNALA_BRANDT4)
+FARM_NG_INSTANTIATE_BATCH_AVX2(float, DISTORTION_MODEL_PANO_TOOLS_DERSCH)
+FARM_NG_INSTANTIATE_BATCH_AVX2(double, DISTORTION_MODEL_INVERSE_BROWN_CONRADY)
+FARM_NG_INSTANTIATE_BATCH_AVX2(double, DISTORTION_MODEL_BROWN_CONRADY)
+FARM_NG_INSTANTIATE_BATCH_AVX2(double, DISTORTION_MODEL_KANNALA_BRANDT4)
+FARM_NG_INSTANTIATE_BATCH_AVX2(double, DISTORTION_MODEL_PANO_TOOLS_DERSCH)
+
+#undef FARM_NG_INSTANTIATE_BATCH_AVX2
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
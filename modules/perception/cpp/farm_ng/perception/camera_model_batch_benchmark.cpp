@@ -0,0 +1,101 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_batch.h"
+
+namespace farm_ng {
+namespace perception {
+namespace {
+
+// Projects into the T265's Kannala-Brandt model, and unprojects from it, the
+// most expensive of the distortion models.
+CameraModel MakeCameraModel() { return DefaultFishEyeT265CameraModel(); }
+
+// Roughly a lidar sweep's worth of points, in front of the camera.
+Eigen::Matrix3Xd MakePoints(int n) {
+  Eigen::Matrix3Xd points(3, n);
+  for (int i = 0; i < n; ++i) {
+    points.col(i) = Eigen::Vector3d(std::sin(i * 0.37), std::cos(i * 0.11),
+                                    2.0 + std::sin(i));
+  }
+  return points;
+}
+
+// The baseline, one ProjectPointToPixel per point.
+void BM_ProjectPointToPixel(benchmark::State& state) {
+  const CameraModel model = MakeCameraModel();
+  const Eigen::Matrix3Xd points = MakePoints(state.range(0));
+  Eigen::Matrix2Xd pixels(2, points.cols());
+  for (auto _ : state) {
+    for (int i = 0; i < points.cols(); ++i) {
+      pixels.col(i) =
+          ProjectPointToPixel(model, Eigen::Vector3d(points.col(i)));
+    }
+    benchmark::DoNotOptimize(pixels.data());
+  }
+  state.SetItemsProcessed(state.iterations() * points.cols());
+}
+BENCHMARK(BM_ProjectPointToPixel)->RangeMultiplier(8)->Range(64, 1 << 18);
+
+template <typename Scalar>
+void BM_ProjectPointsToPixels(benchmark::State& state) {
+  const CameraModel model = MakeCameraModel();
+  const Eigen::Matrix<Scalar, 3, Eigen::Dynamic> points =
+      MakePoints(state.range(0)).cast<Scalar>();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ProjectPointsToPixels(model, points));
+  }
+  state.SetItemsProcessed(state.iterations() * points.cols());
+  state.SetLabel(CameraModelBatchIsa());
+}
+BENCHMARK_TEMPLATE(BM_ProjectPointsToPixels, double)
+    ->RangeMultiplier(8)
+    ->Range(64, 1 << 18);
+BENCHMARK_TEMPLATE(BM_ProjectPointsToPixels, float)
+    ->RangeMultiplier(8)
+    ->Range(64, 1 << 18);
+
+void BM_ReprojectPixelToPoint(benchmark::State& state) {
+  const CameraModel model = MakeCameraModel();
+  const Eigen::Matrix2Xd pixels =
+      ProjectPointsToPixels(model, MakePoints(state.range(0)));
+  Eigen::Matrix3Xd points(3, pixels.cols());
+  for (auto _ : state) {
+    for (int i = 0; i < pixels.cols(); ++i) {
+      points.col(i) =
+          ReprojectPixelToPoint(model, Eigen::Vector2d(pixels.col(i)), 1.0);
+    }
+    benchmark::DoNotOptimize(points.data());
+  }
+  state.SetItemsProcessed(state.iterations() * pixels.cols());
+}
+BENCHMARK(BM_ReprojectPixelToPoint)->RangeMultiplier(8)->Range(64, 1 << 18);
+
+template <typename Scalar>
+void BM_ReprojectPixelsToPoints(benchmark::State& state) {
+  const CameraModel model = MakeCameraModel();
+  const Eigen::Matrix<Scalar, 2, Eigen::Dynamic> pixels =
+      ProjectPointsToPixels(model, MakePoints(state.range(0)))
+          .cast<Scalar>();
+  const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> depths =
+      Eigen::Matrix<Scalar, Eigen::Dynamic, 1>::Ones(pixels.cols());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ReprojectPixelsToPoints(model, pixels, depths));
+  }
+  state.SetItemsProcessed(state.iterations() * pixels.cols());
+  state.SetLabel(CameraModelBatchIsa());
+}
+BENCHMARK_TEMPLATE(BM_ReprojectPixelsToPoints, double)
+    ->RangeMultiplier(8)
+    ->Range(64, 1 << 18);
+BENCHMARK_TEMPLATE(BM_ReprojectPixelsToPoints, float)
+    ->RangeMultiplier(8)
+    ->Range(64, 1 << 18);
+
+}  // namespace
+}  // namespace perception
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
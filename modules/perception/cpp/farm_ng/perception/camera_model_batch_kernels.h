@@ -0,0 +1,340 @@
+#ifndef FARM_NG_PERCEPTION_CAMERA_MODEL_BATCH_KERNELS_H_
+#define FARM_NG_PERCEPTION_CAMERA_MODEL_BATCH_KERNELS_H_
+
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "farm_ng/perception/camera_model.h"
+
+// The kernels of camera_model_batch.cpp, written against a pack of lanes,
+// Pack<S>. The baseline build, camera_model_batch.cpp, and the AVX2 build,
+// camera_model_batch_avx2.cpp, each compile them with their own Pack
+// specializations and instruction set.
+//
+// So that no function built for AVX2 can be linked in place of a baseline
+// one, everything here has internal linkage. For the same reason, the kernels
+// avoid inline functions from other headers that take scalars, e.g.
+// std::min, which the AVX2 build would emit as shared weak symbols.
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+constexpr float kEpsilon = std::numeric_limits<float>::epsilon();
+
+// Lanes of a scalar type S, with the arithmetic the kernels below need.
+// Each instruction set specializes Pack for float and double; the generic
+// template is the one lane fallback.
+template <typename S>
+struct Pack {
+  using Scalar = S;
+  static constexpr int kLanes = 1;
+  // Value initialized to all false.
+  struct Mask {
+    bool m;
+    friend Mask operator|(Mask a, Mask b) { return {a.m || b.m}; }
+    friend bool All(Mask a) { return a.m; }
+  };
+
+  Pack() = default;
+  explicit Pack(S s) : v(s) {}
+  static Pack Load(const S* p) { return Pack(*p); }
+  void Store(S* p) const { *p = v; }
+  // Lanes p[0], p[stride], ...
+  static Pack LoadStrided(const S* p, int stride) { return Pack(*p); }
+  void StoreStrided(S* p, int stride) const { *p = v; }
+  Pack& operator*=(Pack b) { return *this = *this * b; }
+
+  friend Pack operator+(Pack a, Pack b) { return Pack(a.v + b.v); }
+  friend Pack operator-(Pack a, Pack b) { return Pack(a.v - b.v); }
+  friend Pack operator*(Pack a, Pack b) { return Pack(a.v * b.v); }
+  friend Pack operator/(Pack a, Pack b) { return Pack(a.v / b.v); }
+  friend Mask operator<(Pack a, Pack b) { return {a.v < b.v}; }
+  // a where m is set, otherwise b.
+  friend Pack Select(Mask m, Pack a, Pack b) { return m.m ? a : b; }
+  friend Pack Sqrt(Pack a) { return Pack(std::sqrt(a.v)); }
+  friend Pack Abs(Pack a) { return Pack(std::abs(a.v)); }
+
+  S v;
+};
+
+// atan, for x >= 0, after Cephes: reduces x to [0, tan(pi/8)] and applies a
+// rational approximation.
+constexpr double kAtanP[] = {-8.750608600031904122785e-1,
+                             -1.615753718733365076637e1,
+                             -7.500855792314704667340e1,
+                             -1.228866684490136173410e2,
+                             -6.485021904942025371773e1};
+constexpr double kAtanQ[] = {2.485846490142306297962e1,
+                             1.650270098316988542046e2,
+                             4.328810604912902668951e2,
+                             4.853903996359136964868e2,
+                             1.945506571482613964425e2};
+
+template <class P>
+P AtanNonNegative(P x) {
+  using S = typename P::Scalar;
+  const P zero(0);
+  const P one(1);
+  // Low bits of pi/4.
+  const S more_bits = S(6.123233995736765886130e-17);
+  const auto big = P(S(2.41421356237309504880)) < x;  // tan(3 pi / 8)
+  const auto mid = P(S(0.66)) < x;
+  P y = Select(big, P(S(M_PI_2)), Select(mid, P(S(M_PI_4)), zero));
+  P correction =
+      Select(big, P(more_bits), Select(mid, P(S(0.5) * more_bits), zero));
+  x = Select(big, zero - one / x, Select(mid, (x - one) / (x + one), x));
+  P z = x * x;
+  P num = P(S(kAtanP[0]));
+  P den = z + P(S(kAtanQ[0]));
+  for (int i = 1; i < 5; ++i) {
+    num = num * z + P(S(kAtanP[i]));
+    den = den * z + P(S(kAtanQ[i]));
+  }
+  return y + (x * (z * num / den) + x + correction);
+}
+
+// There is no vector tan, so it is applied lane by lane, in double: the
+// float overload of std::tan is an inline function.
+template <class P>
+P TanLanes(P a) {
+  using S = typename P::Scalar;
+  alignas(64) S lanes[P::kLanes];
+  a.Store(lanes);
+  for (S& lane : lanes) {
+    lane = S(std::tan(double(lane)));
+  }
+  return P::Load(lanes);
+}
+
+// Lane-wise Distortion<Model>. The branch free kernels of camera_model.h run
+// on packs as they are; those that branch per point are restated here with
+// selects, and must be kept in sync.
+template <CameraModel::DistortionModel Model>
+struct BatchDistortion : Distortion<Model> {};
+
+template <>
+struct BatchDistortion<CameraModel::DISTORTION_MODEL_BROWN_CONRADY>
+    : Distortion<CameraModel::DISTORTION_MODEL_BROWN_CONRADY> {
+  template <class P>
+  static void Undistort(const P* k, P* x_io, P* y_io) {
+    const P zero(0);
+    const P one(1);
+    const P two(2);
+    const P x0 = *x_io;
+    const P y0 = *y_io;
+    P x = x0;
+    P y = y0;
+    typename P::Mask failed{};
+    for (int j = 0; j < 5; j++) {
+      P r2 = x * x + y * y;
+      P icdist = (one + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2) /
+                 (one + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2);
+      failed = failed | (icdist < zero);
+      P deltaX = two * k[2] * x * y + k[3] * (r2 + two * x * x);
+      P deltaY = k[2] * (r2 + two * y * y) + two * k[3] * x * y;
+      x = (x0 - deltaX) * icdist;
+      y = (y0 - deltaY) * icdist;
+    }
+    *x_io = Select(failed, x0, x);
+    *y_io = Select(failed, y0, y);
+  }
+};
+
+template <>
+struct BatchDistortion<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4>
+    : Distortion<CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4> {
+  template <class P>
+  static void Distort(const P* k, P* x, P* y) {
+    const P eps(kEpsilon);
+    P r = Sqrt(*x * *x + *y * *y);
+    r = Select(r < eps, eps, r);
+    P theta = AtanNonNegative(r);
+    P theta2 = theta * theta;
+    P series =
+        P(1) +
+        theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3])));
+    P rd = theta * series;
+    *x = *x * (rd / r);
+    *y = *y * (rd / r);
+  }
+
+  template <class P>
+  static void Undistort(const P* k, P* x, P* y) {
+    const P eps(kEpsilon);
+    const P one(1);
+    P rd = Sqrt(*x * *x + *y * *y);
+    rd = Select(rd < eps, eps, rd);
+    P theta = rd;
+    P theta2 = rd * rd;
+    typename P::Mask converged{};
+    for (int i = 0; i < 4; i++) {
+      P series =
+          one +
+          theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3])));
+      P f = theta * series - rd;
+      converged = converged | (Abs(f) < eps);
+      if (All(converged)) {
+        break;
+      }
+      P df = one + theta2 * (P(3) * k[0] +
+                             theta2 * (P(5) * k[1] +
+                                       theta2 * (P(7) * k[2] +
+                                                 P(9) * theta2 * k[3])));
+      theta = Select(converged, theta, theta - f / df);
+      theta2 = theta * theta;
+    }
+    P r = TanLanes(theta);
+    *x = *x * (r / rd);
+    *y = *y * (r / rd);
+  }
+};
+
+template <>
+struct BatchDistortion<CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH>
+    : Distortion<CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH> {
+  template <class P>
+  static void Distort(const P* k, P* x, P* y) {
+    const P eps(kEpsilon);
+    P r_corr = Sqrt(*x * *x + *y * *y);
+    r_corr = Select(r_corr < eps, eps, r_corr);
+    P r_dist = k[0] * r_corr * r_corr * r_corr * r_corr +
+               k[1] * r_corr * r_corr * r_corr + k[2] * r_corr * r_corr +
+               r_corr;
+    *x = *x * (r_dist / r_corr);
+    *y = *y * (r_dist / r_corr);
+  }
+
+  // Unsupported, as in Distortion, without the inline DistortionModel_Name.
+  template <class P>
+  static void Undistort(const P*, P*, P*) {
+    LOG(FATAL) << "Unsupported distortion model: "
+                  "DISTORTION_MODEL_PANO_TOOLS_DERSCH";
+  }
+};
+
+// Intrinsics of camera, broadcast to packs.
+template <class P, class Camera>
+struct PackedCamera {
+  using S = typename P::Scalar;
+
+  explicit PackedCamera(const Camera& camera)
+      : fx(S(camera.fx)), fy(S(camera.fy)), cx(S(camera.cx)), cy(S(camera.cy)) {
+    for (int i = 0; i < Camera::num_coefficients; ++i) {
+      k[i] = P(S(camera.k[i]));
+    }
+  }
+
+  P fx;
+  P fy;
+  P cx;
+  P cy;
+  P k[Camera::num_coefficients];
+};
+
+// Projects a pack of points, column major 3xkLanes, to pixels, 2xkLanes.
+template <class P, class Camera>
+void ProjectPack(const PackedCamera<P, Camera>& camera,
+                 const typename P::Scalar* points,
+                 typename P::Scalar* pixels) {
+  P z = P::LoadStrided(points + 2, 3);
+  P x = P::LoadStrided(points, 3) / z;
+  P y = P::LoadStrided(points + 1, 3) / z;
+  BatchDistortion<Camera::distortion_model>::Distort(camera.k, &x, &y);
+  (x * camera.fx + camera.cx).StoreStrided(pixels, 2);
+  (y * camera.fy + camera.cy).StoreStrided(pixels + 1, 2);
+}
+
+// Reprojects a pack of pixels, column major 2xkLanes, at depths to points,
+// 3xkLanes.
+template <class P, class Camera>
+void ReprojectPack(const PackedCamera<P, Camera>& camera,
+                   const typename P::Scalar* pixels,
+                   const typename P::Scalar* depths,
+                   typename P::Scalar* points) {
+  P x = (P::LoadStrided(pixels, 2) - camera.cx) / camera.fx;
+  P y = (P::LoadStrided(pixels + 1, 2) - camera.cy) / camera.fy;
+  BatchDistortion<Camera::distortion_model>::Undistort(camera.k, &x, &y);
+  P depth = P::Load(depths);
+  (depth * x).StoreStrided(points, 3);
+  (depth * y).StoreStrided(points + 1, 3);
+  depth.StoreStrided(points + 2, 3);
+}
+
+// The last partial pack of ProjectBatch and ReprojectBatch runs on copies,
+// padded by repeating the last column.
+inline int LastAt(int i, int n) { return i < n ? i : n - 1; }
+
+template <typename S>
+void CopyValues(const S* from, int n, S* to) {
+  for (int i = 0; i < n; ++i) {
+    to[i] = from[i];
+  }
+}
+
+template <class P, class Camera>
+void ProjectBatch(const Camera& camera, const typename P::Scalar* points,
+                  int n, typename P::Scalar* pixels) {
+  using S = typename P::Scalar;
+  constexpr int kLanes = P::kLanes;
+  const PackedCamera<P, Camera> packed(camera);
+  int i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    ProjectPack(packed, points + 3 * i, pixels + 2 * i);
+  }
+  if (i < n) {
+    S points_pad[3 * kLanes];
+    S pixels_pad[2 * kLanes];
+    for (int l = 0; l < kLanes; ++l) {
+      CopyValues(points + 3 * LastAt(i + l, n), 3, points_pad + 3 * l);
+    }
+    ProjectPack(packed, points_pad, pixels_pad);
+    CopyValues(pixels_pad, 2 * (n - i), pixels + 2 * i);
+  }
+}
+
+template <class P, class Camera>
+void ReprojectBatch(const Camera& camera, const typename P::Scalar* pixels,
+                    const typename P::Scalar* depths, int n,
+                    typename P::Scalar* points) {
+  using S = typename P::Scalar;
+  constexpr int kLanes = P::kLanes;
+  const PackedCamera<P, Camera> packed(camera);
+  int i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    ReprojectPack(packed, pixels + 2 * i, depths + i, points + 3 * i);
+  }
+  if (i < n) {
+    S pixels_pad[2 * kLanes];
+    S depths_pad[kLanes];
+    S points_pad[3 * kLanes];
+    for (int l = 0; l < kLanes; ++l) {
+      const int j = LastAt(i + l, n);
+      CopyValues(pixels + 2 * j, 2, pixels_pad + 2 * l);
+      depths_pad[l] = depths[j];
+    }
+    ReprojectPack(packed, pixels_pad, depths_pad, points_pad);
+    CopyValues(points_pad, 3 * (n - i), points + 3 * i);
+  }
+}
+
+}  // namespace
+
+#if defined(__x86_64__)
+// Defined in camera_model_batch_avx2.cpp, for each PinholeCamera, in float
+// and double. Only call these where the CPU supports AVX2 and FMA.
+template <typename S, class Camera>
+void ProjectBatchAvx2(const Camera& camera, const S* points, int n,
+                      S* pixels);
+template <typename S, class Camera>
+void ReprojectBatchAvx2(const Camera& camera, const S* pixels,
+                        const S* depths, int n, S* points);
+#endif
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,78 @@
+#include "farm_ng/perception/camera_model_batch.h"
+
+#include <cmath>
+
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_test_utils.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+using namespace farm_ng::perception;
+
+namespace {
+
+// Spans the field of view, with n not a multiple of any pack size so the
+// padded tail is exercised.
+Eigen::Matrix3Xd MakePoints(int n) {
+  Eigen::Matrix3Xd points(3, n);
+  for (int i = 0; i < n; ++i) {
+    points.col(i) = Eigen::Vector3d(0.8 * std::sin(i * 0.37),
+                                    0.6 * std::cos(i * 0.11),
+                                    1.0 + 0.5 * std::sin(i));
+  }
+  return points;
+}
+
+void ExpectMatchesSinglePoint() {
+  for (auto distortion_model :
+       {CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4,
+        CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY,
+        CameraModel::DISTORTION_MODEL_BROWN_CONRADY,
+        CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH}) {
+    CameraModel model = MakeDistortedCameraModel(distortion_model);
+    for (int n : {0, 1, 3, 37}) {
+      Eigen::Matrix3Xd points = MakePoints(n);
+      Eigen::Matrix2Xd pixels = ProjectPointsToPixels(model, points);
+      Eigen::Matrix2Xf pixels_f =
+          ProjectPointsToPixels(model, Eigen::Matrix3Xf(points.cast<float>()));
+      ASSERT_EQ(pixels.cols(), n);
+      for (int i = 0; i < n; ++i) {
+        Eigen::Vector2d pixel =
+            ProjectPointToPixel(model, Eigen::Vector3d(points.col(i)));
+        EXPECT_NEAR((pixels.col(i) - pixel).norm(), 0.0, 1e-9);
+        EXPECT_NEAR((pixels_f.col(i).cast<double>() - pixel).norm(), 0.0,
+                    1e-3);
+      }
+      if (distortion_model ==
+          CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH) {
+        continue;
+      }
+      Eigen::VectorXd depths = points.row(2).transpose();
+      Eigen::Matrix3Xd reprojected =
+          ReprojectPixelsToPoints(model, pixels, depths);
+      Eigen::Matrix3Xf reprojected_f = ReprojectPixelsToPoints(
+          model, Eigen::Matrix2Xf(pixels.cast<float>()),
+          Eigen::VectorXf(depths.cast<float>()));
+      for (int i = 0; i < n; ++i) {
+        Eigen::Vector3d point = ReprojectPixelToPoint(
+            model, Eigen::Vector2d(pixels.col(i)), depths[i]);
+        EXPECT_NEAR((reprojected.col(i) - point).norm(), 0.0, 1e-9);
+        EXPECT_NEAR((reprojected_f.col(i).cast<double>() - point).norm(), 0.0,
+                    1e-5);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+TEST(camera_model_batch, matches_single_point) {
+  // The AVX2 kernels where the CPU supports them, then the baseline ones.
+  for (bool avx2 : {true, false}) {
+    SetCameraModelBatchAvx2Enabled(avx2);
+    SCOPED_TRACE(CameraModelBatchIsa());
+    LOG(INFO) << "isa: " << CameraModelBatchIsa();
+    ExpectMatchesSinglePoint();
+  }
+  SetCameraModelBatchAvx2Enabled(true);
+}
@@ -1,8 +1,12 @@
 #include "farm_ng/perception/camera_model.h"
+
+#include <array>
+#include <vector>
+
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
-using namespace farm_ng;
+using namespace farm_ng::perception;
 
 TEST(camera_model, smoke) {
   CameraModel model = DefaultFishEyeT265CameraModel();
@@ -44,3 +48,116 @@ TEST(apriltag_size_study, smoke) {
     }
   }
 }
+
+namespace {
+
+struct ProjectionReference {
+  CameraModel::DistortionModel distortion_model;
+  int n_coefficients;
+  // kPoints projected by the implementation before PinholeCamera.
+  std::array<Eigen::Vector2d, 4> pixels;
+  // The pixels reprojected at each point's depth by that implementation, or
+  // empty where it could not reproject.
+  std::vector<Eigen::Vector3d> points;
+};
+
+const std::array<Eigen::Vector3d, 4> kPoints = {
+    {{0.0, 0.0, 1.0}, {-0.5, 0.3, 2.0}, {0.3, -0.2, 1.5}, {0.8, 0.6, 2.0}}};
+
+CameraModel MakeCameraModel(const ProjectionReference& reference) {
+  const double coefficients[8] = {-0.01,  0.03,  -0.002,  0.001,
+                                  0.0005, 0.001, -0.0002, 0.0001};
+  CameraModel model;
+  model.set_image_width(640);
+  model.set_image_height(480);
+  model.set_fx(400);
+  model.set_fy(410);
+  model.set_cx(320);
+  model.set_cy(240);
+  model.set_distortion_model(reference.distortion_model);
+  for (int i = 0; i < reference.n_coefficients; ++i) {
+    model.add_distortion_coefficients(coefficients[i]);
+  }
+  return model;
+}
+
+}  // namespace
+
+TEST(camera_model, pinhole_camera_matches_reference) {
+  const std::vector<ProjectionReference> references = {
+      {CameraModel::DISTORTION_MODEL_KANNALA_BRANDT4,
+       5,
+       {{{320.000000000, 240.000000000},
+         {222.756562305, 299.804714182},
+         {398.474140567, 186.376003946},
+         {468.251349354, 353.968224816}}},
+       {{0.000000000000, 0.000000000000, 1.0},
+        {-0.499999999910, 0.299999999946, 2.0},
+        {0.299999999946, -0.199999999964, 1.5},
+        {0.800000003998, 0.600000002998, 2.0}}},
+      {CameraModel::DISTORTION_MODEL_INVERSE_BROWN_CONRADY,
+       5,
+       {{{320.000000000, 240.000000000},
+         {220.207155090, 301.323809619},
+         {400.059503828, 185.261087199},
+         {479.937328976, 362.669946650}}},
+       {{0.000000000000, 0.000000000000, 1.0},
+        {-0.497932644692, 0.298285082898, 2.0},
+        {0.300446899799, -0.200529310109, 1.5},
+        {0.799371856368, 0.596783633362, 2.0}}},
+      {CameraModel::DISTORTION_MODEL_BROWN_CONRADY,
+       5,
+       {{{320.000000000, 240.000000000},
+         {220.157294294, 301.323724009},
+         {400.027575123, 185.261038481},
+         {479.809250000, 362.669885937}}},
+       {{0.000000000000, 0.000000000000, 1.0},
+        {-0.500250839680, 0.300000419444, 2.0},
+        {0.299880087897, -0.200000086028, 1.5},
+        {0.799361409609, 0.600000141348, 2.0}}},
+      {CameraModel::DISTORTION_MODEL_BROWN_CONRADY,
+       8,
+       {{{320.000000000, 240.000000000},
+         {220.165649944, 301.318585285},
+         {400.023007213, 185.264159886},
+         {479.771032744, 362.640506422}}},
+       {{0.000000000000, 0.000000000000, 1.0},
+        {-0.500250891227, 0.300000437844, 2.0},
+        {0.299880071703, -0.200000079807, 1.5},
+        {0.799361070105, 0.600000000205, 2.0}}},
+      {CameraModel::DISTORTION_MODEL_PANO_TOOLS_DERSCH,
+       5,
+       {{{320.000000000, 240.000000000},
+         {219.828091065, 301.605723995},
+         {400.089097014, 185.272450374},
+         {480.840000000, 363.645750000}}},
+       {}},
+  };
+  for (const ProjectionReference& reference : references) {
+    CameraModel model = MakeCameraModel(reference);
+    SCOPED_TRACE(model.ShortDebugString());
+    VisitPinholeCamera(model, [&](const auto& camera) {
+      for (size_t i = 0; i < kPoints.size(); ++i) {
+        const Eigen::Vector2d& pixel = reference.pixels[i];
+        EXPECT_NEAR(
+            (ProjectPointToPixel(model, kPoints[i]) - pixel).norm(), 0.0, 1e-8);
+        EXPECT_NEAR((ProjectPointToPixel(camera, kPoints[i]) - pixel).norm(),
+                    0.0, 1e-8);
+        if (reference.points.empty()) {
+          continue;
+        }
+        // Kannala-Brandt undistortion differs from the reference by about
+        // 1e-11, see its Newton step.
+        const double depth = kPoints[i].z();
+        EXPECT_NEAR((ReprojectPixelToPoint(model, pixel, depth) -
+                     reference.points[i])
+                        .norm(),
+                    0.0, 1e-9);
+        EXPECT_NEAR((ReprojectPixelToPoint(camera, pixel, depth) -
+                     reference.points[i])
+                        .norm(),
+                    0.0, 1e-9);
+      }
+    });
+  }
+}
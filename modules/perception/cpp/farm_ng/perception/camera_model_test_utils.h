@@ -0,0 +1,30 @@
+#ifndef FARM_NG_PERCEPTION_CAMERA_MODEL_TEST_UTILS_H_
+#define FARM_NG_PERCEPTION_CAMERA_MODEL_TEST_UTILS_H_
+
+#include <cmath>
+
+#include "farm_ng/perception/camera_model.h"
+
+namespace farm_ng {
+namespace perception {
+
+// A 90 degree camera with small, nonzero distortion coefficients, for tests
+// that exercise the distortion models. Models that take fewer than 8
+// coefficients ignore the rest.
+inline CameraModel MakeDistortedCameraModel(
+    CameraModel::DistortionModel distortion_model, int image_width = 640,
+    int image_height = 480) {
+  CameraModel model = CreateCameraModel(M_PI / 2, image_width, image_height);
+  model.set_distortion_model(distortion_model);
+  model.clear_distortion_coefficients();
+  for (double k :
+       {-0.01, 0.03, -0.002, 0.001, 0.0005, 0.001, -0.0002, 0.0001}) {
+    model.add_distortion_coefficients(k);
+  }
+  return model;
+}
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
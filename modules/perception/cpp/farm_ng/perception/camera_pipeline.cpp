@@ -1,13 +1,20 @@
 #include "farm_ng/perception/camera_pipeline.h"
 
+#include <algorithm>
+
 #include <opencv2/opencv.hpp>
 
+#include "farm_ng/core/trace.h"
+
 #include "farm_ng/perception/camera_model.h"
-#include "farm_ng/perception/image_utils.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
 
 using farm_ng::core::Bucket;
+using farm_ng::core::GetMetricsRegistry;
 using farm_ng::core::MakeEvent;
 using farm_ng::core::ReadProtobufFromJsonFile;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::TraceSpan;
 
 namespace farm_ng {
 namespace perception {
@@ -16,13 +23,52 @@ typedef boost::signals2::signal<void(
     const std::vector<FrameData>& synced_frames)>
     Signal;
 
+namespace {
+// Bounds the frames buffered per camera, ample for the 500ms kept at 60fps.
+const size_t kMaxBufferedFrames = 64;
+const int64_t kHistoryNs = 500 * 1000000LL;
+// Used until a camera's period has been estimated.
+const int64_t kDefaultPeriodNs = 1000000000LL / 7;
+// Bounds on how long to wait for a set to complete.
+const int64_t kMinDeadlineNs = 5 * 1000000LL;
+const int64_t kMaxDeadlineNs = 250 * 1000000LL;
+// A slower camera must be this much slower to become the reference.
+const double kReferenceHysteresis = 1.1;
+
+// Default queue capacity for POLICY_KEEP_N and POLICY_BLOCK.
+const size_t kDefaultQueueCapacity = 4;
+
+size_t QueueCapacity(const CameraQueueConfig& config) {
+  switch (config.policy()) {
+    case CameraQueueConfig::POLICY_KEEP_N:
+    case CameraQueueConfig::POLICY_BLOCK:
+      return config.capacity() > 0 ? config.capacity() : kDefaultQueueCapacity;
+    default:
+      return 1;
+  }
+}
+
+// Exponential moving average, with weight 1/2^shift on the new sample.
+int64_t Smooth(int64_t average, int64_t sample, int shift) {
+  return average + (sample - average) / (1 << shift);
+}
+}  // namespace
+
 MultiCameraSync::MultiCameraSync(EventBus& event_bus)
-    : event_bus_(event_bus), timer_(event_bus.get_io_service()) {}
+    : event_bus_(event_bus),
+      deadline_timer_(event_bus.get_io_service()),
+      status_timer_(event_bus.get_io_service()) {
+  SendStatus(boost::system::error_code());
+}
 
 CameraModel MultiCameraSync::AddCameraConfig(
     const CameraConfig& camera_config) {
   frame_grabbers_.emplace_back(
       FrameGrabber::MakeFrameGrabber(event_bus_, camera_config));
+  Stream stream;
+  stream.frame_name = frame_grabbers_.back()->GetCameraModel().frame_name();
+  stream.frames.set_capacity(kMaxBufferedFrames);
+  streams_.push_back(std::move(stream));
   frame_grabbers_.back()->VisualFrameSignal().connect(
       std::bind(&MultiCameraSync::OnFrame, this, std::placeholders::_1));
   return frame_grabbers_.back()->GetCameraModel();
@@ -30,122 +76,342 @@ CameraModel MultiCameraSync::AddCameraConfig(
 
 Signal& MultiCameraSync::GetSynchronizedFrameDataSignal() { return signal_; }
 
-std::vector<FrameData> MultiCameraSync::CollectSynchronizedFrameData() {
-  std::vector<FrameData> synced_frames;
-  std::lock_guard<std::mutex> lock(frame_series_mtx_);
-  auto time_window =
-      google::protobuf::util::TimeUtil::MillisecondsToDuration(1000.0 / 7);
-
-  for (const auto& grabber : frame_grabbers_) {
-    const auto& frame_name = grabber->GetCameraModel().frame_name();
-    const auto& series = frame_series_[frame_name];
-    auto closest = series.FindNearest(latest_frame_stamp_, time_window);
-    if (closest) {
-      synced_frames.push_back(*closest);
-    } else {
-      LOG(INFO) << "Could not find nearest frame for camera: " << frame_name
-                << " " << latest_frame_stamp_.ShortDebugString();
+void MultiCameraSync::ConnectBeforeSync(
+    const std::string& frame_name,
+    std::function<void(const FrameData&)> slot) {
+  auto grabber = std::find_if(
+      frame_grabbers_.begin(), frame_grabbers_.end(),
+      [&frame_name](const std::unique_ptr<FrameGrabber>& frame_grabber) {
+        return frame_grabber->GetCameraModel().frame_name() == frame_name;
+      });
+  CHECK(grabber != frame_grabbers_.end()) << "Unknown camera: " << frame_name;
+  // The grabber is already running, signals2 makes connecting thread safe.
+  (*grabber)->VisualFrameSignal().connect(slot, boost::signals2::at_front);
+}
+
+MultiCameraSyncStatus MultiCameraSync::GetStatus() const {
+  MultiCameraSyncStatus status;
+  status.set_sets(n_sets_);
+  status.set_complete_sets(n_complete_sets_);
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    const Stream& stream = streams_[i];
+    CameraSyncStatus* camera = status.add_cameras();
+    camera->set_frame_name(stream.frame_name);
+    if (stream.period_ns > 0) {
+      camera->set_frame_rate(1e9 / stream.period_ns);
+    }
+    camera->set_skew_ms(stream.offset_ns * 1e-6);
+    camera->set_reference(i == reference_);
+    camera->set_frames(stream.n_frames);
+    camera->set_frames_synced(stream.n_synced);
+    if (n_sets_ > 0) {
+      camera->set_completeness(double(stream.n_synced) / n_sets_);
     }
   }
-  return synced_frames;
+  return status;
 }
 
-void MultiCameraSync::GetSynchronizedFrameData(
-    const boost::system::error_code& error) {
+void MultiCameraSync::SendStatus(const boost::system::error_code& error) {
   if (error) {
-    LOG(WARNING) << "Synchronized frame timer error (frame sync may not be "
-                    "keeping up): "
-                 << error;
+    LOG(WARNING) << "sync status timer error: " << error;
     return;
   }
-  signal_(CollectSynchronizedFrameData());
+  status_timer_.expires_from_now(std::chrono::seconds(1));
+  status_timer_.async_wait(
+      std::bind(&MultiCameraSync::SendStatus, this, std::placeholders::_1));
+  if (streams_.empty()) {
+    return;
+  }
+  auto status = GetStatus();
+  VLOG(1) << status.ShortDebugString();
+  event_bus_.Send(MakeEvent(event_bus_.GetName() + "/sync_status", status));
 }
 
 void MultiCameraSync::OnFrame(const FrameData& frame_data) {
-  std::lock_guard<std::mutex> lock(frame_series_mtx_);
-  TimeSeries<FrameData>& series =
-      frame_series_[frame_data.camera_model.frame_name()];
-  series.insert(frame_data);
-  series.RemoveBefore(
-      frame_data.stamp() -
-      google::protobuf::util::TimeUtil::MillisecondsToDuration(500));
-  VLOG(2) << frame_data.camera_model.frame_name()
-          << " n frames: " << series.size();
-
-  if (frame_data.camera_model.frame_name() ==
-      frame_grabbers_.front()->GetCameraModel().frame_name()) {
-    latest_frame_stamp_ = frame_data.stamp();
-    // schedule a bit into the future to give opportunity for other streams
-    // that are slightly offset to be grabbed.
-    // TODO base this on frame frate from frame grabber.
-    timer_.expires_from_now(std::chrono::milliseconds(int(250.0 / 30.0)));
-    timer_.async_wait(std::bind(&MultiCameraSync::GetSynchronizedFrameData,
-                                this, std::placeholders::_1));
+  TraceSpan span("multi_camera_sync/on_frame", frame_data.stamp());
+  // Synchronize on the event bus thread, which also runs the deadline timer
+  // and delivers the synchronized sets.
+  event_bus_.get_io_service().post(
+      [this, frame_data]() mutable { AddFrame(std::move(frame_data)); });
+}
+
+void MultiCameraSync::AddFrame(FrameData frame_data) {
+  auto stream_it = std::find_if(
+      streams_.begin(), streams_.end(), [&frame_data](const Stream& stream) {
+        return stream.frame_name == frame_data.camera_model.frame_name();
+      });
+  CHECK(stream_it != streams_.end())
+      << "Unknown camera: " << frame_data.camera_model.frame_name();
+  Stream& stream = *stream_it;
+  const int64_t stamp_ns = StampToNanoseconds(frame_data.stamp());
+
+  if (stream.n_frames > 0 && stamp_ns > stream.last_stamp_ns) {
+    int64_t dt = stamp_ns - stream.last_stamp_ns;
+    if (stream.period_ns == 0) {
+      stream.period_ns = dt;
+    } else {
+      // Clamped so dropped frames only nudge the estimate.
+      stream.period_ns =
+          Smooth(stream.period_ns, std::min(dt, 3 * stream.period_ns), 4);
+    }
+  }
+  stream.last_stamp_ns = stamp_ns;
+  stream.n_frames++;
+  stream.frames.insert(std::move(frame_data));
+  stream.frames.RemoveBefore(stamp_ns - kHistoryNs);
+  UpdateReference();
+
+  if (&stream == &streams_[reference_]) {
+    if (pending_stamp_ns_) {
+      // The previous set's deadline hasn't passed, but a new one is starting.
+      TryEmit(true);
+    }
+    pending_stamp_ns_ = stamp_ns;
+    uint64_t set_id = ++set_id_;
+    int64_t deadline_ns = 0;
+    for (const Stream& s : streams_) {
+      deadline_ns = std::max(
+          deadline_ns, s.period_ns > 0 ? s.period_ns : kDefaultPeriodNs);
+    }
+    deadline_ns = std::clamp(deadline_ns, kMinDeadlineNs, kMaxDeadlineNs);
+    deadline_timer_.expires_from_now(std::chrono::nanoseconds(deadline_ns));
+    deadline_timer_.async_wait(std::bind(&MultiCameraSync::OnDeadline, this,
+                                         std::placeholders::_1, set_id));
+  }
+  if (pending_stamp_ns_) {
+    TryEmit(false);
+  }
+}
+
+void MultiCameraSync::UpdateReference() {
+  size_t reference = reference_;
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i].period_ns >
+        streams_[reference].period_ns * kReferenceHysteresis) {
+      reference = i;
+    }
+  }
+  if (reference != reference_) {
+    LOG(INFO) << "Synchronizing camera frames to: "
+              << streams_[reference].frame_name;
+    reference_ = reference;
+    // Offsets were relative to the old reference.
+    for (Stream& stream : streams_) {
+      stream.offset_ns = 0;
+    }
+  }
+}
+
+void MultiCameraSync::TryEmit(bool deadline_passed) {
+  CHECK(pending_stamp_ns_);
+  const int64_t reference_stamp_ns = *pending_stamp_ns_;
+  std::vector<const FrameData*> matches(streams_.size(), nullptr);
+  bool complete = true;
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    const Stream& stream = streams_[i];
+    int64_t period_ns =
+        stream.period_ns > 0 ? stream.period_ns : kDefaultPeriodNs;
+    const FrameData* match = stream.frames.FindNearest(
+        reference_stamp_ns + stream.offset_ns, period_ns / 2);
+    if (match &&
+        StampToNanoseconds(match->stamp()) > stream.last_synced_stamp_ns) {
+      matches[i] = match;
+    } else {
+      complete = false;
+    }
+  }
+  if (!complete && !deadline_passed) {
+    return;
+  }
+
+  std::vector<FrameData> synced_frames;
+  synced_frames.reserve(streams_.size());
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    Stream& stream = streams_[i];
+    if (!matches[i]) {
+      VLOG(1) << "Could not find nearest frame for camera: "
+              << stream.frame_name << " " << reference_stamp_ns;
+      continue;
+    }
+    const int64_t stamp_ns = StampToNanoseconds(matches[i]->stamp());
+    stream.offset_ns =
+        Smooth(stream.offset_ns, stamp_ns - reference_stamp_ns, 3);
+    stream.last_synced_stamp_ns = stamp_ns;
+    stream.n_synced++;
+    synced_frames.push_back(*matches[i]);
+  }
+  pending_stamp_ns_.reset();
+  deadline_timer_.cancel();
+  n_sets_++;
+  if (complete) {
+    n_complete_sets_++;
+  }
+  if (synced_frames.empty()) {
+    return;
+  }
+  TraceSpan span("multi_camera_sync/emit", synced_frames.front().stamp());
+  signal_(synced_frames);
+}
+
+void MultiCameraSync::OnDeadline(const boost::system::error_code& error,
+                                 uint64_t set_id) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    LOG(WARNING) << "Synchronized frame timer error: " << error;
+    return;
+  }
+  if (set_id == set_id_ && pending_stamp_ns_) {
+    TryEmit(true);
   }
 }
 
 SingleCameraPipeline::SingleCameraPipeline(
     EventBus& event_bus, boost::asio::io_service& pool_service,
-    const CameraConfig& camera_config, const CameraModel& camera_model)
+    const CameraConfig& camera_config, const CameraModel& camera_model,
+    RawFrameTranscoder& transcoder)
     : event_bus_(event_bus),
       strand_(pool_service),
       camera_model_(camera_model),
       detector_(camera_model_),
       video_file_writer_(event_bus_, camera_model_,
                          VideoStreamer::Mode::MODE_MP4_FILE),
-      post_count_(0) {
-  if (camera_config.has_udp_stream_port()) {
-    udp_streamer_ = std::make_unique<VideoStreamer>(
-        event_bus_, camera_model_, VideoStreamer::MODE_MP4_UDP,
-        camera_config.udp_stream_port().value());
+      raw_recorder_(event_bus_, camera_model_,
+                    [&transcoder](const RawFrameChunk& chunk) {
+                      transcoder.Post(chunk);
+                    }),
+      stable_frames_(GetMetricsRegistry().GetCounter(
+          "camera_pipeline/stable_frames/" + camera_model.frame_name())),
+      queue_policy_(camera_config.queue().policy()),
+      queue_capacity_(QueueCapacity(camera_config.queue())),
+      frames_posted_(GetMetricsRegistry().GetCounter(
+          "camera_pipeline/posted/" + camera_model.frame_name())),
+      frames_processed_(GetMetricsRegistry().GetCounter(
+          "camera_pipeline/processed/" + camera_model.frame_name())),
+      frames_dropped_(GetMetricsRegistry().GetCounter(
+          "camera_pipeline/dropped/" + camera_model.frame_name())),
+      latency_(GetMetricsRegistry().GetHistogram(
+          "camera_pipeline/latency/" + camera_model.frame_name())) {
+  if (queue_policy_ == CameraQueueConfig::POLICY_UNSPECIFIED) {
+    queue_policy_ = CameraQueueConfig::POLICY_LATEST_ONLY;
+  }
+  auto profiles = StreamProfiles(camera_config);
+  if (!profiles.empty()) {
+    udp_streamer_ = std::make_unique<SimulcastStreamer>(
+        event_bus_, camera_model_, profiles);
+  }
+  if (camera_config.has_point_cloud()) {
+    // Full resolution clouds are hundreds of datagrams per frame.
+    CHECK(camera_config.point_cloud().voxel_size() > 0 ||
+          camera_config.point_cloud().stride() > 1)
+        << "point_cloud needs a voxel_size or stride to downsample: "
+        << camera_config.ShortDebugString();
+    point_cloud_ = std::make_unique<DepthmapPointCloud>(
+        camera_model_, camera_config.point_cloud());
   }
 }
 
 void SingleCameraPipeline::Post(CameraPipelineCommand command) {
   strand_.post([this, command] {
     latest_command_.CopyFrom(command);
+    if (latest_command_.has_record_start()) {
+      raw_recorder_.set_config(latest_command_.record_start().raw());
+    }
     LOG(INFO) << "Camera pipeline: " << camera_model_.frame_name()
               << " command: " << latest_command_.ShortDebugString();
   });
 }
 
-int SingleCameraPipeline::PostCount() const { return post_count_; }
-
 void SingleCameraPipeline::Post(FrameData frame_data) {
-  post_count_++;
-  strand_.post([this, frame_data] {
-    Compute(frame_data);
-    post_count_--;
-    CHECK_GE(post_count_, 0);
-  });
+  std::lock_guard<std::mutex> lock(queue_mtx_);
+  frames_posted_.Increment();
+  // With POLICY_BLOCK the queue may briefly exceed capacity, by the frames
+  // already admitted by WaitForRoom and waiting to be synchronized.
+  if (queue_policy_ != CameraQueueConfig::POLICY_BLOCK &&
+      queue_.size() >= queue_capacity_) {
+    // Keep the newest frames.
+    queue_.pop_front();
+    frames_dropped_.Increment();
+  }
+  queue_.push_back({std::move(frame_data), std::chrono::steady_clock::now()});
+  if (!computing_) {
+    computing_ = true;
+    strand_.post([this] { ComputeNext(); });
+  }
+}
+
+void SingleCameraPipeline::WaitForRoom() {
+  if (queue_policy_ != CameraQueueConfig::POLICY_BLOCK) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(queue_mtx_);
+  queue_cv_.wait(lock, [this] { return queue_.size() < queue_capacity_; });
+}
+
+void SingleCameraPipeline::ComputeNext() {
+  QueuedFrame frame;
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    CHECK(!queue_.empty());
+    frame = std::move(queue_.front());
+    queue_.pop_front();
+  }
+  queue_cv_.notify_one();
+
+  Compute(std::move(frame.frame_data));
+  latency_.Record(std::chrono::steady_clock::now() - frame.posted);
+  frames_processed_.Increment();
+
+  std::lock_guard<std::mutex> lock(queue_mtx_);
+  if (queue_.empty()) {
+    computing_ = false;
+    return;
+  }
+  strand_.post([this] { ComputeNext(); });
+}
+
+CameraQueueStatus SingleCameraPipeline::GetStatus() const {
+  CameraQueueStatus status;
+  status.set_frame_name(camera_model_.frame_name());
+  status.set_policy(queue_policy_);
+  status.set_capacity(queue_capacity_);
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    status.set_depth(queue_.size());
+  }
+  status.set_frames_posted(frames_posted_.value());
+  status.set_frames_processed(frames_processed_.value());
+  status.set_frames_dropped(frames_dropped_.value());
+  *status.mutable_latency() = latency_.Summary("latency");
+  return status;
 }
 
 void SingleCameraPipeline::Compute(FrameData frame_data) {
+  TraceSpan span("camera_pipeline/compute", frame_data.stamp());
   if (udp_streamer_) {
     udp_streamer_->AddFrame(frame_data.image, frame_data.stamp());
   }
+  if (point_cloud_ && !frame_data.depthmap.empty()) {
+    SendPointCloud(frame_data);
+  }
   switch (latest_command_.record_start().mode()) {
     case CameraPipelineCommand::RecordStart::MODE_EVERY_FRAME: {
       video_file_writer_.AddFrame(frame_data.image, frame_data.stamp());
     } break;
     case CameraPipelineCommand::RecordStart::MODE_EVERY_APRILTAG_FRAME: {
-      cv::Mat gray;
-      if (frame_data.image.channels() != 1) {
-        cv::cvtColor(frame_data.image, gray, cv::COLOR_BGR2GRAY);
-      } else {
-        gray = frame_data.image;
+      RecordApriltagFrame(frame_data, DetectApriltags(frame_data));
+    } break;
+    case CameraPipelineCommand::RecordStart::MODE_RAW_BURST: {
+      raw_recorder_.AddFrame(frame_data.image, frame_data.stamp());
+    } break;
+    case CameraPipelineCommand::RecordStart::MODE_APRILTAG_STABLE: {
+      auto apriltags = DetectApriltags(frame_data);
+      if (FilterApriltags(apriltags)) {
+        stable_frames_.Increment();
+        RecordApriltagFrame(frame_data, std::move(apriltags));
       }
-      auto apriltags = detector_.Detect(gray, frame_data.stamp());
-      auto image_pb =
-          video_file_writer_.AddFrame(frame_data.image, frame_data.stamp());
-      apriltags.mutable_image()->CopyFrom(image_pb);
-      event_bus_.AsyncSend(
-          MakeEvent(frame_data.camera_model.frame_name() + "/apriltags",
-                    apriltags, frame_data.stamp()));
     } break;
-    case CameraPipelineCommand::RecordStart::MODE_APRILTAG_STABLE:
-      LOG(INFO) << "Mode not support.";
-      break;
     default:
       break;
   }
@@ -154,30 +420,125 @@ void SingleCameraPipeline::Compute(FrameData frame_data) {
     // Close may be called regardless of state.  If we were recording,
     // it closes the video file on the last chunk.
     video_file_writer_.Close();
+    // Hands the recording's chunks to the transcoder.
+    raw_recorder_.Close();
+    stable_filter_.Reset();
+    novel_filter_.Reset();
     // Disposes of apriltag config (tag library, etc.)
     detector_.Close();
   }
 }
 
-CameraModel GridCameraModel() {
+ApriltagDetections SingleCameraPipeline::DetectApriltags(
+    const FrameData& frame_data) {
+  cv::Mat gray;
+  if (frame_data.image.channels() != 1) {
+    gray = GetFrameBufferPool().Get(frame_data.image.size(), CV_8UC1);
+    cv::cvtColor(frame_data.image, gray, cv::COLOR_BGR2GRAY);
+  } else {
+    gray = frame_data.image;
+  }
+  return detector_.Detect(gray, frame_data.stamp());
+}
+
+void SingleCameraPipeline::RecordApriltagFrame(const FrameData& frame_data,
+                                               ApriltagDetections apriltags) {
+  auto image_pb =
+      video_file_writer_.AddFrame(frame_data.image, frame_data.stamp());
+  apriltags.mutable_image()->CopyFrom(image_pb);
+  event_bus_.AsyncSend(
+      MakeEvent(frame_data.camera_model.frame_name() + "/apriltags",
+                apriltags, frame_data.stamp()));
+}
+
+void SingleCameraPipeline::SendPointCloud(const FrameData& frame_data) {
+  TraceSpan span("camera_pipeline/point_cloud", frame_data.stamp());
+  for (auto& event : MakePointCloudEvents(
+           point_cloud_->Convert(frame_data.depthmap,
+                                 frame_data.depthmap_range),
+           frame_data.stamp())) {
+    event_bus_.AsyncSend(std::move(event));
+  }
+}
+
+bool SingleCameraPipeline::FilterApriltags(
+    const ApriltagDetections& apriltags) {
+  const auto& stable = latest_command_.record_start().stable();
+  const int window_size =
+      stable.window_size() > 0 ? stable.window_size() : 7;
+  if (stable.novel()) {
+    return novel_filter_.AddApriltags(apriltags, window_size);
+  }
+  const int steady_count =
+      stable.steady_count() > 0 ? stable.steady_count() : 5;
+  return stable_filter_.AddApriltags(apriltags, steady_count, window_size);
+}
+
+int GridColumns(size_t n_cameras) { return n_cameras > 1 ? 2 : 1; }
+
+CameraModel GridCameraModel(const std::vector<CameraModel>& cameras) {
   auto model = Default1080HDCameraModel();
-  return model;
+  if (cameras.empty()) {
+    return model;
+  }
+  // Cells fit the largest camera, and the grid fits in 1080p.
+  int cols = GridColumns(cameras.size());
+  int rows = (cameras.size() + cols - 1) / cols;
+  int cell_width = 0;
+  int cell_height = 0;
+  for (const CameraModel& camera : cameras) {
+    cell_width = std::max(cell_width, camera.image_width());
+    cell_height = std::max(cell_height, camera.image_height());
+  }
+  double scale =
+      std::min({1.0, double(model.image_width()) / (cols * cell_width),
+                double(model.image_height()) / (rows * cell_height)});
+  int width = int(cols * cell_width * scale) & ~1;
+  int height = int(rows * cell_height * scale) & ~1;
+  return ResizeCameraModel(model, width, height);
 }
 
-MultiCameraPipeline::MultiCameraPipeline(EventBus& event_bus)
+MultiCameraPipeline::MultiCameraPipeline(EventBus& event_bus,
+                                         const CameraPipelineConfig& config)
     : event_bus_(event_bus),
+      status_timer_(event_bus.get_io_service()),
+      pool_("camera_pipeline"),
       work_(pool_.get_io_service()),
-      udp_streamer_(event_bus, GridCameraModel(), VideoStreamer::MODE_MP4_UDP,
-                    5000) {}
+      grid_profiles_(config.grid_stream_profiles().begin(),
+                     config.grid_stream_profiles().end()),
+      grid_busy_(false),
+      grid_skipped_(
+          GetMetricsRegistry().GetCounter("camera_pipeline/grid_skipped")),
+      grid_compose_latency_(
+          GetMetricsRegistry().GetHistogram("camera_pipeline/grid_compose")),
+      transcoder_(event_bus) {
+  if (grid_profiles_.empty()) {
+    VideoStreamProfile profile;
+    profile.set_port(5000);
+    grid_profiles_.push_back(profile);
+  }
+  SendStatus(boost::system::error_code());
+}
+
+MultiCameraPipeline::~MultiCameraPipeline() {
+  pool_.Stop();
+  pool_.Join();
+}
 
 void MultiCameraPipeline::Start(size_t n_threads) { pool_.Start(n_threads); }
 
-void MultiCameraPipeline::AddCamera(const CameraConfig& camera_config,
-                                    const CameraModel& camera_model) {
-  pipelines_.emplace(std::piecewise_construct,
-                     std::forward_as_tuple(camera_model.frame_name()),
-                     std::forward_as_tuple(event_bus_, pool_.get_io_service(),
-                                           camera_config, camera_model));
+SingleCameraPipeline& MultiCameraPipeline::AddCamera(
+    const CameraConfig& camera_config, const CameraModel& camera_model) {
+  grid_tiles_[camera_model.frame_name()] = camera_models_.size();
+  grid_intervals_.push_back(camera_config.grid_interval());
+  camera_models_.push_back(camera_model);
+  return pipelines_
+      .emplace(std::piecewise_construct,
+               std::forward_as_tuple(camera_model.frame_name()),
+               std::forward_as_tuple(event_bus_, pool_.get_io_service(),
+                                     camera_config, camera_model,
+                                     transcoder_))
+      .first->second;
 }
 
 void MultiCameraPipeline::Post(CameraPipelineCommand command) {
@@ -190,40 +551,87 @@ void MultiCameraPipeline::OnFrame(
     const std::vector<FrameData>& synced_frame_data) {
   CHECK(!synced_frame_data.empty());
   CHECK(!pool_.get_io_service().stopped());
-  bool do_post = true;
-  for (auto& pipeline : pipelines_) {
-    if (pipeline.second.PostCount() > 0) {
-      do_post = false;
-    }
+
+  for (const FrameData& frame : synced_frame_data) {
+    // Each camera's queue decides whether to drop its own frame.
+    pipelines_.at(frame.camera_model.frame_name()).Post(frame);
   }
-  if (!do_post) {
-    VLOG(1) << "pipeline full.";
+  if (grid_busy_.exchange(true)) {
+    grid_skipped_.Increment();
+    return;
   }
-
-  std::vector<cv::Mat> images;
+  // Cameras missing from the set keep their last tile.
+  std::vector<cv::Mat> tiles(camera_models_.size());
   for (const FrameData& frame : synced_frame_data) {
-    if (do_post) {
-      pipelines_.at(frame.camera_model.frame_name()).Post(frame);
+    tiles[grid_tiles_.at(frame.camera_model.frame_name())] = frame.image;
+  }
+  auto stamp = synced_frame_data.front().stamp();
+  pool_.get_io_service().post([this, tiles, stamp] {
+    ComposeGrid(tiles, stamp);
+    grid_busy_ = false;
+  });
+}
+
+void MultiCameraPipeline::ComposeGrid(
+    const std::vector<cv::Mat>& tiles,
+    const google::protobuf::Timestamp& stamp) {
+  TraceSpan span("camera_pipeline/grid", stamp);
+  if (!grid_streamer_) {
+    // Sized once every camera has been added.
+    grid_camera_ = GridCameraModel(camera_models_);
+    grid_compositor_ = std::make_unique<GridCompositor>(
+        GetCvSize(grid_camera_), camera_models_.size(),
+        GridColumns(camera_models_.size()));
+    for (size_t i = 0; i < grid_intervals_.size(); ++i) {
+      grid_compositor_->set_tile_interval(i, grid_intervals_[i]);
     }
-    images.push_back(frame.image);
+    grid_streamer_ = std::make_unique<SimulcastStreamer>(
+        event_bus_, grid_camera_, grid_profiles_);
+  }
+  cv::Mat grid;
+  {
+    ScopedLatency latency(grid_compose_latency_);
+    grid = grid_compositor_->Compose(tiles);
   }
-  auto grid_camera = GridCameraModel();
-  int cols = 1;
-  if(images.size() > 1) {
-    cols = 2;
+  grid_streamer_->AddFrame(grid, stamp);
+}
+
+MultiCameraPipelineStatus MultiCameraPipeline::GetStatus() const {
+  MultiCameraPipelineStatus status;
+  for (const auto& pipeline : pipelines_) {
+    *status.add_cameras() = pipeline.second.GetStatus();
   }
-  udp_streamer_.AddFrame(
-      ConstructGridImage(
-          images,
-          cv::Size(grid_camera.image_width(), grid_camera.image_height()), cols),
-      synced_frame_data.front().stamp());
+  return status;
+}
+
+void MultiCameraPipeline::SendStatus(const boost::system::error_code& error) {
+  if (error) {
+    LOG(WARNING) << "queue status timer error: " << error;
+    return;
+  }
+  status_timer_.expires_from_now(std::chrono::seconds(1));
+  status_timer_.async_wait(
+      std::bind(&MultiCameraPipeline::SendStatus, this, std::placeholders::_1));
+  if (pipelines_.empty()) {
+    return;
+  }
+  auto status = GetStatus();
+  VLOG(1) << status.ShortDebugString();
+  event_bus_.Send(MakeEvent(event_bus_.GetName() + "/queue_status", status));
 }
 
 CameraPipelineClient::CameraPipelineClient(EventBus& bus)
+    : CameraPipelineClient(
+          bus, ReadProtobufFromJsonFile<CameraPipelineConfig>(
+                   GetBucketAbsolutePath(Bucket::BUCKET_CONFIGURATIONS) /
+                   "camera.json")) {}
+
+CameraPipelineClient::CameraPipelineClient(EventBus& bus,
+                                           const CameraPipelineConfig& config)
     : io_service_(bus.get_io_service()),
       event_bus_(bus),
 
-      multi_camera_pipeline_(event_bus_),
+      multi_camera_pipeline_(event_bus_, config),
       multi_camera_(event_bus_) {
   event_bus_.GetEventSignal()->connect(
       std::bind(&CameraPipelineClient::on_event, this, std::placeholders::_1));
@@ -235,15 +643,18 @@ CameraPipelineClient::CameraPipelineClient(EventBus& bus)
        // tracking camera commands, recording, etc.
        std::string("^camera_pipeline/command$")});
 
-  CameraPipelineConfig config = ReadProtobufFromJsonFile<CameraPipelineConfig>(
-      GetBucketAbsolutePath(Bucket::BUCKET_CONFIGURATIONS) / "camera.json");
-
   // This starts a thread per camera for processing.
   multi_camera_pipeline_.Start(config.camera_configs().size());
 
   for (const CameraConfig& camera_config : config.camera_configs()) {
     auto camera_model = multi_camera_.AddCameraConfig(camera_config);
-    multi_camera_pipeline_.AddCamera(camera_config, camera_model);
+    SingleCameraPipeline& pipeline =
+        multi_camera_pipeline_.AddCamera(camera_config, camera_model);
+    // Backpressure for POLICY_BLOCK is applied on the grabber's thread, so
+    // the event bus thread, which synchronizes and posts frames, never waits.
+    multi_camera_.ConnectBeforeSync(
+        camera_model.frame_name(),
+        [&pipeline](const FrameData&) { pipeline.WaitForRoom(); });
   }
 
   multi_camera_.GetSynchronizedFrameDataSignal().connect(
@@ -251,6 +662,14 @@ CameraPipelineClient::CameraPipelineClient(EventBus& bus)
                 std::placeholders::_1));
 }
 
+MultiCameraPipelineStatus CameraPipelineClient::GetPipelineStatus() const {
+  return multi_camera_pipeline_.GetStatus();
+}
+
+MultiCameraSyncStatus CameraPipelineClient::GetSyncStatus() const {
+  return multi_camera_.GetStatus();
+}
+
 void CameraPipelineClient::on_command(const CameraPipelineCommand& command) {
   latest_command_ = command;
   multi_camera_pipeline_.Post(latest_command_);
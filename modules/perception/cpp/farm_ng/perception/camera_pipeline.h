@@ -1,11 +1,24 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+
 #include <boost/asio/steady_timer.hpp>
 #include <boost/signals2/signal.hpp>
 
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
 #include "farm_ng/core/thread_pool.h"
 
 #include "farm_ng/perception/apriltag.h"
+#include "farm_ng/perception/depthmap_point_cloud.h"
 #include "farm_ng/perception/frame_grabber.h"
+#include "farm_ng/perception/grid_compositor.h"
+#include "farm_ng/perception/raw_frame_recorder.h"
 #include "farm_ng/perception/time_series.h"
 #include "farm_ng/perception/video_streamer.h"
 
@@ -13,12 +26,25 @@
 #include "farm_ng/perception/camera_pipeline.pb.h"
 
 typedef farm_ng::core::Event EventPb;
+using farm_ng::core::Counter;
 using farm_ng::core::EventBus;
+using farm_ng::core::Histogram;
 using farm_ng::core::ThreadPool;
 
 namespace farm_ng {
 namespace perception {
 
+// Groups frames from several cameras into synchronized sets.
+//
+// Each camera's frame period, and the offset of its stamps from those of a
+// reference camera (the slowest one), are estimated online. Every reference
+// frame starts a set, which is emitted as soon as each camera has a frame
+// within half a period of its expected stamp. If a camera's frame doesn't
+// arrive within one period of the slowest camera, the set is emitted without
+// it.
+//
+// Per camera rate, skew and completeness are published periodically as
+// <service>/sync_status.
 class MultiCameraSync {
   typedef boost::signals2::signal<void(
       const std::vector<FrameData>& synced_frames)>
@@ -29,72 +55,185 @@ class MultiCameraSync {
   CameraModel AddCameraConfig(const CameraConfig& camera_config);
   Signal& GetSynchronizedFrameDataSignal();
 
+  // Calls slot on the camera's grabber thread before each of its frames is
+  // synchronized, e.g. to hold the camera back while its pipeline is full.
+  void ConnectBeforeSync(const std::string& frame_name,
+                         std::function<void(const FrameData&)> slot);
+
+  // Only call from the event bus io_service.
+  MultiCameraSyncStatus GetStatus() const;
+
  private:
-  std::vector<FrameData> CollectSynchronizedFrameData();
-  void GetSynchronizedFrameData(const boost::system::error_code& error);
+  struct Stream {
+    std::string frame_name;
+    TimeSeries<FrameData> frames;
+    // Estimated frame period, 0 until two frames have arrived.
+    int64_t period_ns = 0;
+    // Mean offset of this camera's stamps from the reference camera's.
+    int64_t offset_ns = 0;
+    int64_t last_stamp_ns = 0;
+    // Stamp of the last frame emitted in a set, so frames aren't reused.
+    int64_t last_synced_stamp_ns = std::numeric_limits<int64_t>::min();
+    uint64_t n_frames = 0;
+    uint64_t n_synced = 0;
+  };
+
+  // Called from the frame grabber threads.
   void OnFrame(const FrameData& frame_data);
+  // The rest runs on the event bus io_service.
+  void AddFrame(FrameData frame_data);
+  void UpdateReference();
+  void TryEmit(bool deadline_passed);
+  void OnDeadline(const boost::system::error_code& error, uint64_t set_id);
+  void SendStatus(const boost::system::error_code& error);
 
   EventBus& event_bus_;
-  boost::asio::steady_timer timer_;
+  boost::asio::steady_timer deadline_timer_;
+  boost::asio::steady_timer status_timer_;
   std::vector<std::unique_ptr<FrameGrabber>> frame_grabbers_;
-  std::mutex frame_series_mtx_;
-  std::map<std::string, TimeSeries<FrameData>> frame_series_;
-  google::protobuf::Timestamp latest_frame_stamp_;
+  std::vector<Stream> streams_;
+  size_t reference_ = 0;
+  // Reference stamp of the set being collected, if any.
+  std::optional<int64_t> pending_stamp_ns_;
+  uint64_t set_id_ = 0;
+  uint64_t n_sets_ = 0;
+  uint64_t n_complete_sets_ = 0;
   Signal signal_;
 };
 
+// Processes one camera's frames, serially, on the shared pool.
+//
+// Frames wait in a bounded queue, per CameraConfig.queue, so a camera that
+// falls behind drops (or, with POLICY_BLOCK, holds back) only its own frames.
 class SingleCameraPipeline {
  public:
   SingleCameraPipeline(EventBus& event_bus,
                        boost::asio::io_service& pool_service,
                        const CameraConfig& camera_config,
-                       const CameraModel& camera_model);
+                       const CameraModel& camera_model,
+                       RawFrameTranscoder& transcoder);
 
   void Post(CameraPipelineCommand command);
-  int PostCount() const;
+  // Queues the frame for Compute. Never waits, as it is called on the event
+  // bus thread; with POLICY_BLOCK the camera is held back by WaitForRoom
+  // instead, so nothing is dropped.
   void Post(FrameData frame_data);
+  // With POLICY_BLOCK, waits while the queue is full. Called on the camera's
+  // grabber thread, before the frame is synchronized.
+  void WaitForRoom();
   void Compute(FrameData frame_data);
 
+  CameraQueueStatus GetStatus() const;
+
  private:
+  struct QueuedFrame {
+    FrameData frame_data;
+    std::chrono::steady_clock::time_point posted;
+  };
+
+  // Computes the oldest queued frame, then reposts itself while frames
+  // remain, so commands interleave with a backlog of frames.
+  void ComputeNext();
+
+  ApriltagDetections DetectApriltags(const FrameData& frame_data);
+  // Records the frame and sends its detections as <frame_name>/apriltags.
+  void RecordApriltagFrame(const FrameData& frame_data,
+                           ApriltagDetections apriltags);
+  // MODE_APRILTAG_STABLE, true if the frame should be recorded.
+  bool FilterApriltags(const ApriltagDetections& apriltags);
+  // Archives the frame's depthmap as a point cloud, and sends its resource
+  // as <frame_name>/point_cloud.
+  void SendPointCloud(const FrameData& frame_data);
+
   EventBus& event_bus_;
   boost::asio::io_service::strand strand_;
   CameraModel camera_model_;
   ApriltagDetector detector_;
   VideoStreamer video_file_writer_;
-  std::unique_ptr<VideoStreamer> udp_streamer_;
+  RawFrameRecorder raw_recorder_;
+  std::unique_ptr<SimulcastStreamer> udp_streamer_;
+  // Set when CameraConfig.point_cloud is.
+  std::unique_ptr<DepthmapPointCloud> point_cloud_;
   CameraPipelineCommand latest_command_;
-  std::atomic<int> post_count_;
+  // MODE_APRILTAG_STABLE state, reset when recording stops.
+  ApriltagsFilter stable_filter_;
+  ApriltagsFilterNovel novel_filter_;
+  Counter& stable_frames_;
+
+  CameraQueueConfig::Policy queue_policy_;
+  size_t queue_capacity_;
+  mutable std::mutex queue_mtx_;
+  std::condition_variable queue_cv_;
+  std::deque<QueuedFrame> queue_;
+  // True while a ComputeNext is posted to the strand.
+  bool computing_ = false;
+  Counter& frames_posted_;
+  Counter& frames_processed_;
+  Counter& frames_dropped_;
+  Histogram& latency_;
 };
 
-CameraModel GridCameraModel();
+// The camera model of the grid image streamed by MultiCameraPipeline, which
+// tiles every camera's image at the size of the largest, within 1080p.
+CameraModel GridCameraModel(const std::vector<CameraModel>& cameras);
 
 class MultiCameraPipeline {
  public:
-  MultiCameraPipeline(EventBus& event_bus);
+  MultiCameraPipeline(EventBus& event_bus, const CameraPipelineConfig& config);
+  ~MultiCameraPipeline();
 
   void Start(size_t n_threads);
 
-  void AddCamera(const CameraConfig& camera_config,
-                 const CameraModel& camera_model);
+  SingleCameraPipeline& AddCamera(const CameraConfig& camera_config,
+                                  const CameraModel& camera_model);
 
   void Post(CameraPipelineCommand command);
 
+  // Posts each frame to its camera's pipeline, and the set to the grid
+  // preview, which is composed and encoded on the pool. Sets arriving while
+  // the previous one is being composed skip the grid.
   void OnFrame(const std::vector<FrameData>& synced_frame_data);
 
+  MultiCameraPipelineStatus GetStatus() const;
+
  private:
+  void SendStatus(const boost::system::error_code& error);
+  // On the pool.
+  void ComposeGrid(const std::vector<cv::Mat>& tiles,
+                   const google::protobuf::Timestamp& stamp);
+
   EventBus& event_bus_;
+  boost::asio::steady_timer status_timer_;
   ThreadPool pool_;
   boost::asio::io_service::work work_;
-  VideoStreamer udp_streamer_;
+  std::vector<VideoStreamProfile> grid_profiles_;
+  std::vector<CameraModel> camera_models_;
+  std::vector<int> grid_intervals_;
+  std::map<std::string, int> grid_tiles_;
+  // True while a ComposeGrid is posted to the pool.
+  std::atomic<bool> grid_busy_;
+  CameraModel grid_camera_;
+  std::unique_ptr<GridCompositor> grid_compositor_;
+  std::unique_ptr<SimulcastStreamer> grid_streamer_;
+  Counter& grid_skipped_;
+  Histogram& grid_compose_latency_;
+  // Outlives the pipelines, whose raw recorders post chunks to it.
+  RawFrameTranscoder transcoder_;
   std::map<std::string, SingleCameraPipeline> pipelines_;
 };
 
 class CameraPipelineClient {
  public:
+  // Reads the CameraPipelineConfig from configurations/camera.json.
   CameraPipelineClient(EventBus& bus);
+  CameraPipelineClient(EventBus& bus, const CameraPipelineConfig& config);
   void on_command(const CameraPipelineCommand& command);
   void on_event(const EventPb& event);
 
+  // Only call from the event bus io_service.
+  MultiCameraPipelineStatus GetPipelineStatus() const;
+  MultiCameraSyncStatus GetSyncStatus() const;
+
  private:
   boost::asio::io_service& io_service_;
   EventBus& event_bus_;
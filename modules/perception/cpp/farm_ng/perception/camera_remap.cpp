@@ -0,0 +1,200 @@
+#include "farm_ng/perception/camera_remap.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <glog/logging.h>
+
+#include "farm_ng/core/metrics.h"
+
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_batch.h"
+
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::Histogram;
+using farm_ng::core::ScopedLatency;
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+// Centers of the pixels in rows [row_begin, row_end) of an image of the given
+// width, in row major order.
+Eigen::Matrix2Xd PixelCenters(int width, int row_begin, int row_end) {
+  Eigen::Matrix2Xd pixels(2, width * (row_end - row_begin));
+  int i = 0;
+  for (int y = row_begin; y < row_end; ++y) {
+    for (int x = 0; x < width; ++x, ++i) {
+      pixels.col(i) << x, y;
+    }
+  }
+  return pixels;
+}
+
+Histogram& BuildLatency() {
+  static Histogram& latency =
+      GetMetricsRegistry().GetHistogram("camera_remap/build");
+  return latency;
+}
+
+std::string CameraKey(const CameraModel& camera) {
+  CameraModel key = camera;
+  key.clear_frame_name();
+  std::string bytes = key.SerializeAsString();
+  return std::to_string(bytes.size()) + ":" + bytes;
+}
+
+// Entries by key, built outside the lock so one camera's build doesn't hold
+// up lookups of the others. Should two threads race to build an entry, the
+// first one inserted wins.
+template <class T>
+class Cache {
+ public:
+  template <class Build>
+  std::shared_ptr<const T> Get(const std::string& key, Build build) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      auto it = entries_.find(key);
+      if (it != entries_.end()) {
+        return it->second;
+      }
+    }
+    std::shared_ptr<const T> entry = build();
+    std::lock_guard<std::mutex> lock(mtx_);
+    return entries_.emplace(key, entry).first->second;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::map<std::string, std::shared_ptr<const T>> entries_;
+};
+
+}  // namespace
+
+CameraModel UndistortedCameraModel(const CameraModel& camera) {
+  CameraModel undistorted = camera;
+  undistorted.set_distortion_model(CameraModel::DISTORTION_MODEL_BROWN_CONRADY);
+  undistorted.clear_distortion_coefficients();
+  return undistorted;
+}
+
+CameraRemap::CameraRemap(const CameraModel& source, const CameraModel& target,
+                         const Sophus::SO3d& source_rotation_target)
+    : source_(source), target_(target) {
+  ScopedLatency latency(BuildLatency());
+  const int width = target.image_width();
+  const int height = target.image_height();
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  const Eigen::Matrix3d rotation = source_rotation_target.matrix();
+  cv::Mat map_x(height, width, CV_32FC1);
+  cv::Mat map_y(height, width, CV_32FC1);
+  cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& rows) {
+    Eigen::Matrix2Xd pixels_target =
+        PixelCenters(width, rows.start, rows.end);
+    Eigen::Matrix3Xd points_source =
+        rotation * ReprojectPixelsToPoints(
+                       target, pixels_target,
+                       Eigen::VectorXd::Ones(pixels_target.cols()));
+    Eigen::Matrix2Xd pixels_source =
+        ProjectPointsToPixels(source, points_source);
+    int i = 0;
+    for (int y = rows.start; y < rows.end; ++y) {
+      float* xs = map_x.ptr<float>(y);
+      float* ys = map_y.ptr<float>(y);
+      for (int x = 0; x < width; ++x, ++i) {
+        if (points_source(2, i) > 0.0) {
+          xs[x] = pixels_source(0, i);
+          ys[x] = pixels_source(1, i);
+        } else {
+          xs[x] = -1.0f;
+          ys[x] = -1.0f;
+        }
+      }
+    }
+  });
+  cv::convertMaps(map_x, map_y, map1_, map2_, CV_16SC2);
+}
+
+void CameraRemap::Apply(const cv::Mat& source_image, cv::Mat* target_image,
+                        int interpolation) const {
+  CHECK_EQ(source_image.cols, source_.image_width());
+  CHECK_EQ(source_image.rows, source_.image_height());
+  cv::remap(source_image, *target_image, map1_, map2_, interpolation,
+            cv::BORDER_CONSTANT);
+}
+
+PixelBearings::PixelBearings(const CameraModel& camera) : camera_(camera) {
+  ScopedLatency latency(BuildLatency());
+  const int width = camera.image_width();
+  const int height = camera.image_height();
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  rays_.create(height, width, CV_32FC3);
+  cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& rows) {
+    Eigen::Matrix2Xd pixels = PixelCenters(width, rows.start, rows.end);
+    Eigen::Matrix3Xd points = ReprojectPixelsToPoints(
+        camera, pixels, Eigen::VectorXd::Ones(pixels.cols()));
+    points.colwise().normalize();
+    int i = 0;
+    for (int y = rows.start; y < rows.end; ++y) {
+      cv::Vec3f* row = rays_.ptr<cv::Vec3f>(y);
+      for (int x = 0; x < width; ++x, ++i) {
+        row[x] = cv::Vec3f(points(0, i), points(1, i), points(2, i));
+      }
+    }
+  });
+}
+
+Eigen::Vector3d PixelBearings::Ray(const Eigen::Vector2d& pixel) const {
+  const double fx = std::floor(pixel.x());
+  const double fy = std::floor(pixel.y());
+  if (!(fx >= 0 && fy >= 0 && fx + 1 < rays_.cols && fy + 1 < rays_.rows)) {
+    return ReprojectPixelToPoint<double>(camera_, pixel, 1.0).normalized();
+  }
+  const int x = fx;
+  const int y = fy;
+  const double ax = pixel.x() - fx;
+  const double ay = pixel.y() - fy;
+  const cv::Vec3f* row0 = rays_.ptr<cv::Vec3f>(y) + x;
+  const cv::Vec3f* row1 = rays_.ptr<cv::Vec3f>(y + 1) + x;
+  Eigen::Vector3d ray;
+  for (int c = 0; c < 3; ++c) {
+    ray[c] = (1 - ay) * ((1 - ax) * row0[0][c] + ax * row0[1][c]) +
+             ay * ((1 - ax) * row1[0][c] + ax * row1[1][c]);
+  }
+  return ray.normalized();
+}
+
+std::shared_ptr<const CameraRemap> GetUndistortRemap(
+    const CameraModel& camera) {
+  return GetCameraRemap(camera, UndistortedCameraModel(camera));
+}
+
+std::shared_ptr<const CameraRemap> GetCameraRemap(
+    const CameraModel& source, const CameraModel& target,
+    const Sophus::SO3d& source_rotation_target) {
+  static Cache<CameraRemap> cache;
+  const Eigen::Vector4d q = source_rotation_target.unit_quaternion().coeffs();
+  const std::string key =
+      CameraKey(source) + CameraKey(target) +
+      std::string(reinterpret_cast<const char*>(q.data()), sizeof(q));
+  return cache.Get(key, [&]() {
+    return std::make_shared<CameraRemap>(source, target,
+                                         source_rotation_target);
+  });
+}
+
+std::shared_ptr<const PixelBearings> GetPixelBearings(
+    const CameraModel& camera) {
+  static Cache<PixelBearings> cache;
+  return cache.Get(CameraKey(camera), [&]() {
+    return std::make_shared<PixelBearings>(camera);
+  });
+}
+
+}  // namespace perception
+}  // namespace farm_ng
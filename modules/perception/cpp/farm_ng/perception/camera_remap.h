@@ -0,0 +1,93 @@
+#ifndef FARM_NG_PERCEPTION_CAMERA_REMAP_H_
+#define FARM_NG_PERCEPTION_CAMERA_REMAP_H_
+
+#include <memory>
+
+#include <Eigen/Core>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <sophus/so3.hpp>
+
+#include "farm_ng/perception/camera_model.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// A camera model with camera's image size and intrinsics and no distortion,
+// the default target for undistortion.
+CameraModel UndistortedCameraModel(const CameraModel& camera);
+
+// Lookup tables for cv::remap, from the images of a source camera to the
+// images a target camera would see from the same center, e.g. undistorted,
+// rectified or re-projected to a pinhole camera of another field of view.
+class CameraRemap {
+ public:
+  // source_rotation_target rotates points from the target camera's frame to
+  // the source camera's, the rectifying rotation for stereo pairs.
+  CameraRemap(const CameraModel& source, const CameraModel& target,
+              const Sophus::SO3d& source_rotation_target = Sophus::SO3d());
+
+  const CameraModel& source() const { return source_; }
+  const CameraModel& target() const { return target_; }
+
+  // Resamples source_image, of the source camera's size, to the target
+  // camera's size. Target pixels seeing outside the source image, or behind
+  // the source camera, are black.
+  void Apply(const cv::Mat& source_image, cv::Mat* target_image,
+             int interpolation = cv::INTER_LINEAR) const;
+
+  // The fixed point maps, CV_16SC2 and CV_16UC1, as from cv::convertMaps.
+  const cv::Mat& map1() const { return map1_; }
+  const cv::Mat& map2() const { return map2_; }
+
+ private:
+  CameraModel source_;
+  CameraModel target_;
+  cv::Mat map1_;
+  cv::Mat map2_;
+};
+
+// The ray seen by each pixel of a camera, so reprojecting a pixel doesn't
+// iterate the distortion model. Rays are stored as unit vectors, which
+// interpolate well out to the rim of a fisheye lens.
+class PixelBearings {
+ public:
+  explicit PixelBearings(const CameraModel& camera);
+
+  const CameraModel& camera() const { return camera_; }
+
+  // The unit vector along ReprojectPixelToPoint(camera, pixel, 1.0),
+  // interpolated bilinearly between pixel centers, or computed directly
+  // outside the image.
+  Eigen::Vector3d Ray(const Eigen::Vector2d& pixel) const;
+
+  // As ReprojectPixelToPoint(camera, pixel, 1.0), from Ray.
+  Eigen::Vector3d Bearing(const Eigen::Vector2d& pixel) const {
+    Eigen::Vector3d ray = Ray(pixel);
+    return ray / ray.z();
+  }
+
+ private:
+  CameraModel camera_;
+  // The ray of each pixel center, CV_32FC3.
+  cv::Mat rays_;
+};
+
+// Process wide caches of the above, keyed by the camera models, ignoring
+// frame_name, so an entry's models may carry another camera's frame_name.
+// Each is built on first use, in parallel across rows, and shared
+// thereafter. Entries are never evicted, so callers should use a bounded set
+// of cameras.
+//
+// Thread safe.
+std::shared_ptr<const CameraRemap> GetUndistortRemap(const CameraModel& camera);
+std::shared_ptr<const CameraRemap> GetCameraRemap(
+    const CameraModel& source, const CameraModel& target,
+    const Sophus::SO3d& source_rotation_target = Sophus::SO3d());
+std::shared_ptr<const PixelBearings> GetPixelBearings(
+    const CameraModel& camera);
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,104 @@
+#include "farm_ng/perception/camera_remap.h"
+
+#include <cmath>
+
+#include "farm_ng/perception/camera_model.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+using namespace farm_ng::perception;
+
+namespace {
+
+// The source pixel of each target pixel, from the fixed point maps.
+Eigen::Vector2d MapAt(const CameraRemap& remap, int x, int y) {
+  cv::Mat map_x, map_y;
+  cv::convertMaps(remap.map1(), remap.map2(), map_x, map_y, CV_32FC1);
+  return Eigen::Vector2d(map_x.at<float>(y, x), map_y.at<float>(y, x));
+}
+
+}  // namespace
+
+TEST(camera_remap, bearings_match_reproject) {
+  CameraModel camera = DefaultFishEyeT265CameraModel();
+  PixelBearings bearings(camera);
+  int n_checked = 0;
+  for (double y = 0.25; y < camera.image_height(); y += 13.7) {
+    for (double x = 0.5; x < camera.image_width(); x += 11.3) {
+      Eigen::Vector2d pixel(x, y);
+      Eigen::Vector3d expected =
+          ReprojectPixelToPoint<double>(camera, pixel, 1.0);
+      // Out to 80 degrees off axis, well past the T265's image circle.
+      if (expected.head<2>().norm() > std::tan(80 * M_PI / 180)) {
+        continue;
+      }
+      Eigen::Vector3d ray = bearings.Ray(pixel);
+      EXPECT_NEAR(ray.norm(), 1.0, 1e-9);
+      EXPECT_LT(std::acos(std::min(1.0, ray.dot(expected.normalized()))),
+                1e-4)
+          << pixel.transpose();
+      EXPECT_NEAR(bearings.Bearing(pixel).z(), 1.0, 1e-9);
+      ++n_checked;
+    }
+  }
+  EXPECT_GT(n_checked, 1000);
+  // Outside the image, computed directly.
+  Eigen::Vector2d outside(-3.5, 10.0);
+  EXPECT_NEAR((bearings.Bearing(outside) -
+               ReprojectPixelToPoint<double>(camera, outside, 1.0))
+                  .norm(),
+              0.0, 1e-12);
+}
+
+TEST(camera_remap, undistort_matches_projection) {
+  CameraModel camera = DefaultFishEyeT265CameraModel();
+  CameraRemap remap(camera, UndistortedCameraModel(camera));
+  for (int y = 0; y < camera.image_height(); y += 97) {
+    for (int x = 0; x < camera.image_width(); x += 89) {
+      Eigen::Vector2d expected = ProjectPointToPixel(
+          camera, ReprojectPixelToPoint<double>(remap.target(),
+                                                Eigen::Vector2d(x, y), 1.0));
+      // Fixed point maps resolve 1/32 of a pixel.
+      EXPECT_NEAR((MapAt(remap, x, y) - expected).norm(), 0.0, 1.0 / 32)
+          << x << " " << y;
+    }
+  }
+
+  cv::Mat image(camera.image_height(), camera.image_width(), CV_8UC1,
+                cv::Scalar(255));
+  cv::Mat undistorted;
+  remap.Apply(image, &undistorted);
+  EXPECT_EQ(undistorted.size(), image.size());
+  int cx = camera.cx();
+  int cy = camera.cy();
+  EXPECT_EQ(undistorted.at<uint8_t>(cy, cx), 255);
+}
+
+TEST(camera_remap, rotated_target) {
+  CameraModel camera = DefaultFishEyeT265CameraModel();
+  CameraModel target = CreateCameraModel(M_PI / 3, 321, 241);
+  // The target looks 60 degrees off the source's axis, toward +x.
+  CameraRemap remap(camera, target, Sophus::SO3d::rotY(M_PI / 3));
+  Eigen::Vector2d expected = ProjectPointToPixel(
+      camera, Eigen::Vector3d(std::sin(M_PI / 3), 0.0, std::cos(M_PI / 3)));
+  EXPECT_NEAR((MapAt(remap, 160, 120) - expected).norm(), 0.0, 1.0 / 32);
+
+  // Behind the source camera, the target sees nothing.
+  CameraRemap behind(camera, target, Sophus::SO3d::rotY(M_PI));
+  EXPECT_EQ(MapAt(behind, 160, 120), Eigen::Vector2d(-1.0, -1.0));
+}
+
+TEST(camera_remap, cache_ignores_frame_name) {
+  CameraModel camera = DefaultFishEyeT265CameraModel();
+  camera.set_frame_name("left");
+  CameraModel renamed = camera;
+  renamed.set_frame_name("right");
+  CameraModel resized = ResizeCameraModel(camera, 424, 400);
+
+  EXPECT_EQ(GetPixelBearings(camera), GetPixelBearings(renamed));
+  EXPECT_NE(GetPixelBearings(camera), GetPixelBearings(resized));
+  EXPECT_EQ(GetUndistortRemap(camera), GetUndistortRemap(renamed));
+  EXPECT_NE(GetUndistortRemap(camera),
+            GetCameraRemap(camera, UndistortedCameraModel(camera),
+                           Sophus::SO3d::rotZ(0.1)));
+}
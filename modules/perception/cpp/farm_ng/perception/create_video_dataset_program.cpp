@@ -21,6 +21,7 @@
 #include "farm_ng/perception/create_video_dataset.pb.h"
 #include "farm_ng/perception/create_video_dataset_program.h"
 #include "farm_ng/perception/image.pb.h"
+#include "farm_ng/perception/offline_apriltag_detector.h"
 
 
 typedef farm_ng::core::Event EventPb;
@@ -83,6 +84,8 @@ int CreateVideoDatasetProgram::run() {
       tag->set_size(node.tag_size());
     }
   }
+  apriltag_config.mutable_detector()->set_refine_corners(
+      configuration_.refine_corners());
 
   core::SetArchivePath(
       (core::GetBucketRelativePath(core::BUCKET_LOGS) / configuration_.name())
@@ -91,6 +94,31 @@ int CreateVideoDatasetProgram::run() {
 
   core::EventLogWriter log_writer(resource_path.second);
 
+  // Frames are decoded here, and detected in parallel.
+  OfflineApriltagDetector detector(
+      &apriltag_config, configuration_.n_workers(),
+      [&](const ApriltagDetections& detections,
+          const google::protobuf::Timestamp& stamp) {
+        log_writer.Write(
+            MakeEvent(detections.image().camera_model().frame_name() +
+                          "/apriltags",
+                      detections, stamp));
+        for (auto const& detection : detections.detections()) {
+          bool first_time_seen = true;
+          for (auto& entry : *status_.mutable_per_tag_id_num_frames()) {
+            if (entry.tag_id() == detection.id()) {
+              entry.set_num_frames(entry.num_frames() + 1);
+              first_time_seen = false;
+            }
+          }
+          if (first_time_seen) {
+            auto per_tag_id_num_frames = status_.add_per_tag_id_num_frames();
+            per_tag_id_num_frames->set_tag_id(detection.id());
+            per_tag_id_num_frames->set_num_frames(1);
+          }
+        }
+      });
+
   for (int camera_id = 0; camera_id < configuration_.video_file_cameras_size();
        ++camera_id) {
     std::string video_path =
@@ -105,8 +133,6 @@ int CreateVideoDatasetProgram::run() {
     cv::VideoCapture capture(video_path);
     CameraModel camera_model;
 
-    std::optional<ApriltagDetector> detector;
-
     Image image_pb;
     image_pb.mutable_fps()->set_value(capture.get(cv::CAP_PROP_FPS));
     image_pb.mutable_frame_number()->set_value(0);
@@ -114,7 +140,11 @@ int CreateVideoDatasetProgram::run() {
         configuration_.video_file_cameras(camera_id).video_file_resource());
 
     while (true) {
-      capture.set(cv::CAP_PROP_POS_FRAMES, image_pb.frame_number().value());
+      // Seeking flushes the decoder, so only seek when skipping frames.
+      if (image_pb.frame_number().value() !=
+          int(capture.get(cv::CAP_PROP_POS_FRAMES))) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, image_pb.frame_number().value());
+      }
       double msec = capture.get(cv::CAP_PROP_POS_MSEC);
       cv::Mat image;
       capture >> image;
@@ -139,7 +169,6 @@ int CreateVideoDatasetProgram::run() {
         camera_model = intrinsic_map_[camera_name];
       }
 
-      detector = ApriltagDetector(camera_model, nullptr, &apriltag_config);
       image_pb.mutable_camera_model()->CopyFrom(camera_model);
 
       CHECK_EQ(camera_model.image_width(), image.size().width);
@@ -178,25 +207,7 @@ int CreateVideoDatasetProgram::run() {
         if (configuration_.has_detection_scale()) {
           scale = configuration_.detection_scale().value();
         }
-        auto detections = detector->Detect(gray, stamp, scale);
-        detections.mutable_image()->CopyFrom(image_pb);
-        log_writer.Write(MakeEvent(camera_model.frame_name() + "/apriltags",
-                                   detections, stamp));
-
-        for (auto const& detection : detections.detections()) {
-          bool first_time_seen = true;
-          for (auto& entry : *status_.mutable_per_tag_id_num_frames()) {
-            if (entry.tag_id() == detection.id()) {
-              entry.set_num_frames(entry.num_frames() + 1);
-              first_time_seen = false;
-            }
-          }
-          if (first_time_seen) {
-            auto per_tag_id_num_frames = status_.add_per_tag_id_num_frames();
-            per_tag_id_num_frames->set_tag_id(detection.id());
-            per_tag_id_num_frames->set_num_frames(1);
-          }
-        }
+        detector.Submit(image_pb, gray, stamp, scale);
       }
 
       bus_.get_io_service().poll();
@@ -209,6 +220,7 @@ int CreateVideoDatasetProgram::run() {
     }
   }
 
+  detector.Flush();
   bus_.get_io_service().poll();
 
   result.mutable_configuration()->CopyFrom(configuration_);
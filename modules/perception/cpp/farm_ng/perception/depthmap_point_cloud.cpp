@@ -0,0 +1,225 @@
+#include "farm_ng/perception/depthmap_point_cloud.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "farm_ng/core/ipc.h"
+
+#include "farm_ng/perception/camera_model_batch.h"
+#include "farm_ng/perception/tensor.h"
+
+using farm_ng::core::MakeEvent;
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+// Voxel coordinates are offset by this, and packed in 21 bits each.
+const int64_t kVoxelOffset = 1 << 20;
+const uint64_t kVoxelMask = (1 << 21) - 1;
+
+// Of point data per event, leaving room for the name, stamps and tensor
+// shapes in a 65507 byte datagram.
+const int64_t kMaxPointCloudPartBytes = 60000;
+
+uint64_t PackVoxel(const Eigen::Vector3f& voxel) {
+  auto coordinate = [](float c) {
+    return uint64_t(int64_t(c) + kVoxelOffset) & kVoxelMask;
+  };
+  return coordinate(voxel.x()) | coordinate(voxel.y()) << 21 |
+         coordinate(voxel.z()) << 42;
+}
+
+}  // namespace
+
+VoxelGrid::VoxelGrid(double voxel_size)
+    : inverse_voxel_size_(1.0 / voxel_size) {
+  CHECK_GT(voxel_size, 0.0);
+}
+
+void VoxelGrid::Add(const Eigen::Vector3f& point) {
+  Eigen::Vector3f voxel = (point * inverse_voxel_size_).array().floor();
+  const uint64_t key = PackVoxel(voxel);
+  // Neighboring pixels usually fall in the same voxel, so skip the lookup.
+  if (voxels_.empty() || key != last_key_) {
+    auto inserted = index_.emplace(key, voxels_.size());
+    if (inserted.second) {
+      voxels_.push_back({Eigen::Vector3d::Zero(), 0});
+    }
+    last_key_ = key;
+    last_index_ = inserted.first->second;
+  }
+  Voxel& v = voxels_[last_index_];
+  v.sum += point.cast<double>();
+  ++v.count;
+}
+
+void VoxelGrid::Clear() {
+  index_.clear();
+  voxels_.clear();
+}
+
+Eigen::Matrix3Xd VoxelGrid::Centroids() const {
+  Eigen::Matrix3Xd centroids(3, voxels_.size());
+  for (size_t i = 0; i < voxels_.size(); ++i) {
+    centroids.col(i) = voxels_[i].sum / voxels_[i].count;
+  }
+  return centroids;
+}
+
+DepthmapPointCloud::DepthmapPointCloud(const CameraModel& camera,
+                                       const PointCloudConfig& config)
+    : camera_(camera),
+      stride_(config.stride() > 0 ? config.stride() : 1),
+      min_range_(config.min_range()),
+      max_range_(config.max_range() > 0
+                     ? config.max_range()
+                     : std::numeric_limits<float>::infinity()) {
+  const int width = camera.image_width();
+  const int height = camera.image_height();
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  const int n_cols = (width + stride_ - 1) / stride_;
+  const int n_rows = (height + stride_ - 1) / stride_;
+  Eigen::Matrix2Xf pixels(2, n_cols * n_rows);
+  int i = 0;
+  for (int y = 0; y < height; y += stride_) {
+    for (int x = 0; x < width; x += stride_, ++i) {
+      pixels.col(i) << x, y;
+    }
+  }
+  Eigen::Matrix3Xf bearings = ReprojectPixelsToPoints(
+      camera, pixels, Eigen::VectorXf::Ones(pixels.cols()));
+  bearing_x_ = bearings.row(0).transpose().array();
+  bearing_y_ = bearings.row(1).transpose().array();
+  bearing_norm_ = bearings.colwise().norm().transpose().array();
+  depths_.resize(pixels.cols());
+  ranges_.resize(pixels.cols());
+  if (config.voxel_size() > 0) {
+    voxel_grid_ = std::make_unique<VoxelGrid>(config.voxel_size());
+  }
+}
+
+void DepthmapPointCloud::SampleDepths(const cv::Mat& depthmap,
+                                      Depthmap::Range range) {
+  CHECK_EQ(depthmap.cols, camera_.image_width());
+  CHECK_EQ(depthmap.rows, camera_.image_height());
+  int i = 0;
+  if (range == Depthmap::RANGE_MM) {
+    CHECK_EQ(depthmap.type(), CV_16UC1);
+    for (int y = 0; y < depthmap.rows; y += stride_) {
+      const uint16_t* row = depthmap.ptr<uint16_t>(y);
+      for (int x = 0; x < depthmap.cols; x += stride_) {
+        depths_[i++] = row[x] * 0.001f;
+      }
+    }
+  } else if (range == Depthmap::RANGE_UNSPECIFIED) {
+    CHECK_EQ(depthmap.type(), CV_32FC1);
+    for (int y = 0; y < depthmap.rows; y += stride_) {
+      const float* row = depthmap.ptr<float>(y);
+      for (int x = 0; x < depthmap.cols; x += stride_) {
+        depths_[i++] = row[x];
+      }
+    }
+  } else {
+    LOG(FATAL) << "Unsupported range type: " << Depthmap::Range_Name(range);
+  }
+  CHECK_EQ(i, depths_.size());
+}
+
+Eigen::Matrix3Xd DepthmapPointCloud::Unproject(const cv::Mat& depthmap,
+                                               Depthmap::Range range) {
+  SampleDepths(depthmap, range);
+  ranges_ = depths_ * bearing_norm_;
+  // Missing and NaN depths fail both comparisons.
+  auto keep = [this](int i) {
+    return depths_[i] > 0 && ranges_[i] >= min_range_ &&
+           ranges_[i] <= max_range_;
+  };
+  auto point = [this](int i) {
+    return Eigen::Vector3f(bearing_x_[i] * depths_[i],
+                           bearing_y_[i] * depths_[i], depths_[i]);
+  };
+
+  if (voxel_grid_) {
+    voxel_grid_->Clear();
+    for (int i = 0; i < depths_.size(); ++i) {
+      if (keep(i)) {
+        voxel_grid_->Add(point(i));
+      }
+    }
+    return voxel_grid_->Centroids();
+  }
+
+  int n_kept = 0;
+  for (int i = 0; i < depths_.size(); ++i) {
+    n_kept += keep(i);
+  }
+  Eigen::Matrix3Xd points(3, n_kept);
+  int j = 0;
+  for (int i = 0; i < depths_.size(); ++i) {
+    if (keep(i)) {
+      points.col(j++) = point(i).cast<double>();
+    }
+  }
+  return points;
+}
+
+PointCloud DepthmapPointCloud::Convert(const cv::Mat& depthmap,
+                                       Depthmap::Range range) {
+  PointCloud cloud;
+  cloud.set_frame_name(camera_.frame_name());
+  const Eigen::MatrixXf points = Unproject(depthmap, range).cast<float>();
+  EigenToTensor(points, "xyz", "points", cloud.add_point_data());
+  return cloud;
+}
+
+std::vector<farm_ng::core::Event> MakePointCloudEvents(
+    const PointCloud& cloud, const google::protobuf::Timestamp& stamp) {
+  const std::string name = cloud.frame_name() + "/point_cloud";
+  int64_t n_points = 0;
+  int64_t point_bytes = 0;
+  for (const Tensor& tensor : cloud.point_data()) {
+    CHECK_EQ(tensor.shape_size(), 2);
+    n_points = tensor.shape(1).size();
+    CHECK_EQ(n_points, cloud.point_data(0).shape(1).size());
+    point_bytes += n_points > 0 ? tensor.data().size() / n_points : 0;
+  }
+  const int64_t part_points =
+      std::max<int64_t>(1, kMaxPointCloudPartBytes / std::max<int64_t>(
+                                                         1, point_bytes));
+  if (n_points <= part_points) {
+    return {MakeEvent(name, cloud, stamp)};
+  }
+
+  const int n_parts = (n_points + part_points - 1) / part_points;
+  std::vector<farm_ng::core::Event> events;
+  events.reserve(n_parts);
+  for (int part = 0; part < n_parts; ++part) {
+    const int64_t begin = part * part_points;
+    const int64_t count = std::min(part_points, n_points - begin);
+    PointCloud part_pb;
+    part_pb.set_frame_name(cloud.frame_name());
+    part_pb.set_part(part);
+    part_pb.set_n_parts(n_parts);
+    for (const Tensor& tensor : cloud.point_data()) {
+      // Column major, so a range of points is a range of bytes.
+      const int64_t column_bytes = tensor.data().size() / n_points;
+      Tensor* part_tensor = part_pb.add_point_data();
+      part_tensor->set_dtype(tensor.dtype());
+      *part_tensor->add_shape() = tensor.shape(0);
+      *part_tensor->add_shape() = tensor.shape(1);
+      part_tensor->mutable_shape(1)->set_size(count);
+      part_tensor->set_data(
+          tensor.data().substr(begin * column_bytes, count * column_bytes));
+    }
+    events.push_back(MakeEvent(name, part_pb, stamp));
+  }
+  return events;
+}
+
+}  // namespace perception
+}  // namespace farm_ng
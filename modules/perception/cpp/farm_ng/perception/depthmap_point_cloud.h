@@ -0,0 +1,102 @@
+#ifndef FARM_NG_PERCEPTION_DEPTHMAP_POINT_CLOUD_H_
+#define FARM_NG_PERCEPTION_DEPTHMAP_POINT_CLOUD_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+#include <opencv2/core.hpp>
+
+#include "farm_ng/core/io.pb.h"
+
+#include "farm_ng/perception/camera_model.pb.h"
+#include "farm_ng/perception/camera_pipeline.pb.h"
+#include "farm_ng/perception/depthmap.pb.h"
+#include "farm_ng/perception/point_cloud.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// Downsamples points as they are added, keeping the centroid of the points
+// in each occupied cube of a grid.
+class VoxelGrid {
+ public:
+  // Precondition: voxel_size > 0. Voxels more than 2^20 voxels from the
+  // origin alias others.
+  explicit VoxelGrid(double voxel_size);
+
+  void Add(const Eigen::Vector3f& point);
+
+  // Empties the grid, keeping its allocations for the next cloud.
+  void Clear();
+
+  // Occupied voxels.
+  size_t size() const { return voxels_.size(); }
+
+  // The centroid of each occupied voxel, in the order they were occupied.
+  Eigen::Matrix3Xd Centroids() const;
+
+ private:
+  struct Voxel {
+    Eigen::Vector3d sum;
+    int count;
+  };
+
+  float inverse_voxel_size_;
+  // Index in voxels_ by packed voxel coordinates.
+  std::unordered_map<uint64_t, uint32_t> index_;
+  std::vector<Voxel> voxels_;
+  // Of the last point added, valid while voxels_ is not empty.
+  uint64_t last_key_ = 0;
+  uint32_t last_index_ = 0;
+};
+
+// Converts a camera's depthmaps to point clouds in the camera frame, filtered
+// by range and optionally downsampled, per PointCloudConfig.
+//
+// The bearing of each sampled pixel is computed once, so a frame costs a
+// multiply per point rather than inverting the distortion model.
+//
+// Not thread safe.
+class DepthmapPointCloud {
+ public:
+  DepthmapPointCloud(const CameraModel& camera, const PointCloudConfig& config);
+
+  // depthmap is the camera's size, RANGE_MM in CV_16UC1, or in meters in
+  // CV_32FC1 when range is RANGE_UNSPECIFIED. Zero depths are missing.
+  // Returns the points as a 3xN float "xyz" tensor, in the camera's frame.
+  PointCloud Convert(const cv::Mat& depthmap, Depthmap::Range range);
+
+  // As above, returning the points.
+  Eigen::Matrix3Xd Unproject(const cv::Mat& depthmap, Depthmap::Range range);
+
+ private:
+  // Fills depths_ from the sampled pixels of depthmap, in meters.
+  void SampleDepths(const cv::Mat& depthmap, Depthmap::Range range);
+
+  CameraModel camera_;
+  int stride_;
+  float min_range_;
+  float max_range_;
+  // The point at depth 1, and its distance from the camera, of each sampled
+  // pixel, in row major order.
+  Eigen::ArrayXf bearing_x_;
+  Eigen::ArrayXf bearing_y_;
+  Eigen::ArrayXf bearing_norm_;
+  Eigen::ArrayXf depths_;
+  Eigen::ArrayXf ranges_;
+  std::unique_ptr<VoxelGrid> voxel_grid_;
+};
+
+// Returns the cloud as <frame_name>/point_cloud events, each of which fits an
+// event bus datagram. A cloud too large for one is split by point into
+// PointCloud parts, see PointCloud.n_parts.
+std::vector<farm_ng::core::Event> MakePointCloudEvents(
+    const PointCloud& cloud, const google::protobuf::Timestamp& stamp);
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,63 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_batch.h"
+#include "farm_ng/perception/depthmap_point_cloud.h"
+
+namespace farm_ng {
+namespace perception {
+namespace {
+
+// A 720p depth camera, such as the K4A's, with Brown-Conrady distortion.
+CameraModel MakeCameraModel() {
+  CameraModel model = CreateCameraModel(M_PI / 2, 1280, 720);
+  model.set_distortion_model(CameraModel::DISTORTION_MODEL_BROWN_CONRADY);
+  model.set_frame_name("depth");
+  return model;
+}
+
+// Depths from 0.5m to 4.5m, varying from pixel to pixel so neighboring
+// pixels rarely share a voxel.
+cv::Mat MakeDepthmap(const CameraModel& camera) {
+  cv::Mat depthmap(camera.image_height(), camera.image_width(), CV_16UC1);
+  for (int y = 0; y < depthmap.rows; ++y) {
+    for (int x = 0; x < depthmap.cols; ++x) {
+      depthmap.at<uint16_t>(y, x) = 500 + (x * 7 + y * 13) % 4000;
+    }
+  }
+  return depthmap;
+}
+
+// Arguments are the stride, and the voxel size in millimeters, 0 for none.
+void BM_Unproject(benchmark::State& state) {
+  const CameraModel camera = MakeCameraModel();
+  const cv::Mat depthmap = MakeDepthmap(camera);
+  PointCloudConfig config;
+  config.set_stride(state.range(0));
+  config.set_voxel_size(state.range(1) / 1000.0);
+  config.set_max_range(4.0);
+  DepthmapPointCloud converter(camera, config);
+  int64_t points = 0;
+  for (auto _ : state) {
+    Eigen::Matrix3Xd cloud = converter.Unproject(depthmap, Depthmap::RANGE_MM);
+    points = cloud.cols();
+    benchmark::DoNotOptimize(cloud.data());
+  }
+  state.SetItemsProcessed(state.iterations() * depthmap.rows * depthmap.cols /
+                          (state.range(0) * state.range(0)));
+  state.counters["points"] = points;
+  state.SetLabel(CameraModelBatchIsa());
+}
+BENCHMARK(BM_Unproject)
+    ->ArgNames({"stride", "voxel_mm"})
+    ->ArgsProduct({{1, 2}, {0, 50}})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace perception
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
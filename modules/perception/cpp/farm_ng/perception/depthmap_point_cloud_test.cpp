@@ -0,0 +1,171 @@
+#include "farm_ng/perception/depthmap_point_cloud.h"
+
+#include <cmath>
+
+#include "farm_ng/core/ipc.h"
+
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/camera_model_test_utils.h"
+#include "farm_ng/perception/tensor.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+using farm_ng::core::MakeTimestampNow;
+using namespace farm_ng::perception;
+
+namespace {
+
+CameraModel MakeCameraModel() {
+  CameraModel model = MakeDistortedCameraModel(
+      CameraModel::DISTORTION_MODEL_BROWN_CONRADY, 64, 48);
+  model.set_frame_name("depth");
+  return model;
+}
+
+}  // namespace
+
+TEST(depthmap_point_cloud, unprojects_each_pixel) {
+  CameraModel camera = MakeCameraModel();
+  cv::Mat depthmap(camera.image_height(), camera.image_width(), CV_16UC1);
+  for (int y = 0; y < depthmap.rows; ++y) {
+    for (int x = 0; x < depthmap.cols; ++x) {
+      // A missing pixel on each row.
+      depthmap.at<uint16_t>(y, x) = x == 7 ? 0 : 1000 + 10 * x + y;
+    }
+  }
+  DepthmapPointCloud converter(camera, PointCloudConfig());
+  Eigen::Matrix3Xd points = converter.Unproject(depthmap, Depthmap::RANGE_MM);
+  ASSERT_EQ(points.cols(), (depthmap.cols - 1) * depthmap.rows);
+  int i = 0;
+  for (int y = 0; y < depthmap.rows; ++y) {
+    for (int x = 0; x < depthmap.cols; ++x) {
+      if (x == 7) {
+        continue;
+      }
+      Eigen::Vector3d expected = ReprojectPixelToPoint<double>(
+          camera, Eigen::Vector2d(x, y), depthmap.at<uint16_t>(y, x) / 1000.0);
+      EXPECT_NEAR((points.col(i++) - expected).norm(), 0.0, 1e-5)
+          << x << " " << y;
+    }
+  }
+}
+
+TEST(depthmap_point_cloud, filters_range_and_strides) {
+  CameraModel camera = MakeCameraModel();
+  cv::Mat depthmap(camera.image_height(), camera.image_width(), CV_32FC1);
+  for (int y = 0; y < depthmap.rows; ++y) {
+    for (int x = 0; x < depthmap.cols; ++x) {
+      depthmap.at<float>(y, x) = x < 32 ? 1.0f : 4.0f;
+    }
+  }
+  depthmap.at<float>(0, 0) = std::nanf("");
+  PointCloudConfig config;
+  config.set_stride(2);
+  config.set_max_range(3.0);
+  DepthmapPointCloud converter(camera, config);
+  Eigen::Matrix3Xd points =
+      converter.Unproject(depthmap, Depthmap::RANGE_UNSPECIFIED);
+  // The near half, every other row and column, less the NaN.
+  EXPECT_EQ(points.cols(), 16 * 24 - 1);
+  for (int i = 0; i < points.cols(); ++i) {
+    EXPECT_LE(points.col(i).norm(), 3.0);
+    EXPECT_NEAR(points(2, i), 1.0, 1e-6);
+  }
+
+  config.set_max_range(0.0);
+  config.set_min_range(3.0);
+  DepthmapPointCloud far(camera, config);
+  points = far.Unproject(depthmap, Depthmap::RANGE_UNSPECIFIED);
+  EXPECT_EQ(points.cols(), 16 * 24);
+  for (int i = 0; i < points.cols(); ++i) {
+    EXPECT_NEAR(points(2, i), 4.0, 1e-6);
+  }
+}
+
+TEST(depthmap_point_cloud, voxel_grid_centroids) {
+  VoxelGrid grid(0.5);
+  grid.Add(Eigen::Vector3f(0.1, 0.1, 0.1));
+  grid.Add(Eigen::Vector3f(0.3, 0.2, 0.4));
+  grid.Add(Eigen::Vector3f(-0.1, 0.1, 0.1));
+  grid.Add(Eigen::Vector3f(1.2, -3.1, 7.9));
+  ASSERT_EQ(grid.size(), 3);
+  Eigen::Matrix3Xd centroids = grid.Centroids();
+  EXPECT_NEAR((centroids.col(0) - Eigen::Vector3d(0.2, 0.15, 0.25)).norm(),
+              0.0, 1e-6);
+  EXPECT_NEAR((centroids.col(1) - Eigen::Vector3d(-0.1, 0.1, 0.1)).norm(),
+              0.0, 1e-6);
+  EXPECT_NEAR((centroids.col(2) - Eigen::Vector3d(1.2, -3.1, 7.9)).norm(),
+              0.0, 1e-6);
+  grid.Clear();
+  EXPECT_EQ(grid.size(), 0);
+  EXPECT_EQ(grid.Centroids().cols(), 0);
+}
+
+TEST(depthmap_point_cloud, downsamples_to_voxels) {
+  CameraModel camera = MakeCameraModel();
+  cv::Mat depthmap(camera.image_height(), camera.image_width(), CV_16UC1);
+  for (int y = 0; y < depthmap.rows; ++y) {
+    for (int x = 0; x < depthmap.cols; ++x) {
+      depthmap.at<uint16_t>(y, x) = 2000;
+    }
+  }
+  PointCloudConfig config;
+  config.set_voxel_size(0.25);
+  DepthmapPointCloud converter(camera, config);
+  PointCloud cloud = converter.Convert(depthmap, Depthmap::RANGE_MM);
+  EXPECT_EQ(cloud.frame_name(), "depth");
+  ASSERT_EQ(cloud.point_data_size(), 1);
+  auto points = TensorToEigenMapXf(cloud.point_data(0));
+  ASSERT_EQ(points.rows(), 3);
+  // The plane z = 2 spans about 4m x 3m, in 25cm voxels.
+  EXPECT_GT(points.cols(), 100);
+  EXPECT_LT(points.cols(), depthmap.rows * depthmap.cols / 4);
+  for (int i = 0; i < points.cols(); ++i) {
+    EXPECT_NEAR(points(2, i), 2.0, 1e-5);
+  }
+}
+
+TEST(depthmap_point_cloud, events_fit_in_a_datagram) {
+  CameraModel camera = CreateCameraModel(M_PI / 2, 640, 480);
+  camera.set_frame_name("depth");
+  cv::Mat depthmap(camera.image_height(), camera.image_width(), CV_16UC1,
+                   cv::Scalar(2000));
+  PointCloudConfig config;
+  config.set_stride(2);
+  DepthmapPointCloud converter(camera, config);
+  PointCloud cloud = converter.Convert(depthmap, Depthmap::RANGE_MM);
+  ASSERT_EQ(cloud.point_data(0).dtype(), Tensor::DATA_TYPE_FLOAT32);
+  ASSERT_GT(cloud.ByteSizeLong(), 65507);
+  auto points = TensorToEigenMapXf(cloud.point_data(0));
+
+  auto events = MakePointCloudEvents(cloud, MakeTimestampNow());
+  ASSERT_GT(events.size(), 1);
+  int n_points = 0;
+  for (size_t part = 0; part < events.size(); ++part) {
+    const farm_ng::core::Event& event = events[part];
+    EXPECT_EQ(event.name(), "depth/point_cloud");
+    // The event bus's datagram limit.
+    EXPECT_LT(event.ByteSizeLong(), 65507);
+    PointCloud part_pb;
+    ASSERT_TRUE(event.data().UnpackTo(&part_pb));
+    EXPECT_EQ(part_pb.frame_name(), "depth");
+    EXPECT_EQ(part_pb.part(), int(part));
+    EXPECT_EQ(part_pb.n_parts(), int(events.size()));
+    auto part_points = TensorToEigenMapXf(part_pb.point_data(0));
+    ASSERT_EQ(part_points.rows(), 3);
+    EXPECT_TRUE(part_points == points.middleCols(n_points, part_points.cols()));
+    n_points += part_points.cols();
+  }
+  EXPECT_EQ(n_points, points.cols());
+
+  // A cloud that fits is sent whole.
+  config.set_voxel_size(0.25);
+  DepthmapPointCloud downsampled(camera, config);
+  cloud = downsampled.Convert(depthmap, Depthmap::RANGE_MM);
+  events = MakePointCloudEvents(cloud, MakeTimestampNow());
+  ASSERT_EQ(events.size(), 1);
+  PointCloud whole;
+  ASSERT_TRUE(events[0].data().UnpackTo(&whole));
+  EXPECT_EQ(whole.n_parts(), 0);
+  EXPECT_EQ(whole.point_data(0).data(), cloud.point_data(0).data());
+}
@@ -0,0 +1,147 @@
+#include "farm_ng/perception/frame_buffer_pool.h"
+
+#include <new>
+
+#include <glog/logging.h>
+
+using farm_ng::core::GetMetricsRegistry;
+
+namespace farm_ng {
+namespace perception {
+
+struct FrameBufferPool::Buffer {
+  explicit Buffer(size_t n) : n_bytes(n), data(cv::fastMalloc(n)) {}
+  ~Buffer() { cv::fastFree(data); }
+
+  size_t n_bytes;
+  void* data;
+  // The cv::UMatData describing the buffer while it's in use lives here too,
+  // so handing out a buffer doesn't allocate.
+  alignas(cv::UMatData) unsigned char umat_data[sizeof(cv::UMatData)];
+};
+
+class FrameBufferPool::Allocator : public cv::MatAllocator {
+ public:
+  explicit Allocator(FrameBufferPool* pool) : pool_(pool) {}
+
+  cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+                         size_t* step, cv::AccessFlag flags,
+                         cv::UMatUsageFlags usage_flags) const override {
+    if (data) {
+      // Wrapping caller owned memory, there's nothing to pool.
+      return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data,
+                                                  step, flags, usage_flags);
+    }
+    size_t n_bytes = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; --i) {
+      if (step) {
+        step[i] = n_bytes;
+      }
+      n_bytes *= sizes[i];
+    }
+    Buffer* buffer = pool_->Acquire(n_bytes);
+    cv::UMatData* u = new (buffer->umat_data) cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(buffer->data);
+    u->size = n_bytes;
+    u->userdata = buffer;
+    return u;
+  }
+
+  bool allocate(cv::UMatData* u, cv::AccessFlag,
+                cv::UMatUsageFlags) const override {
+    return u != nullptr;
+  }
+
+  void deallocate(cv::UMatData* u) const override {
+    if (!u) {
+      return;
+    }
+    CHECK_EQ(u->refcount, 0);
+    Buffer* buffer = static_cast<Buffer*>(u->userdata);
+    u->~UMatData();
+    pool_->Release(buffer);
+  }
+
+ private:
+  FrameBufferPool* pool_;
+};
+
+FrameBufferPool::FrameBufferPool(size_t max_free_bytes)
+    : allocator_(new Allocator(this)),
+      max_free_bytes_(max_free_bytes),
+      hits_(GetMetricsRegistry().GetCounter("frame_buffer_pool/hits")),
+      misses_(GetMetricsRegistry().GetCounter("frame_buffer_pool/misses")),
+      allocated_bytes_(
+          GetMetricsRegistry().GetGauge("frame_buffer_pool/allocated_bytes")) {
+}
+
+FrameBufferPool::~FrameBufferPool() {
+  for (auto& it : free_) {
+    for (Buffer* buffer : it.second) {
+      delete buffer;
+    }
+  }
+}
+
+cv::Mat FrameBufferPool::Get(cv::Size size, int type) {
+  cv::Mat mat;
+  mat.allocator = allocator_.get();
+  mat.create(size, type);
+  return mat;
+}
+
+void FrameBufferPool::Reserve(cv::Size size, int type, int count) {
+  std::vector<cv::Mat> mats;
+  for (int i = 0; i < count; ++i) {
+    mats.push_back(Get(size, type));
+  }
+  // Released back to the pool here.
+}
+
+cv::MatAllocator* FrameBufferPool::allocator() { return allocator_.get(); }
+
+size_t FrameBufferPool::free_bytes() const {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return free_bytes_;
+}
+
+FrameBufferPool::Buffer* FrameBufferPool::Acquire(size_t n_bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = free_.find(n_bytes);
+    if (it != free_.end() && !it->second.empty()) {
+      Buffer* buffer = it->second.back();
+      it->second.pop_back();
+      free_bytes_ -= n_bytes;
+      hits_.Increment();
+      return buffer;
+    }
+    total_bytes_ += n_bytes;
+    allocated_bytes_.Set(total_bytes_);
+  }
+  misses_.Increment();
+  return new Buffer(n_bytes);
+}
+
+void FrameBufferPool::Release(Buffer* buffer) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (free_bytes_ + buffer->n_bytes <= max_free_bytes_) {
+      free_[buffer->n_bytes].push_back(buffer);
+      free_bytes_ += buffer->n_bytes;
+      return;
+    }
+    total_bytes_ -= buffer->n_bytes;
+    allocated_bytes_.Set(total_bytes_);
+  }
+  delete buffer;
+}
+
+FrameBufferPool& GetFrameBufferPool() {
+  // Leaked, as buffers may be released during static destruction.
+  static FrameBufferPool* pool = new FrameBufferPool;
+  return *pool;
+}
+
+}  // namespace perception
+}  // namespace farm_ng
@@ -0,0 +1,79 @@
+#ifndef FARM_NG_PERCEPTION_FRAME_BUFFER_POOL_H_
+#define FARM_NG_PERCEPTION_FRAME_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "farm_ng/core/metrics.h"
+
+namespace farm_ng {
+namespace perception {
+
+// A pool of image buffers, so steady state capture and processing don't
+// allocate image memory per frame.
+//
+// Buffers are plain reference counted cv::Mats, backed by a cv::MatAllocator.
+// When the last cv::Mat referencing a buffer is released (e.g. the last copy
+// of a FrameData) the memory returns to the pool, keyed by its size in bytes,
+// for the next frame of the same size and type:
+//
+//   cv::Mat bgr = GetFrameBufferPool().Get(rgb.size(), CV_8UC3);
+//   cv::cvtColor(rgb, bgr, cv::COLOR_RGB2BGR);
+//
+// OpenCV writes into a destination of the right size and type in place, so
+// Get a new buffer for each frame rather than reusing a cv::Mat that may
+// still be referenced downstream.
+//
+// Thread safe. The pool must outlive every buffer it hands out, which is why
+// GetFrameBufferPool() is never destroyed.
+class FrameBufferPool {
+ public:
+  // Free buffers beyond max_free_bytes are returned to the system.
+  explicit FrameBufferPool(size_t max_free_bytes = size_t(256) << 20);
+  ~FrameBufferPool();
+
+  FrameBufferPool(const FrameBufferPool&) = delete;
+  FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+  // Returns an uninitialized, continuous image from the pool.
+  cv::Mat Get(cv::Size size, int type);
+
+  // Preallocates count buffers for images of the given size and type.
+  void Reserve(cv::Size size, int type, int count);
+
+  // For cv::Mat::allocator, so cv::Mat::create() draws from the pool.
+  cv::MatAllocator* allocator();
+
+  size_t free_bytes() const;
+
+ private:
+  class Allocator;
+  struct Buffer;
+
+  Buffer* Acquire(size_t n_bytes);
+  void Release(Buffer* buffer);
+
+  std::unique_ptr<Allocator> allocator_;
+  size_t max_free_bytes_;
+  mutable std::mutex mtx_;
+  std::map<size_t, std::vector<Buffer*>> free_;
+  size_t free_bytes_ = 0;
+  // Free and in use.
+  size_t total_bytes_ = 0;
+  farm_ng::core::Counter& hits_;
+  farm_ng::core::Counter& misses_;
+  farm_ng::core::Gauge& allocated_bytes_;
+};
+
+// Shared by the frame grabbers and camera pipeline stages.
+FrameBufferPool& GetFrameBufferPool();
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -5,34 +5,47 @@
 #include <librealsense2/rs.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
+
+using farm_ng::core::ApplyThreadPolicy;
 using farm_ng::core::EventBus;
+using farm_ng::core::TraceSpan;
 
 namespace farm_ng {
 namespace perception {
 
 namespace {
-// Convert rs2::frame to cv::Mat
+// Copy rs2::frame to a pooled cv::Mat, converting RGB to BGR.
 // https://raw.githubusercontent.com/IntelRealSense/librealsense/master/wrappers/opencv/cv-helpers.hpp
-cv::Mat RS2FrameToMat(const rs2::frame& f) {
+cv::Mat RS2FrameToMat(const rs2::frame& f, FrameBufferPool& pool) {
   using namespace cv;
   using namespace rs2;
 
   auto vf = f.as<video_frame>();
   const int w = vf.get_width();
   const int h = vf.get_height();
+  // The frame's memory belongs to librealsense, so copy it out.
+  auto copy = [&](int type) {
+    Mat view(Size(w, h), type, (void*)f.get_data(), Mat::AUTO_STEP);
+    Mat out = pool.Get(view.size(), type);
+    view.copyTo(out);
+    return out;
+  };
   if (f.get_profile().format() == RS2_FORMAT_BGR8) {
-    return Mat(Size(w, h), CV_8UC3, (void*)f.get_data(), Mat::AUTO_STEP);
+    return copy(CV_8UC3);
   } else if (f.get_profile().format() == RS2_FORMAT_RGB8) {
     auto r_rgb = Mat(Size(w, h), CV_8UC3, (void*)f.get_data(), Mat::AUTO_STEP);
-    Mat r_bgr;
+    Mat r_bgr = pool.Get(r_rgb.size(), CV_8UC3);
     cvtColor(r_rgb, r_bgr, COLOR_RGB2BGR);
     return r_bgr;
   } else if (f.get_profile().format() == RS2_FORMAT_Z16) {
-    return Mat(Size(w, h), CV_16UC1, (void*)f.get_data(), Mat::AUTO_STEP);
+    return copy(CV_16UC1);
   } else if (f.get_profile().format() == RS2_FORMAT_Y8) {
-    return Mat(Size(w, h), CV_8UC1, (void*)f.get_data(), Mat::AUTO_STEP);
+    return copy(CV_8UC1);
   } else if (f.get_profile().format() == RS2_FORMAT_DISPARITY32) {
-    return Mat(Size(w, h), CV_32FC1, (void*)f.get_data(), Mat::AUTO_STEP);
+    return copy(CV_32FC1);
   }
 
   throw std::runtime_error("Frame format is not supported yet!");
@@ -132,6 +145,13 @@ class FrameGrabberIntel : public FrameGrabber {
   // simultaneously from multiple sensors Therefore any modification to common
   // memory should be done under lock
   void frame_callback(const rs2::frame& frame) {
+    // The sensor threads belong to librealsense, so the frame_grabber policy
+    // is applied the first time each one delivers a frame.
+    thread_local bool thread_policy_applied = false;
+    if (!thread_policy_applied) {
+      ApplyThreadPolicy("frame_grabber");
+      thread_policy_applied = true;
+    }
     VLOG(1) << "frame recved : " << camera_model_.frame_name();
     if (rs2::frameset fs = frame.as<rs2::frameset>()) {
       std::optional<rs2::video_frame> video_frame;
@@ -142,11 +162,12 @@ class FrameGrabberIntel : public FrameGrabber {
       } else if (config_.model() == CameraConfig::MODEL_INTEL_T265) {
         video_frame = fs.get_fisheye_frame(0);
       }
-      cv::Mat frame_0 = RS2FrameToMat(*video_frame).clone();
+      cv::Mat frame_0 = RS2FrameToMat(*video_frame, GetFrameBufferPool());
       auto stamp = google::protobuf::util::TimeUtil::MillisecondsToTimestamp(
           video_frame->get_timestamp());
 
       std::lock_guard<std::mutex> lock(mtx_);
+      TraceSpan span("frame_grabber/signal", stamp);
       signal_(FrameData({config_, camera_model_, frame_0, cv::Mat(), Depthmap::RANGE_UNSPECIFIED, stamp}));
     }
   }
@@ -9,10 +9,15 @@
 #include <iostream>
 
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
 #include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
 
+using farm_ng::core::ApplyThreadPolicy;
 using farm_ng::core::EventBus;
 using farm_ng::core::MakeTimestampNow;
+using farm_ng::core::TraceSpan;
 
 namespace farm_ng {
 namespace perception {
@@ -84,6 +89,7 @@ class FrameGrabberK4a : public FrameGrabber {
       camera_model_.CopyFrom(model);
 
       capture_thread_.emplace([this, config, calibration]() {
+        ApplyThreadPolicy("frame_grabber");
         std::cout << "Started  K4A device..." << std::endl;
         k4a::transformation depth_to_color(calibration);
         dev_->start_cameras(&config);
@@ -110,11 +116,17 @@ class FrameGrabberK4a : public FrameGrabber {
 
             std::lock_guard<std::mutex> lock(mtx_);
 
+            // Fresh buffers each frame, as the previous ones may still be
+            // referenced downstream.
+            FrameBufferPool& pool = GetFrameBufferPool();
+            frame_data_.image = pool.Get(color_mat.size(), CV_8UC3);
             cv::cvtColor(color_mat, frame_data_.image, cv::COLOR_BGRA2BGR);
             frame_data_.depthmap_range = Depthmap::RANGE_MM;
-            frame_data_.depthmap = depthmap.clone();
+            frame_data_.depthmap = pool.Get(depthmap.size(), CV_16UC1);
+            depthmap.copyTo(frame_data_.depthmap);
             frame_data_.mutable_stamp()->CopyFrom(stamp);
 
+            TraceSpan span("frame_grabber/signal", stamp);
             signal_(frame_data_);
           }
         }
@@ -0,0 +1,318 @@
+#include "farm_ng/perception/frame_grabber.h"
+
+#include <apriltag.h>
+#include <tag36h11.h>
+#include <google/protobuf/util/time_util.h>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include "farm_ng/core/blobstore.h"
+#include "farm_ng/core/event_log_reader.h"
+#include "farm_ng/core/ipc.h"
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
+#include "farm_ng/perception/image_loader.h"
+
+using farm_ng::core::ApplyThreadPolicy;
+using farm_ng::core::EventBus;
+using farm_ng::core::EventLogReader;
+using farm_ng::core::GetBlobstoreRoot;
+using farm_ng::core::MakeTimestampNow;
+using farm_ng::core::TraceSpan;
+using google::protobuf::util::TimeUtil;
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+const double kDefaultFrameRate = 30.0;
+const int kDefaultWidth = 1280;
+const int kDefaultHeight = 720;
+
+std::string ResolvePath(const std::string& path) {
+  boost::filesystem::path p(path);
+  if (p.is_absolute()) {
+    return p.string();
+  }
+  return (GetBlobstoreRoot() / p).string();
+}
+
+// Renders tag36h11 apriltags drifting and turning in front of a pinhole
+// camera.
+class SyntheticApriltagScene {
+ public:
+  static constexpr int kNumTags = 4;
+  // Black border edge length, in meters.
+  static constexpr double kTagSize = 0.16;
+
+  explicit SyntheticApriltagScene(const CameraModel& camera_model)
+      : camera_model_(camera_model) {
+    std::shared_ptr<apriltag_family_t> family(tag36h11_create(),
+                                              &tag36h11_destroy);
+    for (int id = 0; id < kNumTags; ++id) {
+      image_u8_t* tag = apriltag_to_image(family.get(), id);
+      // The rendered tag includes its white border.
+      tag_border_fraction_ =
+          double(family->width_at_border) / family->total_width;
+      tags_.push_back(
+          cv::Mat(tag->height, tag->width, CV_8UC1, tag->buf, tag->stride)
+              .clone());
+      image_u8_destroy(tag);
+    }
+    canvas_.create(GetCvSize(camera_model_), CV_8UC1);
+  }
+
+  // Renders the scene at time t, in seconds, into a BGR image.
+  void Render(double t, cv::Mat* image) {
+    canvas_.setTo(cv::Scalar(96));
+    const double fx = camera_model_.fx(), fy = camera_model_.fy();
+    const double cx = camera_model_.cx(), cy = camera_model_.cy();
+    const double half = 0.5 * kTagSize / tag_border_fraction_;
+    for (int i = 0; i < kNumTags; ++i) {
+      // Tags sit on a 2x2 grid 1.5m away, each on its own trajectory.
+      double phase = t * (0.5 + 0.1 * i) + i;
+      double x0 = (i % 2 == 0 ? -0.3 : 0.3) + 0.1 * std::sin(phase);
+      double y0 = (i / 2 == 0 ? -0.2 : 0.2) + 0.05 * std::cos(phase);
+      double z0 = 1.5 + 0.3 * std::sin(0.7 * phase);
+      double yaw = 0.4 * std::sin(phase);
+      double roll = 0.3 * phase;
+      const cv::Point2f corners[4] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+      std::vector<cv::Point2f> pixels;
+      for (const cv::Point2f& c : corners) {
+        // Roll in the tag plane, then yaw about the vertical axis.
+        double u = half * (c.x * std::cos(roll) - c.y * std::sin(roll));
+        double v = half * (c.x * std::sin(roll) + c.y * std::cos(roll));
+        double x = x0 + u * std::cos(yaw);
+        double y = y0 + v;
+        double z = z0 + u * std::sin(yaw);
+        pixels.emplace_back(fx * x / z + cx, fy * y / z + cy);
+      }
+      cv::Rect roi =
+          cv::boundingRect(pixels) & cv::Rect(cv::Point(0, 0), canvas_.size());
+      if (roi.empty()) {
+        continue;
+      }
+      const cv::Mat& tag = tags_[i];
+      std::vector<cv::Point2f> tag_corners = {
+          {0, 0},
+          {float(tag.cols), 0},
+          {float(tag.cols), float(tag.rows)},
+          {0, float(tag.rows)}};
+      for (cv::Point2f& p : pixels) {
+        p -= cv::Point2f(roi.x, roi.y);
+      }
+      cv::Mat canvas_roi = canvas_(roi);
+      cv::warpPerspective(tag, canvas_roi,
+                          cv::getPerspectiveTransform(tag_corners, pixels),
+                          roi.size(), cv::INTER_NEAREST,
+                          cv::BORDER_TRANSPARENT);
+    }
+    cv::cvtColor(canvas_, *image, cv::COLOR_GRAY2BGR);
+  }
+
+ private:
+  CameraModel camera_model_;
+  std::vector<cv::Mat> tags_;
+  double tag_border_fraction_ = 1.0;
+  cv::Mat canvas_;
+};
+
+}  // namespace
+
+// Generates or replays frames at a fixed rate, for exercising the camera
+// pipeline without hardware. See SimulatedCameraConfig.
+class FrameGrabberSimulated : public FrameGrabber {
+ public:
+  FrameGrabberSimulated(EventBus& event_bus, CameraConfig config)
+      : event_bus_(event_bus),
+        config_(config),
+        sim_(config.simulated()),
+        stop_(false) {
+    if (sim_.frame_rate() <= 0) {
+      sim_.set_frame_rate(kDefaultFrameRate);
+    }
+    cv::Size size(sim_.image_width(), sim_.image_height());
+
+    switch (sim_.source()) {
+      case SimulatedCameraConfig::SOURCE_VIDEO_FILE: {
+        video_.reset(new cv::VideoCapture(ResolvePath(sim_.path())));
+        CHECK(video_->isOpened()) << "Could not open: " << sim_.path();
+        cv::Size source_size(video_->get(cv::CAP_PROP_FRAME_WIDTH),
+                             video_->get(cv::CAP_PROP_FRAME_HEIGHT));
+        camera_model_ = CreateCameraModel(M_PI / 2, source_size.width,
+                                          source_size.height);
+      } break;
+      case SimulatedCameraConfig::SOURCE_EVENT_LOG: {
+        log_reader_.reset(new EventLogReader(ResolvePath(sim_.path())));
+        // The first image sets the camera model.
+        Image image;
+        CHECK(NextLogImage(&image)) << "No images in: " << sim_.path();
+        camera_model_ = image.camera_model();
+        log_reader_->Reset(ResolvePath(sim_.path()));
+      } break;
+      default: {
+        if (size.area() == 0) {
+          size = cv::Size(kDefaultWidth, kDefaultHeight);
+        }
+        camera_model_ = CreateCameraModel(M_PI / 2, size.width, size.height);
+        scene_.reset(new SyntheticApriltagScene(camera_model_));
+      } break;
+    }
+    if (size.area() > 0 && size != GetCvSize(camera_model_)) {
+      camera_model_ =
+          ResizeCameraModel(camera_model_, size.width, size.height);
+    }
+    camera_model_.set_frame_name(config_.name());
+    LOG(INFO) << "Simulated camera: " << sim_.ShortDebugString()
+              << " model: " << camera_model_.ShortDebugString();
+
+    capture_thread_ = std::thread([this]() {
+      ApplyThreadPolicy("frame_grabber");
+      Run();
+    });
+  }
+
+  virtual ~FrameGrabberSimulated() {
+    stop_ = true;
+    capture_thread_.join();
+  }
+
+  virtual const CameraConfig& GetCameraConfig() const override {
+    return config_;
+  }
+  virtual const CameraModel& GetCameraModel() const override {
+    return camera_model_;
+  };
+
+  virtual FrameGrabber::Signal& VisualFrameSignal() override { return signal_; }
+
+ private:
+  void Run() {
+    const auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double>(1.0 / sim_.frame_rate()));
+    const auto start = std::chrono::steady_clock::now();
+    std::mt19937 rng(std::hash<std::string>()(config_.name()));
+    std::normal_distribution<double> jitter_ns(0.0,
+                                               sim_.stamp_jitter_ms() * 1e6);
+    auto next = start;
+    while (!stop_) {
+      std::this_thread::sleep_until(next);
+      auto now = std::chrono::steady_clock::now();
+      // Don't burst to catch up if we fell behind.
+      next = std::max(next + period, now);
+
+      cv::Mat image = GetFrameBufferPool().Get(GetCvSize(camera_model_),
+                                               CV_8UC3);
+      if (!NextImage(std::chrono::duration<double>(now - start).count(),
+                     &image)) {
+        LOG(INFO) << "Simulated camera finished: " << config_.name();
+        break;
+      }
+      int64_t stamp_ns = TimeUtil::TimestampToNanoseconds(MakeTimestampNow());
+      if (sim_.stamp_jitter_ms() > 0) {
+        stamp_ns += int64_t(jitter_ns(rng));
+      }
+      auto stamp = TimeUtil::NanosecondsToTimestamp(stamp_ns);
+      TraceSpan span("frame_grabber/signal", stamp);
+      signal_(FrameData({config_, camera_model_, image, cv::Mat(),
+                         Depthmap::RANGE_UNSPECIFIED, stamp}));
+    }
+  }
+
+  // Fills image, which is preallocated at the camera model's size.
+  bool NextImage(double t, cv::Mat* image) {
+    if (scene_) {
+      scene_->Render(t, image);
+      return true;
+    }
+    cv::Mat source;
+    if (video_) {
+      if (!video_->read(scratch_) && sim_.loop()) {
+        video_->set(cv::CAP_PROP_POS_FRAMES, 0);
+        video_->read(scratch_);
+      }
+      source = scratch_;
+    } else {
+      Image image;
+      if (!NextLogImage(&image) && sim_.loop()) {
+        log_reader_->Reset(ResolvePath(sim_.path()));
+        NextLogImage(&image);
+      }
+      if (image.has_resource()) {
+        source = image_loader_.LoadImage(image);
+      }
+    }
+    if (source.empty()) {
+      return false;
+    }
+    if (source.channels() == 1) {
+      cv::cvtColor(source, scratch_gray_, cv::COLOR_GRAY2BGR);
+      source = scratch_gray_;
+    }
+    if (source.size() == image->size()) {
+      source.copyTo(*image);
+    } else {
+      cv::resize(source, *image, image->size());
+    }
+    return true;
+  }
+
+  bool NextLogImage(Image* image) {
+    while (true) {
+      core::Event event;
+      try {
+        event = log_reader_->ReadNext();
+      } catch (const std::runtime_error&) {
+        return false;
+      }
+      if (!event.data().UnpackTo(image)) {
+        continue;
+      }
+      if (sim_.replay_frame_name().empty()) {
+        sim_.set_replay_frame_name(image->camera_model().frame_name());
+      }
+      if (image->camera_model().frame_name() == sim_.replay_frame_name()) {
+        return true;
+      }
+    }
+  }
+
+  EventBus& event_bus_;
+  CameraConfig config_;
+  SimulatedCameraConfig sim_;
+  CameraModel camera_model_;
+  FrameGrabber::Signal signal_;
+
+  std::unique_ptr<SyntheticApriltagScene> scene_;
+  std::unique_ptr<cv::VideoCapture> video_;
+  std::unique_ptr<EventLogReader> log_reader_;
+  ImageLoader image_loader_;
+  cv::Mat scratch_;
+  cv::Mat scratch_gray_;
+
+  std::atomic<bool> stop_;
+  std::thread capture_thread_;
+};
+
+namespace {
+static FrameGrabber::FrameGrabberFactory simulated_factory =
+    [](EventBus& event_bus, CameraConfig config) {
+      return std::unique_ptr<FrameGrabber>(
+          new FrameGrabberSimulated(event_bus, config));
+    };
+
+static int _simulated =
+    FrameGrabber::AddFrameGrabberFactory("simulated", simulated_factory);
+}  // namespace
+
+}  // namespace perception
+}  // namespace farm_ng
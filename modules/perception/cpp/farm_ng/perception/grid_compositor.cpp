@@ -0,0 +1,132 @@
+#include "farm_ng/perception/grid_compositor.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "farm_ng/perception/frame_buffer_pool.h"
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+// Encoders may hold a few canvases at once.
+const size_t kMaxCanvases = 4;
+
+// Other threads release their references concurrently, so the count is read
+// atomically, as cv::Mat updates it.
+bool InUse(const cv::Mat& image) {
+  return image.u && CV_XADD(&image.u->refcount, 0) > 1;
+}
+}  // namespace
+
+GridCompositor::GridCompositor(cv::Size canvas_size, int n_tiles, int n_cols)
+    : canvas_size_(canvas_size), tiles_(n_tiles) {
+  CHECK_GT(n_tiles, 0);
+  CHECK_GT(n_cols, 0);
+  int n_rows = (n_tiles + n_cols - 1) / n_cols;
+  int target_width = canvas_size.width / n_cols;
+  int target_height = canvas_size.height / n_rows;
+  for (int i = 0; i < n_tiles; ++i) {
+    tiles_[i].cell = cv::Rect((i % n_cols) * target_width,
+                              (i / n_cols) * target_height, target_width,
+                              target_height);
+  }
+  // AcquireCanvas hands out references.
+  canvases_.reserve(kMaxCanvases);
+}
+
+void GridCompositor::set_tile_interval(int tile, int interval) {
+  CHECK_GE(tile, 0);
+  CHECK_LT(tile, int(tiles_.size()));
+  tiles_[tile].interval = std::max(1, interval);
+}
+
+GridCompositor::Canvas& GridCompositor::AcquireCanvas() {
+  for (size_t i = 0; i < canvases_.size(); ++i) {
+    if (int(i) != last_ && !InUse(canvases_[i].image)) {
+      return canvases_[i];
+    }
+  }
+  Canvas* canvas;
+  if (canvases_.size() < kMaxCanvases) {
+    canvases_.emplace_back();
+    canvas = &canvases_.back();
+  } else {
+    // Every canvas is still held downstream, so let one go.
+    canvas = &canvases_[(last_ + 1) % canvases_.size()];
+  }
+  canvas->image = GetFrameBufferPool().Get(canvas_size_, CV_8UC3);
+  canvas->image.setTo(cv::Scalar::all(0));
+  canvas->versions.assign(tiles_.size(), 0);
+  return *canvas;
+}
+
+void GridCompositor::DrawTile(Tile* tile, const cv::Mat& source,
+                              cv::Mat canvas) {
+  if (source.size() != tile->source_size) {
+    float resize_ratio =
+        std::min(tile->cell.width / float(source.cols),
+                 tile->cell.height / float(source.rows));
+    tile->roi = cv::Rect(tile->cell.x, tile->cell.y,
+                         source.cols * resize_ratio,
+                         source.rows * resize_ratio);
+    tile->source_size = source.size();
+    canvas(tile->cell).setTo(cv::Scalar::all(0));
+  }
+  cv::Mat dst = canvas(tile->roi);
+  if (source.channels() == 1) {
+    // Resizing before converting touches a third of the bytes.
+    cv::Mat gray = source;
+    if (source.size() != dst.size()) {
+      cv::resize(source, tile->gray_scratch, dst.size());
+      gray = tile->gray_scratch;
+    }
+    cv::cvtColor(gray, dst, cv::COLOR_GRAY2BGR);
+  } else {
+    CHECK_EQ(source.channels(), 3);
+    if (source.size() == dst.size()) {
+      source.copyTo(dst);
+    } else {
+      cv::resize(source, dst, dst.size());
+    }
+  }
+}
+
+cv::Mat GridCompositor::Compose(const std::vector<cv::Mat>& images) {
+  CHECK_EQ(images.size(), tiles_.size());
+  Canvas& canvas = AcquireCanvas();
+
+  // Tiles to draw from their new image, or else copy from the last canvas.
+  std::vector<std::pair<int, bool>> work;
+  for (size_t i = 0; i < tiles_.size(); ++i) {
+    Tile& tile = tiles_[i];
+    bool draw = !images[i].empty() && tile.n_images++ % tile.interval == 0;
+    if (draw) {
+      tile.version = next_version_++;
+      work.emplace_back(i, true);
+    } else if (canvas.versions[i] != tile.version) {
+      work.emplace_back(i, false);
+    }
+    canvas.versions[i] = tile.version;
+  }
+
+  const cv::Mat last = last_ >= 0 ? canvases_[last_].image : cv::Mat();
+  cv::parallel_for_(cv::Range(0, work.size()), [&](const cv::Range& range) {
+    for (int w = range.start; w < range.end; ++w) {
+      int i = work[w].first;
+      if (work[w].second) {
+        DrawTile(&tiles_[i], images[i], canvas.image);
+      } else {
+        last(tiles_[i].cell).copyTo(canvas.image(tiles_[i].cell));
+      }
+    }
+  });
+  last_ = &canvas - canvases_.data();
+  return canvas.image;
+}
+
+}  // namespace perception
+}  // namespace farm_ng
@@ -0,0 +1,69 @@
+#ifndef FARM_NG_PERCEPTION_GRID_COMPOSITOR_H_
+#define FARM_NG_PERCEPTION_GRID_COMPOSITOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace farm_ng {
+namespace perception {
+
+// Tiles camera images into a grid, like ConstructGridImage, for a stream of
+// frames.
+//
+// Tile geometry is computed once per source size, tiles are redrawn in
+// parallel, and only tiles with a new image are redrawn. Canvases are reused
+// once the caller releases them, so steady state composition doesn't
+// allocate: a reused canvas copies, rather than redraws, the tiles it is
+// missing from the last one composed.
+//
+// Not thread safe.
+class GridCompositor {
+ public:
+  GridCompositor(cv::Size canvas_size, int n_tiles, int n_cols);
+
+  // Redraws the tile at most every interval'th image it is given, for low
+  // priority cameras. Defaults to 1.
+  void set_tile_interval(int tile, int interval);
+
+  // images holds each tile's new image, gray or BGR, or an empty cv::Mat to
+  // keep the tile's last image. Returns the BGR canvas, which is not written
+  // to again while the caller holds a reference to it.
+  cv::Mat Compose(const std::vector<cv::Mat>& images);
+
+ private:
+  struct Tile {
+    cv::Rect cell;
+    // Where the image is drawn within the canvas, for source_size.
+    cv::Rect roi;
+    cv::Size source_size;
+    int interval = 1;
+    uint64_t n_images = 0;
+    // Of the image last drawn, 0 if none.
+    uint64_t version = 0;
+    cv::Mat gray_scratch;
+  };
+
+  struct Canvas {
+    cv::Mat image;
+    // The version of each tile drawn in image.
+    std::vector<uint64_t> versions;
+  };
+
+  Canvas& AcquireCanvas();
+  void DrawTile(Tile* tile, const cv::Mat& source, cv::Mat canvas);
+
+  cv::Size canvas_size_;
+  std::vector<Tile> tiles_;
+  std::vector<Canvas> canvases_;
+  // Index in canvases_ of the last canvas composed, which holds the latest
+  // version of every tile.
+  int last_ = -1;
+  uint64_t next_version_ = 1;
+};
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,87 @@
+#include "farm_ng/perception/grid_compositor.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace farm_ng::perception;
+
+namespace {
+
+// Three tiles in two columns of 100x50 cells.
+const cv::Size kCanvasSize(200, 100);
+const cv::Size kCellSize(100, 50);
+
+cv::Mat Bgr(cv::Size size, int b, int g, int r) {
+  return cv::Mat(size, CV_8UC3, cv::Scalar(b, g, r));
+}
+
+cv::Mat Gray(cv::Size size, int value) {
+  return cv::Mat(size, CV_8UC1, cv::Scalar(value));
+}
+
+cv::Vec3b Pixel(const cv::Mat& canvas, int x, int y) {
+  return canvas.at<cv::Vec3b>(y, x);
+}
+
+}  // namespace
+
+TEST(grid_compositor, places_tiles) {
+  GridCompositor compositor(kCanvasSize, 3, 2);
+  // A BGR image the size of its cell, a larger gray image, and a square image
+  // that is fit to the cell's height.
+  cv::Mat canvas = compositor.Compose({Bgr(kCellSize, 10, 20, 30),
+                                       Gray(cv::Size(200, 100), 40),
+                                       Bgr(cv::Size(50, 50), 50, 60, 70)});
+  ASSERT_EQ(canvas.size(), kCanvasSize);
+  ASSERT_EQ(canvas.type(), CV_8UC3);
+  EXPECT_EQ(Pixel(canvas, 0, 0), cv::Vec3b(10, 20, 30));
+  EXPECT_EQ(Pixel(canvas, 99, 49), cv::Vec3b(10, 20, 30));
+  EXPECT_EQ(Pixel(canvas, 100, 0), cv::Vec3b(40, 40, 40));
+  EXPECT_EQ(Pixel(canvas, 199, 49), cv::Vec3b(40, 40, 40));
+  EXPECT_EQ(Pixel(canvas, 0, 50), cv::Vec3b(50, 60, 70));
+  EXPECT_EQ(Pixel(canvas, 49, 99), cv::Vec3b(50, 60, 70));
+  // The rest of the third cell, and the empty fourth cell, are black.
+  EXPECT_EQ(Pixel(canvas, 50, 50), cv::Vec3b(0, 0, 0));
+  EXPECT_EQ(Pixel(canvas, 150, 75), cv::Vec3b(0, 0, 0));
+}
+
+TEST(grid_compositor, skips_tiles_by_interval) {
+  GridCompositor compositor(kCanvasSize, 3, 2);
+  compositor.set_tile_interval(1, 2);
+  for (int frame = 0; frame < 5; ++frame) {
+    const int value = 10 * (frame + 1);
+    // The last canvas is released each time, so canvases are reused.
+    cv::Mat canvas = compositor.Compose(
+        {Bgr(kCellSize, value, 0, 0), Bgr(kCellSize, value, 1, 0),
+         frame == 3 ? cv::Mat() : Bgr(kCellSize, value, 2, 0)});
+    EXPECT_EQ(Pixel(canvas, 0, 0), cv::Vec3b(value, 0, 0)) << frame;
+    // Drawn from every other image.
+    const int drawn = 10 * (frame - frame % 2 + 1);
+    EXPECT_EQ(Pixel(canvas, 100, 0), cv::Vec3b(drawn, 1, 0)) << frame;
+    // An empty image keeps the tile's last one.
+    const int kept = frame == 3 ? 30 : value;
+    EXPECT_EQ(Pixel(canvas, 0, 50), cv::Vec3b(kept, 2, 0)) << frame;
+  }
+}
+
+TEST(grid_compositor, keeps_held_canvases) {
+  GridCompositor compositor(kCanvasSize, 3, 2);
+  cv::Mat first = compositor.Compose({Bgr(kCellSize, 1, 0, 0),
+                                      Bgr(kCellSize, 2, 0, 0),
+                                      Bgr(kCellSize, 3, 0, 0)});
+  std::vector<cv::Mat> held;
+  for (int frame = 0; frame < 3; ++frame) {
+    // Only the first tile has a new image, the others are copied.
+    held.push_back(compositor.Compose(
+        {Bgr(kCellSize, 100 + frame, 0, 0), cv::Mat(), cv::Mat()}));
+    EXPECT_NE(held.back().data, first.data);
+    EXPECT_EQ(Pixel(held.back(), 0, 0), cv::Vec3b(100 + frame, 0, 0));
+    EXPECT_EQ(Pixel(held.back(), 100, 0), cv::Vec3b(2, 0, 0));
+    EXPECT_EQ(Pixel(held.back(), 0, 50), cv::Vec3b(3, 0, 0));
+  }
+  EXPECT_EQ(Pixel(first, 0, 0), cv::Vec3b(1, 0, 0));
+  for (int frame = 0; frame < 3; ++frame) {
+    EXPECT_EQ(Pixel(held[frame], 0, 0), cv::Vec3b(100 + frame, 0, 0));
+  }
+}
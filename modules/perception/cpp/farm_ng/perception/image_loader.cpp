@@ -41,7 +41,10 @@ cv::Mat ImageLoader::LoadImage(const Image& image) {
       CHECK_GT(frame_number, 0);
       frame_number -= 1;
     }
-    capture_->set(cv::CAP_PROP_POS_FRAMES, frame_number);
+    // Seeking flushes the decoder, so frames read in order are much faster.
+    if (frame_number != int(capture_->get(cv::CAP_PROP_POS_FRAMES))) {
+      capture_->set(cv::CAP_PROP_POS_FRAMES, frame_number);
+    }
     CHECK_EQ(frame_number, uint32_t(capture_->get(cv::CAP_PROP_POS_FRAMES)));
     *capture_ >> frame;
   } else {
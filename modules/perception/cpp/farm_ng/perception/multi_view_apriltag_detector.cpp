@@ -0,0 +1,151 @@
+#include "farm_ng/perception/multi_view_apriltag_detector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "farm_ng/perception/apriltag.h"
+#include "farm_ng/perception/image_loader.h"
+
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::ThreadPool;
+
+namespace farm_ng {
+namespace perception {
+
+// A camera's detector and loader, used by one thread at a time.
+class MultiViewApriltagDetector::View {
+ public:
+  View(const CameraModel& camera_model, const ApriltagConfig& config)
+      : detector_(camera_model, nullptr, &config),
+        latency_(GetMetricsRegistry().GetHistogram(
+            "multi_view_apriltag/view/" + camera_model.frame_name())) {}
+
+  ApriltagDetections Detect(const Image& image,
+                            const google::protobuf::Timestamp& stamp) {
+    ScopedLatency latency(latency_);
+    cv::Mat image_mat = loader_.LoadImage(image);
+    cv::Mat depth_mat = loader_.LoadDepthmap(image);
+    cv::Mat gray;
+    if (image_mat.channels() == 3) {
+      cv::cvtColor(image_mat, gray, cv::COLOR_BGR2GRAY);
+    } else {
+      CHECK_EQ(image_mat.channels(), 1);
+      gray = image_mat;
+    }
+    ApriltagDetections tags = detector_.Detect(gray, depth_mat, stamp);
+    tags.mutable_image()->CopyFrom(image);
+    return tags;
+  }
+
+ private:
+  ApriltagDetector detector_;
+  ImageLoader loader_;
+  farm_ng::core::Histogram& latency_;
+};
+
+MultiViewApriltagDetector::MultiViewApriltagDetector(
+    const ApriltagConfig& config, int n_threads)
+    : config_(config),
+      n_threads_(n_threads > 0
+                     ? n_threads
+                     : std::max(1u, std::thread::hardware_concurrency())),
+      detect_latency_(
+          GetMetricsRegistry().GetHistogram("multi_view_apriltag/detect")) {
+  if (n_threads_ > 1) {
+    pool_ = std::make_unique<ThreadPool>("multi_view_apriltag");
+    pool_work_ = std::make_unique<boost::asio::io_service::work>(
+        pool_->get_io_service());
+    pool_->Start(n_threads_ - 1);
+  }
+}
+
+MultiViewApriltagDetector::~MultiViewApriltagDetector() {
+  if (pool_) {
+    pool_work_.reset();
+    pool_->Stop();
+    pool_->Join();
+  }
+}
+
+MultiViewApriltagDetector::View& MultiViewApriltagDetector::GetView(
+    const CameraModel& camera_model) {
+  auto it = views_.find(camera_model.frame_name());
+  if (it == views_.end()) {
+    LOG(INFO) << camera_model.ShortDebugString();
+    it = views_
+             .emplace(camera_model.frame_name(),
+                      std::make_unique<View>(camera_model, config_))
+             .first;
+  }
+  return *it->second;
+}
+
+MultiViewApriltagDetections MultiViewApriltagDetector::Detect(
+    const google::protobuf::RepeatedPtrField<Image>& images,
+    const google::protobuf::Timestamp& stamp) {
+  auto start = std::chrono::steady_clock::now();
+  const int n_views = images.size();
+  // Views are created up front, so the workers only read views_.
+  std::vector<View*> views;
+  std::set<std::string> frame_names;
+  for (const Image& image : images) {
+    CHECK_GT(image.camera_model().image_width(), 1);
+    CHECK(frame_names.insert(image.camera_model().frame_name()).second)
+        << "Duplicate view: " << image.camera_model().frame_name();
+    views.push_back(&GetView(image.camera_model()));
+  }
+
+  std::vector<ApriltagDetections> detections(n_views);
+  last_timing_.per_view.assign(n_views, std::chrono::microseconds(0));
+  std::atomic<int> next_view(0);
+  auto work = [&]() {
+    for (int i = next_view++; i < n_views; i = next_view++) {
+      auto view_start = std::chrono::steady_clock::now();
+      detections[i] = views[i]->Detect(images.Get(i), stamp);
+      last_timing_.per_view[i] =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - view_start);
+    }
+  };
+
+  int n_workers = pool_ ? std::min(n_threads_, n_views) - 1 : 0;
+  std::mutex mtx;
+  std::condition_variable cv;
+  int n_running = n_workers;
+  for (int w = 0; w < n_workers; ++w) {
+    pool_->get_io_service().post([&]() {
+      work();
+      std::lock_guard<std::mutex> lock(mtx);
+      if (--n_running == 0) {
+        cv.notify_one();
+      }
+    });
+  }
+  work();
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return n_running == 0; });
+  }
+
+  MultiViewApriltagDetections multi_view_detections;
+  for (int i = 0; i < n_views; ++i) {
+    LOG(INFO) << images.Get(i).camera_model().frame_name()
+              << " n tags: " << detections[i].detections_size();
+    multi_view_detections.add_detections_per_view()->Swap(&detections[i]);
+  }
+  last_timing_.total = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  detect_latency_.Record(last_timing_.total);
+  return multi_view_detections;
+}
+
+}  // namespace perception
+}  // namespace farm_ng
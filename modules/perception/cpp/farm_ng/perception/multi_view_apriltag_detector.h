@@ -0,0 +1,73 @@
+#ifndef FARM_NG_PERCEPTION_MULTI_VIEW_APRILTAG_DETECTOR_H_
+#define FARM_NG_PERCEPTION_MULTI_VIEW_APRILTAG_DETECTOR_H_
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+#include <google/protobuf/timestamp.pb.h>
+
+#include "farm_ng/core/metrics.h"
+#include "farm_ng/core/thread_pool.h"
+
+#include "farm_ng/perception/apriltag.pb.h"
+#include "farm_ng/perception/image.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// Detects apriltags in a synchronized set of images, e.g. a
+// CalibratedCaptureResponse, loading and detecting the views concurrently.
+// Each camera, by frame name, keeps its own ApriltagDetector across calls.
+//
+// Not thread safe.
+class MultiViewApriltagDetector {
+ public:
+  // n_threads defaults to the number of cores, and includes the calling
+  // thread.
+  explicit MultiViewApriltagDetector(const ApriltagConfig& config,
+                                     int n_threads = 0);
+  ~MultiViewApriltagDetector();
+
+  MultiViewApriltagDetector(const MultiViewApriltagDetector&) = delete;
+  MultiViewApriltagDetector& operator=(const MultiViewApriltagDetector&) =
+      delete;
+
+  // Loads each image and its depthmap, if any, from their resources and
+  // detects apriltags. detections_per_view follows the order of images, each
+  // with its image set.
+  // Precondition: camera frame names are unique within images.
+  MultiViewApriltagDetections Detect(
+      const google::protobuf::RepeatedPtrField<Image>& images,
+      const google::protobuf::Timestamp& stamp);
+
+  struct Timing {
+    std::chrono::microseconds total{0};
+    // Load and detect time of each view, in the order of images.
+    std::vector<std::chrono::microseconds> per_view;
+  };
+
+  // Of the last Detect.
+  const Timing& last_timing() const { return last_timing_; }
+
+ private:
+  class View;
+
+  View& GetView(const CameraModel& camera_model);
+
+  ApriltagConfig config_;
+  int n_threads_;
+  std::map<std::string, std::unique_ptr<View>> views_;
+  std::unique_ptr<farm_ng::core::ThreadPool> pool_;
+  std::unique_ptr<boost::asio::io_service::work> pool_work_;
+  Timing last_timing_;
+  farm_ng::core::Histogram& detect_latency_;
+};
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,242 @@
+#include "farm_ng/perception/offline_apriltag_detector.h"
+
+#include <algorithm>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "farm_ng/core/blobstore.h"
+#include "farm_ng/core/ipc.h"
+#include "farm_ng/perception/image_loader.h"
+
+using farm_ng::core::Bucket;
+using farm_ng::core::GetBucketAbsolutePath;
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::ReadProtobufFromJsonFile;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::ThreadPool;
+
+namespace farm_ng {
+namespace perception {
+
+struct OfflineApriltagDetector::Job {
+  Image image;
+  google::protobuf::Timestamp stamp;
+  double scale;
+  // Released once detected.
+  cv::Mat frame;
+  ApriltagDetections detections;
+  // Guarded by done_mtx_.
+  bool done = false;
+};
+
+// Decodes the frames of one camera's videos, in submission order, so its
+// capture is only ever read forward. The ImageLoader reopens its capture when
+// the camera moves on to its next video.
+class OfflineApriltagDetector::Decoder {
+ public:
+  Decoder() : pool_("apriltag_decode"), work_(pool_.get_io_service()) {
+    pool_.Start(1);
+  }
+
+  ~Decoder() {
+    work_.reset();
+    pool_.Stop();
+    pool_.Join();
+  }
+
+  template <typename Handler>
+  void Post(Handler handler) {
+    pool_.get_io_service().post(std::move(handler));
+  }
+
+  ImageLoader& loader() { return loader_; }
+
+ private:
+  ThreadPool pool_;
+  std::optional<boost::asio::io_service::work> work_;
+  ImageLoader loader_;
+};
+
+// An ApriltagDetector per camera, used by one pool thread at a time.
+class OfflineApriltagDetector::Worker {
+ public:
+  explicit Worker(const ApriltagConfig& config) : config_(config) {}
+
+  ApriltagDetector& GetDetector(const CameraModel& camera_model) {
+    auto it = detectors_.find(camera_model.frame_name());
+    if (it == detectors_.end()) {
+      it = detectors_
+               .emplace(camera_model.frame_name(),
+                        std::make_unique<ApriltagDetector>(camera_model,
+                                                           nullptr, &config_))
+               .first;
+    }
+    return *it->second;
+  }
+
+ private:
+  const ApriltagConfig& config_;
+  std::map<std::string, std::unique_ptr<ApriltagDetector>> detectors_;
+};
+
+OfflineApriltagDetector::OfflineApriltagDetector(const ApriltagConfig* config,
+                                                 int n_workers,
+                                                 Callback callback)
+    : callback_(std::move(callback)),
+      pending_gauge_(GetMetricsRegistry().GetGauge("offline_apriltag/pending")),
+      decode_latency_(
+          GetMetricsRegistry().GetHistogram("offline_apriltag/decode")) {
+  if (config != nullptr) {
+    config_ = *config;
+  } else {
+    config_ = ReadProtobufFromJsonFile<ApriltagConfig>(
+        GetBucketAbsolutePath(Bucket::BUCKET_CONFIGURATIONS) / "apriltag.json");
+  }
+  config_.mutable_detector()->set_tracking(false);
+  config_.mutable_detector()->clear_engine();
+  config_.mutable_detector()->clear_n_threads();
+
+  if (n_workers <= 0) {
+    n_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Enough to keep every worker busy while the oldest frame is detected.
+  max_pending_ = 4 * n_workers;
+  for (int i = 0; i < n_workers; ++i) {
+    idle_workers_.push_back(std::make_unique<Worker>(config_));
+  }
+  pool_ = std::make_unique<ThreadPool>("apriltag_offline");
+  pool_work_ =
+      std::make_unique<boost::asio::io_service::work>(pool_->get_io_service());
+  pool_->Start(n_workers);
+}
+
+OfflineApriltagDetector::~OfflineApriltagDetector() {
+  // Decoders post to the pool, so they go first.
+  decoders_.clear();
+  pool_work_.reset();
+  pool_->Stop();
+  pool_->Join();
+}
+
+void OfflineApriltagDetector::Submit(const Image& image,
+                                     const google::protobuf::Timestamp& stamp,
+                                     double scale) {
+  auto job = std::make_shared<Job>();
+  job->image = image;
+  job->stamp = stamp;
+  job->scale = scale;
+  Enqueue(job);
+  // Still images are independent, so they're decoded by the workers.
+  if (image.resource().content_type() != "video/mp4") {
+    pool_->get_io_service().post([this, job]() { Detect(job); });
+    Deliver(max_pending_);
+    return;
+  }
+  Decoder& decoder = GetDecoder(image);
+  decoder.Post([this, job, &decoder]() {
+    {
+      ScopedLatency latency(decode_latency_);
+      job->frame = decoder.loader().LoadImage(job->image);
+    }
+    pool_->get_io_service().post([this, job]() { Detect(job); });
+  });
+  Deliver(max_pending_);
+}
+
+void OfflineApriltagDetector::Submit(const Image& image, const cv::Mat& frame,
+                                     const google::protobuf::Timestamp& stamp,
+                                     double scale) {
+  auto job = std::make_shared<Job>();
+  job->image = image;
+  job->stamp = stamp;
+  job->scale = scale;
+  job->frame = frame;
+  Enqueue(job);
+  pool_->get_io_service().post([this, job]() { Detect(job); });
+  Deliver(max_pending_);
+}
+
+void OfflineApriltagDetector::Flush() { Deliver(0); }
+
+void OfflineApriltagDetector::Enqueue(std::shared_ptr<Job> job) {
+  std::lock_guard<std::mutex> lock(done_mtx_);
+  pending_.push_back(std::move(job));
+  pending_gauge_.Set(pending_.size());
+}
+
+OfflineApriltagDetector::Decoder& OfflineApriltagDetector::GetDecoder(
+    const Image& image) {
+  // Images without a camera name share a decoder per video.
+  const std::string& key = image.camera_model().frame_name().empty()
+                               ? image.resource().path()
+                               : image.camera_model().frame_name();
+  auto it = decoders_.find(key);
+  if (it == decoders_.end()) {
+    it = decoders_.emplace(key, std::make_unique<Decoder>()).first;
+  }
+  return *it->second;
+}
+
+void OfflineApriltagDetector::Detect(std::shared_ptr<Job> job) {
+  // There are as many workers as pool threads.
+  std::unique_ptr<Worker> worker;
+  {
+    std::lock_guard<std::mutex> lock(workers_mtx_);
+    CHECK(!idle_workers_.empty());
+    worker = std::move(idle_workers_.back());
+    idle_workers_.pop_back();
+  }
+  if (job->frame.empty()) {
+    ScopedLatency latency(decode_latency_);
+    job->frame = ImageLoader().LoadImage(job->image);
+  }
+  cv::Mat gray;
+  if (job->frame.channels() == 3) {
+    cv::cvtColor(job->frame, gray, cv::COLOR_BGR2GRAY);
+  } else {
+    CHECK_EQ(job->frame.channels(), 1);
+    gray = job->frame;
+  }
+  job->detections = worker->GetDetector(job->image.camera_model())
+                        .Detect(gray, job->stamp, job->scale);
+  job->detections.mutable_image()->CopyFrom(job->image);
+  job->frame.release();
+  {
+    std::lock_guard<std::mutex> lock(workers_mtx_);
+    idle_workers_.push_back(std::move(worker));
+  }
+  Complete(job);
+}
+
+void OfflineApriltagDetector::Complete(const std::shared_ptr<Job>& job) {
+  {
+    std::lock_guard<std::mutex> lock(done_mtx_);
+    job->done = true;
+  }
+  done_cv_.notify_one();
+}
+
+void OfflineApriltagDetector::Deliver(size_t max_pending) {
+  std::unique_lock<std::mutex> lock(done_mtx_);
+  while (!pending_.empty()) {
+    std::shared_ptr<Job> job = pending_.front();
+    if (!job->done) {
+      if (pending_.size() <= max_pending) {
+        return;
+      }
+      done_cv_.wait(lock, [&job] { return job->done; });
+    }
+    pending_.pop_front();
+    pending_gauge_.Set(pending_.size());
+    lock.unlock();
+    callback_(job->detections, job->stamp);
+    lock.lock();
+  }
+}
+
+}  // namespace perception
+}  // namespace farm_ng
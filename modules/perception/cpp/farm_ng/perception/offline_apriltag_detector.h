@@ -0,0 +1,106 @@
+#ifndef FARM_NG_PERCEPTION_OFFLINE_APRILTAG_DETECTOR_H_
+#define FARM_NG_PERCEPTION_OFFLINE_APRILTAG_DETECTOR_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/timestamp.pb.h>
+#include <opencv2/core.hpp>
+
+#include "farm_ng/core/metrics.h"
+#include "farm_ng/core/thread_pool.h"
+
+#include "farm_ng/perception/apriltag.h"
+#include "farm_ng/perception/apriltag.pb.h"
+#include "farm_ng/perception/image.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// Detects apriltags in recorded frames, for offline programs like
+// detect_apriltags and create_video_dataset.
+//
+// Video frames are decoded on a thread per camera, so interleaved cameras
+// don't reopen and seek each other's videos. A camera's video segments are
+// read one after another, so its decoder reopens only on a new segment, and
+// holds one open video at a time. Frames are then detected on a pool of
+// workers, each holding an ApriltagDetector per camera. Detections are
+// handed back in the order the frames were submitted, on the submitting
+// thread, so callers keep their serial status and event output.
+//
+// Frames may reach the workers in any order, so detector tracking is
+// disabled, and the library runs single threaded on each worker.
+class OfflineApriltagDetector {
+ public:
+  // detections has its image set to the submitted Image.
+  typedef std::function<void(const ApriltagDetections& detections,
+                             const google::protobuf::Timestamp& stamp)>
+      Callback;
+
+  // config defaults to configurations/apriltag.json, and n_workers to the
+  // number of cores.
+  OfflineApriltagDetector(const ApriltagConfig* config, int n_workers,
+                          Callback callback);
+  ~OfflineApriltagDetector();
+
+  OfflineApriltagDetector(const OfflineApriltagDetector&) = delete;
+  OfflineApriltagDetector& operator=(const OfflineApriltagDetector&) = delete;
+
+  // Queues the frame for decoding from image's resource, and detection. scale
+  // is passed to ApriltagDetector::Detect. Delivers the detections of any
+  // frames completed in order, and blocks while too many frames are pending.
+  void Submit(const Image& image, const google::protobuf::Timestamp& stamp,
+              double scale = 0.0);
+
+  // As above, for a frame the caller already decoded, gray or BGR.
+  void Submit(const Image& image, const cv::Mat& frame,
+              const google::protobuf::Timestamp& stamp, double scale = 0.0);
+
+  // Blocks until every submitted frame is delivered.
+  void Flush();
+
+ private:
+  struct Job;
+  class Decoder;
+  class Worker;
+
+  void Enqueue(std::shared_ptr<Job> job);
+  void Detect(std::shared_ptr<Job> job);
+  void Complete(const std::shared_ptr<Job>& job);
+  // Delivers completed jobs from the front of pending_, waiting for the front
+  // to complete while more than max_pending are outstanding.
+  void Deliver(size_t max_pending);
+  Decoder& GetDecoder(const Image& image);
+
+  ApriltagConfig config_;
+  Callback callback_;
+  size_t max_pending_;
+
+  std::unique_ptr<farm_ng::core::ThreadPool> pool_;
+  std::unique_ptr<boost::asio::io_service::work> pool_work_;
+  // Keyed by camera frame_name.
+  std::map<std::string, std::unique_ptr<Decoder>> decoders_;
+
+  std::mutex workers_mtx_;
+  std::vector<std::unique_ptr<Worker>> idle_workers_;
+
+  // Submitted and not yet delivered, in submission order.
+  std::deque<std::shared_ptr<Job>> pending_;
+  std::mutex done_mtx_;
+  std::condition_variable done_cv_;
+
+  farm_ng::core::Gauge& pending_gauge_;
+  farm_ng::core::Histogram& decode_latency_;
+};
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,680 @@
+#include "farm_ng/perception/raw_frame_recorder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <glog/logging.h>
+#include <google/protobuf/util/time_util.h>
+
+#include "farm_ng/core/blobstore.h"
+#include "farm_ng/core/event_log.h"
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
+#include "farm_ng/perception/video_streamer.h"
+
+using farm_ng::core::ApplyThreadPolicy;
+using farm_ng::core::EventBus;
+using farm_ng::core::EventLogWriter;
+using farm_ng::core::GetArchivePath;
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::GetThreadPolicy;
+using farm_ng::core::GetUniqueArchiveResource;
+using farm_ng::core::MakeEvent;
+using farm_ng::core::NativePathFromResourcePath;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::SetCurrentThreadName;
+using farm_ng::core::ThreadPolicy;
+using farm_ng::core::TraceSpan;
+using google::protobuf::util::TimeUtil;
+
+namespace farm_ng {
+namespace perception {
+
+namespace {
+
+const char kMagic[8] = "FNRAWCK";
+const uint32_t kVersion = 1;
+const uint64_t kHeaderBytes = 4096;
+const uint64_t kAlignment = 4096;
+const int kDefaultChunkFrames = 300;
+const size_t kDefaultMaxQueuedFrames = 60;
+const int kTranscoderNice = 10;
+
+struct ChunkHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t type;
+  uint32_t codec;
+  uint32_t capacity;
+  uint32_t camera_model_bytes;
+  uint32_t reserved;
+  uint64_t slot_bytes;
+  uint64_t data_offset;
+};
+static_assert(sizeof(ChunkHeader) == 56, "Chunk header layout changed");
+
+struct IndexEntry {
+  // 1 + the frame's index in the chunk, 0 for an empty slot.
+  uint64_t sequence;
+  int64_t stamp_ns;
+  uint32_t size;
+  uint32_t codec;
+};
+static_assert(sizeof(IndexEntry) == 24, "Index entry layout changed");
+
+uint64_t AlignUp(uint64_t n) {
+  return (n + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+void WriteAll(int fd, const void* data, size_t n, uint64_t offset) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (n > 0) {
+    ssize_t written = pwrite(fd, p, n, offset);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(written, 0) << "Raw frame write failed: " << std::strerror(errno);
+    p += written;
+    n -= written;
+    offset += written;
+  }
+}
+
+void ReadAll(int fd, void* data, size_t n, uint64_t offset) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  while (n > 0) {
+    ssize_t n_read = pread(fd, p, n, offset);
+    if (n_read < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n_read, 0) << "Raw frame read failed: " << std::strerror(errno);
+    p += n_read;
+    n -= n_read;
+    offset += n_read;
+  }
+}
+
+// Lossless compression of 8 bit, 3 channel images after the "Quite OK Image"
+// format: each pixel is a run of the previous pixel, a hit in a 64 entry
+// table of recently seen pixels, a small difference from the previous pixel,
+// or the pixel itself. Only the pixel stream is stored, the chunk header
+// holds the size.
+namespace qoi {
+const uint8_t kOpIndex = 0x00;
+const uint8_t kOpDiff = 0x40;
+const uint8_t kOpLuma = 0x80;
+const uint8_t kOpRun = 0xc0;
+const uint8_t kOpRgb = 0xfe;
+const uint8_t kMask = 0xc0;
+const int kMaxRun = 62;
+
+struct Pixel {
+  uint8_t c[3];
+  bool operator==(const Pixel& o) const {
+    return c[0] == o.c[0] && c[1] == o.c[1] && c[2] == o.c[2];
+  }
+};
+
+inline int Hash(const Pixel& p) {
+  // The format's hash, with alpha fixed at 255.
+  return (p.c[0] * 3 + p.c[1] * 5 + p.c[2] * 7 + 255 * 11) % 64;
+}
+
+size_t MaxBytes(cv::Size size) { return size_t(size.area()) * 4; }
+
+size_t Encode(const cv::Mat& image, uint8_t* out) {
+  CHECK_EQ(image.type(), CV_8UC3);
+  Pixel table[64] = {};
+  Pixel prev = {{0, 0, 0}};
+  int run = 0;
+  uint8_t* p = out;
+  const int n_rows = image.rows;
+  for (int y = 0; y < n_rows; ++y) {
+    const Pixel* row = image.ptr<Pixel>(y);
+    for (int x = 0; x < image.cols; ++x) {
+      const Pixel px = row[x];
+      if (px == prev) {
+        if (++run == kMaxRun) {
+          *p++ = kOpRun | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        *p++ = kOpRun | (run - 1);
+        run = 0;
+      }
+      int hash = Hash(px);
+      if (table[hash] == px) {
+        *p++ = kOpIndex | hash;
+      } else {
+        table[hash] = px;
+        int d0 = int8_t(px.c[0] - prev.c[0]);
+        int d1 = int8_t(px.c[1] - prev.c[1]);
+        int d2 = int8_t(px.c[2] - prev.c[2]);
+        int d0_1 = d0 - d1;
+        int d2_1 = d2 - d1;
+        if (d0 >= -2 && d0 <= 1 && d1 >= -2 && d1 <= 1 && d2 >= -2 &&
+            d2 <= 1) {
+          *p++ = kOpDiff | (d0 + 2) << 4 | (d1 + 2) << 2 | (d2 + 2);
+        } else if (d1 >= -32 && d1 <= 31 && d0_1 >= -8 && d0_1 <= 7 &&
+                   d2_1 >= -8 && d2_1 <= 7) {
+          *p++ = kOpLuma | (d1 + 32);
+          *p++ = (d0_1 + 8) << 4 | (d2_1 + 8);
+        } else {
+          *p++ = kOpRgb;
+          *p++ = px.c[0];
+          *p++ = px.c[1];
+          *p++ = px.c[2];
+        }
+      }
+      prev = px;
+    }
+  }
+  if (run > 0) {
+    *p++ = kOpRun | (run - 1);
+  }
+  return p - out;
+}
+
+void Decode(const uint8_t* in, size_t n, cv::Mat* image) {
+  CHECK_EQ(image->type(), CV_8UC3);
+  Pixel table[64] = {};
+  Pixel px = {{0, 0, 0}};
+  int run = 0;
+  const uint8_t* end = in + n;
+  for (int y = 0; y < image->rows; ++y) {
+    Pixel* row = image->ptr<Pixel>(y);
+    for (int x = 0; x < image->cols; ++x) {
+      if (run > 0) {
+        run--;
+      } else {
+        CHECK(in < end) << "Truncated QOI frame";
+        uint8_t b = *in++;
+        if (b == kOpRgb) {
+          CHECK_LE(3, end - in) << "Truncated QOI frame";
+          px.c[0] = in[0];
+          px.c[1] = in[1];
+          px.c[2] = in[2];
+          in += 3;
+        } else if ((b & kMask) == kOpIndex) {
+          px = table[b];
+        } else if ((b & kMask) == kOpDiff) {
+          px.c[0] += ((b >> 4) & 0x03) - 2;
+          px.c[1] += ((b >> 2) & 0x03) - 2;
+          px.c[2] += (b & 0x03) - 2;
+        } else if ((b & kMask) == kOpLuma) {
+          CHECK(in < end) << "Truncated QOI frame";
+          uint8_t b2 = *in++;
+          int d1 = (b & 0x3f) - 32;
+          px.c[0] += d1 - 8 + ((b2 >> 4) & 0x0f);
+          px.c[1] += d1;
+          px.c[2] += d1 - 8 + (b2 & 0x0f);
+        } else {
+          run = b & 0x3f;
+        }
+        table[Hash(px)] = px;
+      }
+      row[x] = px;
+    }
+  }
+}
+}  // namespace qoi
+
+RawRecorderConfig::Codec ChunkCodec(RawRecorderConfig::Codec codec,
+                                    int type) {
+  if (codec == RawRecorderConfig::CODEC_UNSPECIFIED) {
+    return type == CV_8UC3 ? RawRecorderConfig::CODEC_QOI
+                           : RawRecorderConfig::CODEC_RAW;
+  }
+  if (codec == RawRecorderConfig::CODEC_QOI && type != CV_8UC3) {
+    LOG(WARNING) << "QOI needs 8 bit color images, writing raw frames.";
+    return RawRecorderConfig::CODEC_RAW;
+  }
+  return codec;
+}
+
+}  // namespace
+
+RawFrameChunkWriter::RawFrameChunkWriter(const boost::filesystem::path& path,
+                                         const CameraModel& camera_model,
+                                         int type,
+                                         RawRecorderConfig::Codec codec,
+                                         int capacity)
+    : size_(camera_model.image_width(), camera_model.image_height()),
+      type_(type),
+      codec_(codec),
+      capacity_(capacity) {
+  CHECK_GT(capacity_, 0);
+  TraceSpan span("raw_recorder/open");
+  raw_bytes_ = uint64_t(size_.area()) * CV_ELEM_SIZE(type_);
+  if (codec_ == RawRecorderConfig::CODEC_QOI) {
+    scratch_.resize(qoi::MaxBytes(size_));
+  }
+  // QOI frames that don't compress are stored raw, so no slot needs more.
+  slot_bytes_ = AlignUp(raw_bytes_);
+  data_offset_ = AlignUp(kHeaderBytes + capacity_ * sizeof(IndexEntry));
+
+  fd_ = open(path.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_GE(fd_, 0) << "Could not open: " << path.string() << " "
+                   << std::strerror(errno);
+  // Reserve the whole chunk up front, so writes don't allocate blocks.
+  // Returns an error number rather than setting errno.
+  int error = posix_fallocate(fd_, 0, data_offset_ + capacity_ * slot_bytes_);
+  if (error != 0) {
+    LOG(WARNING) << "Could not preallocate " << path.string() << ": "
+                 << std::strerror(error);
+  }
+
+  std::string model_bytes;
+  CHECK(camera_model.SerializeToString(&model_bytes));
+  CHECK_LE(sizeof(ChunkHeader) + model_bytes.size(), kHeaderBytes);
+  ChunkHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.width = size_.width;
+  header.height = size_.height;
+  header.type = type_;
+  header.codec = codec_;
+  header.capacity = capacity_;
+  header.camera_model_bytes = model_bytes.size();
+  header.slot_bytes = slot_bytes_;
+  header.data_offset = data_offset_;
+  WriteAll(fd_, &header, sizeof(header), 0);
+  WriteAll(fd_, model_bytes.data(), model_bytes.size(), sizeof(header));
+  if (error != 0) {
+    // Without preallocation the index isn't zero filled.
+    std::vector<uint8_t> zeros(data_offset_ - kHeaderBytes);
+    WriteAll(fd_, zeros.data(), zeros.size(), kHeaderBytes);
+  }
+}
+
+RawFrameChunkWriter::~RawFrameChunkWriter() { close(fd_); }
+
+size_t RawFrameChunkWriter::Write(uint64_t frame_index, const cv::Mat& image,
+                                  int64_t stamp_ns) {
+  CHECK_EQ(image.size(), size_);
+  CHECK_EQ(image.type(), type_);
+  const int slot = frame_index % capacity_;
+  const uint64_t offset = data_offset_ + slot * slot_bytes_;
+  RawRecorderConfig::Codec codec = codec_;
+  size_t size = 0;
+  if (codec == RawRecorderConfig::CODEC_QOI) {
+    size = qoi::Encode(image, scratch_.data());
+    // Noisy frames can grow, and are written raw to fit the slot.
+    if (size > raw_bytes_) {
+      codec = RawRecorderConfig::CODEC_RAW;
+    }
+  }
+  if (codec == RawRecorderConfig::CODEC_QOI) {
+    WriteAll(fd_, scratch_.data(), size, offset);
+  } else if (image.isContinuous()) {
+    size = image.total() * image.elemSize();
+    WriteAll(fd_, image.data, size, offset);
+  } else {
+    const size_t row_bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+      WriteAll(fd_, image.ptr(y), row_bytes, offset + y * row_bytes);
+    }
+    size = image.rows * row_bytes;
+  }
+  IndexEntry entry = {frame_index + 1, stamp_ns, uint32_t(size),
+                      uint32_t(codec)};
+  WriteAll(fd_, &entry, sizeof(entry),
+           kHeaderBytes + slot * sizeof(IndexEntry));
+  frames_written_ = std::max(frames_written_, frame_index + 1);
+  return size;
+}
+
+int RawFrameChunkWriter::frame_count() const {
+  return std::min<uint64_t>(frames_written_, capacity_);
+}
+
+RawFrameChunkReader::RawFrameChunkReader(const boost::filesystem::path& path) {
+  fd_ = open(path.string().c_str(), O_RDONLY);
+  CHECK_GE(fd_, 0) << "Could not open: " << path.string() << " "
+                   << std::strerror(errno);
+  ChunkHeader header;
+  ReadAll(fd_, &header, sizeof(header), 0);
+  CHECK_EQ(std::memcmp(header.magic, kMagic, sizeof(kMagic)), 0)
+      << "Not a raw frame chunk: " << path.string();
+  CHECK_EQ(header.version, kVersion) << path.string();
+  std::string model_bytes(header.camera_model_bytes, '\0');
+  ReadAll(fd_, &model_bytes[0], model_bytes.size(), sizeof(header));
+  CHECK(camera_model_.ParseFromString(model_bytes)) << path.string();
+  size_ = cv::Size(header.width, header.height);
+  type_ = header.type;
+  slot_bytes_ = header.slot_bytes;
+  data_offset_ = header.data_offset;
+
+  std::vector<IndexEntry> entries(header.capacity);
+  ReadAll(fd_, entries.data(), entries.size() * sizeof(IndexEntry),
+          kHeaderBytes);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const IndexEntry& e = entries[i];
+    if (e.sequence != 0) {
+      slots_.push_back({e.sequence, e.stamp_ns, e.size, e.codec, int(i)});
+    }
+  }
+  // A ring chunk may have wrapped, so slot order isn't capture order.
+  std::sort(slots_.begin(), slots_.end(), [](const Slot& a, const Slot& b) {
+    return a.sequence < b.sequence;
+  });
+}
+
+RawFrameChunkReader::~RawFrameChunkReader() { close(fd_); }
+
+double RawFrameChunkReader::frame_rate() const {
+  if (slots_.size() < 2) {
+    return 0;
+  }
+  return (slots_.size() - 1) * 1e9 /
+         (slots_.back().stamp_ns - slots_.front().stamp_ns);
+}
+
+bool RawFrameChunkReader::Next(cv::Mat* image,
+                               google::protobuf::Timestamp* stamp) {
+  if (next_ >= slots_.size()) {
+    return false;
+  }
+  const Slot& slot = slots_[next_++];
+  CHECK_LE(slot.size, slot_bytes_);
+  const uint64_t offset = data_offset_ + slot.index * slot_bytes_;
+  *image = GetFrameBufferPool().Get(size_, type_);
+  if (slot.codec == RawRecorderConfig::CODEC_QOI) {
+    scratch_.resize(slot.size);
+    ReadAll(fd_, scratch_.data(), slot.size, offset);
+    qoi::Decode(scratch_.data(), scratch_.size(), image);
+  } else {
+    CHECK_EQ(slot.size, image->total() * image->elemSize());
+    ReadAll(fd_, image->data, slot.size, offset);
+  }
+  *stamp = TimeUtil::NanosecondsToTimestamp(slot.stamp_ns);
+  return true;
+}
+
+RawFrameRecorder::RawFrameRecorder(EventBus& bus,
+                                   const CameraModel& camera_model,
+                                   ChunkCallback on_chunk)
+    : bus_(bus),
+      camera_model_(camera_model),
+      on_chunk_(on_chunk),
+      max_queued_frames_(kDefaultMaxQueuedFrames),
+      queue_depth_(GetMetricsRegistry().GetGauge(
+          "raw_recorder/queue_depth/" + camera_model.frame_name())),
+      write_latency_(GetMetricsRegistry().GetHistogram(
+          "raw_recorder/write/" + camera_model.frame_name())),
+      bytes_(GetMetricsRegistry().GetCounter("raw_recorder/bytes/" +
+                                             camera_model.frame_name())),
+      dropped_(GetMetricsRegistry().GetCounter("raw_recorder/dropped/" +
+                                               camera_model.frame_name())) {
+  writer_thread_ = std::thread([this]() {
+    ApplyThreadPolicy("raw_recorder");
+    Run();
+  });
+}
+
+RawFrameRecorder::~RawFrameRecorder() {
+  Close();
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    stop_ = true;
+  }
+  queue_cv_.notify_one();
+  writer_thread_.join();
+}
+
+void RawFrameRecorder::set_config(const RawRecorderConfig& config) {
+  config_ = config;
+  std::lock_guard<std::mutex> lock(queue_mtx_);
+  max_queued_frames_ = config.max_queued_frames() > 0
+                           ? config.max_queued_frames()
+                           : kDefaultMaxQueuedFrames;
+}
+
+std::shared_ptr<const RawFrameRecorder::Chunk> RawFrameRecorder::MakeChunk(
+    int type) {
+  auto chunk = std::make_shared<Chunk>();
+  auto resource_path = GetUniqueArchiveResource(
+      camera_model_.frame_name(), "rawframes", "application/x-raw-frames");
+  chunk->chunk_pb.mutable_resource()->CopyFrom(resource_path.first);
+  chunk->chunk_pb.mutable_camera_model()->CopyFrom(camera_model_);
+  chunk->chunk_pb.set_keep_raw(config_.keep_raw());
+  chunk->chunk_pb.set_archive_path(GetArchivePath().string());
+  chunk->path = resource_path.second;
+  chunk->codec = ChunkCodec(config_.codec(), type);
+  chunk->capacity = config_.chunk_frames() > 0 ? config_.chunk_frames()
+                                               : kDefaultChunkFrames;
+  chunk->type = type;
+  // Reserve the name, so the following chunk gets a different one before
+  // the writer has created this file.
+  std::ofstream(chunk->path.string());
+  return chunk;
+}
+
+bool RawFrameRecorder::Enqueue(Work work) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    if (work.type == Work::WORK_FRAME) {
+      if (queued_frames_ >= max_queued_frames_) {
+        dropped_.Increment();
+        return false;
+      }
+      queued_frames_++;
+      queue_depth_.Set(queued_frames_);
+    }
+    queue_.push_back(std::move(work));
+  }
+  queue_cv_.notify_one();
+  return true;
+}
+
+bool RawFrameRecorder::AddFrame(const cv::Mat& image,
+                                const google::protobuf::Timestamp& stamp) {
+  TraceSpan span("raw_recorder/add_frame", stamp);
+  if (chunk_ && chunk_->type != image.type()) {
+    CloseChunk();
+  }
+  if (!chunk_) {
+    chunk_ = MakeChunk(image.type());
+    chunk_frames_ = 0;
+  }
+  recording_ = true;
+  if (!Enqueue({Work::WORK_FRAME, chunk_, chunk_frames_, image, stamp})) {
+    return false;
+  }
+  chunk_frames_++;
+  if (!config_.ring() && chunk_frames_ >= uint64_t(chunk_->capacity)) {
+    // The writer closes the full chunk when it sees the next one's frames.
+    chunk_.reset();
+  }
+  return true;
+}
+
+void RawFrameRecorder::CloseChunk() {
+  if (!chunk_) {
+    return;
+  }
+  chunk_.reset();
+  Enqueue({Work::WORK_CLOSE});
+}
+
+void RawFrameRecorder::Close() {
+  if (!recording_) {
+    return;
+  }
+  recording_ = false;
+  chunk_.reset();
+  Enqueue({Work::WORK_STOP});
+}
+
+void RawFrameRecorder::Run() {
+  while (true) {
+    Work work;
+    {
+      std::unique_lock<std::mutex> lock(queue_mtx_);
+      queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      work = std::move(queue_.front());
+      queue_.pop_front();
+      if (work.type == Work::WORK_FRAME) {
+        queued_frames_--;
+        queue_depth_.Set(queued_frames_);
+      }
+    }
+    if (work.type == Work::WORK_CLOSE) {
+      CloseWriter();
+      continue;
+    }
+    if (work.type == Work::WORK_STOP) {
+      CloseWriter();
+      ReleaseChunks();
+      continue;
+    }
+    TraceSpan span("raw_recorder/write", work.stamp);
+    if (writer_chunk_ != work.chunk) {
+      CloseWriter();
+      writer_ = std::make_unique<RawFrameChunkWriter>(
+          work.chunk->path, camera_model_, work.chunk->type, work.chunk->codec,
+          work.chunk->capacity);
+      writer_chunk_ = work.chunk;
+    }
+    ScopedLatency latency(write_latency_);
+    bytes_.Increment(writer_->Write(
+        work.frame_index, work.image,
+        TimeUtil::TimestampToNanoseconds(work.stamp)));
+  }
+  CloseWriter();
+  ReleaseChunks();
+}
+
+void RawFrameRecorder::CloseWriter() {
+  if (!writer_) {
+    return;
+  }
+  RawFrameChunk chunk_pb = writer_chunk_->chunk_pb;
+  chunk_pb.set_frame_count(writer_->frame_count());
+  writer_.reset();
+  writer_chunk_.reset();
+  LOG(INFO) << "Raw frame chunk: " << chunk_pb.resource().path() << " "
+            << chunk_pb.frame_count() << " frames";
+  bus_.AsyncSend(
+      MakeEvent(camera_model_.frame_name() + "/raw_chunk", chunk_pb));
+  closed_chunks_.push_back(std::move(chunk_pb));
+}
+
+void RawFrameRecorder::ReleaseChunks() {
+  if (on_chunk_) {
+    for (const RawFrameChunk& chunk_pb : closed_chunks_) {
+      on_chunk_(chunk_pb);
+    }
+  }
+  closed_chunks_.clear();
+}
+
+RawFrameTranscoder::RawFrameTranscoder(EventBus& bus)
+    : bus_(bus),
+      pending_chunks_(
+          GetMetricsRegistry().GetGauge("raw_transcoder/pending_chunks")) {
+  thread_ = std::thread([this]() {
+    ThreadPolicy policy = GetThreadPolicy("raw_transcoder");
+    if (!policy.has_nice()) {
+      // Stay out of the way of capture.
+      policy.mutable_nice()->set_value(kTranscoderNice);
+    }
+    SetCurrentThreadName("raw_transcoder");
+    ApplyThreadPolicy(policy);
+    Run();
+  });
+}
+
+RawFrameTranscoder::~RawFrameTranscoder() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void RawFrameTranscoder::Post(const RawFrameChunk& chunk) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    pending_.push_back(chunk);
+    pending_chunks_.Set(pending_.size());
+  }
+  cv_.notify_one();
+}
+
+void RawFrameTranscoder::Run() {
+  while (true) {
+    RawFrameChunk chunk;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        break;
+      }
+      chunk = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    Transcode(chunk);
+    std::lock_guard<std::mutex> lock(mtx_);
+    pending_chunks_.Set(pending_.size());
+  }
+}
+
+void RawFrameTranscoder::Transcode(const RawFrameChunk& chunk) {
+  TraceSpan span("raw_transcoder/transcode");
+  auto path = NativePathFromResourcePath(chunk.resource());
+  // Recording has usually stopped, and the active archive moved on, by now.
+  const boost::filesystem::path archive_path =
+      chunk.archive_path().empty() ? GetArchivePath()
+                                   : boost::filesystem::path(
+                                         chunk.archive_path());
+  auto log_path = GetUniqueArchiveResource(archive_path, "events", "log", "");
+  LOG(INFO) << "Transcoding: " << path.string() << " to "
+            << log_path.first.path();
+  {
+    // The recording's own log has closed, so the events locating the frames
+    // in the mp4s are logged alongside them.
+    EventLogWriter log_writer(log_path.second);
+    RawFrameChunkReader reader(path);
+    const std::string& frame_name = reader.camera_model().frame_name();
+    if (chunk.keep_raw()) {
+      log_writer.Write(MakeEvent(frame_name + "/raw_chunk", chunk));
+    }
+    VideoStreamProfile profile;
+    profile.set_name("transcode");
+    profile.set_frame_rate(reader.frame_rate());
+    VideoStreamer streamer(bus_, reader.camera_model(),
+                           VideoStreamer::MODE_MP4_FILE, profile);
+    streamer.set_archive_path(archive_path);
+    streamer.set_block_when_full(true);
+    cv::Mat image;
+    google::protobuf::Timestamp stamp;
+    while (reader.Next(&image, &stamp)) {
+      Image image_pb = streamer.AddFrame(image, stamp);
+      log_writer.Write(MakeEvent(frame_name + "/image", image_pb, stamp));
+    }
+    // The streamer finishes encoding on destruction, before the log is
+    // closed.
+  }
+  // Only once the mp4s are complete and logged.
+  if (!chunk.keep_raw()) {
+    boost::filesystem::remove(path);
+  }
+}
+
+}  // namespace perception
+}  // namespace farm_ng
@@ -0,0 +1,234 @@
+#ifndef FARM_NG_PERCEPTION_RAW_FRAME_RECORDER_H_
+#define FARM_NG_PERCEPTION_RAW_FRAME_RECORDER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+
+#include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
+
+#include "farm_ng/perception/camera_model.pb.h"
+#include "farm_ng/perception/camera_pipeline.pb.h"
+
+namespace farm_ng {
+namespace perception {
+
+// A preallocated file of fixed size frame slots, with an index of the frame
+// in each slot. Frames are written raw or QOI compressed, so capture costs
+// little more than the disk write, and are transcoded to mp4 later by
+// RawFrameTranscoder. Slots hold a raw frame, and QOI frames that would be
+// larger are written raw.
+//
+// Layout, all little endian:
+//   [0, 4096)           header, followed by the serialized CameraModel
+//   [4096, data_offset) one index entry per slot
+//   [data_offset, ...)  capacity slots of slot_bytes each
+//
+// A slot's data is written before its index entry, so a chunk cut short by a
+// crash reads back every frame indexed before it.
+class RawFrameChunkWriter {
+ public:
+  RawFrameChunkWriter(const boost::filesystem::path& path,
+                      const CameraModel& camera_model, int type,
+                      RawRecorderConfig::Codec codec, int capacity);
+  ~RawFrameChunkWriter();
+
+  RawFrameChunkWriter(const RawFrameChunkWriter&) = delete;
+  RawFrameChunkWriter& operator=(const RawFrameChunkWriter&) = delete;
+
+  // Writes the frame_index'th frame of the chunk, to slot frame_index %
+  // capacity. Returns the bytes written.
+  size_t Write(uint64_t frame_index, const cv::Mat& image, int64_t stamp_ns);
+
+  // Frames held, at most capacity.
+  int frame_count() const;
+
+ private:
+  int fd_ = -1;
+  cv::Size size_;
+  int type_;
+  RawRecorderConfig::Codec codec_;
+  int capacity_;
+  uint64_t raw_bytes_;
+  uint64_t slot_bytes_;
+  uint64_t data_offset_;
+  uint64_t frames_written_ = 0;
+  std::vector<uint8_t> scratch_;
+};
+
+// Reads the frames of a chunk in the order they were captured.
+class RawFrameChunkReader {
+ public:
+  explicit RawFrameChunkReader(const boost::filesystem::path& path);
+  ~RawFrameChunkReader();
+
+  RawFrameChunkReader(const RawFrameChunkReader&) = delete;
+  RawFrameChunkReader& operator=(const RawFrameChunkReader&) = delete;
+
+  const CameraModel& camera_model() const { return camera_model_; }
+  int frame_count() const { return slots_.size(); }
+  // Estimated from the stamps, 0 with fewer than two frames.
+  double frame_rate() const;
+
+  // Decodes the next frame into image, returning false after the last.
+  bool Next(cv::Mat* image, google::protobuf::Timestamp* stamp);
+
+ private:
+  struct Slot {
+    uint64_t sequence;
+    int64_t stamp_ns;
+    uint32_t size;
+    uint32_t codec;
+    int index;
+  };
+
+  int fd_ = -1;
+  CameraModel camera_model_;
+  cv::Size size_;
+  int type_;
+  uint64_t slot_bytes_;
+  uint64_t data_offset_;
+  std::vector<Slot> slots_;
+  size_t next_ = 0;
+  std::vector<uint8_t> scratch_;
+};
+
+// Records every frame of a camera to raw frame chunks in the active logging
+// directory, on a writer thread fed by a bounded queue.
+//
+// Each closed chunk is sent as <frame_name>/raw_chunk. The chunks are held
+// until the recording is closed, then handed to on_chunk, typically
+// RawFrameTranscoder::Post, so transcoding never competes with capture.
+//
+// Queue depth, write time, bytes written and drops are published as metrics
+// under raw_recorder/<metric>/<frame_name>.
+class RawFrameRecorder {
+ public:
+  using ChunkCallback = std::function<void(const RawFrameChunk&)>;
+
+  RawFrameRecorder(farm_ng::core::EventBus& bus,
+                   const CameraModel& camera_model, ChunkCallback on_chunk);
+  // Finishes writing queued frames, then closes the chunk.
+  ~RawFrameRecorder();
+
+  // Applies to chunks started after the call.
+  void set_config(const RawRecorderConfig& config);
+
+  // Queues the frame for writing. The image is referenced rather than
+  // copied, so it must not be modified afterwards. Returns false if the frame
+  // was dropped.
+  bool AddFrame(const cv::Mat& image,
+                const google::protobuf::Timestamp& stamp);
+  // Ends the recording. Once the frames queued before it are written, the
+  // last chunk is closed and every chunk of the recording is handed to
+  // on_chunk.
+  void Close();
+
+ private:
+  struct Chunk {
+    RawFrameChunk chunk_pb;
+    boost::filesystem::path path;
+    RawRecorderConfig::Codec codec;
+    int capacity;
+    int type;
+  };
+
+  struct Work {
+    // WORK_CLOSE ends a chunk, WORK_STOP the recording.
+    enum Type { WORK_FRAME, WORK_CLOSE, WORK_STOP };
+    Type type;
+    std::shared_ptr<const Chunk> chunk;
+    uint64_t frame_index = 0;
+    cv::Mat image;
+    google::protobuf::Timestamp stamp;
+  };
+
+  std::shared_ptr<const Chunk> MakeChunk(int type);
+  // Ends the current chunk, the recording continues in a new one.
+  void CloseChunk();
+  bool Enqueue(Work work);
+
+  // Writer thread.
+  void Run();
+  void CloseWriter();
+  // Hands the closed chunks to on_chunk.
+  void ReleaseChunks();
+
+  farm_ng::core::EventBus& bus_;
+  CameraModel camera_model_;
+  ChunkCallback on_chunk_;
+
+  // Caller side.
+  RawRecorderConfig config_;
+  std::shared_ptr<const Chunk> chunk_;
+  uint64_t chunk_frames_ = 0;
+  // Set from the first frame of a recording until Close.
+  bool recording_ = false;
+
+  std::mutex queue_mtx_;
+  std::condition_variable queue_cv_;
+  std::deque<Work> queue_;
+  size_t queued_frames_ = 0;
+  size_t max_queued_frames_;
+  bool stop_ = false;
+
+  // Writer thread only.
+  std::unique_ptr<RawFrameChunkWriter> writer_;
+  std::shared_ptr<const Chunk> writer_chunk_;
+  // Closed chunks of the recording, for on_chunk once it stops.
+  std::vector<RawFrameChunk> closed_chunks_;
+
+  farm_ng::core::Gauge& queue_depth_;
+  farm_ng::core::Histogram& write_latency_;
+  farm_ng::core::Counter& bytes_;
+  farm_ng::core::Counter& dropped_;
+
+  std::thread writer_thread_;
+};
+
+// Transcodes raw frame chunks to mp4 on a low priority thread, one chunk at a
+// time, sending the same <frame_name>/image events as live MODE_MP4_FILE
+// recording, stamped with the original capture times.
+//
+// The mp4s are written to the chunk's archive, with an event log of their
+// <frame_name>/image events (and the <frame_name>/raw_chunk, if kept), since
+// the recording's own log has usually closed by the time a chunk is
+// transcoded. Chunks are deleted once transcoded and logged unless
+// RawFrameChunk.keep_raw is set.
+//
+// The thread runs the "raw_transcoder" ThreadPolicy stage, at nice 10 unless
+// the stage sets its own.
+class RawFrameTranscoder {
+ public:
+  explicit RawFrameTranscoder(farm_ng::core::EventBus& bus);
+  // Finishes the chunks already posted.
+  ~RawFrameTranscoder();
+
+  // Thread safe.
+  void Post(const RawFrameChunk& chunk);
+
+ private:
+  void Run();
+  void Transcode(const RawFrameChunk& chunk);
+
+  farm_ng::core::EventBus& bus_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::deque<RawFrameChunk> pending_;
+  bool stop_ = false;
+  farm_ng::core::Gauge& pending_chunks_;
+  std::thread thread_;
+};
+
+}  // namespace perception
+}  // namespace farm_ng
+
+#endif
@@ -0,0 +1,194 @@
+#include "farm_ng/perception/raw_frame_recorder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include <google/protobuf/util/time_util.h>
+#include <opencv2/core.hpp>
+
+#include "farm_ng/perception/camera_model.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+using farm_ng::core::GetEventBus;
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::SetArchivePath;
+using google::protobuf::util::TimeUtil;
+using namespace farm_ng::perception;
+
+namespace {
+
+class RawFrameRecorderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("raw_frame_recorder_test_%%%%%%");
+    boost::filesystem::create_directories(root_);
+    camera_ = CreateCameraModel(M_PI / 2, 64, 48);
+    camera_.set_frame_name("raw_test");
+  }
+  void TearDown() override { boost::filesystem::remove_all(root_); }
+
+  // Gradients, flat runs and a few jumps, so every QOI op is used.
+  cv::Mat SceneImage(int seed) const {
+    cv::Mat image(camera_.image_height(), camera_.image_width(), CV_8UC3);
+    for (int y = 0; y < image.rows; ++y) {
+      for (int x = 0; x < image.cols; ++x) {
+        uint8_t v = x < 16 ? 100 : x + 2 * y + seed;
+        image.at<cv::Vec3b>(y, x) =
+            (x + y) % 17 == 0 ? cv::Vec3b(seed, 255 - v, 7 * x)
+                              : cv::Vec3b(v, v + 1, v + y % 3);
+      }
+    }
+    return image;
+  }
+
+  void ExpectFrames(RawFrameChunkReader* reader,
+                    const std::vector<cv::Mat>& images,
+                    const std::vector<int64_t>& stamps_ns) {
+    ASSERT_EQ(reader->frame_count(), int(images.size()));
+    cv::Mat image;
+    google::protobuf::Timestamp stamp;
+    for (size_t i = 0; i < images.size(); ++i) {
+      ASSERT_TRUE(reader->Next(&image, &stamp));
+      EXPECT_EQ(cv::norm(image, images[i], cv::NORM_INF), 0.0) << i;
+      EXPECT_EQ(TimeUtil::TimestampToNanoseconds(stamp), stamps_ns[i]);
+    }
+    EXPECT_FALSE(reader->Next(&image, &stamp));
+  }
+
+  boost::filesystem::path root_;
+  CameraModel camera_;
+};
+
+}  // namespace
+
+TEST_F(RawFrameRecorderTest, qoi_round_trip) {
+  boost::filesystem::path path = root_ / "qoi.rawframes";
+  std::vector<cv::Mat> images;
+  std::vector<int64_t> stamps_ns;
+  {
+    RawFrameChunkWriter writer(path, camera_, CV_8UC3,
+                               RawRecorderConfig::CODEC_QOI, 4);
+    for (int i = 0; i < 3; ++i) {
+      images.push_back(SceneImage(i * 40));
+      stamps_ns.push_back(1000000000LL + i * 33000000LL);
+      size_t size = writer.Write(i, images.back(), stamps_ns.back());
+      EXPECT_LT(size, images.back().total() * images.back().elemSize() / 2);
+    }
+    // Noise doesn't compress, so the frame is stored raw in its slot.
+    cv::Mat noise(images[0].size(), CV_8UC3);
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(256));
+    images.push_back(noise);
+    stamps_ns.push_back(2000000000LL);
+    EXPECT_EQ(writer.Write(3, noise, stamps_ns.back()),
+              noise.total() * noise.elemSize());
+    EXPECT_EQ(writer.frame_count(), 4);
+  }
+  RawFrameChunkReader reader(path);
+  EXPECT_EQ(reader.camera_model().frame_name(), "raw_test");
+  ExpectFrames(&reader, images, stamps_ns);
+}
+
+TEST_F(RawFrameRecorderTest, ring_round_trip) {
+  boost::filesystem::path path = root_ / "ring.rawframes";
+  std::vector<cv::Mat> images;
+  std::vector<int64_t> stamps_ns;
+  {
+    RawFrameChunkWriter writer(path, camera_, CV_16UC1,
+                               RawRecorderConfig::CODEC_RAW, 3);
+    for (int i = 0; i < 5; ++i) {
+      cv::Mat image(camera_.image_height(), camera_.image_width(), CV_16UC1,
+                    cv::Scalar(1000 * i + 1));
+      writer.Write(i, image, i * 1000);
+      // The ring keeps the last 3.
+      if (i >= 2) {
+        images.push_back(image);
+        stamps_ns.push_back(i * 1000);
+      }
+    }
+    EXPECT_EQ(writer.frame_count(), 3);
+  }
+  RawFrameChunkReader reader(path);
+  ExpectFrames(&reader, images, stamps_ns);
+}
+
+TEST_F(RawFrameRecorderTest, reads_chunk_cut_short_by_a_crash) {
+  boost::filesystem::path path = root_ / "crash.rawframes";
+  std::vector<cv::Mat> images;
+  std::vector<int64_t> stamps_ns;
+  {
+    RawFrameChunkWriter writer(path, camera_, CV_8UC3,
+                               RawRecorderConfig::CODEC_QOI, 8);
+    for (int i = 0; i < 3; ++i) {
+      images.push_back(SceneImage(i));
+      stamps_ns.push_back(i);
+      writer.Write(i, images.back(), stamps_ns.back());
+    }
+  }
+  // Crash while writing the third frame: its data is cut short, and its
+  // index entry, written after the data, never made it. See the layout in
+  // raw_frame_recorder.h.
+  int fd = open(path.string().c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  uint64_t slot_bytes = 0;
+  uint64_t data_offset = 0;
+  ASSERT_EQ(pread(fd, &slot_bytes, sizeof(slot_bytes), 40), 8);
+  ASSERT_EQ(pread(fd, &data_offset, sizeof(data_offset), 48), 8);
+  const char zeros[24] = {};
+  ASSERT_EQ(pwrite(fd, zeros, sizeof(zeros), 4096 + 2 * sizeof(zeros)), 24);
+  ASSERT_EQ(ftruncate(fd, data_offset + 2 * slot_bytes + 100), 0);
+  close(fd);
+  images.pop_back();
+  stamps_ns.pop_back();
+
+  RawFrameChunkReader reader(path);
+  ExpectFrames(&reader, images, stamps_ns);
+}
+
+TEST_F(RawFrameRecorderTest, holds_chunks_until_close) {
+  setenv("BLOBSTORE_ROOT", root_.string().c_str(), 1);
+  SetArchivePath("raw");
+  boost::asio::io_service io_service;
+  std::vector<RawFrameChunk> chunks;
+  farm_ng::core::Counter& bytes =
+      GetMetricsRegistry().GetCounter("raw_recorder/bytes/raw_test");
+  const int64_t frame_bytes =
+      camera_.image_width() * camera_.image_height() * 2;
+  {
+    RawFrameRecorder recorder(
+        GetEventBus(io_service), camera_,
+        [&chunks](const RawFrameChunk& chunk) { chunks.push_back(chunk); });
+    RawRecorderConfig config;
+    config.set_chunk_frames(2);
+    config.set_keep_raw(true);
+    recorder.set_config(config);
+    cv::Mat image(camera_.image_height(), camera_.image_width(), CV_16UC1,
+                  cv::Scalar(7));
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_TRUE(
+          recorder.AddFrame(image, TimeUtil::NanosecondsToTimestamp(i)));
+    }
+    // Once the fifth frame is written, two chunks have been closed.
+    while (bytes.value() < 5 * frame_bytes) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(chunks.empty());
+    // As on record_stop, which resets the archive before the recording is
+    // closed.
+    SetArchivePath("default");
+    recorder.Close();
+  }
+  ASSERT_EQ(chunks.size(), 3);
+  EXPECT_EQ(chunks[0].frame_count(), 2);
+  EXPECT_EQ(chunks[1].frame_count(), 2);
+  EXPECT_EQ(chunks[2].frame_count(), 1);
+  EXPECT_TRUE(chunks[0].keep_raw());
+  for (const RawFrameChunk& chunk : chunks) {
+    EXPECT_EQ(chunk.archive_path(), "raw");
+  }
+}
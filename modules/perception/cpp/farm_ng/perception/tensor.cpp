@@ -18,6 +18,22 @@ void EigenToTensor(const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
                 x.size() * sizeof(double));
 }
 
+void EigenToTensor(const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic,
+                                       Eigen::ColMajor>& x,
+                   std::string rows_name, std::string cols_name, Tensor* out) {
+  out->set_dtype(Tensor::DATA_TYPE_FLOAT32);
+  auto dim1 = out->add_shape();
+  dim1->set_size(x.rows());
+  dim1->set_name(rows_name);
+
+  auto dim2 = out->add_shape();
+  dim2->set_size(x.cols());
+  dim2->set_name(cols_name);
+
+  out->set_data(reinterpret_cast<const char*>(x.data()),
+                x.size() * sizeof(float));
+}
+
 Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>>
 TensorToEigenMapXd(const farm_ng::perception::Tensor& x) {
   CHECK_EQ(x.dtype(), Tensor::DATA_TYPE_FLOAT64);
@@ -28,6 +44,16 @@ TensorToEigenMapXd(const farm_ng::perception::Tensor& x) {
       const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>>(
       reinterpret_cast<const double*>(x.data().data()), rows, cols);
 }
+Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>>
+TensorToEigenMapXf(const farm_ng::perception::Tensor& x) {
+  CHECK_EQ(x.dtype(), Tensor::DATA_TYPE_FLOAT32);
+  CHECK_EQ(x.shape_size(), 2);
+  int rows = x.shape(0).size();
+  int cols = x.shape(1).size();
+  return Eigen::Map<
+      const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>>(
+      reinterpret_cast<const float*>(x.data().data()), rows, cols);
+}
 void TensorToEigen(const farm_ng::perception::Tensor& x,
                    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
                                  Eigen::ColMajor>* out) {
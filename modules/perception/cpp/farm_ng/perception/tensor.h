@@ -11,9 +11,17 @@ void EigenToTensor(const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
                                        Eigen::ColMajor>& x,
                    std::string rows_name, std::string cols_name, Tensor* out);
 
+// As above, as DATA_TYPE_FLOAT32, half the size on the wire.
+void EigenToTensor(const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic,
+                                       Eigen::ColMajor>& x,
+                   std::string rows_name, std::string cols_name, Tensor* out);
+
 Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic>>
 TensorToEigenMapXd(const farm_ng::perception::Tensor& x);
 
+Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>>
+TensorToEigenMapXf(const farm_ng::perception::Tensor& x);
+
 void TensorToEigen(const farm_ng::perception::Tensor& x,
                    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
                                  Eigen::ColMajor>* out);
@@ -1,106 +1,294 @@
 #ifndef FARM_NG_CALIBRATION_TIME_SERIES_H_
 #define FARM_NG_CALIBRATION_TIME_SERIES_H_
 #include <algorithm>
-#include <deque>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+#include <vector>
 
-#include <glog/logging.h>
+#include <google/protobuf/duration.pb.h>
 #include <google/protobuf/timestamp.pb.h>
-#include <google/protobuf/util/time_util.h>
 
 namespace farm_ng {
 namespace perception {
 
+inline int64_t StampToNanoseconds(const google::protobuf::Timestamp& stamp) {
+  return stamp.seconds() * 1000000000LL + stamp.nanos();
+}
+
+inline int64_t DurationToNanoseconds(
+    const google::protobuf::Duration& duration) {
+  return duration.seconds() * 1000000000LL + duration.nanos();
+}
+
+// A series of values ordered by their stamp(), e.g. FrameData or protobuf
+// messages with a stamp field.
+//
+// Each entry caches its stamp as int64 nanoseconds, so lookups are binary
+// searches over integers. Entries are stored in a ring buffer whose slots are
+// reused, so once the buffer has grown to its working size inserting and
+// removing values does not allocate (beyond what copying ValueT does).
+//
+// With a capacity, the series holds at most that many values, dropping the
+// oldest on insert. Without one (capacity 0) it grows as needed.
+//
+// Iterators, references and pointers returned by lookups are invalidated by
+// insert, RemoveBefore and set_capacity.
 template <typename ValueT>
 class TimeSeries {
+  struct Entry {
+    int64_t stamp_ns = 0;
+    ValueT value;
+  };
+
  public:
-  typedef std::deque<ValueT> ContainerT;
-  typedef typename ContainerT::const_iterator const_iterator;
+  class const_iterator {
+   public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef ValueT value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ValueT* pointer;
+    typedef const ValueT& reference;
+
+    const_iterator() : series_(nullptr), index_(0) {}
+
+    reference operator*() const { return series_->at(index_).value; }
+    pointer operator->() const { return &series_->at(index_).value; }
+    reference operator[](difference_type n) const {
+      return series_->at(index_ + n).value;
+    }
+    // Cached stamp of the value, in nanoseconds.
+    int64_t stamp_ns() const { return series_->at(index_).stamp_ns; }
+
+    const_iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator it = *this;
+      ++index_;
+      return it;
+    }
+    const_iterator& operator--() {
+      --index_;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator it = *this;
+      --index_;
+      return it;
+    }
+    const_iterator& operator+=(difference_type n) {
+      index_ += n;
+      return *this;
+    }
+    const_iterator& operator-=(difference_type n) {
+      index_ -= n;
+      return *this;
+    }
+    const_iterator operator+(difference_type n) const {
+      return const_iterator(series_, index_ + n);
+    }
+    const_iterator operator-(difference_type n) const {
+      return const_iterator(series_, index_ - n);
+    }
+    difference_type operator-(const const_iterator& rhs) const {
+      return difference_type(index_) - difference_type(rhs.index_);
+    }
+
+    bool operator==(const const_iterator& rhs) const {
+      return index_ == rhs.index_;
+    }
+    bool operator!=(const const_iterator& rhs) const {
+      return index_ != rhs.index_;
+    }
+    bool operator<(const const_iterator& rhs) const {
+      return index_ < rhs.index_;
+    }
+    bool operator>(const const_iterator& rhs) const {
+      return index_ > rhs.index_;
+    }
+    bool operator<=(const const_iterator& rhs) const {
+      return index_ <= rhs.index_;
+    }
+    bool operator>=(const const_iterator& rhs) const {
+      return index_ >= rhs.index_;
+    }
+
+   private:
+    friend class TimeSeries;
+    const_iterator(const TimeSeries* series, size_t index)
+        : series_(series), index_(index) {}
+
+    const TimeSeries* series_;
+    size_t index_;
+  };
   typedef std::pair<const_iterator, const_iterator> RangeT;
-  static bool Compare(const ValueT& lhs, const ValueT& rhs) {
-    return lhs.stamp() < rhs.stamp();
+
+  explicit TimeSeries(size_t capacity = 0) { set_capacity(capacity); }
+
+  // Maximum number of values held, 0 for unbounded. Shrinking drops the
+  // oldest values.
+  size_t capacity() const { return capacity_; }
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    if (capacity_ > 0) {
+      while (size_ > capacity_) {
+        PopFront();
+      }
+      Reserve(capacity_);
+    }
   }
 
-  bool empty() const { return series_.empty(); }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+
+  // First value with stamp >= stamp_ns.
+  const_iterator lower_bound(int64_t stamp_ns) const {
+    size_t first = 0;
+    size_t count = size_;
+    while (count > 0) {
+      size_t step = count / 2;
+      if (at(first + step).stamp_ns < stamp_ns) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return const_iterator(this, first);
+  }
   const_iterator lower_bound(const google::protobuf::Timestamp& stamp) const {
-    ValueT x;
-    x.mutable_stamp()->CopyFrom(stamp);
-    return std::lower_bound(series_.begin(), series_.end(), x,
-                            &TimeSeries::Compare);
+    return lower_bound(StampToNanoseconds(stamp));
   }
 
+  // First value with stamp > stamp_ns.
+  const_iterator upper_bound(int64_t stamp_ns) const {
+    return lower_bound(stamp_ns + 1);
+  }
   const_iterator upper_bound(const google::protobuf::Timestamp& stamp) const {
-    return std::upper_bound(
-        series_.begin(), series_.end(), stamp,
-        [](const google::protobuf::Timestamp& stamp, const ValueT& rhs) {
-          return stamp < rhs.stamp();
-        });
+    return upper_bound(StampToNanoseconds(stamp));
   }
 
-  RangeT find_range(google::protobuf::Timestamp begin_stamp,
-                    google::protobuf::Timestamp end_stamp) const {
-    auto begin_it = lower_bound(begin_stamp);
-    VLOG(2) << "begin delta nanoseconds: "
-            << google::protobuf::util::TimeUtil::DurationToNanoseconds(
-                   begin_it->stamp() - begin_stamp);
-    auto end_it = upper_bound(end_stamp);
-    if (end_it != series_.end()) {
-      VLOG(2) << "end delta nanoseconds: "
-              << google::protobuf::util::TimeUtil::DurationToNanoseconds(
-                     end_it->stamp() - end_stamp);
-    }
-
-    return std::make_pair(begin_it, end_it);
+  // Values with begin <= stamp <= end.
+  RangeT find_range(int64_t begin_stamp_ns, int64_t end_stamp_ns) const {
+    return std::make_pair(lower_bound(begin_stamp_ns),
+                          upper_bound(end_stamp_ns));
+  }
+  RangeT find_range(const google::protobuf::Timestamp& begin_stamp,
+                    const google::protobuf::Timestamp& end_stamp) const {
+    return find_range(StampToNanoseconds(begin_stamp),
+                      StampToNanoseconds(end_stamp));
   }
 
   void insert(const ValueT& value) {
-    series_.insert(upper_bound(value.stamp()), value);
+    if (Entry* entry = Append(StampToNanoseconds(value.stamp()))) {
+      entry->value = value;
+    }
+  }
+  void insert(ValueT&& value) {
+    if (Entry* entry = Append(StampToNanoseconds(value.stamp()))) {
+      entry->value = std::move(value);
+    }
   }
 
-  const_iterator begin() const { return series_.begin(); }
+  void RemoveBefore(int64_t begin_stamp_ns) {
+    while (size_ > 0 && at(0).stamp_ns < begin_stamp_ns) {
+      PopFront();
+    }
+  }
+  void RemoveBefore(const google::protobuf::Timestamp& begin_stamp) {
+    RemoveBefore(StampToNanoseconds(begin_stamp));
+  }
 
-  const_iterator end() const { return series_.end(); }
+  // Returns the value nearest to stamp_ns, within +/- window_ns inclusive, or
+  // nullptr. On a tie the earlier value is returned.
+  const ValueT* FindNearest(int64_t stamp_ns, int64_t window_ns) const {
+    auto next = lower_bound(stamp_ns);
+    const Entry* nearest = nullptr;
+    if (next != end()) {
+      nearest = &at(next.index_);
+    }
+    if (next != begin()) {
+      const Entry& prev = at(next.index_ - 1);
+      if (!nearest ||
+          stamp_ns - prev.stamp_ns <= nearest->stamp_ns - stamp_ns) {
+        nearest = &prev;
+      }
+    }
+    if (!nearest || std::abs(nearest->stamp_ns - stamp_ns) > window_ns) {
+      return nullptr;
+    }
+    return &nearest->value;
+  }
+  const ValueT* FindNearest(
+      const google::protobuf::Timestamp& stamp,
+      const google::protobuf::Duration& time_window) const {
+    return FindNearest(StampToNanoseconds(stamp),
+                       DurationToNanoseconds(time_window));
+  }
 
-  size_t size() const { return series_.size(); }
+ private:
+  const Entry& at(size_t index) const {
+    return entries_[(head_ + index) & (entries_.size() - 1)];
+  }
+  Entry& at(size_t index) {
+    return entries_[(head_ + index) & (entries_.size() - 1)];
+  }
 
-  void RemoveBefore(google::protobuf::Timestamp begin_stamp) {
-    if (series_.empty()) {
+  // Grows the ring to a power of two of at least n slots, preserving order.
+  void Reserve(size_t n) {
+    if (n <= entries_.size()) {
       return;
     }
-    if (begin()->stamp() > begin_stamp) {
-      return;
+    size_t new_size = std::max<size_t>(entries_.size(), 16);
+    while (new_size < n) {
+      new_size *= 2;
     }
-    series_.erase(begin(), lower_bound(begin_stamp));
+    std::vector<Entry> entries(new_size);
+    for (size_t i = 0; i < size_; ++i) {
+      entries[i] = std::move(at(i));
+    }
+    entries_.swap(entries);
+    head_ = 0;
   }
 
-  std::optional<ValueT> FindNearest(
-      google::protobuf::Timestamp stamp,
-      google::protobuf::Duration time_window) const {
-    auto begin_range = stamp - time_window;
-
-    auto end_range = stamp + time_window;
-
-    auto range = find_range(begin_range, end_range);
+  void PopFront() {
+    // Release the value, e.g. so a frame's image buffer can be reused.
+    at(0).value = ValueT();
+    head_ = (head_ + 1) & (entries_.size() - 1);
+    --size_;
+  }
 
-    auto closest = range.first;
-    double score = 1e10;
-    while (range.first != range.second) {
-      double score_i =
-          std::abs(google::protobuf::util::TimeUtil::DurationToNanoseconds(
-              range.first->stamp() - stamp));
-      if (score_i < score) {
-        score = score_i;
-        closest = range.first;
+  // Makes room for a value with the given stamp, keeping the series sorted,
+  // and returns its entry. Returns nullptr if the series is full and the value
+  // would be older than everything in it.
+  Entry* Append(int64_t stamp_ns) {
+    if (capacity_ > 0 && size_ == capacity_) {
+      if (stamp_ns < at(0).stamp_ns) {
+        return nullptr;
       }
-      range.first++;
+      PopFront();
     }
-    if (closest != end()) {
-      return *closest;
+    Reserve(size_ + 1);
+    size_t index = size_++;
+    // Values almost always arrive in order, otherwise shift later values up.
+    while (index > 0 && at(index - 1).stamp_ns > stamp_ns) {
+      std::swap(at(index), at(index - 1));
+      --index;
     }
-    return std::optional<ValueT>();
+    at(index).stamp_ns = stamp_ns;
+    return &at(index);
   }
 
- private:
-  ContainerT series_;
+  std::vector<Entry> entries_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
 };
 
 }  // namespace perception
@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+#include <google/protobuf/util/time_util.h>
+
+#include "farm_ng/core/io.pb.h"
+#include "farm_ng/perception/time_series.h"
+
+using farm_ng::core::Event;
+using google::protobuf::util::TimeUtil;
+
+namespace farm_ng {
+namespace perception {
+namespace {
+
+// Events stand in for any stamped message, e.g. FrameData.
+Event MakeStamped(int64_t nanoseconds) {
+  Event event;
+  *event.mutable_stamp() = TimeUtil::NanosecondsToTimestamp(nanoseconds);
+  return event;
+}
+
+constexpr int64_t kPeriodNs = 33333333;  // 30 fps
+
+// The MultiCameraSync::AddFrame pattern: append, then trim to a window of
+// state.range(0) frames.
+void BM_TimeSeriesInsertRemoveBefore(benchmark::State& state) {
+  TimeSeries<Event> series;
+  int64_t t = 0;
+  for (auto _ : state) {
+    series.insert(MakeStamped(t));
+    series.RemoveBefore(
+        TimeUtil::NanosecondsToTimestamp(t - state.range(0) * kPeriodNs));
+    t += kPeriodNs;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TimeSeriesInsertRemoveBefore)->RangeMultiplier(4)->Range(4, 1024);
+
+void BM_TimeSeriesFindNearest(benchmark::State& state) {
+  TimeSeries<Event> series;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    series.insert(MakeStamped(i * kPeriodNs));
+  }
+  const auto window = TimeUtil::NanosecondsToDuration(kPeriodNs * 4);
+  int64_t i = 0;
+  for (auto _ : state) {
+    auto query = TimeUtil::NanosecondsToTimestamp(
+        (i++ % state.range(0)) * kPeriodNs + kPeriodNs / 3);
+    benchmark::DoNotOptimize(series.FindNearest(query, window));
+  }
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_TimeSeriesFindNearest)
+    ->RangeMultiplier(4)
+    ->Range(4, 1024)
+    ->Complexity(benchmark::oLogN);
+
+// The MultiCameraSync::AddFrame pattern with a bounded series, which drops the
+// oldest frame instead of trimming by time.
+void BM_TimeSeriesInsertBounded(benchmark::State& state) {
+  TimeSeries<Event> series(state.range(0));
+  int64_t t = 0;
+  for (auto _ : state) {
+    series.insert(MakeStamped(t));
+    t += kPeriodNs;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TimeSeriesInsertBounded)->RangeMultiplier(4)->Range(4, 1024);
+
+}  // namespace
+}  // namespace perception
+}  // namespace farm_ng
+
+BENCHMARK_MAIN();
@@ -0,0 +1,138 @@
+#include "farm_ng/perception/time_series.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using farm_ng::perception::TimeSeries;
+
+namespace {
+
+struct Value {
+  Value() = default;
+  Value(int64_t stamp_ns, int id) : id(id) {
+    stamp_pb.set_seconds(stamp_ns / 1000000000LL);
+    stamp_pb.set_nanos(stamp_ns % 1000000000LL);
+  }
+  const google::protobuf::Timestamp& stamp() const { return stamp_pb; }
+
+  google::protobuf::Timestamp stamp_pb;
+  int id = -1;
+};
+
+std::vector<int> Ids(const TimeSeries<Value>& series) {
+  std::vector<int> ids;
+  for (const Value& value : series) {
+    ids.push_back(value.id);
+  }
+  return ids;
+}
+
+}  // namespace
+
+TEST(time_series, inserts_out_of_order) {
+  TimeSeries<Value> series;
+  series.insert(Value(300, 3));
+  series.insert(Value(100, 1));
+  series.insert(Value(400, 4));
+  series.insert(Value(200, 2));
+  EXPECT_EQ(Ids(series), std::vector<int>({1, 2, 3, 4}));
+
+  EXPECT_EQ(series.lower_bound(200)->id, 2);
+  EXPECT_EQ(series.upper_bound(200)->id, 3);
+  EXPECT_EQ(series.lower_bound(201)->id, 3);
+  EXPECT_EQ(series.lower_bound(401), series.end());
+  EXPECT_EQ(series.upper_bound(99), series.begin());
+  EXPECT_EQ(series.begin().stamp_ns(), 100);
+
+  auto range = series.find_range(200, 300);
+  ASSERT_EQ(range.second - range.first, 2);
+  EXPECT_EQ(range.first->id, 2);
+  EXPECT_EQ(range.first[1].id, 3);
+
+  // Equal stamps keep their insertion order.
+  series.insert(Value(200, 5));
+  EXPECT_EQ(Ids(series), std::vector<int>({1, 2, 5, 3, 4}));
+}
+
+TEST(time_series, evicts_oldest_at_capacity) {
+  TimeSeries<Value> series(3);
+  for (int i = 0; i < 5; ++i) {
+    series.insert(Value(i * 100, i));
+  }
+  EXPECT_EQ(series.size(), 3);
+  EXPECT_EQ(Ids(series), std::vector<int>({2, 3, 4}));
+
+  // Older than everything held, so it would be evicted straight away.
+  series.insert(Value(50, 10));
+  EXPECT_EQ(Ids(series), std::vector<int>({2, 3, 4}));
+  // Within the series, it evicts the oldest.
+  series.insert(Value(250, 11));
+  EXPECT_EQ(Ids(series), std::vector<int>({11, 3, 4}));
+
+  series.set_capacity(2);
+  EXPECT_EQ(Ids(series), std::vector<int>({3, 4}));
+  series.set_capacity(0);
+  for (int i = 5; i < 40; ++i) {
+    series.insert(Value(i * 100, i));
+  }
+  EXPECT_EQ(series.size(), 37);
+}
+
+TEST(time_series, wraps_around) {
+  TimeSeries<Value> series;
+  int next_id = 0;
+  // Keep a window of 10 values sliding through the ring, which has 16 slots,
+  // so its head wraps many times.
+  for (int round = 0; round < 100; ++round) {
+    series.insert(Value(next_id * 100, next_id));
+    ++next_id;
+    series.RemoveBefore((next_id - 10) * 100);
+    ASSERT_LE(series.size(), 10);
+    EXPECT_EQ(series.begin()->id, std::max(0, next_id - 10));
+    EXPECT_EQ((series.end() - 1)->id, next_id - 1);
+  }
+  // Out of order across the wrap point.
+  series.insert(Value((next_id - 5) * 100 + 50, 1000));
+  std::vector<int> expected;
+  for (int id = next_id - 10; id < next_id; ++id) {
+    expected.push_back(id);
+    if (id == next_id - 5) {
+      expected.push_back(1000);
+    }
+  }
+  EXPECT_EQ(Ids(series), expected);
+  // Growing the ring while wrapped keeps the order.
+  for (int i = 0; i < 20; ++i) {
+    series.insert(Value(next_id * 100, next_id));
+    expected.push_back(next_id++);
+  }
+  EXPECT_EQ(Ids(series), expected);
+  series.RemoveBefore(next_id * 100);
+  EXPECT_TRUE(series.empty());
+}
+
+TEST(time_series, find_nearest_ties_and_ends) {
+  TimeSeries<Value> series;
+  EXPECT_EQ(series.FindNearest(100, 1000), nullptr);
+
+  series.insert(Value(100, 1));
+  series.insert(Value(200, 2));
+  series.insert(Value(400, 4));
+  // Ties go to the earlier value.
+  EXPECT_EQ(series.FindNearest(150, 50)->id, 1);
+  EXPECT_EQ(series.FindNearest(300, 100)->id, 2);
+  EXPECT_EQ(series.FindNearest(301, 100)->id, 4);
+  EXPECT_EQ(series.FindNearest(200, 0)->id, 2);
+  // Before the first value and after the last, the window is inclusive.
+  EXPECT_EQ(series.FindNearest(0, 100)->id, 1);
+  EXPECT_EQ(series.FindNearest(0, 99), nullptr);
+  EXPECT_EQ(series.FindNearest(500, 100)->id, 4);
+  EXPECT_EQ(series.FindNearest(500, 99), nullptr);
+
+  google::protobuf::Duration window;
+  window.set_nanos(60);
+  EXPECT_EQ(series.FindNearest(Value(140, 0).stamp(), window)->id, 1);
+  EXPECT_EQ(series.FindNearest(Value(260, 0).stamp(), window)->id, 2);
+  EXPECT_EQ(series.FindNearest(Value(300, 0).stamp(), window), nullptr);
+}
@@ -1,86 +1,233 @@
 #include "farm_ng/perception/video_streamer.h"
 
+#include <algorithm>
+#include <fstream>
+
 #include <gflags/gflags.h>
 
+#include "farm_ng/core/thread_policy.h"
+#include "farm_ng/core/trace.h"
+#include "farm_ng/perception/camera_model.h"
+#include "farm_ng/perception/frame_buffer_pool.h"
+#include "farm_ng/perception/time_series.h"
+
 DEFINE_bool(jetson, false, "Use jetson hardware encoding.");
 
+using farm_ng::core::ApplyThreadPolicy;
 using farm_ng::core::EventBus;
+using farm_ng::core::GetArchivePath;
+using farm_ng::core::GetMetricsRegistry;
 using farm_ng::core::GetUniqueArchiveResource;
 using farm_ng::core::MakeEvent;
+using farm_ng::core::ScopedLatency;
+using farm_ng::core::TraceSpan;
 
 namespace farm_ng {
 namespace perception {
 
+namespace {
+const int kDefaultBitrate = 10000;
+const int kDefaultKeyframeInterval = 15;
+
+std::string MetricName(const std::string& metric, const CameraModel& model,
+                       VideoStreamer::Mode mode,
+                       const VideoStreamProfile& profile) {
+  std::string name = "video_streamer/" + metric + "/" + model.frame_name() +
+                     (mode == VideoStreamer::MODE_MP4_UDP ? "/udp" : "/file");
+  if (!profile.name().empty()) {
+    name += "/" + profile.name();
+  }
+  return name;
+}
+
+VideoStreamProfile PortProfile(uint64_t port) {
+  VideoStreamProfile profile;
+  profile.set_port(port);
+  return profile;
+}
+
+// Even, as required by the encoders.
+cv::Size OutputSize(const VideoStreamProfile& profile, cv::Size camera_size) {
+  cv::Size size = camera_size;
+  if (profile.image_width() > 0 && profile.image_height() > 0) {
+    size = cv::Size(profile.image_width(), profile.image_height());
+  } else if (profile.image_width() > 0) {
+    size = cv::Size(profile.image_width(), profile.image_width() *
+                                               camera_size.height /
+                                               camera_size.width);
+  } else if (profile.image_height() > 0) {
+    size = cv::Size(profile.image_height() * camera_size.width /
+                        camera_size.height,
+                    profile.image_height());
+  }
+  return cv::Size(size.width & ~1, size.height & ~1);
+}
+}  // namespace
+
 VideoStreamer::VideoStreamer(EventBus& bus, const CameraModel& camera_model,
                              Mode mode, uint64_t port)
-    : bus_(bus), mode_(mode), port_(port) {
+    : VideoStreamer(bus, camera_model, mode, PortProfile(port)) {}
+
+VideoStreamer::VideoStreamer(EventBus& bus, const CameraModel& camera_model,
+                             Mode mode, const VideoStreamProfile& profile)
+    : bus_(bus),
+      mode_(mode),
+      profile_(profile),
+      queue_depth_(GetMetricsRegistry().GetGauge(
+          MetricName("queue_depth", camera_model, mode, profile))),
+      encode_fps_(GetMetricsRegistry().GetGauge(
+          MetricName("encode_fps", camera_model, mode, profile))),
+      encode_latency_(GetMetricsRegistry().GetHistogram(
+          MetricName("encode", camera_model, mode, profile))),
+      dropped_(GetMetricsRegistry().GetCounter(
+          MetricName("dropped", camera_model, mode, profile))),
+      inline_opens_(GetMetricsRegistry().GetCounter(
+          MetricName("inline_open", camera_model, mode, profile))) {
+  CHECK(mode_ == MODE_MP4_UDP || mode_ == MODE_MP4_FILE)
+      << "Unsupported mode: " << mode_;
   image_pb_.mutable_camera_model()->CopyFrom(camera_model);
-  image_pb_.mutable_fps()->set_value(30);
+  image_pb_.mutable_fps()->set_value(
+      profile_.frame_rate() > 0 ? profile_.frame_rate() : 30);
   image_pb_.mutable_frame_number()->set_value(0);
+  encoder_thread_ = std::thread([this]() {
+    ApplyThreadPolicy("video_streamer");
+    Run();
+  });
+}
+
+VideoStreamer::~VideoStreamer() {
+  Close();
+  {
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    stop_ = true;
+  }
+  queue_cv_.notify_one();
+  encoder_thread_.join();
+}
+
+boost::filesystem::path VideoStreamer::ArchivePath() const {
+  return archive_path_.empty() ? GetArchivePath() : archive_path_;
 }
 
-void VideoStreamer::ResetVideoStreamer(bool is_color) {
+std::shared_ptr<const VideoStreamer::Segment> VideoStreamer::MakeSegment(
+    bool is_color) {
   // TODO(ethanrublee) look up image size from realsense profile.
-  std::string gst_pipeline;
+  auto segment = std::make_shared<Segment>();
+  segment->is_color = is_color;
   if (mode_ == MODE_MP4_UDP) {
-    // image_pb_.mutable_fps()->set_value(30);
+    const int bitrate =
+        profile_.bitrate() > 0 ? profile_.bitrate() : kDefaultBitrate;
+    const int keyframe_interval = profile_.keyframe_interval() > 0
+                                      ? profile_.keyframe_interval()
+                                      : kDefaultKeyframeInterval;
     std::string encoder;
     if (FLAGS_jetson) {
-      encoder = std::string(" omxh264enc control-rate=1 bitrate=1000000 ! ") +
-                " video/x-h264, stream-format=byte-stream !";
+      // omxh264enc takes bit/s, and has historically streamed at 1Mbit/s.
+      int jetson_bitrate =
+          profile_.bitrate() > 0 ? profile_.bitrate() * 1000 : 1000000;
+      encoder = " omxh264enc control-rate=1 bitrate=" +
+                std::to_string(jetson_bitrate) +
+                " iframeinterval=" + std::to_string(keyframe_interval) +
+                " ! video/x-h264, stream-format=byte-stream !";
 
     } else {
-      encoder = std::string(
-                    " x264enc bitrate=10000 speed-preset=ultrafast "
-                    "tune=zerolatency ") +
-                "key-int-max=15 ! video/x-h264,profile=constrained-baseline ! "
-                "queue " +
+      encoder = " x264enc bitrate=" + std::to_string(bitrate) +
+                " speed-preset=ultrafast tune=zerolatency key-int-max=" +
+                std::to_string(keyframe_interval) +
+                " ! video/x-h264,profile=constrained-baseline ! queue "
                 "max-size-time=100000000 ! h264parse ! ";
     }
-    gst_pipeline = std::string("appsrc !") + " videoconvert ! " + encoder +
-                   " rtph264pay pt=96 mtu=1400 config-interval=10 !" +
-                   " udpsink port=" + std::to_string(port_);
-  } else if (mode_ == MODE_MP4_FILE) {
+    segment->gst_pipeline = std::string("appsrc !") + " videoconvert ! " +
+                            encoder +
+                            " rtph264pay pt=96 mtu=1400 config-interval=10 !" +
+                            " udpsink port=" + std::to_string(profile_.port());
+  } else {
     std::string encoder;
     if (FLAGS_jetson) {
       encoder = " omxh264enc bitrate=10000000 ! ";
     } else {
       encoder = " x264enc ! ";
     }
-    auto resource_path = GetUniqueArchiveResource(
-        image_pb_.camera_model().frame_name(), "mp4", "video/mp4");
-    gst_pipeline =
+    segment->archive_path = ArchivePath();
+    auto resource_path =
+        GetUniqueArchiveResource(segment->archive_path,
+                                 image_pb_.camera_model().frame_name(), "mp4",
+                                 "video/mp4");
+    segment->resource = resource_path.first;
+    segment->path = resource_path.second;
+    // Reserve the name, so the following segment gets a different one before
+    // the encoder has created this file.
+    std::ofstream(segment->path.string());
+    segment->gst_pipeline =
         std::string("appsrc !") + " videoconvert ! " + encoder +
-        " mp4mux ! filesink location=" + resource_path.second.string();
-    image_pb_.mutable_resource()->CopyFrom(resource_path.first);
-    image_pb_.mutable_frame_number()->set_value(0);
+        " mp4mux ! filesink location=" + segment->path.string();
+  }
+  return segment;
+}
+
+void VideoStreamer::StartSegment(bool is_color) {
+  if (next_segment_ && (next_segment_->is_color != is_color ||
+                        next_segment_->archive_path != ArchivePath())) {
+    // The archive changed, e.g. logging restarted, since it was reserved.
+    DiscardNextSegment();
+  }
+  if (next_segment_) {
+    segment_ = std::move(next_segment_);
   } else {
-    LOG(FATAL) << "Unsupported mode: " << mode_;
+    segment_ = MakeSegment(is_color);
+    if (mode_ == MODE_MP4_FILE) {
+      Enqueue({Work::WORK_PREPARE, segment_});
+    }
+  }
+  if (mode_ == MODE_MP4_FILE) {
+    image_pb_.mutable_resource()->CopyFrom(segment_->resource);
+    image_pb_.mutable_frame_number()->set_value(0);
+    next_segment_ = MakeSegment(is_color);
+    Enqueue({Work::WORK_PREPARE, next_segment_});
   }
+}
 
-  LOG(INFO) << "Running gstreamer with pipeline:\n" << gst_pipeline;
-  if (mode_ == MODE_MP4_UDP) {
-    LOG(INFO) << "To view streamer run:\n"
-              << "gst-launch-1.0 udpsrc port=" << port_
-              << " ! application/x-rtp,encoding-name=H264,payload=96 ! "
-                 "rtph264depay ! h264parse ! queue ! avdec_h264 ! xvimagesink "
-                 "sync=false async=false -e";
+void VideoStreamer::DiscardNextSegment() {
+  if (next_segment_) {
+    Enqueue({Work::WORK_DISCARD, std::move(next_segment_)});
+    next_segment_.reset();
   }
-  writer_ = std::make_shared<cv::VideoWriter>(
-      gst_pipeline,
-      0,                        // fourcc
-      image_pb_.fps().value(),  // fps
-      cv::Size(image_pb_.camera_model().image_width(),
-               image_pb_.camera_model().image_height()),
-      is_color);
 }
+
+bool VideoStreamer::Enqueue(Work work) {
+  {
+    std::unique_lock<std::mutex> lock(queue_mtx_);
+    if (work.type == Work::WORK_FRAME) {
+      if (block_when_full_) {
+        space_cv_.wait(lock,
+                       [this] { return queued_frames_ < kMaxQueuedFrames; });
+      }
+      if (queued_frames_ >= kMaxQueuedFrames) {
+        dropped_.Increment();
+        return false;
+      }
+      queued_frames_++;
+      queue_depth_.Set(queued_frames_);
+    }
+    queue_.push_back(std::move(work));
+  }
+  queue_cv_.notify_one();
+  return true;
+}
+
 Image VideoStreamer::AddFrame(const cv::Mat& image,
                               const google::protobuf::Timestamp& stamp) {
-  if (!writer_) {
+  TraceSpan span("video_streamer/add_frame", stamp);
+  if (!segment_) {
     bool is_color = image.channels() == 3;
-    ResetVideoStreamer(is_color);
+    StartSegment(is_color);
+  }
+  if (!Enqueue({Work::WORK_FRAME, segment_, image, stamp})) {
+    Image dropped = image_pb_;
+    dropped.clear_resource();
+    dropped.clear_frame_number();
+    return dropped;
   }
-  writer_->write(image);
   Image image_sent = image_pb_;
   if (mode_ == MODE_MP4_FILE) {
     bus_.AsyncSend(MakeEvent(image_sent.camera_model().frame_name() + "/image",
@@ -93,13 +240,211 @@ Image VideoStreamer::AddFrame(const cv::Mat& image,
 
   if (mode_ == MODE_MP4_FILE) {
     if (image_pb_.frame_number().value() >= k_max_frames_) {
-      writer_.reset();
+      // The encoder switches files when it sees the next segment's frames.
+      segment_.reset();
     }
   }
   return image_sent;
 }
 
-void VideoStreamer::Close() { writer_.reset(); }
+void VideoStreamer::Close() {
+  if (!segment_ && !next_segment_) {
+    return;
+  }
+  segment_.reset();
+  DiscardNextSegment();
+  Enqueue({Work::WORK_CLOSE});
+}
+
+void VideoStreamer::Run() {
+  rate_begin_ = std::chrono::steady_clock::now();
+  while (true) {
+    Work work;
+    {
+      std::unique_lock<std::mutex> lock(queue_mtx_);
+      queue_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      work = std::move(queue_.front());
+      queue_.pop_front();
+      if (work.type == Work::WORK_FRAME) {
+        queued_frames_--;
+        queue_depth_.Set(queued_frames_);
+      }
+    }
+    space_cv_.notify_one();
+    switch (work.type) {
+      case Work::WORK_FRAME:
+        Encode(work);
+        break;
+      case Work::WORK_PREPARE:
+        prepared_.emplace_back(work.segment, OpenWriter(*work.segment));
+        break;
+      case Work::WORK_DISCARD:
+        prepared_.erase(
+            std::remove_if(prepared_.begin(), prepared_.end(),
+                           [&work](const auto& p) {
+                             return p.first == work.segment;
+                           }),
+            prepared_.end());
+        // Never written to, so only the reserved name or an empty mp4.
+        boost::filesystem::remove(work.segment->path);
+        break;
+      case Work::WORK_CLOSE:
+        writer_.reset();
+        writer_segment_.reset();
+        break;
+    }
+  }
+  writer_.reset();
+  prepared_.clear();
+}
+
+std::unique_ptr<cv::VideoWriter> VideoStreamer::OpenWriter(
+    const Segment& segment) {
+  TraceSpan span("video_streamer/open");
+  LOG(INFO) << "Running gstreamer with pipeline:\n" << segment.gst_pipeline;
+  if (mode_ == MODE_MP4_UDP) {
+    LOG(INFO) << "To view streamer run:\n"
+              << "gst-launch-1.0 udpsrc port=" << profile_.port()
+              << " ! application/x-rtp,encoding-name=H264,payload=96 ! "
+                 "rtph264depay ! h264parse ! queue ! avdec_h264 ! xvimagesink "
+                 "sync=false async=false -e";
+  }
+  return std::make_unique<cv::VideoWriter>(
+      segment.gst_pipeline,
+      0,                        // fourcc
+      image_pb_.fps().value(),  // fps
+      cv::Size(image_pb_.camera_model().image_width(),
+               image_pb_.camera_model().image_height()),
+      segment.is_color);
+}
+
+void VideoStreamer::Encode(const Work& work) {
+  TraceSpan span("video_streamer/encode", work.stamp);
+  if (writer_segment_ != work.segment) {
+    // Closing the previous file finalizes it, which takes a moment too.
+    writer_.reset();
+    auto prepared = std::find_if(
+        prepared_.begin(), prepared_.end(),
+        [&work](const auto& p) { return p.first == work.segment; });
+    if (prepared != prepared_.end()) {
+      writer_ = std::move(prepared->second);
+      // Segments are encoded in the order they were prepared, so any writers
+      // ahead of this one belong to segments that never got a frame.
+      prepared_.erase(prepared_.begin(), prepared + 1);
+    } else {
+      inline_opens_.Increment();
+      writer_ = OpenWriter(*work.segment);
+    }
+    writer_segment_ = work.segment;
+  }
+  {
+    ScopedLatency latency(encode_latency_);
+    writer_->write(work.image);
+  }
+  UpdateEncodeRate();
+}
+
+void VideoStreamer::UpdateEncodeRate() {
+  rate_frames_++;
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - rate_begin_).count();
+  if (elapsed >= 1.0) {
+    encode_fps_.Set(rate_frames_ / elapsed);
+    rate_frames_ = 0;
+    rate_begin_ = now;
+  }
+}
+
+FrameRateDecimator::FrameRateDecimator(double frame_rate) {
+  if (frame_rate > 0) {
+    period_ns_ = 1e9 / frame_rate;
+  }
+}
+
+bool FrameRateDecimator::Keep(int64_t stamp_ns) {
+  if (period_ns_ <= 0) {
+    return true;
+  }
+  // Some slack for stamp jitter.
+  if (next_stamp_ns_ > 0 && stamp_ns < next_stamp_ns_ - period_ns_ / 10) {
+    return false;
+  }
+  // Deadlines advance by whole periods, so fractional ratios keep their
+  // average rate. After a gap, or on the first frame, they restart here.
+  if (next_stamp_ns_ == 0 || stamp_ns - next_stamp_ns_ >= period_ns_) {
+    next_stamp_ns_ = stamp_ns;
+  }
+  next_stamp_ns_ += period_ns_;
+  return true;
+}
+
+SimulcastStreamer::SimulcastStreamer(
+    EventBus& bus, const CameraModel& camera_model,
+    const std::vector<VideoStreamProfile>& profiles)
+    : camera_size_(camera_model.image_width(), camera_model.image_height()) {
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    // Unnamed profiles are named by their index, so each has its own metrics.
+    // A lone one, e.g. udp_stream_port's, keeps the camera's plain names.
+    VideoStreamProfile profile = profiles[i];
+    if (profile.name().empty() && profiles.size() > 1) {
+      profile.set_name(std::to_string(i));
+    }
+    Output output;
+    output.size = OutputSize(profile, camera_size_);
+    output.decimator = FrameRateDecimator(profile.frame_rate());
+    output.streamer = std::make_unique<VideoStreamer>(
+        bus,
+        ResizeCameraModel(camera_model, output.size.width,
+                          output.size.height),
+        VideoStreamer::MODE_MP4_UDP, profile);
+    LOG(INFO) << "Streaming " << camera_model.frame_name() << " "
+              << output.size << " as: " << profile.ShortDebugString();
+    outputs_.push_back(std::move(output));
+  }
+}
+
+void SimulcastStreamer::AddFrame(const cv::Mat& image,
+                                 const google::protobuf::Timestamp& stamp) {
+  TraceSpan span("simulcast_streamer/add_frame", stamp);
+  const int64_t stamp_ns = StampToNanoseconds(stamp);
+  for (Output& output : outputs_) {
+    if (!output.decimator.Keep(stamp_ns)) {
+      continue;
+    }
+
+    if (output.size == image.size()) {
+      output.streamer->AddFrame(image, stamp);
+      continue;
+    }
+    auto scaled =
+        std::find_if(scaled_.begin(), scaled_.end(),
+                     [&output](const std::pair<cv::Size, cv::Mat>& s) {
+                       return s.first == output.size;
+                     });
+    if (scaled == scaled_.end()) {
+      cv::Mat resized = GetFrameBufferPool().Get(output.size, image.type());
+      cv::resize(image, resized, output.size, 0, 0, cv::INTER_AREA);
+      scaled_.emplace_back(output.size, resized);
+      scaled = scaled_.end() - 1;
+    }
+    output.streamer->AddFrame(scaled->second, stamp);
+  }
+  // The encoders hold their own references.
+  scaled_.clear();
+}
+
+std::vector<VideoStreamProfile> StreamProfiles(const CameraConfig& config) {
+  std::vector<VideoStreamProfile> profiles;
+  if (config.has_udp_stream_port()) {
+    profiles.push_back(PortProfile(config.udp_stream_port().value()));
+  }
+  profiles.insert(profiles.end(), config.stream_profiles().begin(),
+                  config.stream_profiles().end());
+  return profiles;
+}
 
 }  // namespace perception
 }  // namespace farm_ng
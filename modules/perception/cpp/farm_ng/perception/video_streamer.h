@@ -1,17 +1,38 @@
 #ifndef FARM_NG_VIDEO_STREAMER_H_
 #define FARM_NG_VIDEO_STREAMER_H_
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
 
+#include <boost/filesystem.hpp>
 #include <opencv2/videoio.hpp>
 
 #include "farm_ng/core/ipc.h"
+#include "farm_ng/core/metrics.h"
 
 #include "farm_ng/perception/camera_model.pb.h"
+#include "farm_ng/perception/camera_pipeline.pb.h"
 #include "farm_ng/perception/image.pb.h"
 
 namespace farm_ng {
 namespace perception {
 
+// Encodes frames with gstreamer, to mp4 files in the archive or an RTP/UDP
+// stream.
+//
+// Encoding happens on a thread per streamer, fed by a bounded queue, so
+// callers never wait on the encoder. If the encoder falls behind, new frames
+// are dropped once kMaxQueuedFrames are waiting. In MODE_MP4_FILE the file for
+// the next segment is opened ahead of time, so rotating files every
+// k_max_frames_ frames doesn't stall the encoder either.
+//
+// Queue depth, encode fps, encode time, drops and writers opened inline at a
+// segment's first frame are published as metrics, under
+// video_streamer/<metric>/<frame_name>/<file|udp>[/<profile name>].
 class VideoStreamer {
  public:
   enum Mode {
@@ -21,24 +42,165 @@ class VideoStreamer {
     MODE_MP4_UDP = 3
   };
 
+  static constexpr size_t kMaxQueuedFrames = 30;
+
   VideoStreamer(farm_ng::core::EventBus& bus, const CameraModel& camera_model,
                 Mode mode, uint64_t port = 0);
+  // The profile's port, frame rate, bitrate and keyframe interval configure
+  // the encoder. Frames are expected at camera_model's resolution, see
+  // SimulcastStreamer for scaling them to the profile's.
+  VideoStreamer(farm_ng::core::EventBus& bus, const CameraModel& camera_model,
+                Mode mode, const VideoStreamProfile& profile);
+  // Finishes encoding queued frames, then closes the file.
+  ~VideoStreamer();
 
+  // Queues the frame for encoding. The image is referenced rather than
+  // copied, so it must not be modified afterwards.
+  //
+  // Returns the Image that locates the frame in the mp4, which in
+  // MODE_MP4_FILE is also sent as <frame_name>/image. If the frame was
+  // dropped the returned Image has no resource.
   Image AddFrame(const cv::Mat& image,
                  const google::protobuf::Timestamp& stamp);
+  // Ends the current file, once the frames queued before it are encoded.
   void Close();
 
+  // When set, AddFrame waits for room in the queue rather than dropping the
+  // frame. For offline encoding, e.g. transcoding raw frames.
+  void set_block_when_full(bool block) { block_when_full_ = block; }
+
+  // MODE_MP4_FILE writes files to archive_path rather than the active
+  // archive, e.g. for a recording that has already stopped. Set before the
+  // first frame.
+  void set_archive_path(const boost::filesystem::path& archive_path) {
+    archive_path_ = archive_path;
+  }
+
  private:
-  void ResetVideoStreamer(bool is_color);
+  // A file, or the UDP stream, and the gstreamer pipeline that writes it.
+  struct Segment {
+    std::string gst_pipeline;
+    bool is_color = true;
+    // MODE_MP4_FILE only.
+    farm_ng::core::Resource resource;
+    boost::filesystem::path path;
+    boost::filesystem::path archive_path;
+  };
+
+  struct Work {
+    enum Type { WORK_FRAME, WORK_PREPARE, WORK_DISCARD, WORK_CLOSE };
+    Type type;
+    std::shared_ptr<const Segment> segment;
+    cv::Mat image;
+    google::protobuf::Timestamp stamp;
+  };
+
+  // The archive MODE_MP4_FILE writes to.
+  boost::filesystem::path ArchivePath() const;
+  std::shared_ptr<const Segment> MakeSegment(bool is_color);
+  void StartSegment(bool is_color);
+  void DiscardNextSegment();
+  // Returns false if the frame was dropped. Other work is never dropped.
+  bool Enqueue(Work work);
+
+  // Encoder thread.
+  void Run();
+  std::unique_ptr<cv::VideoWriter> OpenWriter(const Segment& segment);
+  void Encode(const Work& work);
+  void UpdateEncodeRate();
 
   farm_ng::core::EventBus& bus_;
   Mode mode_;
   Image image_pb_;
-  std::shared_ptr<cv::VideoWriter> writer_;
   const uint k_max_frames_ = 300;
-  uint64_t port_;
+  VideoStreamProfile profile_;
+  // Empty for the active archive.
+  boost::filesystem::path archive_path_;
+
+  // Caller side.
+  std::shared_ptr<const Segment> segment_;
+  // MODE_MP4_FILE, reserved and being opened by the encoder.
+  std::shared_ptr<const Segment> next_segment_;
+
+  std::mutex queue_mtx_;
+  std::condition_variable queue_cv_;
+  std::condition_variable space_cv_;
+  std::deque<Work> queue_;
+  size_t queued_frames_ = 0;
+  bool block_when_full_ = false;
+  bool stop_ = false;
+
+  // Encoder thread only.
+  std::unique_ptr<cv::VideoWriter> writer_;
+  std::shared_ptr<const Segment> writer_segment_;
+  // Opened by WORK_PREPARE ahead of their segment's first frame, oldest
+  // first. The next segment is prepared as soon as the current one starts, so
+  // the current segment's writer may still be waiting here too.
+  std::deque<std::pair<std::shared_ptr<const Segment>,
+                       std::unique_ptr<cv::VideoWriter>>>
+      prepared_;
+  uint64_t rate_frames_ = 0;
+  std::chrono::steady_clock::time_point rate_begin_;
+
+  farm_ng::core::Gauge& queue_depth_;
+  farm_ng::core::Gauge& encode_fps_;
+  farm_ng::core::Histogram& encode_latency_;
+  farm_ng::core::Counter& dropped_;
+  farm_ng::core::Counter& inline_opens_;
+
+  std::thread encoder_thread_;
+};
+
+// Picks the frames to keep to bring a stream down to frame_rate, which needn't
+// divide the input rate, e.g. 2 of every 3 frames for 30 to 20 fps.
+class FrameRateDecimator {
+ public:
+  // A frame_rate of 0 keeps every frame.
+  explicit FrameRateDecimator(double frame_rate = 0);
+
+  bool Keep(int64_t stamp_ns);
+
+ private:
+  int64_t period_ns_ = 0;
+  // The stamp the next kept frame is due at, 0 before the first frame.
+  int64_t next_stamp_ns_ = 0;
 };
 
+// Streams one camera at several resolutions and rates (simulcast), e.g. a
+// full quality stream on the local network and a small preview for remote
+// operators.
+//
+// Each distinct output resolution is downscaled once per frame, shared by all
+// profiles at that resolution, and each profile has its own encoder thread.
+// Profiles without a name are named by their index in profiles, unless there
+// is only one.
+class SimulcastStreamer {
+ public:
+  SimulcastStreamer(farm_ng::core::EventBus& bus,
+                    const CameraModel& camera_model,
+                    const std::vector<VideoStreamProfile>& profiles);
+
+  void AddFrame(const cv::Mat& image,
+                const google::protobuf::Timestamp& stamp);
+
+  bool empty() const { return outputs_.empty(); }
+
+ private:
+  struct Output {
+    cv::Size size;
+    FrameRateDecimator decimator;
+    std::unique_ptr<VideoStreamer> streamer;
+  };
+
+  cv::Size camera_size_;
+  std::vector<Output> outputs_;
+  // Downscaled images of the current frame, by size.
+  std::vector<std::pair<cv::Size, cv::Mat>> scaled_;
+};
+
+// Returns the profiles configured for a camera, including udp_stream_port.
+std::vector<VideoStreamProfile> StreamProfiles(const CameraConfig& config);
+
 }  // namespace perception
 }  // namespace farm_ng
 #endif
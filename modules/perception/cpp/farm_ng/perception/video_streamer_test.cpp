@@ -0,0 +1,78 @@
+#include "farm_ng/perception/video_streamer.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "farm_ng/perception/camera_model.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+using farm_ng::core::GetArchiveRoot;
+using farm_ng::core::GetEventBus;
+using farm_ng::core::GetMetricsRegistry;
+using farm_ng::core::MakeTimestampNow;
+using farm_ng::core::SetArchivePath;
+using namespace farm_ng::perception;
+
+TEST(video_streamer, rotates_files_without_opening_inline) {
+  boost::filesystem::path root =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("video_streamer_test_%%%%%%");
+  setenv("BLOBSTORE_ROOT", root.string().c_str(), 1);
+  SetArchivePath("rotation");
+  CameraModel camera = CreateCameraModel(M_PI / 2, 64, 48);
+  camera.set_frame_name("rotation_test");
+  boost::filesystem::create_directories(GetArchiveRoot() / "rotation");
+
+  boost::asio::io_service io_service;
+  {
+    VideoStreamer streamer(GetEventBus(io_service), camera,
+                           VideoStreamer::MODE_MP4_FILE);
+    streamer.set_block_when_full(true);
+    cv::Mat image(camera.image_height(), camera.image_width(), CV_8UC3,
+                  cv::Scalar(0, 128, 255));
+    // Three rotations, with the encoder already holding the writer of the
+    // segment after next at each.
+    for (int i = 0; i < 300 * 3 + 10; ++i) {
+      Image image_pb = streamer.AddFrame(image, MakeTimestampNow());
+      EXPECT_TRUE(image_pb.has_resource());
+    }
+  }
+  EXPECT_EQ(GetMetricsRegistry()
+                .GetCounter("video_streamer/inline_open/rotation_test/file")
+                .value(),
+            0);
+  boost::filesystem::remove_all(root);
+}
+
+TEST(video_streamer, decimates_to_a_fractional_rate) {
+  FrameRateDecimator decimator(20);
+  const int64_t input_period_ns = 1000000000LL / 30;
+  std::vector<int64_t> kept;
+  for (int i = 0; i < 90; ++i) {
+    // A little jitter, either way.
+    const int64_t stamp_ns =
+        1000000000LL + i * input_period_ns + (i % 2 ? 1000000 : -1000000);
+    if (decimator.Keep(stamp_ns)) {
+      kept.push_back(stamp_ns);
+    }
+  }
+  // Two of every three frames, not every other one.
+  ASSERT_EQ(kept.size(), 60);
+  for (size_t i = 1; i < kept.size(); ++i) {
+    EXPECT_LE(kept[i] - kept[i - 1], 2 * input_period_ns + 2000000) << i;
+  }
+
+  // After a gap, the deadlines restart rather than letting frames burst
+  // through.
+  const int64_t resumed_ns = kept.back() + 1000000000LL;
+  EXPECT_TRUE(decimator.Keep(resumed_ns));
+  EXPECT_FALSE(decimator.Keep(resumed_ns + input_period_ns));
+  EXPECT_TRUE(decimator.Keep(resumed_ns + 2 * input_period_ns));
+
+  FrameRateDecimator unlimited;
+  EXPECT_TRUE(unlimited.Keep(1));
+  EXPECT_TRUE(unlimited.Keep(2));
+}